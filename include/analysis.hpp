@@ -0,0 +1,155 @@
+#pragma once
+
+#include <disasm.hpp>
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+namespace emu {
+
+/// Where the banks of a ROM image appear in the CPU address space.
+struct RomLayout final {
+  const std::uint8_t* image = nullptr;
+  size_t size = 0;
+  /// Size of one bank; 0 means the image is a single bank.
+  size_t bank_size = 0;
+  /// Address the (switchable) banks are mapped at.
+  std::uint16_t org = 0;
+  /// The last bank is permanently mapped just below $10000, as on UxROM and
+  /// similar mappers; the others share the window at `org`.
+  bool fixed_last = false;
+  /// The image is loaded into RAM. Stores into its code are then
+  /// self-modifying code rather than mapper register writes.
+  bool writable = false;
+};
+
+struct BasicBlock final {
+  enum class Exit : std::uint8_t {
+    /// Runs into the next block, which is also a jump target.
+    Fallthrough,
+    /// Conditional branch: the target, then the fall through successor.
+    Branch,
+    Jump,
+    /// JMP (ind) or an RTS dispatch; successors are the jump table entries
+    /// when the table was recognized.
+    Dispatch,
+    /// JSR: the callee, then the return address.
+    Call,
+    Return,
+    /// BRK or an undocumented opcode.
+    Halt,
+  };
+
+  std::uint16_t start = 0;
+  /// Address of the last instruction.
+  std::uint16_t last = 0;
+  /// One past the last byte.
+  std::uint32_t end = 0;
+  Exit exit = Exit::Fallthrough;
+  /// Index of the function this block was first reached from, or -1.
+  std::int32_t function = -1;
+  /// Successors are `BankAnalysis::successors[first_successor...]`; they
+  /// can lie outside the bank.
+  std::uint32_t first_successor = 0;
+  std::uint32_t num_successors = 0;
+};
+
+struct Function final {
+  std::uint16_t entry = 0;
+  std::uint32_t num_blocks = 0;
+  std::uint32_t num_calls = 0;
+  std::uint32_t num_loops = 0;
+};
+
+/// A back edge found while walking a function.
+struct Loop final {
+  std::uint16_t header = 0;
+  /// The instruction jumping back to the header.
+  std::uint16_t latch = 0;
+};
+
+struct JumpTable final {
+  /// The JMP (ind) or RTS performing the dispatch.
+  std::uint16_t dispatch = 0;
+  /// Low and high byte tables; `high == low + 1` for tables of words.
+  std::uint16_t low = 0;
+  std::uint16_t high = 0;
+  /// Entries hold the target minus one (pushed for an RTS).
+  bool minus_one = false;
+  std::vector<std::uint16_t> targets;
+};
+
+struct Write final {
+  /// The storing instruction.
+  std::uint16_t at = 0;
+  /// Absolute address written; indexed stores report their base.
+  std::uint16_t target = 0;
+  /// Immediate value last loaded into the stored register, or -1.
+  std::int16_t value = -1;
+};
+
+/// A control transfer leaving the bank's window.
+struct ExternalRef final {
+  std::uint16_t from = 0;
+  std::uint16_t target = 0;
+  bool call = false;
+  /// The bank selected by a preceding mapper write, or -1.
+  std::int32_t bank = -1;
+};
+
+/// Results for one bank. Block boundaries are final, so an execution engine
+/// can use `block_at` instead of discovering blocks at run time.
+struct BankAnalysis final {
+  std::uint32_t bank = 0;
+  std::uint16_t org = 0;
+  size_t size = 0;
+
+  /// Sorted by start.
+  std::vector<BasicBlock> blocks;
+  std::vector<std::uint16_t> successors;
+  std::vector<Function> functions;
+  std::vector<Loop> loops;
+  std::vector<JumpTable> jump_tables;
+  /// Stores into this bank's code (writable images only).
+  std::vector<Write> self_modifying;
+  /// Stores into ROM windows, i.e. mapper registers (ROM images only).
+  std::vector<Write> bank_switches;
+  std::vector<ExternalRef> external;
+
+  bool contains(std::uint16_t addr) const {
+    return addr >= org && static_cast<size_t>(addr - org) < size;
+  }
+  /// The block starting at `addr`, or nullptr.
+  const BasicBlock* block_at(std::uint16_t addr) const;
+  size_t code_bytes() const;
+};
+
+/// Recovers the control-flow graph of every bank of a ROM by recursive
+/// descent from the vectors and given entry points. Besides branches, JMP
+/// and JSR it follows the common jump table idioms (`JMP (ptr)` with the
+/// pointer loaded from a table, and pushing a table entry then `RTS`).
+///
+/// Banks are analysed in parallel. Transfers that leave a bank's window are
+/// fed to the bank mapped there — to the bank selected by a preceding
+/// mapper write when there is one, otherwise to every bank that can be
+/// mapped there — until no bank finds new code.
+class Analyzer final {
+public:
+  explicit Analyzer(const RomLayout& layout);
+
+  /// Adds an entry point, traced in every bank mapped at `addr`.
+  void add_entry(std::uint16_t addr) { entries_.push_back(addr); }
+
+  /// `threads` of 0 uses one per hardware thread.
+  void run(unsigned threads = 0);
+
+  const std::vector<BankAnalysis>& banks() const { return banks_; }
+
+private:
+  RomLayout layout_;
+  std::vector<std::uint16_t> entries_;
+  std::vector<BankAnalysis> banks_;
+};
+
+}; // namespace emu
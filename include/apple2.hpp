@@ -0,0 +1,138 @@
+#pragma once
+
+#include <bus.hpp>
+#include <cpu.hpp>
+#include <hle.hpp>
+#include <idioms.hpp>
+
+#include <array>
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace emu {
+
+/// The Apple II+: a 6502 with 48K of RAM, the 12K Applesoft and monitor ROM
+/// at $D000 and the keyboard and video soft switches at $C000-$C0FF. Slots,
+/// the language card and the speaker are not emulated.
+///
+/// Nothing in the machine interrupts the CPU, so a frame is a single run
+/// of 17030 cycles followed by the picture. The picture is drawn from
+/// memory at the end of the frame, not as the beam scans, and only where
+/// it changed: a text row or hires line is redrawn when the bus reports its
+/// page of screen memory dirty, when the video mode changed, or, for rows
+/// with flashing characters, when the flash flips. A program that prints a
+/// line costs a few rows rather than the whole screen.
+class Apple2 final : public Device {
+public:
+  static constexpr double ClockRate = 1020484.0;
+  /// 65 cycles on each of 262 lines.
+  static constexpr std::uint64_t FrameCycles = 17030;
+  static constexpr int Width = 280;
+  static constexpr int Height = 192;
+
+  Apple2();
+
+  Apple2(const Apple2&) = delete;
+  Apple2& operator=(const Apple2&) = delete;
+
+  /// Installs the 12K ROM ($D000-$FFFF) and the character generator, of
+  /// which the first 512 bytes are used: 64 glyphs of 8 lines in screen
+  /// code order (@, A-Z, ..., ?), bit 0 the leftmost of 7 pixels. Resets
+  /// the machine.
+  bool load_roms(std::vector<std::uint8_t> rom, std::vector<std::uint8_t> chargen,
+                 std::string& error);
+  void reset();
+
+  /// Runs one frame and redraws what changed.
+  void run_frame();
+  /// Runs until CPU cycle `cycle` or a stop request.
+  void run_until(std::uint64_t cycle);
+
+  /// Queues text for the keyboard; a key is offered each time the
+  /// previous one has been taken. Lower case is typed as upper case.
+  void type(std::string_view text);
+  /// Copies `data` to RAM at `addr`.
+  bool load(std::uint16_t addr, const std::vector<std::uint8_t>& data, std::string& error);
+
+  /// The picture as colour indices 0-15, one byte per pixel.
+  const std::uint8_t* frame() const { return frame_.data(); }
+  std::uint64_t frame_count() const { return frames_; }
+  /// Lines redrawn over all frames so far, out of `Height` per frame.
+  std::uint64_t lines_drawn() const { return lines_drawn_; }
+
+  /// What a snapshot needs beyond the CPU and RAM. Restoring drops queued
+  /// keys and redraws the whole picture at the end of the next frame.
+  struct State final {
+    std::uint8_t switches = 0;
+    std::uint8_t key = 0;
+    std::uint64_t frames = 0;
+  };
+  State state() const { return {switches_, key_, frames_}; }
+  void restore(const State& state);
+
+  /// Runs the guest's fill and copy loops in bulk (see idioms.hpp); off
+  /// by default.
+  void set_idioms(bool on) { cpu_.idioms = on ? &idioms_ : nullptr; }
+  /// Hooks the known routines found in memory with native versions (see
+  /// natives.hpp), or removes every hook; off by default. While it is on,
+  /// programs copied in with `load` are scanned too.
+  void set_hle(bool on);
+
+  CPU& cpu() { return cpu_; }
+  Bus& bus() { return bus_; }
+  Hooks& hooks() { return hooks_; }
+  std::uint8_t* ram() { return ram_.data(); }
+
+  std::uint8_t read(std::uint16_t addr) override;
+  void write(std::uint16_t addr, std::uint8_t value) override;
+  std::uint8_t peek(std::uint16_t addr) override;
+
+  /// The 16 low resolution colours as 0xRRGGBB; high resolution uses
+  /// black, white, violet, green, blue and orange among them.
+  static const std::array<std::uint32_t, 16> Palette;
+
+private:
+  /// Video soft switches, as bits of `switches_`.
+  enum Switch : std::uint8_t { Text = 0x01, Mixed = 0x02, Page2 = 0x04, Hires = 0x08 };
+
+  /// Flips a soft switch at $C050-$C057; reads and writes both do.
+  void soft_switch(std::uint16_t addr);
+  /// Offers the next queued key once the last one was taken.
+  void next_key();
+
+  void render();
+  void draw_text_row(int row, std::uint16_t addr, bool flash);
+  void draw_lores_row(int row, std::uint16_t addr);
+  void draw_hires_line(int y, std::uint16_t addr);
+
+  CPU cpu_;
+  Bus bus_;
+  Idioms idioms_;
+  Hooks hooks_{bus_};
+  bool hle_ = false;
+  std::array<std::uint8_t, 0xC000> ram_{};
+  std::array<std::uint8_t, 0x3000> rom_{};
+  std::array<std::uint8_t, 0x200> chargen_{};
+  std::uint16_t rom_region_ = 0;
+
+  /// The keyboard latch: the last key with bit 7 set until the strobe is
+  /// cleared at $C010.
+  std::uint8_t key_ = 0;
+  std::string pending_;
+
+  std::uint8_t switches_ = Text;
+  std::uint64_t frames_ = 0;
+
+  std::array<std::uint8_t, Width * Height> frame_{};
+  /// Mode and flash phase of the current picture; 0xFF before the first.
+  std::uint8_t drawn_mode_ = 0xFF;
+  bool drawn_flash_ = false;
+  /// Text rows of the picture holding flashing characters.
+  std::array<bool, 24> flashing_{};
+  std::uint64_t lines_drawn_ = 0;
+};
+
+}; // namespace emu
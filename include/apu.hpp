@@ -0,0 +1,212 @@
+#pragma once
+
+#include <blip.hpp>
+
+#include <cstdint>
+#include <cstddef>
+
+namespace emu {
+
+class Bus;
+struct CPU;
+class SnapshotReader;
+class SnapshotWriter;
+
+/// The NES audio processing unit (2A03, NTSC): two pulse channels, the
+/// triangle, noise and the delta modulation channel (DMC), plus the frame
+/// counter that clocks their envelopes and lengths and raises IRQ.
+///
+/// Like the PPU, the APU runs lazily and catches up with the CPU when a
+/// register is accessed or at the machine's events. Catching up works per
+/// channel in blocks: a channel walks its own timer expiries up to the next
+/// frame counter step and only adds an amplitude change to a `BlipBuffer`
+/// when its output level actually changes. A silent channel skips its
+/// timer arithmetically. Channels are mixed linearly.
+///
+/// The frame counter and the DMC's IRQ are exact to the cycle (they are
+/// reported by `next_irq` so the machine stops there); the DMC's sample
+/// fetches do not stall the CPU and the $4017 reset takes effect at once
+/// rather than 3-4 cycles later.
+class Apu final {
+public:
+  /// NTSC CPU clock, which also clocks the APU.
+  static constexpr double ClockRate = 1789773.0;
+  /// Bits of `CPU::irq_lines` the APU drives.
+  static constexpr std::uint8_t FrameIrq = 0x01;
+  static constexpr std::uint8_t DmcIrq = 0x02;
+
+  Apu(CPU& cpu, Bus& bus);
+
+  /// Output sample rate; 44100 by default. Discards pending samples.
+  void set_sample_rate(int rate);
+  int sample_rate() const { return blip_.sample_rate(); }
+
+  /// With audio off, no samples are produced and only what the CPU can
+  /// observe is kept running: the frame counter with the length counters
+  /// and sweeps behind $4015, and the DMC's byte fetches and IRQ. The
+  /// channel timers and the DMC's output level stand still. On by default.
+  void set_audio(bool enabled);
+  bool audio() const { return audio_; }
+
+  /// Brings the APU up to CPU cycle `cycle`.
+  void catch_up(std::uint64_t cycle);
+  /// Catches up with the CPU's current cycle.
+  void sync();
+  /// CPU cycle of the next IRQ the APU will raise, or UINT64_MAX.
+  std::uint64_t next_irq() const;
+
+  /// Saves or restores the APU's state, see snapshot.hpp. Samples not yet
+  /// read are discarded by a restore.
+  void save(SnapshotWriter& out) const;
+  void restore(SnapshotReader& in);
+
+  /// $4000-$4013, $4015 and $4017.
+  void write(std::uint16_t addr, std::uint8_t value);
+  /// $4015; clears the frame IRQ.
+  std::uint8_t read_status();
+  std::uint8_t peek_status() const;
+
+  /// Samples synthesized up to the last catch-up. If they are not read, the
+  /// oldest are dropped once half a second has piled up.
+  size_t samples_available() const { return blip_.samples_available(); }
+  size_t read_samples(std::int16_t* out, size_t max) { return blip_.read_samples(out, max); }
+
+private:
+  struct Envelope final {
+    bool start = false;
+    bool loop = false;
+    bool constant = false;
+    std::uint8_t period = 0;
+    std::uint8_t divider = 0;
+    std::uint8_t decay = 0;
+
+    std::uint8_t volume() const { return constant ? period : decay; }
+    void clock();
+  };
+
+  struct Pulse final {
+    /// Pulse 1 negates its sweep in ones' complement.
+    bool ones_complement = false;
+    bool enabled = false;
+    std::uint8_t duty = 0;
+    std::uint8_t step = 0;
+    std::uint16_t timer = 0;
+    std::uint8_t length = 0;
+    Envelope envelope;
+    bool sweep_enabled = false;
+    bool sweep_negate = false;
+    bool sweep_reload = false;
+    std::uint8_t sweep_period = 0;
+    std::uint8_t sweep_shift = 0;
+    std::uint8_t sweep_divider = 0;
+    /// CPU cycle of the next timer expiry.
+    std::uint64_t next = 0;
+    /// Current output amplitude.
+    int out = 0;
+
+    std::uint16_t sweep_target() const;
+    bool muted() const;
+    bool audible() const { return length > 0 && envelope.volume() > 0 && !muted(); }
+    int level() const;
+  };
+
+  struct Triangle final {
+    bool enabled = false;
+    bool control = false;
+    bool linear_reload = false;
+    std::uint8_t linear_period = 0;
+    std::uint8_t linear = 0;
+    std::uint8_t step = 0;
+    std::uint16_t timer = 0;
+    std::uint8_t length = 0;
+    std::uint64_t next = 0;
+    int out = 0;
+
+    /// Periods below 2 are ultrasonic; the sequencer holds, as if filtered.
+    bool stepping() const { return linear > 0 && length > 0 && timer >= 2; }
+    int level() const;
+  };
+
+  struct Noise final {
+    bool enabled = false;
+    bool short_mode = false;
+    std::uint8_t period = 0;
+    std::uint16_t shift = 1;
+    std::uint8_t length = 0;
+    Envelope envelope;
+    std::uint64_t next = 0;
+    int out = 0;
+
+    bool audible() const { return length > 0 && envelope.volume() > 0; }
+    int level() const;
+  };
+
+  struct Dmc final {
+    bool irq_enabled = false;
+    bool loop = false;
+    std::uint8_t rate = 0;
+    /// The 7-bit output counter.
+    std::uint8_t dac = 0;
+    std::uint16_t start = 0xC000;
+    std::uint16_t size = 1;
+    std::uint16_t address = 0xC000;
+    std::uint16_t remaining = 0;
+    std::uint8_t buffer = 0;
+    bool buffered = false;
+    std::uint8_t shift = 0;
+    std::uint8_t bits = 8;
+    bool silence = true;
+    std::uint64_t next = 0;
+    int out = 0;
+
+    int level() const;
+  };
+
+  template <typename Archive, typename Self> static void fields(Archive& archive, Self& self);
+  /// Runs the channels' timers up to and including cycle `until`.
+  void run_channels(std::uint64_t until);
+  void run_pulse(Pulse& pulse, std::uint64_t until);
+  void run_triangle(std::uint64_t until);
+  void run_noise(std::uint64_t until);
+  void run_dmc(std::uint64_t until);
+  /// The DMC without audio: only steps at byte boundaries matter.
+  void skip_dmc(std::uint64_t until);
+  /// Executes the frame counter step due at `cycle`.
+  void clock_frame(std::uint64_t cycle);
+  void clock_quarter();
+  void clock_half();
+  /// Recomputes the levels that depend on envelopes, lengths and sweeps.
+  void update_levels(std::uint64_t cycle);
+  /// Moves the channel output `out` to `level` at `cycle`.
+  void set_output(int& out, int level, std::uint64_t cycle);
+
+  void write_pulse(Pulse& pulse, int reg, std::uint8_t value);
+  /// Fills the DMC's sample buffer if it is empty and bytes remain.
+  void fetch_sample();
+  void restart_sample();
+  void set_dmc_irq(bool asserted);
+  void set_frame_irq(bool asserted);
+
+  CPU& cpu_;
+  Bus& bus_;
+  BlipBuffer blip_;
+
+  /// CPU cycle the APU has reached; the blip frame starts here.
+  std::uint64_t clock_ = 0;
+  bool audio_ = true;
+
+  Pulse pulse_[2];
+  Triangle triangle_;
+  Noise noise_;
+  Dmc dmc_;
+
+  bool five_step_ = false;
+  bool irq_inhibit_ = false;
+  bool frame_irq_ = false;
+  bool dmc_irq_ = false;
+  /// CPU cycle at which the current frame counter sequence started.
+  std::uint64_t frame_origin_ = 0;
+  int frame_step_ = 0;
+};
+
+}; // namespace emu
@@ -0,0 +1,523 @@
+#pragma once
+
+#include <opcodes.hpp>
+
+#include <array>
+#include <cstdint>
+#include <cstddef>
+#include <stdexcept>
+#include <string_view>
+
+namespace emu {
+
+/// A compile-time 6502 assembler. Programs are written inline and turned
+/// into a `std::array<std::uint8_t, N>` during constant evaluation:
+///
+///   constexpr auto prog = EMU_ASM(R"(
+///           .org $0600
+///           LDX #$00
+///   loop:   STA $0200,X
+///           INX
+///           BNE loop
+///   )");
+///
+/// Supported syntax: `label:` definitions, `name = expr` equates, `.org`,
+/// `.byte` (numbers and "strings") and `.word` directives, `;` comments and
+/// every documented instruction and addressing mode. Expressions are sums
+/// and differences of numbers (`$hex`, `%binary`, decimal, 'c'), labels and
+/// `*`, optionally prefixed by `<` (low byte) or `>` (high byte).
+///
+/// An operand uses zero page addressing when its value is below $100 and
+/// every label in it is defined earlier in the source; forward references
+/// are always assembled as absolute so both passes agree on sizes.
+///
+/// Errors throw, which turns them into compile errors when the assembler runs
+/// in a constant expression.
+namespace assembler {
+
+struct Error final : std::logic_error {
+  using std::logic_error::logic_error;
+};
+
+namespace detail {
+
+constexpr char upper(char c) { return c >= 'a' && c <= 'z' ? c - 'a' + 'A' : c; }
+
+constexpr bool is_ident_start(char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' ||
+         c == '@' || c == '.';
+}
+
+constexpr bool is_ident(char c) {
+  return is_ident_start(c) || (c >= '0' && c <= '9');
+}
+
+constexpr bool equal_nocase(std::string_view a, std::string_view b) {
+  if (a.size() != b.size()) return false;
+  for (size_t i = 0; i < a.size(); ++i) {
+    if (upper(a[i]) != upper(b[i])) return false;
+  }
+  return true;
+}
+
+/// Returns the opcode byte for `op` in `mode`, or -1.
+constexpr int find_opcode(Op op, Mode mode) {
+  for (size_t i = 0; i < OpTable.size(); ++i) {
+    if (OpTable[i].op == op && OpTable[i].mode == mode) return static_cast<int>(i);
+  }
+  return -1;
+}
+
+constexpr bool find_op(std::string_view name, Op& out) {
+  for (size_t i = 0; i + 1 < NumOps; ++i) {
+    if (equal_nocase(Mnemonics[i], name)) {
+      out = static_cast<Op>(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+struct Value final {
+  std::int32_t value = 0;
+  /// False when a label in the expression is defined later in the source.
+  bool early = true;
+};
+
+/// Where assembled bytes go: nowhere while sizing, into the array when
+/// emitting.
+template <size_t N>
+struct Output final {
+  std::array<std::uint8_t, N>* bytes = nullptr;
+  size_t size = 0;
+
+  constexpr void put(std::uint8_t byte) {
+    if (bytes) {
+      if (size >= N) throw Error("program larger than its output array");
+      (*bytes)[size] = byte;
+    }
+    ++size;
+  }
+};
+
+class Assembler final {
+public:
+  static constexpr size_t MaxSymbols = 256;
+
+  constexpr explicit Assembler(std::string_view src) : src_(src) {}
+
+  /// Runs the assembler over the source. The first call defines every label;
+  /// later calls see all of them and can emit the final bytes.
+  template <size_t N>
+  constexpr void pass(Output<N>& out) {
+    final_ = defined_all_;
+    org_ = 0;
+    pc_ = 0;
+    out.size = 0;
+    pos_ = 0;
+    bool has_org = false;
+    while (pos_ < src_.size()) {
+      line_start_ = pos_;
+      skip_blanks();
+
+      if (is_ident_start(peek()) && peek() != '.') {
+        const size_t mark = pos_;
+        const std::string_view name = ident();
+        skip_blanks();
+        if (peek() == ':') {
+          ++pos_;
+          define(name, static_cast<std::int32_t>(pc_));
+          skip_blanks();
+        } else if (peek() == '=') {
+          ++pos_;
+          define(name, expr().value);
+          end_line();
+          continue;
+        } else {
+          pos_ = mark;
+        }
+      }
+
+      if (peek() == '.') {
+        ++pos_;
+        const std::string_view directive = ident();
+        if (equal_nocase(directive, "org")) {
+          const std::int32_t addr = expr().value;
+          if (out.size > 0 && addr < static_cast<std::int32_t>(pc_)) {
+            throw Error(".org cannot move backwards");
+          }
+          if (!has_org && out.size == 0) {
+            org_ = pc_ = static_cast<std::uint16_t>(addr);
+          } else {
+            while (pc_ < static_cast<std::uint32_t>(addr)) emit(out, 0);
+          }
+          has_org = true;
+        } else if (equal_nocase(directive, "byte")) {
+          data(out, 1);
+        } else if (equal_nocase(directive, "word")) {
+          data(out, 2);
+        } else {
+          throw Error("unknown directive");
+        }
+      } else if (is_ident_start(peek())) {
+        instruction(out);
+      }
+      end_line();
+    }
+    defined_all_ = true;
+  }
+
+  constexpr std::uint16_t org() const { return org_; }
+
+private:
+  struct Symbol final {
+    std::string_view name;
+    std::int32_t value = 0;
+    size_t defined_at = 0;
+  };
+
+  constexpr char peek() const { return pos_ < src_.size() ? src_[pos_] : '\n'; }
+
+  constexpr void skip_blanks() {
+    while (pos_ < src_.size() && (src_[pos_] == ' ' || src_[pos_] == '\t' ||
+                                  src_[pos_] == '\r')) {
+      ++pos_;
+    }
+  }
+
+  constexpr void end_line() {
+    skip_blanks();
+    if (peek() == ';') {
+      while (pos_ < src_.size() && src_[pos_] != '\n') ++pos_;
+    }
+    if (pos_ < src_.size() && src_[pos_] != '\n') throw Error("junk at end of line");
+    ++pos_;
+  }
+
+  constexpr bool accept(char c) {
+    skip_blanks();
+    if (upper(peek()) != c) return false;
+    ++pos_;
+    return true;
+  }
+
+  constexpr void expect(char c) {
+    if (!accept(c)) throw Error("syntax error");
+  }
+
+  constexpr std::string_view ident() {
+    const size_t start = pos_;
+    while (pos_ < src_.size() && is_ident(src_[pos_])) ++pos_;
+    return src_.substr(start, pos_ - start);
+  }
+
+  constexpr void define(std::string_view name, std::int32_t value) {
+    for (size_t i = 0; i < num_symbols_; ++i) {
+      if (symbols_[i].name == name) {
+        if (symbols_[i].defined_at != line_start_) throw Error("duplicate label");
+        symbols_[i].value = value;
+        return;
+      }
+    }
+    if (num_symbols_ == MaxSymbols) throw Error("too many labels");
+    symbols_[num_symbols_++] = Symbol{name, value, line_start_};
+  }
+
+  constexpr Value symbol(std::string_view name) const {
+    for (size_t i = 0; i < num_symbols_; ++i) {
+      if (symbols_[i].name == name) {
+        return {symbols_[i].value, symbols_[i].defined_at < line_start_};
+      }
+    }
+    if (final_) throw Error("undefined label");
+    return {0, false};
+  }
+
+  constexpr std::int32_t number(int base) {
+    std::int32_t value = 0;
+    const size_t start = pos_;
+    while (pos_ < src_.size()) {
+      const char c = upper(src_[pos_]);
+      int digit = 0;
+      if (c >= '0' && c <= '9') digit = c - '0';
+      else if (c >= 'A' && c <= 'F') digit = c - 'A' + 10;
+      else break;
+      if (digit >= base) break;
+      value = value * base + digit;
+      ++pos_;
+    }
+    if (pos_ == start) throw Error("bad number");
+    return value;
+  }
+
+  constexpr Value primary() {
+    skip_blanks();
+    const char c = peek();
+    if (c == '$') {
+      ++pos_;
+      return {number(16), true};
+    }
+    if (c == '%') {
+      ++pos_;
+      return {number(2), true};
+    }
+    if (c >= '0' && c <= '9') return {number(10), true};
+    if (c == '\'') {
+      ++pos_;
+      const char ch = peek();
+      ++pos_;
+      expect('\'');
+      return {static_cast<unsigned char>(ch), true};
+    }
+    if (c == '*') {
+      ++pos_;
+      return {static_cast<std::int32_t>(pc_), true};
+    }
+    if (is_ident_start(c)) return symbol(ident());
+    throw Error("expected an expression");
+  }
+
+  constexpr Value expr() {
+    skip_blanks();
+    int part = 0; // 0: whole value, 1: low byte, 2: high byte
+    if (peek() == '<' || peek() == '>') {
+      part = peek() == '<' ? 1 : 2;
+      ++pos_;
+    }
+    Value result = primary();
+    while (true) {
+      skip_blanks();
+      const char op = peek();
+      if (op != '+' && op != '-') break;
+      ++pos_;
+      const Value rhs = primary();
+      result.value += op == '+' ? rhs.value : -rhs.value;
+      result.early = result.early && rhs.early;
+    }
+    if (part == 1) result.value &= 0xFF;
+    if (part == 2) result.value = (result.value >> 8) & 0xFF;
+    return result;
+  }
+
+  template <size_t N>
+  constexpr void emit(Output<N>& out, std::uint8_t byte) {
+    out.put(byte);
+    ++pc_;
+  }
+
+  template <size_t N>
+  constexpr void data(Output<N>& out, int width) {
+    do {
+      skip_blanks();
+      if (width == 1 && peek() == '"') {
+        ++pos_;
+        while (pos_ < src_.size() && src_[pos_] != '"' && src_[pos_] != '\n') {
+          emit(out, static_cast<std::uint8_t>(src_[pos_++]));
+        }
+        expect('"');
+        continue;
+      }
+      const std::int32_t value = expr().value;
+      if (width == 1 && final_ && (value < -128 || value > 0xFF)) {
+        throw Error(".byte value out of range");
+      }
+      emit(out, static_cast<std::uint8_t>(value));
+      if (width == 2) emit(out, static_cast<std::uint8_t>(value >> 8));
+    } while (accept(','));
+  }
+
+  template <size_t N>
+  constexpr void instruction(Output<N>& out) {
+    Op op = Op::ILL;
+    if (!find_op(ident(), op)) throw Error("unknown mnemonic");
+    skip_blanks();
+
+    Mode mode = Mode::Implied;
+    Value operand;
+    bool indexable = false; // true when a zero page form may be chosen
+    char index = 0;
+
+    const char c = peek();
+    if (c == ';' || c == '\n') {
+      mode = find_opcode(op, Mode::Implied) >= 0 ? Mode::Implied : Mode::Accumulator;
+    } else if (upper(c) == 'A' && find_opcode(op, Mode::Accumulator) >= 0 &&
+               !is_ident(pos_ + 1 < src_.size() ? src_[pos_ + 1] : '\n')) {
+      ++pos_;
+      mode = Mode::Accumulator;
+    } else if (c == '#') {
+      ++pos_;
+      operand = expr();
+      mode = Mode::Immediate;
+    } else if (c == '(') {
+      ++pos_;
+      operand = expr();
+      if (accept(',')) {
+        expect('X');
+        expect(')');
+        mode = Mode::IndirectX;
+      } else {
+        expect(')');
+        if (accept(',')) {
+          expect('Y');
+          mode = Mode::IndirectY;
+        } else {
+          mode = Mode::Indirect;
+        }
+      }
+    } else {
+      operand = expr();
+      if (accept(',')) {
+        index = accept('X') ? 'X' : accept('Y') ? 'Y' : 0;
+        if (!index) throw Error("expected X or Y");
+      }
+      if (is_branch(op)) {
+        mode = Mode::Relative;
+      } else {
+        indexable = true;
+        mode = index == 'X' ? Mode::AbsoluteX : index == 'Y' ? Mode::AbsoluteY
+                                                             : Mode::Absolute;
+      }
+    }
+
+    if (indexable && operand.early && operand.value >= 0 && operand.value < 0x100) {
+      const Mode zp = index == 'X' ? Mode::ZeroPageX : index == 'Y' ? Mode::ZeroPageY
+                                                                    : Mode::ZeroPage;
+      if (find_opcode(op, zp) >= 0) mode = zp;
+    }
+
+    const int opcode = find_opcode(op, mode);
+    if (opcode < 0) throw Error("addressing mode not supported by instruction");
+    const std::uint16_t at = static_cast<std::uint16_t>(pc_);
+    emit(out, static_cast<std::uint8_t>(opcode));
+
+    switch (instr_length(mode)) {
+    case 2: {
+      std::int32_t value = operand.value;
+      if (mode == Mode::Relative) {
+        value -= at + 2;
+        if (final_ && (value < -128 || value > 127)) throw Error("branch out of range");
+      } else if (final_ && (value < -128 || value > 0xFF)) {
+        throw Error("operand out of range");
+      }
+      emit(out, static_cast<std::uint8_t>(value));
+      break;
+    }
+    case 3:
+      emit(out, static_cast<std::uint8_t>(operand.value));
+      emit(out, static_cast<std::uint8_t>(operand.value >> 8));
+      break;
+    default:
+      break;
+    }
+  }
+
+  std::string_view src_;
+  size_t pos_ = 0;
+  size_t line_start_ = 0;
+  std::uint16_t org_ = 0;
+  std::uint32_t pc_ = 0;
+  bool final_ = false;
+  bool defined_all_ = false;
+  std::array<Symbol, MaxSymbols> symbols_{};
+  size_t num_symbols_ = 0;
+};
+
+} // namespace detail
+
+/// Number of bytes `src` assembles to.
+constexpr size_t size(std::string_view src) {
+  detail::Assembler as(src);
+  detail::Output<0> out;
+  as.pass(out);
+  return out.size;
+}
+
+/// Assembles `src`; `N` must be `size(src)`.
+template <size_t N>
+constexpr std::array<std::uint8_t, N> assemble(std::string_view src) {
+  std::array<std::uint8_t, N> bytes{};
+  detail::Assembler as(src);
+  detail::Output<N> out;
+  as.pass(out);
+  out.bytes = &bytes;
+  as.pass(out);
+  if (out.size != N) throw Error("output size mismatch");
+  return bytes;
+}
+
+/// Origin set by the first `.org` directive, or 0.
+constexpr std::uint16_t origin(std::string_view src) {
+  detail::Assembler as(src);
+  detail::Output<0> out;
+  as.pass(out);
+  return as.org();
+}
+
+namespace detail {
+
+/// True if `src` assembles to exactly `expected`.
+template <size_t N>
+constexpr bool encodes(std::string_view src, const std::array<std::uint8_t, N>& expected) {
+  if (size(src) != N) return false;
+  const std::array<std::uint8_t, N> bytes = assemble<N>(src);
+  for (size_t i = 0; i < N; ++i) {
+    if (bytes[i] != expected[i]) return false;
+  }
+  return true;
+}
+
+template <typename... T>
+constexpr std::array<std::uint8_t, sizeof...(T)> bytes(T... values) {
+  return {static_cast<std::uint8_t>(values)...};
+}
+
+/// Whether `Source::text` assembles; an error leaves the template argument
+/// non-constant, which removes the first overload.
+template <typename Source, size_t = assemble<size(Source::text)>(Source::text).size()>
+constexpr bool assembles(int) {
+  return true;
+}
+template <typename Source>
+constexpr bool assembles(long) {
+  return false;
+}
+
+struct FarBranch final {
+  static constexpr std::string_view text = R"(
+          .org $0600
+          BNE far
+          .org $0700
+  far:    RTS
+  )";
+};
+
+// Known encodings, so that a regression fails to compile.
+static_assert(encodes("LDA #$12", bytes(0xA9, 0x12)));
+static_assert(encodes("STA $10", bytes(0x85, 0x10)));
+static_assert(encodes("LDA $1234,X", bytes(0xBD, 0x34, 0x12)));
+static_assert(encodes("LDA ($10),Y", bytes(0xB1, 0x10)));
+static_assert(encodes(R"(
+          .org $0600
+          JMP (vector)
+  vector: .word $1234
+  )", bytes(0x6C, 0x03, 0x06, 0x34, 0x12)));
+static_assert(encodes(R"(
+          .org $0600
+  loop:   DEX
+          BNE loop
+  )", bytes(0xCA, 0xD0, 0xFD)));
+// A forward reference is absolute even when its value fits in zero page.
+static_assert(encodes(R"(
+          LDA value
+  value = $10
+  )", bytes(0xAD, 0x10, 0x00)));
+static_assert(!assembles<FarBranch>(0));
+
+} // namespace detail
+
+} // namespace assembler
+
+}; // namespace emu
+
+/// Assembles a string literal at compile time into a std::array.
+#define EMU_ASM(src) ::emu::assembler::assemble<::emu::assembler::size(src)>(src)
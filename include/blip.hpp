@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+namespace emu {
+
+/// Band-limited step synthesis ("BLEP"): turns a signal given as amplitude
+/// changes at clock times into samples at the output rate.
+///
+/// Sound chips output piecewise constant levels that change at most once per
+/// timer period. Instead of evaluating and filtering the output on every
+/// clock, callers add each change with `add_delta`, which writes a short
+/// windowed-sinc step, picked by the fractional sample position, into a
+/// buffer of sample differences. Reading integrates the differences, so
+/// the cost is per change plus per output sample, not per clock.
+///
+/// Time is counted in clocks from the start of the current frame; a frame
+/// is any span the caller likes, ended with `end_frame`, after which its
+/// samples can be read.
+class BlipBuffer final {
+public:
+  /// Amplitude of a full-scale step; output samples are 16 bits.
+  static constexpr int MaxAmplitude = 32767;
+
+  /// `capacity` is in output samples, including ones not read yet.
+  BlipBuffer(double clock_rate, int sample_rate, size_t capacity);
+
+  void set_rates(double clock_rate, int sample_rate);
+  int sample_rate() const { return sample_rate_; }
+
+  /// Adds an amplitude change of `delta` at `time` clocks into the frame.
+  /// Changes past the end of the buffer are dropped.
+  void add_delta(std::uint32_t time, int delta);
+  /// Ends the frame after `clocks` clocks; its samples become available.
+  void end_frame(std::uint32_t clocks);
+
+  size_t samples_available() const { return static_cast<size_t>(offset_ >> FractionBits); }
+  /// Reads up to `max` samples into `out`; returns how many were read.
+  size_t read_samples(std::int16_t* out, size_t max);
+  /// Discards up to `count` of the oldest samples.
+  void remove_samples(size_t count);
+  /// Discards everything, including changes not yet complete.
+  void clear();
+
+  /// Length of the step kernel in samples; also the output latency.
+  static constexpr int Taps = 16;
+  static constexpr int PhaseBits = 6;
+  static constexpr int KernelBits = 12;
+
+private:
+  static constexpr int FractionBits = 32;
+
+  /// Removes `count` samples from the front, keeping later differences.
+  void shift(size_t count);
+
+  int sample_rate_ = 0;
+  /// Output samples per clock, 32.32 fixed point.
+  std::uint64_t factor_ = 0;
+  /// Position of the current frame's start, 32.32 fixed point samples.
+  std::uint64_t offset_ = 0;
+  /// Running sum of the differences, with the high-pass filter applied.
+  std::int32_t integrator_ = 0;
+  std::vector<std::int32_t> buffer_;
+};
+
+}; // namespace emu
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cpu.hpp>
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace emu {
+
+/// A breakpoint condition such as `A == $40 && [$0300] > 3`, compiled once
+/// into stack bytecode.
+///
+/// Operands: numbers (`$hex`, `0xhex`, `%binary`, decimal), the registers
+/// `A X Y SP P PC`, the flags `C Z I D V N` (0 or 1), `[expr]` for the byte
+/// at an address and `{expr}` for the little-endian word there. Operators,
+/// loosest first: `||`, `&&`, `|`, `^`, `&`, `== !=`, `< <= > >=`, `+ -`,
+/// and the unary `! - ~`. Memory is read with `Bus::peek`, so evaluating a
+/// condition never has side effects on devices.
+class Condition final {
+public:
+  /// Compiles `text`. On failure returns false and describes the problem in
+  /// `error`.
+  static bool compile(std::string_view text, Condition& out,
+                      std::string& error);
+
+  /// An empty condition is always true.
+  bool empty() const { return code_.empty(); }
+  bool eval(const CPU& cpu, const Bus& bus) const;
+
+  static constexpr size_t MaxDepth = 32;
+
+  enum class Code : std::uint8_t {
+    Push, Reg, Flag, Peek, PeekConst, Peek16, Peek16Const,
+    Not, Neg, Inv,
+    Add, Sub, And, Or, Xor, LogAnd, LogOr,
+    Eq, Ne, Lt, Le, Gt, Ge,
+  };
+  struct Insn final {
+    Code code;
+    std::int32_t arg;
+  };
+
+private:
+  std::vector<Insn> code_;
+};
+
+/// Breakpoints implemented with the bus' execute traps: untrapped pages cost
+/// one test per instruction and conditions are only evaluated when the CPU
+/// reaches their address.
+class Breakpoints final : public TrapHandler {
+public:
+  explicit Breakpoints(Bus& bus) : bus_(bus) {}
+  ~Breakpoints() override { clear(); }
+
+  Breakpoints(const Breakpoints&) = delete;
+  Breakpoints& operator=(const Breakpoints&) = delete;
+
+  /// Sets a breakpoint at `pc`, replacing any previous one there. An empty
+  /// condition breaks unconditionally.
+  bool add(std::uint16_t pc, std::string_view condition, std::string& error);
+  bool remove(std::uint16_t pc);
+  void clear();
+
+  /// Address the CPU last stopped at, valid after `run` returns with a stop.
+  std::uint16_t last_hit() const { return last_hit_; }
+  std::uint64_t hits(std::uint16_t pc) const;
+
+  Action on_trap(CPU& cpu, Bus& bus) override;
+
+private:
+  struct Entry final {
+    std::uint16_t pc;
+    Condition condition;
+    std::uint64_t hits;
+  };
+
+  Entry* find(std::uint16_t pc);
+
+  Bus& bus_;
+  /// Sorted by address.
+  std::vector<Entry> entries_;
+  std::uint16_t last_hit_ = 0;
+};
+
+}; // namespace emu
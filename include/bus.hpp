@@ -0,0 +1,179 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace emu {
+
+class Coverage;
+
+/// A memory-mapped peripheral. Devices see the full 16-bit address and are
+/// responsible for decoding their own mirrors.
+class Device {
+public:
+  virtual ~Device() = default;
+  virtual std::uint8_t read(std::uint16_t addr) = 0;
+  virtual void write(std::uint16_t addr, std::uint8_t value) = 0;
+  /// Side-effect free read, used by debuggers and other tools.
+  virtual std::uint8_t peek(std::uint16_t addr) {
+    (void)addr;
+    return 0;
+  }
+};
+
+/// The CPU address space, split into 256-byte pages. Each page either points
+/// straight at host memory (RAM/ROM) or forwards to a `Device`, so the common
+/// case of a RAM or ROM access is a table lookup and a load.
+class Bus final {
+public:
+  static constexpr size_t PageBits = 8;
+  static constexpr size_t PageSize = size_t{1} << PageBits;
+  static constexpr size_t NumPages = 0x10000 >> PageBits;
+
+  /// Region 0 is the flat CPU address space. Every other region is a ROM
+  /// bank (or any other block of memory that can be mapped in and out), so
+  /// that code in a bank is identified the same way whichever address it is
+  /// currently visible at.
+  struct Region final {
+    std::string name;
+    std::uint32_t size;
+    /// CPU address the region is normally seen at, used for reporting.
+    std::uint16_t base;
+  };
+
+  /// Where a CPU address currently resolves to.
+  struct Location final {
+    std::uint16_t region;
+    std::uint32_t offset;
+  };
+
+  Bus();
+
+  std::uint8_t read(std::uint16_t addr) {
+    const Page& page = pages_[addr >> PageBits];
+    if (page.read) return page.read[addr & (PageSize - 1)];
+    if (page.device) return page.device->read(addr);
+    return static_cast<std::uint8_t>(addr >> 8);
+  }
+
+  void write(std::uint16_t addr, std::uint8_t value) {
+    Page& page = pages_[addr >> PageBits];
+    if (page.write) {
+      page.write[addr & (PageSize - 1)] = value;
+      dirty_[addr >> PageBits] = 1;
+    } else if (page.device) {
+      page.device->write(addr, value);
+    }
+  }
+
+  std::uint8_t peek(std::uint16_t addr) const {
+    const Page& page = pages_[addr >> PageBits];
+    if (page.read) return page.read[addr & (PageSize - 1)];
+    if (page.device) return page.device->peek(addr);
+    return static_cast<std::uint8_t>(addr >> 8);
+  }
+
+  /// Plain memory (RAM, ROM or open bus) rather than a device, so that
+  /// accesses have no side effects and can be batched.
+  bool plain(std::uint16_t addr) const {
+    return pages_[addr >> PageBits].device == nullptr;
+  }
+  /// Host memory behind `addr`, or nullptr for devices, unmapped pages and,
+  /// for writes, ROM. Valid up to the end of the page. Asking for write
+  /// access marks the page dirty.
+  const std::uint8_t* direct_read(std::uint16_t addr) const {
+    const Page& page = pages_[addr >> PageBits];
+    return page.read ? page.read + (addr & (PageSize - 1)) : nullptr;
+  }
+  std::uint8_t* direct_write(std::uint16_t addr) {
+    const Page& page = pages_[addr >> PageBits];
+    if (!page.write) return nullptr;
+    dirty_[addr >> PageBits] = 1;
+    return page.write + (addr & (PageSize - 1));
+  }
+
+  /// Dirty pages: every write to memory through the bus marks its page, by
+  /// CPU address, so that whatever is derived from memory (a rendered
+  /// screen, decoded tiles) can be rebuilt only where it changed. Users
+  /// test and clear the pages they depend on; writes made straight to host
+  /// memory must be reported with `mark_dirty`. All pages start dirty.
+  bool dirty(std::uint16_t addr) const { return dirty_[addr >> PageBits] != 0; }
+  void mark_dirty(std::uint16_t addr, size_t size);
+  void clear_dirty(std::uint16_t addr, size_t size);
+
+  Location locate(std::uint16_t addr) const {
+    const Page& page = pages_[addr >> PageBits];
+    return {page.region,
+            page.offset + static_cast<std::uint32_t>(addr & (PageSize - 1))};
+  }
+
+  /// Maps `size` bytes of RAM at `addr`. When `mem_size` is smaller than
+  /// `size` the memory is mirrored across the range. Both addresses and sizes
+  /// must be page aligned.
+  void map_ram(std::uint16_t addr, size_t size, std::uint8_t* mem,
+               size_t mem_size = 0);
+
+  /// Maps read-only memory at `addr`. Writes to the range are ignored, or
+  /// go to `registers` (cartridge mapper registers decoded in ROM space)
+  /// while reads stay direct.
+  void map_rom(std::uint16_t addr, size_t size, const std::uint8_t* mem,
+               std::uint16_t region = 0, std::uint32_t offset = 0,
+               Device* registers = nullptr);
+
+  /// Maps ROM over RAM, as the C64's PLA does: reads come from `rom`,
+  /// writes go through to the RAM underneath.
+  void map_overlay(std::uint16_t addr, size_t size, const std::uint8_t* rom,
+                   std::uint8_t* ram, std::uint16_t region = 0, std::uint32_t offset = 0);
+
+  void map_device(std::uint16_t addr, size_t size, Device* device);
+  void unmap(std::uint16_t addr, size_t size);
+
+  /// Execute traps make the CPU call its TrapHandler before running the
+  /// instruction at `addr`. Pages without traps are skipped with one test.
+  /// Traps are counted, so independent users (breakpoints, hooks) can trap
+  /// the same address and remove their trap without removing the other's.
+  void set_trap(std::uint16_t addr, bool on);
+  bool trapped(std::uint16_t addr) const {
+    return pages_[addr >> PageBits].traps != 0 &&
+           ((traps_[addr >> 6] >> (addr & 63)) & 1);
+  }
+  bool has_traps() const { return num_traps_ != 0; }
+
+  /// Registers a region and returns its id.
+  std::uint16_t add_region(std::string name, std::uint32_t size,
+                           std::uint16_t base);
+  const std::vector<Region>& regions() const { return regions_; }
+
+  /// Coverage recorders index by CPU address and must be told before a page
+  /// changes what it maps to.
+  void attach(Coverage* coverage) { coverage_ = coverage; }
+
+private:
+  struct Page final {
+    const std::uint8_t* read = nullptr;
+    std::uint8_t* write = nullptr;
+    Device* device = nullptr;
+    std::uint16_t region = 0;
+    /// Number of trapped addresses in the page.
+    std::uint16_t traps = 0;
+    std::uint32_t offset = 0;
+  };
+
+  /// Changes what a page maps to, keeping its traps.
+  void set_page(size_t index, const std::uint8_t* read, std::uint8_t* write,
+                Device* device, std::uint16_t region, std::uint32_t offset);
+
+  std::array<Page, NumPages> pages_{};
+  std::array<std::uint8_t, NumPages> dirty_{};
+  std::array<std::uint64_t, 0x10000 / 64> traps_{};
+  /// Users per trapped address; allocated by the first trap.
+  std::vector<std::uint8_t> trap_users_;
+  size_t num_traps_ = 0;
+  std::vector<Region> regions_;
+  Coverage* coverage_ = nullptr;
+};
+
+}; // namespace emu
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <bus.hpp>
+#include <cia.hpp>
+#include <cpu.hpp>
+#include <drive.hpp>
+#include <fastload.hpp>
+#include <hle.hpp>
+#include <idioms.hpp>
+#include <sid.hpp>
+#include <snapshot.hpp>
+#include <vic.hpp>
+
+#include <array>
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace emu {
+
+/// The Commodore 64 (PAL): a 6510 CPU with its I/O port at $00/$01, 64K of
+/// RAM under the BASIC, KERNAL and character ROMs as the PLA banks them,
+/// the VIC-II, the SID, two CIAs and 1K of colour RAM. Cartridges are not
+/// supported. The machine itself is the device behind page 0, so that
+/// writes to the processor port can switch banks; reads stay direct.
+///
+/// As with the NES, the CPU runs in slices up to the next event that needs
+/// another chip to be current: the VIC-II's raster IRQs and cycle stealing
+/// and the CIAs' interrupts. Between events the chips catch up when the
+/// CPU touches their registers.
+///
+/// A real 1541 can be attached instead of the fast loader. Its CPU runs on
+/// its own clock and is only brought up to date when the C64 reads or
+/// writes the serial bus lines and at the end of `run_until`.
+class C64 final : public Device, public CiaPorts {
+public:
+  static constexpr double ClockRate = 985248.0;
+  /// Bit of `CPU::irq_lines` driven by CIA 1; the VIC-II uses `Vic::Irq`.
+  static constexpr std::uint8_t CiaIrq = 0x01;
+
+  /// Joystick bits, for `set_joystick`.
+  enum Joystick : std::uint8_t { Up = 0x01, Down = 0x02, Left = 0x04, Right = 0x08, Fire = 0x10 };
+
+  C64();
+
+  C64(const C64&) = delete;
+  C64& operator=(const C64&) = delete;
+
+  /// Installs the KERNAL (8K), BASIC (8K) and character (4K) ROMs and
+  /// resets the machine.
+  bool load_roms(std::vector<std::uint8_t> kernal, std::vector<std::uint8_t> basic,
+                 std::vector<std::uint8_t> chargen, std::string& error);
+  void reset();
+
+  /// Runs up to the start of the next frame.
+  void run_frame();
+  /// Runs until CPU cycle `cycle` or a stop request.
+  void run_until(std::uint64_t cycle);
+
+  /// Presses or releases the key at `row` (the CIA 1 port A bit that
+  /// selects it) and `column` (the port B bit it pulls low).
+  void set_key(int row, int column, bool pressed);
+  /// Joystick `port` 1 or 2, as a mask of `Joystick` bits.
+  void set_joystick(int port, std::uint8_t bits) { joysticks_[(port - 1) & 1] = bits; }
+  /// Puts text in the KERNAL's keyboard buffer, as if typed; returns how
+  /// many characters fit (the buffer holds 10).
+  size_t type(std::string_view text);
+
+  /// Copies a .prg file to its load address, as LOAD"...",8,1 would, and
+  /// sets BASIC's end of program if it loads at $0801. Known routines in
+  /// the program are hooked, see natives.hpp.
+  bool load_prg(const std::vector<std::uint8_t>& prg, std::string& error);
+  /// Serves LOADs and SAVEs on `device` (8-11) with a disk image, through
+  /// `FastLoader`.
+  void mount_disk(std::uint8_t device, D64 disk);
+  /// The fast loader, once a disk was mounted, or nullptr.
+  FastLoader* loader() { return loader_.get(); }
+  /// Connects a 1541 with the given DOS ROM as device 8.
+  bool attach_drive(std::vector<std::uint8_t> rom, std::string& error);
+  /// Turns the native routines off, LOAD and SAVE included, so that the
+  /// KERNAL's own code runs with exact timing; disks then go through the
+  /// 1541.
+  void set_strict(bool strict) { hooks_.set_enabled(!strict); }
+  bool strict() const { return !hooks_.enabled(); }
+  /// Inserts a disk into the attached 1541.
+  void insert_disk(const D64& disk) { drive_->insert(disk); }
+  /// The attached 1541, or nullptr.
+  Drive1541* drive() { return drive_.get(); }
+
+  /// Saves or restores everything but the CPU registers and the ROMs, see
+  /// snapshot.hpp. The 1541 is not covered: there are no snapshots while
+  /// one is attached.
+  void save(SnapshotWriter& out) const;
+  void restore(SnapshotReader& in);
+
+  /// Runs the guest's fill and copy loops in bulk (see idioms.hpp); off
+  /// by default.
+  void set_idioms(bool on) { cpu_.idioms = on ? &idioms_ : nullptr; }
+
+  CPU& cpu() { return cpu_; }
+  Bus& bus() { return bus_; }
+  Hooks& hooks() { return hooks_; }
+  Vic& vic() { return vic_; }
+  Sid& sid() { return sid_; }
+  Cia& cia1() { return cia1_; }
+  Cia& cia2() { return cia2_; }
+  std::uint8_t* ram() { return ram_.data(); }
+
+  std::uint8_t read(std::uint16_t addr) override;
+  void write(std::uint16_t addr, std::uint8_t value) override;
+  std::uint8_t peek(std::uint16_t addr) override;
+
+  std::uint8_t read_port(const Cia& cia, int port, std::uint8_t output) override;
+  void write_port(const Cia& cia, int port, std::uint8_t output) override;
+
+private:
+  /// CIA time of day advances every tenth of a second.
+  static constexpr std::uint32_t TodPeriod = 98525;
+
+  template <typename Archive, typename Self> static void fields(Archive& archive, Self& self);
+  /// Updates the processor port as seen at $01 and the banking it selects.
+  void update_port();
+  void map_banks(std::uint8_t config);
+  /// CPU cycle of the next event that needs the VIC-II or a CIA.
+  std::uint64_t next_event() const;
+  /// Brings the 1541 up to the current CPU cycle.
+  void sync_drive();
+
+  CPU cpu_;
+  Bus bus_;
+  Idioms idioms_;
+  Hooks hooks_{bus_};
+  Vic vic_{cpu_};
+  Sid sid_{cpu_, ClockRate};
+  Cia cia1_{cpu_, *this, Cia::Line::Irq, CiaIrq, TodPeriod};
+  Cia cia2_{cpu_, *this, Cia::Line::Nmi, 0, TodPeriod};
+  /// Created by the first mount, so that LOAD and SAVE are not trapped
+  /// before.
+  std::unique_ptr<FastLoader> loader_;
+  std::unique_ptr<Drive1541> drive_;
+
+  std::array<std::uint8_t, 0x10000> ram_{};
+  std::array<std::uint8_t, 0x400> color_ram_{};
+  std::array<std::uint8_t, 0x2000> kernal_{};
+  std::array<std::uint8_t, 0x2000> basic_{};
+  std::array<std::uint8_t, 0x1000> chargen_{};
+  std::uint16_t kernal_region_ = 0;
+  std::uint16_t basic_region_ = 0;
+  std::uint16_t chargen_region_ = 0;
+
+  std::uint8_t port_direction_ = 0;
+  std::uint8_t port_data_ = 0;
+  /// LORAM, HIRAM and CHAREN as last mapped; 0xFF before the first map.
+  std::uint8_t banks_ = 0xFF;
+
+  /// Pressed keys: bit `column` of `keys_[row]`.
+  std::uint8_t keys_[8] = {};
+  std::uint8_t joysticks_[2] = {};
+};
+
+}; // namespace emu
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <bus.hpp>
+
+#include <cstdint>
+#include <cstddef>
+
+namespace emu {
+
+struct CPU;
+class SnapshotReader;
+class SnapshotWriter;
+class Cia;
+
+/// What is wired to a CIA's two 8-bit ports.
+class CiaPorts {
+public:
+  virtual ~CiaPorts() = default;
+  /// Value seen on `port` (0 = A, 1 = B) when the CIA drives `output` (its
+  /// data register, with input bits pulled high).
+  virtual std::uint8_t read_port(const Cia& cia, int port, std::uint8_t output) = 0;
+  /// Called when the CIA changes what it drives on `port`.
+  virtual void write_port(const Cia& cia, int port, std::uint8_t output) = 0;
+};
+
+/// A MOS 6526 complex interface adapter: two I/O ports, two 16-bit
+/// interval timers, a BCD time-of-day clock with alarm and an interrupt
+/// control register, wired to the CPU's IRQ or NMI.
+///
+/// The CIA is caught up lazily, like the video chips: timers are advanced
+/// arithmetically over the elapsed cycles, counting underflows rather than
+/// stepping, and `next_event` gives the cycle of the next interrupt so the
+/// machine can stop the CPU there. The 6526's one-cycle delays on timer
+/// start and reload, the serial port and the CNT pin are not emulated.
+class Cia final : public Device {
+public:
+  enum class Line { Irq, Nmi };
+
+  /// `irq_source` is the `CPU::irq_lines` bit used when wired to IRQ.
+  /// `tod_period` is the number of CPU cycles per tenth of a second.
+  Cia(CPU& cpu, CiaPorts& ports, Line line, std::uint8_t irq_source, std::uint32_t tod_period);
+
+  void reset();
+  /// Saves or restores the CIA's state, see snapshot.hpp.
+  void save(SnapshotWriter& out) const;
+  void restore(SnapshotReader& in);
+
+  /// Brings the CIA up to CPU cycle `cycle`.
+  void catch_up(std::uint64_t cycle);
+  void sync();
+  /// CPU cycle of the next interrupt the CIA will raise, or UINT64_MAX.
+  std::uint64_t next_event() const;
+
+  /// What the CIA drives on `port`: the data register, inputs pulled high.
+  std::uint8_t port_output(int port) const {
+    return static_cast<std::uint8_t>(data_[port] | ~ddr_[port]);
+  }
+
+  std::uint8_t read(std::uint16_t addr) override;
+  void write(std::uint16_t addr, std::uint8_t value) override;
+  std::uint8_t peek(std::uint16_t addr) override;
+
+private:
+  struct Timer final {
+    std::uint16_t counter = 0xFFFF;
+    std::uint16_t latch = 0xFFFF;
+    std::uint8_t control = 0;
+
+    bool started() const { return control & 0x01; }
+    bool one_shot() const { return control & 0x08; }
+    /// Advances by `ticks` counts; returns the number of underflows.
+    std::uint64_t advance(std::uint64_t ticks);
+    /// Counts until the next underflow.
+    std::uint64_t remaining() const { return counter + std::uint64_t{1}; }
+  };
+
+  template <typename Archive, typename Self> static void fields(Archive& archive, Self& self);
+  /// Timer B counts timer A's underflows instead of cycles.
+  bool b_counts_a() const { return (timer_[1].control & 0x40) != 0; }
+  bool counting(int timer) const;
+  void tick_tod();
+  void raise(std::uint8_t flags);
+  void set_line(bool asserted);
+
+  CPU& cpu_;
+  CiaPorts& ports_;
+  Line line_;
+  std::uint8_t irq_source_;
+  std::uint32_t tod_period_;
+
+  std::uint8_t data_[2] = {};
+  std::uint8_t ddr_[2] = {};
+  Timer timer_[2];
+  std::uint8_t icr_ = 0;
+  std::uint8_t mask_ = 0;
+  bool asserted_ = false;
+  std::uint8_t sdr_ = 0;
+
+  /// Time of day and alarm as tenths, seconds, minutes, hours (BCD).
+  std::uint8_t tod_[4] = {0, 0, 0, 0x01};
+  std::uint8_t alarm_[4] = {};
+  std::uint8_t latched_[4] = {};
+  bool tod_latched_ = false;
+  bool tod_stopped_ = false;
+  std::uint64_t next_tod_ = 0;
+
+  std::uint64_t clock_ = 0;
+};
+
+}; // namespace emu
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <bus.hpp>
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <iosfwd>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace emu {
+
+/// Records which guest instructions ran and which way each conditional
+/// branch went, one bit per byte of every bus region. Instructions that are
+/// known to be code but never ran are found by static decode, so reports
+/// can show them as missed.
+///
+/// The interpreter only ever sets a bit indexed by the CPU address. Those
+/// bits are folded into the per-region bitmaps when the bus is about to remap
+/// a page (and before reporting), so bank switching is accounted for without
+/// resolving the bank on every instruction.
+class Coverage final {
+public:
+  /// Returns the name of the symbol starting at a location, or "".
+  using SymbolFn =
+      std::function<std::string(std::uint16_t region, std::uint32_t offset)>;
+
+  /// Attaches to `bus` and sizes the bitmaps after its regions, so construct
+  /// it once the machine has registered all of its banks.
+  explicit Coverage(Bus& bus);
+  ~Coverage();
+
+  Coverage(const Coverage&) = delete;
+  Coverage& operator=(const Coverage&) = delete;
+
+  void exec(std::uint16_t pc) { set(live_.exec, pc); }
+  void branch(std::uint16_t pc, bool taken) {
+    set(taken ? live_.taken : live_.not_taken, pc);
+  }
+
+  /// Folds the live bits of `[addr, addr + size)` into their regions.
+  void flush(std::uint16_t addr, size_t size);
+  void flush() { flush(0, 0x10000); }
+
+  bool executed(Bus::Location loc);
+
+  /// Marks the code reachable from `addr` as known, by recursive descent
+  /// over what is mapped now: fall-through, branch, JMP and JSR targets,
+  /// stopping at devices. `write_lcov` traces from every instruction that
+  /// ran; entry points that may not have run can be added here.
+  void trace(std::uint16_t addr);
+
+  void clear();
+  /// Adds the coverage of another run over the same machine.
+  void merge(Coverage& other);
+
+  /// Writes an lcov tracefile with one "source file" per region and guest
+  /// addresses as line numbers. Known instructions that never ran count as
+  /// missed lines, and their branches as never evaluated ("-").
+  void write_lcov(std::ostream& out, const SymbolFn& symbol = {},
+                  std::string_view test_name = "");
+
+private:
+  using Bitmap = std::vector<std::uint64_t>;
+
+  struct Bitmaps final {
+    Bitmap exec;
+    Bitmap taken;
+    Bitmap not_taken;
+    /// Known instruction starts, and which of them are branches.
+    Bitmap code;
+    Bitmap branches;
+  };
+
+  static void set(Bitmap& bits, std::uint32_t offset) {
+    bits[offset >> 6] |= std::uint64_t{1} << (offset & 63);
+  }
+  static bool test(const Bitmap& bits, std::uint32_t offset) {
+    return (bits[offset >> 6] >> (offset & 63)) & 1;
+  }
+
+  Bus& bus_;
+  /// Indexed by CPU address, not yet attributed to a region.
+  Bitmaps live_;
+  std::vector<Bitmaps> regions_;
+};
+
+}; // namespace emu
@@ -2,18 +2,124 @@
 
 #include <cstdint>
 #include <cstddef>
+#include <vector>
 
 namespace emu {
 
+class Bus;
+class Coverage;
+class Idioms;
+struct CPU;
+
+/// Receives execute traps: calls made before the CPU executes an
+/// instruction at an address trapped with `Bus::set_trap`.
+class TrapHandler {
+public:
+  enum class Action {
+    /// Execute the instruction normally.
+    Execute,
+    /// The handler changed the CPU state itself (PC, registers, cycles);
+    /// continue from the new PC.
+    Resume,
+    /// Return from `CPU::run` without executing the instruction. The next
+    /// `run` or `step` executes it without trapping again.
+    Stop,
+  };
+
+  virtual ~TrapHandler() = default;
+  virtual Action on_trap(CPU& cpu, Bus& bus) = 0;
+};
+
+/// Lets several trap handlers share the CPU's single handler slot. Handlers
+/// are asked in order; the first one that does not answer `Execute` wins, so
+/// each handler must answer `Execute` for addresses it did not trap.
+class TrapChain final : public TrapHandler {
+public:
+  void add(TrapHandler* handler) { handlers_.push_back(handler); }
+
+  Action on_trap(CPU& cpu, Bus& bus) override {
+    for (TrapHandler* handler : handlers_) {
+      const Action action = handler->on_trap(cpu, bus);
+      if (action != Action::Execute) return action;
+    }
+    return Action::Execute;
+  }
+
+private:
+  std::vector<TrapHandler*> handlers_;
+};
+
 struct CPU final {
   using Register = std::uint8_t;
   static constexpr size_t NumRegs = 6;
 
-  Register PC;
-  Register X;
-  Register Y;
-  Register Status;
+  enum Flag : Register {
+    C = 0x01, // carry
+    Z = 0x02, // zero
+    I = 0x04, // interrupt disable
+    D = 0x08, // decimal
+    B = 0x10, // break (only exists on the stack)
+    U = 0x20, // unused, always reads as 1
+    V = 0x40, // overflow
+    N = 0x80, // negative
+  };
+
+  std::uint16_t PC = 0;
+  Register A = 0;
+  Register X = 0;
+  Register Y = 0;
+  Register SP = 0xFD;
+  Register Status = U | I;
+
+  /// Cycles executed since power-on.
+  std::uint64_t cycles = 0;
+
+  /// The NES' 2A03 has the decimal flag but no BCD arithmetic.
+  bool decimal_mode = true;
+  /// Set when an undocumented opcode is fetched; the CPU stops executing
+  /// but its clock keeps running.
+  bool jammed = false;
+  /// Makes `run` return after the current instruction.
+  bool stop_requested = false;
+  /// Cycle at which the current `run` returns. A device whose register
+  /// write schedules an event before then, such as an IRQ, brings it
+  /// forward with `end_run_by` so the machine can handle the event.
+  std::uint64_t run_end = 0;
+
+  bool nmi_pending = false;
+  /// One bit per interrupt source; IRQ is level triggered.
+  std::uint8_t irq_lines = 0;
+
+  /// Optional guest coverage recorder, see coverage.hpp.
+  Coverage* coverage = nullptr;
+  /// Optional bulk runner for fill and copy loops, see idioms.hpp.
+  Idioms* idioms = nullptr;
+
+  /// Called for trapped addresses. Traps cost nothing per instruction while
+  /// no handler is set or the bus has no traps when `run` starts, so traps
+  /// should be set up between runs.
+  TrapHandler* trap_handler = nullptr;
+  static constexpr std::uint32_t NoTrapSkip = 0x10000;
+  /// Address whose trap is skipped once, after a handler stopped there.
+  std::uint32_t trap_skip = NoTrapSkip;
+
+  /// Loads PC from the reset vector.
+  void reset(Bus& bus);
+
+  void nmi() { nmi_pending = true; }
+  void end_run_by(std::uint64_t cycle) {
+    if (cycle < run_end) run_end = cycle;
+  }
+  void set_irq(std::uint8_t source, bool asserted) {
+    irq_lines = asserted ? (irq_lines | source) : (irq_lines & ~source);
+  }
+
+  /// Executes one instruction (or interrupt entry) and returns its cycles.
+  std::uint32_t step(Bus& bus);
+
+  /// Executes instructions until `cycles` reaches `until`, a stop is
+  /// requested or the CPU jams. Returns the number of cycles executed.
+  std::uint64_t run(Bus& bus, std::uint64_t until);
 };
 
 }; // namespace emu
-
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <opcodes.hpp>
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace emu {
+
+/// One decoded instruction.
+struct Instruction final {
+  std::uint16_t addr = 0;
+  std::uint8_t opcode = 0;
+  std::uint8_t length = 1;
+  /// Raw operand: the byte or little-endian word following the opcode.
+  std::uint16_t operand = 0;
+
+  const OpInfo& info() const { return OpTable[opcode]; }
+
+  /// Statically known destination of a branch, JMP abs or JSR.
+  bool has_target() const {
+    const OpInfo& i = info();
+    return is_branch(i.op) ||
+           ((i.op == Op::JMP || i.op == Op::JSR) && i.mode == Mode::Absolute);
+  }
+  std::uint16_t target() const {
+    if (info().mode == Mode::Relative) {
+      return static_cast<std::uint16_t>(addr + 2 +
+                                        static_cast<std::int8_t>(operand));
+    }
+    return operand;
+  }
+};
+
+/// Decodes the instruction at `addr` from `bytes`, which holds `avail`
+/// readable bytes starting at `addr`. Returns false when the instruction
+/// does not fit.
+bool decode(const std::uint8_t* bytes, size_t avail, std::uint16_t addr,
+            Instruction& out);
+
+/// Longest line `format` can produce, excluding the terminator, plus the
+/// length of the label if one is used.
+constexpr size_t MaxInstructionText = 48;
+
+/// Writes assembler syntax for `instr` into `out` without allocating and
+/// returns the number of characters written. `label` is consulted for the
+/// operand and may return nullptr.
+using LabelFn = const char* (*)(const void* ctx, std::uint16_t addr);
+size_t format(const Instruction& instr, char* out, LabelFn label = nullptr,
+              const void* ctx = nullptr);
+
+class SymbolTable;
+
+/// Disassembles a ROM image (or one bank of it) mapped at `org`. Code and
+/// data are separated by recursive descent from the entry points: every
+/// reachable branch, jump and subroutine target is followed, everything
+/// else is emitted as `.byte` data.
+class Disassembler final {
+public:
+  enum class Kind : std::uint8_t { Data, Code, Operand };
+
+  Disassembler(const std::uint8_t* image, size_t size, std::uint16_t org);
+
+  /// Follows code reachable from `addr`, if it lies inside the image.
+  void trace(std::uint16_t addr);
+  /// Traces from the NMI, RESET and IRQ vectors when the image covers them.
+  void trace_vectors();
+  /// Treats the whole image as a straight-line instruction stream.
+  void trace_linear();
+  /// Names addresses after `symbols` instead of generated labels. The table
+  /// must outlive the disassembler.
+  void use_symbols(const SymbolTable& symbols);
+
+  Kind kind(std::uint16_t addr) const { return kinds_[addr - org_]; }
+  bool contains(std::uint16_t addr) const {
+    return addr >= org_ && static_cast<size_t>(addr - org_) < size_;
+  }
+  /// Symbol or generated label for `addr`, or nullptr. A symbol is returned
+  /// whole, from the table; generated text lives in a scratch buffer that is
+  /// reused by the next call.
+  const char* label(std::uint16_t addr) const;
+
+  /// Appends the listing to `out`.
+  void write(std::string& out) const;
+
+private:
+  /// Ordered by precedence: a vector entry point keeps its name even when
+  /// it is also a subroutine, and so on.
+  enum class Label : std::uint8_t { None, Local, Sub, Irq, Reset, Nmi, Symbol };
+
+  void name(std::uint16_t addr, Label label) {
+    Label& slot = labels_[addr - org_];
+    if (label > slot) slot = label;
+  }
+
+  const std::uint8_t* image_;
+  size_t size_;
+  std::uint16_t org_;
+  std::vector<Kind> kinds_;
+  std::vector<Label> labels_;
+  const SymbolTable* symbols_ = nullptr;
+  /// Longest label the listing can contain; symbols are never shortened.
+  size_t label_length_ = 8;
+  /// Generated labels, such as `sub_C000`.
+  mutable char label_text_[16];
+};
+
+}; // namespace emu
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <bus.hpp>
+#include <cpu.hpp>
+#include <fastload.hpp>
+#include <via.hpp>
+
+#include <array>
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace emu {
+
+/// A Commodore 1541 disk drive: its own 6502 at 1 MHz with 2K of RAM, the
+/// 16K DOS ROM, VIA 1 on the serial bus and VIA 2 on the head, stepper and
+/// spindle motor. A D64 image is GCR encoded into in-memory tracks when
+/// inserted, so the DOS reads and writes it through the real routines and
+/// copy-protected or fast-loading code runs unchanged. Writes change only
+/// the in-memory tracks.
+///
+/// The drive keeps its own clock and runs behind its host: the host brings
+/// it up to date (`run_until`) before it reads or changes the serial lines
+/// and at the end of each of its own slices, so the two CPUs only meet when
+/// they can see each other. With the motor off, ATN released and the lines
+/// quiet for `IdleDelay` cycles the drive can only be waiting in its idle
+/// loop, so its CPU stops and only its timers are advanced until the host
+/// touches the bus again.
+class Drive1541 final : public ViaPorts {
+public:
+  static constexpr double ClockRate = 1000000.0;
+  /// Quiet time after which the drive idles; the DOS turns the motor off
+  /// about a second after the last job.
+  static constexpr std::uint64_t IdleDelay = 2000000;
+  /// Bits of the drive CPU's `irq_lines` driven by the two VIAs.
+  static constexpr std::uint8_t Via1Irq = 0x01;
+  static constexpr std::uint8_t Via2Irq = 0x02;
+
+  Drive1541();
+
+  Drive1541(const Drive1541&) = delete;
+  Drive1541& operator=(const Drive1541&) = delete;
+
+  /// Installs the 16K DOS ROM and resets the drive.
+  bool load_rom(std::vector<std::uint8_t> rom, std::string& error);
+  void reset();
+
+  /// Encodes the image onto the in-memory disk.
+  void insert(const D64& disk);
+  void eject();
+  /// Device number 8-11, as set by the address jumpers.
+  void set_device(std::uint8_t device) { device_ = static_cast<std::uint8_t>((device - 8) & 3); }
+
+  /// Runs the drive until its CPU cycle `cycle`.
+  void run_until(std::uint64_t cycle);
+
+  /// What the host does to the serial bus: true pulls a line low.
+  void set_host_lines(bool atn, bool clk, bool data);
+  /// Whether the drive pulls CLK or DATA low. DATA is also pulled low by
+  /// the ATN acknowledge logic while the host asserts ATN and the DOS has
+  /// not answered.
+  bool pulls_clk() const { return (via1_.port_output(1) & 0x08) != 0; }
+  bool pulls_data() const {
+    const std::uint8_t output = via1_.port_output(1);
+    return (output & 0x02) || (host_atn_ != ((output & 0x10) != 0));
+  }
+
+  bool motor() const { return motor_; }
+  bool led() const { return (via2_.port_output(1) & 0x08) != 0; }
+  /// Track under the head, 1-42; between two tracks, the lower one.
+  int track() const { return half_track_ / 2 + 1; }
+  bool idle() const;
+  /// Drive cycles skipped while idle.
+  std::uint64_t idle_cycles() const { return idle_cycles_; }
+
+  CPU& cpu() { return cpu_; }
+  Bus& bus() { return bus_; }
+
+  std::uint8_t read_port(const Via& via, int port, std::uint8_t output) override;
+  void write_port(const Via& via, int port, std::uint8_t output) override;
+
+private:
+  static constexpr int HalfTracks = 84;
+
+  /// CPU cycle of the next event: a VIA interrupt or, while the motor
+  /// runs, the next byte under the head.
+  std::uint64_t next_event() const;
+  /// Cycles per byte in the speed zone selected by VIA 2.
+  std::uint32_t byte_period() const;
+  /// Turns the disk up to `cycle`, reading or writing a byte at each byte
+  /// boundary; a byte sets the CPU's overflow flag, as BYTE READY does
+  /// through SO, unless it is part of a sync mark.
+  void rotate(std::uint64_t cycle);
+
+  CPU cpu_;
+  Bus bus_;
+  Via via1_{cpu_, *this, Via1Irq};
+  Via via2_{cpu_, *this, Via2Irq};
+  std::array<std::uint8_t, 0x800> ram_{};
+  std::array<std::uint8_t, 0x4000> rom_{};
+  std::uint16_t rom_region_ = 0;
+  std::uint8_t device_ = 0;
+
+  bool host_atn_ = false;
+  bool host_clk_ = false;
+  bool host_data_ = false;
+  /// VIA 1 port B as last driven, to notice when the drive's lines change.
+  std::uint8_t lines_ = 0;
+  /// Last change on the serial bus or of the motor.
+  std::uint64_t last_activity_ = 0;
+  std::uint64_t idle_cycles_ = 0;
+
+  /// GCR bytes of each half track; odd half tracks are left empty.
+  std::array<std::vector<std::uint8_t>, HalfTracks> tracks_;
+  int half_track_ = 34;
+  std::uint8_t phase_ = 0;
+  bool motor_ = false;
+  /// Index of the next byte to pass under the head.
+  size_t head_ = 0;
+  std::uint64_t next_byte_ = 0;
+  std::uint8_t latch_ = 0;
+  bool sync_ = false;
+};
+
+}; // namespace emu
@@ -0,0 +1,210 @@
+#pragma once
+
+/* The C interface of libemu, for embedding the emulator in other programs
+ * and languages. Machines are opaque handles. Memory and pictures are
+ * handed out as views of the machine's own storage, so reading RAM or a
+ * frame after each run costs no copy; a view stays valid until the
+ * machine is destroyed.
+ *
+ * Functions returning int answer EMU_OK or a negative error; the message
+ * of the last error on a machine is available from emu_last_error. A
+ * machine must not be used from two threads at once, but separate
+ * machines are independent. No C++ exception escapes the interface: an
+ * internal failure, such as running out of memory, is reported as an
+ * error. */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_WIN32) && defined(EMU_SHARED)
+#ifdef EMU_BUILDING
+#define EMU_API __declspec(dllexport)
+#else
+#define EMU_API __declspec(dllimport)
+#endif
+#elif defined(__GNUC__)
+#define EMU_API __attribute__((visibility("default")))
+#else
+#define EMU_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Bumped when the interface changes incompatibly. */
+#define EMU_API_VERSION 1
+
+enum {
+  EMU_OK = 0,
+  EMU_ERROR = -1,
+  /* The machine has no such image, memory or operation. */
+  EMU_UNSUPPORTED = -2,
+  /* A buffer passed in is too small or has the wrong size. */
+  EMU_BAD_SIZE = -3,
+};
+
+typedef enum emu_kind {
+  /* A bare 6502 with 64K of RAM. */
+  EMU_BARE = 0,
+  EMU_NES = 1,
+  EMU_C64 = 2,
+  EMU_APPLE2 = 3,
+} emu_kind;
+
+typedef enum emu_image {
+  /* Raw bytes copied to RAM at the given address (bare, Apple II). */
+  EMU_IMAGE_BINARY = 0,
+  /* An iNES cartridge (NES); the machine resets. */
+  EMU_IMAGE_INES = 1,
+  /* System ROMs. The machine resets once all of its ROMs are loaded:
+   * KERNAL, BASIC and CHARGEN for the C64, ROM and CHARGEN for the
+   * Apple II. */
+  EMU_IMAGE_KERNAL = 2,
+  EMU_IMAGE_BASIC = 3,
+  EMU_IMAGE_CHARGEN = 4,
+  EMU_IMAGE_ROM = 5,
+  /* A .prg file (C64), loaded at its own address. */
+  EMU_IMAGE_PRG = 6,
+  /* A .d64 disk image served to LOAD on device 8 (C64), or inserted into
+   * the 1541 if one is attached. */
+  EMU_IMAGE_D64 = 7,
+  /* A 1541 DOS ROM (C64), which attaches a real drive as device 8. */
+  EMU_IMAGE_DRIVE_ROM = 8,
+} emu_image;
+
+typedef enum emu_memory {
+  /* The CPU's main RAM: 64K (bare, C64), 2K (NES) or 48K (Apple II). */
+  EMU_MEMORY_RAM = 0,
+  /* The last picture, one palette index per pixel, row by row. */
+  EMU_MEMORY_FRAME = 1,
+} emu_memory;
+
+typedef struct emu_view {
+  uint8_t* data;
+  size_t size;
+  /* For EMU_MEMORY_FRAME, the picture size; 0 otherwise. */
+  int width;
+  int height;
+} emu_view;
+
+typedef struct emu_cpu_state {
+  uint16_t pc;
+  uint8_t a;
+  uint8_t x;
+  uint8_t y;
+  uint8_t sp;
+  uint8_t status;
+  uint64_t cycles;
+} emu_cpu_state;
+
+typedef struct emu_machine emu_machine;
+
+EMU_API int emu_api_version(void);
+
+/* Returns NULL if out of memory. */
+EMU_API emu_machine* emu_create(emu_kind kind);
+EMU_API void emu_destroy(emu_machine* machine);
+EMU_API const char* emu_last_error(const emu_machine* machine);
+
+EMU_API int emu_load(emu_machine* machine, emu_image image, const uint8_t* data, size_t size,
+                     uint16_t address);
+EMU_API void emu_reset(emu_machine* machine);
+
+/* Runs at least `cycles` CPU cycles (instructions are not split) and
+ * returns how many ran. */
+EMU_API uint64_t emu_run_cycles(emu_machine* machine, uint64_t cycles);
+/* Runs to the end of the next frame; the bare machine has no frames. */
+EMU_API int emu_run_frame(emu_machine* machine);
+
+/* Runs the guest's fill and copy loops in bulk rather than instruction by
+ * instruction; off by default. Cycle counts stay exact. */
+EMU_API void emu_set_idioms(emu_machine* machine, int enabled);
+
+/* Turns the C64's native routines off, so that LOAD runs the KERNAL's own
+ * code with exact timing; disks then need a real 1541. */
+EMU_API int emu_set_strict(emu_machine* machine, int enabled);
+
+/* Controller or joystick `port` (0 or 1) of the NES or C64, as the
+ * machine's button bits. */
+EMU_API int emu_set_buttons(emu_machine* machine, int port, uint8_t buttons);
+/* Types text on the C64 or Apple II keyboard; returns how many characters
+ * were accepted, or a negative error. */
+EMU_API int emu_type(emu_machine* machine, const char* text);
+
+EMU_API emu_view emu_memory_view(emu_machine* machine, emu_memory memory);
+/* Tells the machine that RAM at `address` was changed through a view, so
+ * that pictures drawn from it (the Apple II screen) are brought up to
+ * date. */
+EMU_API void emu_memory_written(emu_machine* machine, uint16_t address, size_t size);
+/* Colours of the palette indices in frames, as 0xRRGGBB; the count is
+ * returned in `count`. */
+EMU_API const uint32_t* emu_palette(const emu_machine* machine, size_t* count);
+
+EMU_API void emu_get_cpu(const emu_machine* machine, emu_cpu_state* state);
+EMU_API void emu_set_cpu(emu_machine* machine, const emu_cpu_state* state);
+
+/* Snapshots hold the complete machine state, so restoring one makes the
+ * machine continue exactly as it did after the save. ROMs are not part of
+ * them: a NES snapshot restores into a machine with the same cartridge
+ * loaded. A C64 with a 1541 attached has no snapshots. Values are stored
+ * as the host holds them, so a snapshot is only valid for the library
+ * build that wrote it. */
+EMU_API size_t emu_snapshot_size(const emu_machine* machine);
+EMU_API int emu_save(const emu_machine* machine, uint8_t* buffer, size_t size);
+EMU_API int emu_restore(emu_machine* machine, const uint8_t* buffer, size_t size);
+
+/* Vectorised environments: many NES instances running one cartridge,
+ * stepped together for reinforcement learning. Each step takes one
+ * controller byte per instance and writes one observation per instance
+ * (the RAM slices, then the downscaled luminance frame) at a fixed stride
+ * into a single buffer, plus one reward and one end-of-episode flag per
+ * instance. Nothing is allocated per step. */
+
+typedef struct emu_ram_slice {
+  uint16_t address;
+  uint16_t size;
+} emu_ram_slice;
+
+/* The change of a RAM value over a step, times `weight`, adds to the
+ * reward. Values are `size` (1-4) bytes, little endian, binary or BCD. */
+typedef struct emu_reward_term {
+  uint16_t address;
+  uint8_t size;
+  uint8_t bcd;
+  float weight;
+} emu_reward_term;
+
+typedef struct emu_vec_config {
+  const uint8_t* ines;
+  size_t ines_size;
+  size_t count;
+  /* Frames each action is held for, at least 1. */
+  unsigned frameskip;
+  /* Frame block size, dividing 256 and 240; 0 for no frame. */
+  unsigned downscale;
+  const emu_ram_slice* slices;
+  size_t num_slices;
+  const emu_reward_term* rewards;
+  size_t num_rewards;
+  /* The episode ends, and the instance restarts, when
+   * (RAM[done_address] & done_mask) == done_value; if done_test is set. */
+  uint8_t done_test;
+  uint16_t done_address;
+  uint8_t done_mask;
+  uint8_t done_value;
+} emu_vec_config;
+
+typedef struct emu_vec emu_vec;
+
+/* Returns NULL on failure, with the reason in `error` if given. */
+EMU_API emu_vec* emu_vec_create(const emu_vec_config* config, char* error, size_t error_size);
+EMU_API void emu_vec_destroy(emu_vec* vec);
+EMU_API size_t emu_vec_observation_size(const emu_vec* vec);
+EMU_API int emu_vec_reset(emu_vec* vec, uint8_t* observations);
+EMU_API void emu_vec_step(emu_vec* vec, const uint8_t* buttons, uint8_t* observations,
+                          float* rewards, uint8_t* dones);
+
+#ifdef __cplusplus
+}
+#endif
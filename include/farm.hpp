@@ -0,0 +1,112 @@
+#pragma once
+
+#include <spsc.hpp>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace emu {
+
+/// A lock-free queue of job numbers owned by one worker thread (after
+/// Chase and Lev, without growing). Only the owner pushes, at the bottom;
+/// any thread, the owner included, takes from the top with one
+/// compare-and-swap. The storage is set up by `reserve` while no other
+/// thread uses the queue, so nothing is allocated while jobs run.
+class WorkQueue final {
+public:
+  /// Makes room for `capacity` jobs and empties the queue.
+  void reserve(size_t capacity);
+  /// Owner only. There must be room: the queue never holds more jobs than
+  /// were reserved.
+  void push(size_t job);
+  /// Takes the oldest job; false if the queue is empty or another thread
+  /// took it first.
+  bool take(size_t& job);
+
+private:
+  alignas(CacheLine) std::atomic<std::int64_t> top_{0};
+  alignas(CacheLine) std::atomic<std::int64_t> bottom_{0};
+  std::unique_ptr<std::atomic<size_t>[]> jobs_;
+  size_t mask_ = 0;
+};
+
+/// Runs thousands of independent jobs, such as emulator instances, on a
+/// fixed pool of threads. Every job runs in slices of a few whole frames.
+/// An unfinished job goes back to the end of its worker's queue, so each
+/// worker cycles through its own instances in turn. A worker whose queue
+/// runs dry steals the oldest job of a random other worker. Jobs that
+/// finish early therefore leave no core idle, as static partitioning
+/// would, and the pool scales with the number of cores.
+///
+/// A worker that finds nothing to steal for a few rounds parks until a
+/// job is pushed back or the batch ends, so the tail of a batch does not
+/// keep every other core spinning on the queues.
+///
+/// Each job runs on one thread at a time. Between slices it may move to
+/// another thread, so a job must not keep thread-local state.
+class Farm final {
+public:
+  /// Runs job `index` for at most `frames` frames; true once it is done.
+  using Job = std::function<bool(size_t index, unsigned frames)>;
+
+  /// Starts `threads` workers, or one per core if 0.
+  explicit Farm(unsigned threads = 0);
+  ~Farm();
+  Farm(const Farm&) = delete;
+  Farm& operator=(const Farm&) = delete;
+
+  unsigned threads() const { return static_cast<unsigned>(workers_.size()); }
+
+  /// Runs jobs 0 to `count` - 1 to completion, `frames` frames per slice,
+  /// and returns when all are done. Jobs start spread evenly, in
+  /// consecutive blocks, over the workers.
+  void run(size_t count, unsigned frames, const Job& job);
+
+  /// Totals over all batches run.
+  std::uint64_t slices() const { return slices_.load(std::memory_order_relaxed); }
+  std::uint64_t steals() const { return steals_.load(std::memory_order_relaxed); }
+
+private:
+  void work(unsigned self);
+  void run_batch(unsigned self);
+  bool steal(unsigned self, std::uint64_t& random, size_t& job);
+  /// Wakes one parked worker, or all of them when the batch is done.
+  void wake(bool all);
+
+  std::vector<std::unique_ptr<WorkQueue>> queues_;
+  std::vector<std::thread> workers_;
+
+  std::mutex mutex_;
+  std::condition_variable start_;
+  std::condition_variable finish_;
+  /// Guarded by `mutex_`: the batch being run, how many workers are done
+  /// with it, and whether the workers should exit.
+  std::uint64_t batch_ = 0;
+  unsigned finished_ = 0;
+  bool quit_ = false;
+
+  /// Set by `run` before a batch starts.
+  const Job* job_ = nullptr;
+  unsigned frames_ = 1;
+  alignas(CacheLine) std::atomic<size_t> remaining_{0};
+
+  /// Idle workers wait on `idle_` for `wakeups_`, guarded by `idle_mutex_`,
+  /// to change; `parked_` counts them so that busy workers only take the
+  /// lock when someone is waiting.
+  std::mutex idle_mutex_;
+  std::condition_variable idle_;
+  std::uint64_t wakeups_ = 0;
+  alignas(CacheLine) std::atomic<unsigned> parked_{0};
+  /// Each worker counts on its own and adds its totals when a batch ends.
+  alignas(CacheLine) std::atomic<std::uint64_t> slices_{0};
+  std::atomic<std::uint64_t> steals_{0};
+};
+
+}; // namespace emu
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <hle.hpp>
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace emu {
+
+/// A 1541 disk image (.d64), 35 or 40 tracks, with or without error bytes.
+class D64 final {
+public:
+  struct Entry final {
+    /// PETSCII, without the $A0 padding.
+    std::string name;
+    /// DEL, SEQ, PRG, USR or REL in the low bits.
+    std::uint8_t type = 0;
+    std::uint8_t track = 0;
+    std::uint8_t sector = 0;
+    std::uint16_t blocks = 0;
+  };
+  static constexpr std::uint8_t Prg = 2;
+
+  bool load(std::vector<std::uint8_t> image, std::string& error);
+
+  const std::vector<Entry>& directory() const { return directory_; }
+  /// The first closed file matching a CBM DOS pattern, where `*` matches
+  /// the rest of the name and `?` any character, or nullptr.
+  const Entry* find(std::string_view pattern) const;
+  /// Follows the file's sector chain.
+  bool read(const Entry& entry, std::vector<std::uint8_t>& out, std::string& error) const;
+  /// Writes a PRG file as the 1541 would: sectors from the BAM, nearest to
+  /// the directory track first, and an entry in the first free directory
+  /// slot. An existing file of that name is replaced if `replace` is set
+  /// and is an error otherwise, as is a full disk; the image is left
+  /// unchanged on errors.
+  bool write(std::string_view name, const std::vector<std::uint8_t>& data, bool replace,
+             std::string& error);
+
+  /// The whole image, as written back to a .d64 file.
+  const std::vector<std::uint8_t>& image() const { return image_; }
+
+  std::uint8_t tracks() const { return tracks_; }
+  /// The 256 bytes of a sector, or nullptr if there is no such sector.
+  const std::uint8_t* sector(std::uint8_t track, std::uint8_t sector) const;
+  /// Sectors on a track in the 1541's format, by speed zone.
+  static std::uint8_t sectors_in(std::uint8_t track);
+
+private:
+  /// Offset of a sector in the image, or -1 if it does not exist.
+  long offset(std::uint8_t track, std::uint8_t sector) const;
+  /// Rebuilds `directory_` from the directory chain.
+  bool read_directory(std::string& error);
+  /// Takes the first free sector of `track` from sector `from` on, wrapping
+  /// around, out of the BAM; false if the track is full.
+  bool allocate(std::uint8_t track, std::uint8_t from, std::uint8_t& sector);
+  /// Marks a sector free in the BAM.
+  void release(std::uint8_t track, std::uint8_t sector);
+
+  std::vector<std::uint8_t> image_;
+  std::uint8_t tracks_ = 0;
+  std::vector<Entry> directory_;
+};
+
+/// Instant LOAD and SAVE for C64-style KERNALs: traps their entries in the
+/// KERNAL jump table and copies files between mounted images and memory,
+/// instead of clocking them through the serial bus or tape routines byte by
+/// byte. Inputs (SETLFS, SETNAM, the A/X/Y arguments) and results (carry,
+/// A, X/Y, STATUS and the start and end address pointers) follow the
+/// KERNAL, so both BASIC's LOAD and SAVE and programs calling $FFD5 and
+/// $FFD8 work unchanged. A SAVE the drive would refuse (an existing name
+/// without "@", a full disk) succeeds for the KERNAL as it does on the real
+/// machine, where only the drive's error channel tells, and leaves the disk
+/// as it was.
+///
+/// Programs loaded are scanned for `add_known_routines`.
+///
+/// In strict mode LOAD and SAVE are not trapped at all, so the KERNAL's own
+/// tape or serial bus routines run on the emulated hardware with exact
+/// timing; a disk then needs a real drive on the bus. Unmounted devices,
+/// and directory loads ("$"), always run the guest routine.
+class FastLoader final {
+public:
+  /// KERNAL jump table entries of LOAD and SAVE.
+  static constexpr std::uint16_t LoadEntry = 0xFFD5;
+  static constexpr std::uint16_t SaveEntry = 0xFFD8;
+
+  explicit FastLoader(Hooks& hooks, std::uint16_t load_entry = LoadEntry,
+                      std::uint16_t save_entry = SaveEntry);
+  ~FastLoader();
+
+  FastLoader(const FastLoader&) = delete;
+  FastLoader& operator=(const FastLoader&) = delete;
+
+  /// Serves LOAD and SAVE for `device` (8-11 for drives) with a disk image.
+  void mount_disk(std::uint8_t device, D64 disk);
+  /// Serves LOAD for `device` (1 for tape) with a single .prg file, whatever
+  /// name is asked for, as a tape would; SAVE replaces the file.
+  void mount_file(std::uint8_t device, std::vector<std::uint8_t> prg);
+  void unmount(std::uint8_t device);
+
+  /// The disk or file mounted as `device`, with whatever was saved to it,
+  /// or nullptr.
+  const D64* disk(std::uint8_t device) const;
+  const std::vector<std::uint8_t>* file(std::uint8_t device) const;
+
+  /// Removes the LOAD and SAVE hooks, or puts them back.
+  void set_strict(bool strict);
+  bool strict() const { return strict_; }
+
+  std::uint64_t loads() const { return loads_; }
+  std::uint64_t saves() const { return saves_; }
+
+private:
+  struct Medium final {
+    std::uint8_t device = 0;
+    bool disk = false;
+    D64 image;
+    std::vector<std::uint8_t> file;
+  };
+
+  void install();
+  void uninstall();
+  bool load(CPU& cpu, Bus& bus);
+  bool save(CPU& cpu, Bus& bus);
+  Medium* find(std::uint8_t device);
+  const Medium* find(std::uint8_t device) const;
+
+  Hooks& hooks_;
+  std::uint16_t load_entry_;
+  std::uint16_t save_entry_;
+  std::vector<Medium> media_;
+  bool strict_ = false;
+  std::uint64_t loads_ = 0;
+  std::uint64_t saves_ = 0;
+};
+
+}; // namespace emu
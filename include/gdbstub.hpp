@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+namespace emu {
+
+class Breakpoints;
+class Bus;
+struct CPU;
+class SymbolTable;
+
+/// A GDB remote serial protocol server for one CPU, listening on a loopback
+/// TCP port or a Unix-domain socket.
+///
+/// The stub does not own the run loop. The emulator keeps running its
+/// slices and calls `poll` in between, so a debugger can attach to an
+/// instance that is already running. Breakpoints are set through the
+/// shared `Breakpoints` execute traps, so the target runs at full speed
+/// until one is hit.
+///
+/// Registers are sent as A, X, Y, P, SP (one byte each) followed by the
+/// little-endian PC, which is also what the `target.xml` the stub serves
+/// describes. `monitor break ADDR [COND]` and `monitor delete ADDR` expose
+/// compiled conditional breakpoints.
+class GdbStub final {
+public:
+  GdbStub(CPU& cpu, Bus& bus, Breakpoints& breakpoints);
+  ~GdbStub();
+
+  GdbStub(const GdbStub&) = delete;
+  GdbStub& operator=(const GdbStub&) = delete;
+
+  bool listen_tcp(std::uint16_t port, std::string& error);
+  bool listen_unix(const std::string& path, std::string& error);
+
+  /// Lets monitor commands take symbol names for addresses.
+  void use_symbols(const SymbolTable& symbols) { symbols_ = &symbols; }
+
+  /// Call between run slices. Accepts a pending connection, notices a
+  /// debugger interrupt and, while the target is halted, serves requests
+  /// until the debugger resumes it. Returns false once the debugger has
+  /// asked to kill the target.
+  bool poll();
+
+  /// Call when `CPU::run` returned because a breakpoint stopped it. The
+  /// target is halted and the debugger told; without a debugger attached
+  /// the target simply keeps running.
+  void stopped();
+
+  bool connected() const { return client_ >= 0; }
+  bool halted() const { return halted_; }
+
+private:
+  bool read_some(bool block);
+  bool next_packet(std::string& packet, bool block);
+  void send(std::string_view payload);
+  void handle(const std::string& packet);
+  void disconnect();
+
+  std::string read_registers() const;
+  void write_registers(std::string_view hex);
+  std::string read_memory(std::string_view args) const;
+  std::string write_memory(std::string_view args);
+  std::string monitor(std::string_view hex);
+  std::string features(std::string_view args) const;
+
+  CPU& cpu_;
+  Bus& bus_;
+  Breakpoints& breakpoints_;
+  const SymbolTable* symbols_ = nullptr;
+  int listener_ = -1;
+  int client_ = -1;
+  std::string unix_path_;
+  std::string input_;
+  bool halted_ = false;
+  bool killed_ = false;
+};
+
+}; // namespace emu
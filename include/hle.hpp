@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cpu.hpp>
+
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace emu {
+
+/// A native replacement for a guest subroutine. It is entered when the CPU
+/// reaches the routine's first instruction, right after the JSR, and must
+/// leave the registers, flags, memory and `cycles` as the guest routine
+/// would before returning with `return_from_subroutine`. Returning false
+/// declines the call, which then runs as guest code (for instance for
+/// arguments the native version does not handle).
+using NativeRoutine = std::function<bool(CPU& cpu, Bus& bus)>;
+
+/// Pops the return address pushed by JSR into PC and charges RTS' cycles.
+void return_from_subroutine(CPU& cpu, Bus& bus);
+
+/// Whether the top of the stack is a return address pushed by JSR: the
+/// byte two below it is a JSR opcode. A routine reached by a JMP tail call
+/// from a subroutine passes, and returning to that subroutine's caller is
+/// what its RTS would do; any other entry, with something else on top of
+/// the stack, fails.
+bool called_by_jsr(const CPU& cpu, const Bus& bus);
+
+/// High-level emulation: runs native routines in place of guest ones,
+/// found by address or by a hash of their code. Hooks are execute traps,
+/// so unhooked code runs at full speed.
+///
+/// A hook installed by hash checks the hash again whenever it fires and
+/// declines if the code changed, so it is safe to hook code in a bank that
+/// may be switched out. Hooks also decline calls that were not made by JSR
+/// (see `called_by_jsr`), since natives return with an RTS of their own.
+class Hooks final : public TrapHandler {
+public:
+  explicit Hooks(Bus& bus) : bus_(bus) {}
+  ~Hooks() override { clear(); }
+
+  Hooks(const Hooks&) = delete;
+  Hooks& operator=(const Hooks&) = delete;
+
+  /// Replaces the routine at `addr`, or an earlier hook there. Hooks added
+  /// by a running routine take effect when it returns.
+  void add(std::uint16_t addr, std::string name, NativeRoutine routine);
+  /// Hooks every routine in [begin, end) whose first `length` bytes hash to
+  /// `hash`, and returns how many were found. The scan uses a rolling hash,
+  /// so it costs about one multiply per byte of the range.
+  size_t add_by_hash(std::uint64_t hash, std::uint16_t length, const std::string& name,
+                     const NativeRoutine& routine, std::uint16_t begin = 0,
+                     std::uint32_t end = 0x10000);
+  bool remove(std::uint16_t addr);
+  void clear();
+
+  /// Disabled hooks stay registered but do not trap, for runs that need the
+  /// guest's exact timing.
+  void set_enabled(bool enabled);
+  bool enabled() const { return enabled_; }
+
+  /// Hash of the `length` bytes at `addr`, read with `Bus::peek`.
+  static std::uint64_t hash(const Bus& bus, std::uint16_t addr, std::uint16_t length);
+  /// The same hash of code held by the host.
+  static std::uint64_t hash(const std::uint8_t* code, size_t length);
+
+  /// Calls handled natively by the hook at `addr`.
+  std::uint64_t calls(std::uint16_t addr) const;
+
+  Action on_trap(CPU& cpu, Bus& bus) override;
+
+private:
+  struct Entry final {
+    std::uint16_t addr;
+    std::string name;
+    NativeRoutine routine;
+    /// Length and hash of the code the hook was installed for; 0 when it
+    /// was installed by address.
+    std::uint16_t length;
+    std::uint64_t hash;
+    std::uint64_t calls;
+  };
+
+  Entry* find(std::uint16_t addr);
+  void insert(Entry entry);
+
+  Bus& bus_;
+  /// Sorted by address.
+  std::vector<Entry> entries_;
+  /// Hooks added while a routine runs, inserted once it returns.
+  std::vector<Entry> added_;
+  bool running_ = false;
+  bool enabled_ = true;
+};
+
+}; // namespace emu
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <opcodes.hpp>
+
+#include <array>
+#include <cstdint>
+#include <cstddef>
+
+namespace emu {
+
+class Bus;
+struct CPU;
+
+/// Runs the canonical 6502 fill and copy loops in bulk:
+///
+///     loop: LDA src,X      loop: LDA #$00      loop: LDA (src),Y
+///           STA dst,X            STA $0200,X         STA (dst),Y
+///           INX                  STA $0300,X         INY
+///           BNE loop             DEX                 BNE loop
+///                                BPL loop
+///
+/// that is, a body of indexed loads and stores (or immediate loads) that
+/// share one index register, stepped by one and closed by BNE or BPL. A loop
+/// is recognized when its backward branch is taken; the remaining
+/// iterations are then done natively, as a host memset or memcpy when the
+/// memory allows, leaving registers, flags, memory and cycles exactly as
+/// the interpreter would.
+///
+/// Loops touching device pages, or storing into their own code or pointers,
+/// are left to the interpreter, as are iterations that would end a run
+/// beyond its cycle budget. Attach with `CPU::idioms`; it is not used while
+/// coverage or execute traps are active.
+class Idioms final {
+public:
+  /// Called by the CPU for a taken backward branch at `pc`, with `cycles`
+  /// the CPU cycle count including the branch. Returns the extra cycles
+  /// spent.
+  std::uint32_t loop(CPU& cpu, Bus& bus, std::uint16_t pc, std::uint64_t cycles,
+                     std::uint64_t until);
+
+  /// Forgets loops found not to be idioms, e.g. after loading new code.
+  void clear() { misses_.fill(0); }
+
+  std::uint64_t loops() const { return loops_; }
+  std::uint64_t iterations() const { return iterations_; }
+
+private:
+  static constexpr size_t MaxOps = 8;
+
+  struct Access final {
+    bool store;
+    bool immediate;
+    Mode mode;
+    std::uint16_t operand;
+    std::uint8_t cycles;
+    bool page_penalty;
+  };
+
+  struct Body final {
+    Access ops[MaxOps];
+    size_t num_ops = 0;
+    bool index_x = true;
+    std::int8_t step = 1;
+    /// BNE, otherwise BPL.
+    bool until_zero = true;
+    std::uint16_t head = 0;
+  };
+
+  bool recognize(Bus& bus, std::uint16_t pc, std::uint16_t head, Body& out) const;
+
+  /// Branches found not to close an idiom, direct mapped by address and
+  /// stored plus one so that 0 is empty.
+  std::array<std::uint32_t, 256> misses_{};
+  std::uint64_t loops_ = 0;
+  std::uint64_t iterations_ = 0;
+};
+
+}; // namespace emu
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cpu.hpp>
+
+#include <array>
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+namespace emu {
+
+/// Sixteen bare 6502s, each with 64K of RAM of its own, executing in lock
+/// step: one instruction is decoded once and carried out for every lane
+/// that is at it, with the registers held as arrays of one byte per lane
+/// (structure of arrays) so that the compiler turns the per-lane loops
+/// into vector operations: sixteen byte registers fill one SSE2 register,
+/// and builds for AVX2 or AVX-512 widen the word and cycle loops. Meant
+/// for search workloads that run the same program from many starting
+/// states, where the lanes mostly follow the same path.
+///
+/// RAM is interleaved: byte `addr` of lane `l` is at `addr * Lanes + l`.
+/// When all lanes use the same address, which is the common case for
+/// code, variables and the stack, an access is one 16-byte load or a
+/// blended store; only lanes whose addresses differ, through X, Y or
+/// pointers, are gathered byte by byte.
+///
+/// When lanes diverge, the lanes at the lowest PC issue first and the
+/// others wait; this reconverges after if/else blocks and loops. Lanes at
+/// the same PC but with different opcodes there wait too.
+///
+/// Only the CPU and RAM are emulated: no interrupts other than BRK, no
+/// traps, coverage or bulk idioms.
+class CpuLanes final {
+public:
+  static constexpr size_t Lanes = 16;
+  template <typename T>
+  using Vector = std::array<T, Lanes>;
+  static constexpr std::uint32_t NoExit = 0x10000;
+
+  CpuLanes();
+
+  /// Copies `data` to `address` in every lane's RAM.
+  void load(std::uint16_t address, const std::uint8_t* data, size_t size);
+  std::uint8_t peek(size_t lane, std::uint16_t address) const {
+    return memory_[address * Lanes + lane];
+  }
+  void poke(size_t lane, std::uint16_t address, std::uint8_t value) {
+    memory_[address * Lanes + lane] = value;
+  }
+
+  /// The lane's registers, cycles and jam flag as a CPU.
+  CPU state(size_t lane) const;
+  void set_state(size_t lane, const CPU& cpu);
+  /// The NES' 2A03 has no BCD arithmetic; applies to every lane.
+  void set_decimal_mode(bool enabled) { decimal_mode_ = enabled; }
+  /// Lanes stop when they reach `address`, before executing it.
+  void set_exit(std::uint32_t address) { exit_ = address; }
+
+  /// Runs until every lane's cycles reach `until`, it jams or it reaches
+  /// the exit address.
+  void run(std::uint64_t until);
+
+  /// Instructions issued, and instructions executed summed over the lanes;
+  /// their ratio is the average number of lanes that were in step.
+  std::uint64_t issued() const { return issued_; }
+  std::uint64_t executed() const { return executed_; }
+
+private:
+  using Mask = Vector<std::uint8_t>;
+  using Bytes = Vector<std::uint8_t>;
+  using Words = Vector<std::uint16_t>;
+
+  bool issue(std::uint64_t until);
+  /// True if every active lane uses the address of the leading lane.
+  bool uniform(const Words& addr, const Mask& active) const;
+  Bytes read(const Words& addr, const Mask& active) const;
+  Words read16(const Words& lo, const Words& hi, const Mask& active) const;
+  void write(const Words& addr, const Bytes& value, const Mask& active);
+  void push(const Bytes& value, const Mask& active);
+  Bytes pull(const Mask& active);
+  void set_nz(const Bytes& value, const Mask& active);
+  void set_flag(CPU::Flag flag, const Mask& on, const Mask& active);
+  void adc(const Bytes& value, const Mask& active);
+  void sbc(const Bytes& value, const Mask& active);
+
+  alignas(64) Words pc_{};
+  Bytes a_{};
+  Bytes x_{};
+  Bytes y_{};
+  Bytes sp_{};
+  Bytes status_{};
+  Mask jammed_{};
+  Vector<std::uint64_t> cycles_{};
+  /// The first lane of the current issue.
+  size_t lead_ = 0;
+
+  std::vector<std::uint8_t> memory_;
+  bool decimal_mode_ = true;
+  std::uint32_t exit_ = NoExit;
+  std::uint64_t issued_ = 0;
+  std::uint64_t executed_ = 0;
+};
+
+}; // namespace emu
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <asm.hpp>
+#include <hle.hpp>
+
+#include <cstdint>
+#include <cstddef>
+
+namespace emu {
+
+/// Common library routines that `add_known_routines` recognises in guest
+/// code by the hash of their bytes, and runs as native code with the same
+/// effect on registers, flags, memory and cycles. They use nothing but
+/// zero page operands and relative branches, so the same bytes are found
+/// wherever a program has them. Arguments and results live at $F7-$FE.
+///
+/// A native runs at once, so an interrupt raised during the routine is
+/// taken after it returns rather than partway through. It declines, and
+/// the guest code runs, while an interrupt is pending, in decimal mode
+/// where that would change the arithmetic, and when the routine would
+/// write over its own code or arguments or touch a device.
+namespace routines {
+
+/// Fills X pages (256 if X is 0) from the pointer at $FB with A. Leaves
+/// the pointer's high byte past the end, X and Y at 0.
+constexpr auto Fill = EMU_ASM(R"(
+          LDY #$00
+  loop:   STA ($FB),Y
+          INY
+          BNE loop
+          INC $FC
+          DEX
+          BNE loop
+          RTS
+)");
+
+/// Copies X pages (256 if X is 0) from the pointer at $FB to the pointer
+/// at $FD, in ascending order. Leaves both pointers' high bytes past the
+/// end, X and Y at 0 and the last byte copied in A.
+constexpr auto Copy = EMU_ASM(R"(
+          LDY #$00
+  loop:   LDA ($FB),Y
+          STA ($FD),Y
+          INY
+          BNE loop
+          INC $FC
+          INC $FE
+          DEX
+          BNE loop
+          RTS
+)");
+
+/// Multiplies $FB by $FC into A (high byte) and $FB (low byte); X ends
+/// at 0.
+constexpr auto Multiply8 = EMU_ASM(R"(
+          LDA #$00
+          LDX #$08
+          LSR $FB
+  loop:   BCC skip
+          CLC
+          ADC $FC
+  skip:   ROR A
+          ROR $FB
+          DEX
+          BNE loop
+          RTS
+)");
+
+/// Multiplies $FB/$FC by $FD/$FE into $F7-$FA, low byte first. The
+/// multiplier at $FB/$FC ends at 0, X at 0.
+constexpr auto Multiply16 = EMU_ASM(R"(
+          LDA #$00
+          STA $F9
+          STA $FA
+          LDX #$10
+  loop:   LSR $FC
+          ROR $FB
+          BCC skip
+          LDA $F9
+          CLC
+          ADC $FD
+          STA $F9
+          LDA $FA
+          ADC $FE
+          STA $FA
+  skip:   ROR $FA
+          ROR $F9
+          ROR $F8
+          ROR $F7
+          DEX
+          BNE loop
+          RTS
+)");
+
+/// Divides $FB/$FC by $FD/$FE: the quotient replaces the dividend and the
+/// remainder goes to $F7/$F8. X ends at 0.
+constexpr auto Divide16 = EMU_ASM(R"(
+          LDA #$00
+          STA $F7
+          STA $F8
+          LDX #$10
+  loop:   ASL $FB
+          ROL $FC
+          ROL $F7
+          ROL $F8
+          LDA $F7
+          SEC
+          SBC $FD
+          TAY
+          LDA $F8
+          SBC $FE
+          BCC skip
+          STA $F8
+          STY $F7
+          INC $FB
+  skip:   DEX
+          BNE loop
+          RTS
+)");
+
+} // namespace routines
+
+/// Hooks every routine of `routines` found in [begin, end) with its native
+/// version, and returns how many were found. The hooks check the code
+/// again whenever they fire, so a scan may cover memory that changes.
+size_t add_known_routines(Hooks& hooks, std::uint16_t begin = 0, std::uint32_t end = 0x10000);
+
+}; // namespace emu
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <apu.hpp>
+#include <bus.hpp>
+#include <cpu.hpp>
+#include <hle.hpp>
+#include <idioms.hpp>
+#include <ppu.hpp>
+#include <snapshot.hpp>
+
+#include <array>
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace emu {
+
+/// An iNES cartridge with mapper 0 (NROM), 2 (UxROM), 3 (CNROM) or 7
+/// (AxROM). PRG banks are bus regions named "prg0", "prg1"..., so coverage
+/// and symbols follow bank switches. Reads stay direct; the cartridge only
+/// sees writes, to its mapper registers.
+class Cartridge final : public Device {
+public:
+  bool load(std::vector<std::uint8_t> ines, std::string& error);
+  /// Maps the cartridge into the CPU and PPU address spaces.
+  void attach(Bus& bus, Ppu& ppu);
+
+  int mapper() const { return mapper_; }
+  size_t prg_banks() const { return prg_.size() / PrgBankSize; }
+
+  /// Saves or restores the bank registers and CHR RAM, and maps the banks
+  /// again; the cartridge must be the one the snapshot was taken of.
+  void save(SnapshotWriter& out) const;
+  void restore(SnapshotReader& in);
+
+  std::uint8_t read(std::uint16_t addr) override;
+  void write(std::uint16_t addr, std::uint8_t value) override;
+
+private:
+  static constexpr size_t PrgBankSize = 0x4000;
+  static constexpr size_t ChrBankSize = 0x2000;
+
+  template <typename Archive, typename Self> static void fields(Archive& archive, Self& self);
+  void map_prg();
+  void map_chr();
+
+  std::vector<std::uint8_t> prg_;
+  std::vector<std::uint8_t> chr_;
+  bool chr_ram_ = false;
+  int mapper_ = 0;
+  Ppu::Mirroring mirroring_ = Ppu::Mirroring::Horizontal;
+  std::uint8_t prg_bank_ = 0;
+  std::uint8_t chr_bank_ = 0;
+
+  Bus* bus_ = nullptr;
+  Ppu* ppu_ = nullptr;
+  std::uint16_t first_region_ = 0;
+};
+
+/// The NES (NTSC): a 2A03 CPU with its APU, the PPU, 2K of RAM, 8K of
+/// cartridge RAM and two standard controllers. The machine itself is the
+/// device behind the I/O registers at $4000-$40FF.
+///
+/// The CPU runs in slices up to the next event that needs the other chips
+/// to be current: the start of vblank, which may raise NMI, and the APU's
+/// IRQs. In between, the PPU and APU catch up when the CPU touches their
+/// registers.
+class Nes final : public Device {
+public:
+  /// Controller bits, in the order they are shifted out.
+  enum Button : std::uint8_t {
+    A = 0x01, B = 0x02, Select = 0x04, Start = 0x08,
+    Up = 0x10, Down = 0x20, Left = 0x40, Right = 0x80,
+  };
+
+  Nes();
+
+  Nes(const Nes&) = delete;
+  Nes& operator=(const Nes&) = delete;
+
+  /// Loads an iNES image and resets the machine.
+  bool load(std::vector<std::uint8_t> ines, std::string& error);
+  void reset();
+
+  /// Runs up to the start of the next vblank, when the frame is complete.
+  void run_frame();
+  /// Runs until CPU cycle `cycle` or a stop request.
+  void run_until(std::uint64_t cycle);
+
+  void set_buttons(int port, std::uint8_t buttons) { buttons_[port & 1] = buttons; }
+
+  /// Saves or restores everything but the CPU registers and the cartridge
+  /// ROM, see snapshot.hpp.
+  void save(SnapshotWriter& out) const;
+  void restore(SnapshotReader& in);
+
+  /// Runs the guest's fill and copy loops in bulk (see idioms.hpp); off
+  /// by default.
+  void set_idioms(bool on) { cpu_.idioms = on ? &idioms_ : nullptr; }
+  /// Hooks the known routines found in memory with native versions (see
+  /// natives.hpp), or removes every hook; off by default. Only the PRG
+  /// banks mapped at the time are scanned.
+  void set_hle(bool on);
+
+  CPU& cpu() { return cpu_; }
+  Bus& bus() { return bus_; }
+  Hooks& hooks() { return hooks_; }
+  Ppu& ppu() { return ppu_; }
+  Apu& apu() { return apu_; }
+  Cartridge& cartridge() { return cartridge_; }
+  std::uint8_t* ram() { return ram_.data(); }
+
+  std::uint8_t read(std::uint16_t addr) override;
+  void write(std::uint16_t addr, std::uint8_t value) override;
+  std::uint8_t peek(std::uint16_t addr) override;
+
+private:
+  template <typename Archive, typename Self> static void fields(Archive& archive, Self& self);
+  /// CPU cycle of the next event that needs the PPU or APU to be current.
+  std::uint64_t next_event() const;
+
+  CPU cpu_;
+  Bus bus_;
+  Idioms idioms_;
+  Hooks hooks_{bus_};
+  Ppu ppu_{cpu_};
+  Apu apu_{cpu_, bus_};
+  Cartridge cartridge_;
+  std::array<std::uint8_t, 0x800> ram_{};
+  std::array<std::uint8_t, 0x2000> prg_ram_{};
+
+  std::uint8_t buttons_[2] = {};
+  std::uint8_t shift_[2] = {};
+  bool strobe_ = false;
+};
+
+}; // namespace emu
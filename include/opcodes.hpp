@@ -0,0 +1,301 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstddef>
+#include <string_view>
+
+namespace emu {
+
+/// Addressing modes of the NMOS 6502.
+enum class Mode : std::uint8_t {
+  Implied,
+  Accumulator,
+  Immediate,
+  ZeroPage,
+  ZeroPageX,
+  ZeroPageY,
+  Relative,
+  Absolute,
+  AbsoluteX,
+  AbsoluteY,
+  Indirect,
+  IndirectX, // (zp,X)
+  IndirectY, // (zp),Y
+};
+
+/// Documented 6502 operations. `ILL` covers every undocumented opcode.
+enum class Op : std::uint8_t {
+  ADC, AND, ASL, BCC, BCS, BEQ, BIT, BMI, BNE, BPL, BRK, BVC, BVS, CLC,
+  CLD, CLI, CLV, CMP, CPX, CPY, DEC, DEX, DEY, EOR, INC, INX, INY, JMP,
+  JSR, LDA, LDX, LDY, LSR, NOP, ORA, PHA, PHP, PLA, PLP, ROL, ROR, RTI,
+  RTS, SBC, SEC, SED, SEI, STA, STX, STY, TAX, TAY, TSX, TXA, TXS, TYA,
+  ILL,
+};
+
+static constexpr size_t NumOps = static_cast<size_t>(Op::ILL) + 1;
+
+/// Static metadata for one opcode byte. This table is the single source of
+/// truth for decoding: the interpreter, disassembler and assembler all read it.
+struct OpInfo final {
+  Op op = Op::ILL;
+  Mode mode = Mode::Implied;
+  std::uint8_t cycles = 0;
+  /// One extra cycle when indexing crosses a page boundary.
+  bool page_penalty = false;
+};
+
+constexpr std::array<std::string_view, NumOps> Mnemonics = {
+  "ADC", "AND", "ASL", "BCC", "BCS", "BEQ", "BIT", "BMI", "BNE", "BPL",
+  "BRK", "BVC", "BVS", "CLC", "CLD", "CLI", "CLV", "CMP", "CPX", "CPY",
+  "DEC", "DEX", "DEY", "EOR", "INC", "INX", "INY", "JMP", "JSR", "LDA",
+  "LDX", "LDY", "LSR", "NOP", "ORA", "PHA", "PHP", "PLA", "PLP", "ROL",
+  "ROR", "RTI", "RTS", "SBC", "SEC", "SED", "SEI", "STA", "STX", "STY",
+  "TAX", "TAY", "TSX", "TXA", "TXS", "TYA", "???",
+};
+
+constexpr std::string_view mnemonic(Op op) {
+  return Mnemonics[static_cast<size_t>(op)];
+}
+
+/// Instruction length in bytes, including the opcode.
+constexpr std::uint8_t instr_length(Mode mode) {
+  switch (mode) {
+  case Mode::Implied:
+  case Mode::Accumulator:
+    return 1;
+  case Mode::Absolute:
+  case Mode::AbsoluteX:
+  case Mode::AbsoluteY:
+  case Mode::Indirect:
+    return 3;
+  default:
+    return 2;
+  }
+}
+
+constexpr bool is_branch(Op op) {
+  switch (op) {
+  case Op::BCC: case Op::BCS: case Op::BEQ: case Op::BMI:
+  case Op::BNE: case Op::BPL: case Op::BVC: case Op::BVS:
+    return true;
+  default:
+    return false;
+  }
+}
+
+/// True for instructions after which execution never falls through.
+constexpr bool ends_flow(Op op) {
+  switch (op) {
+  case Op::JMP: case Op::RTS: case Op::RTI: case Op::BRK: case Op::ILL:
+    return true;
+  default:
+    return false;
+  }
+}
+
+/// True for instructions that store to their effective address.
+constexpr bool writes_memory(Op op, Mode mode) {
+  switch (op) {
+  case Op::STA: case Op::STX: case Op::STY: case Op::DEC: case Op::INC:
+    return true;
+  case Op::ASL: case Op::LSR: case Op::ROL: case Op::ROR:
+    return mode != Mode::Accumulator;
+  default:
+    return false;
+  }
+}
+
+namespace detail {
+
+constexpr std::array<OpInfo, 256> make_op_table() {
+  std::array<OpInfo, 256> t{};
+  for (auto& info : t) info = OpInfo{Op::ILL, Mode::Implied, 2, false};
+
+  t[0x69] = {Op::ADC, Mode::Immediate, 2, false};
+  t[0x65] = {Op::ADC, Mode::ZeroPage, 3, false};
+  t[0x75] = {Op::ADC, Mode::ZeroPageX, 4, false};
+  t[0x6D] = {Op::ADC, Mode::Absolute, 4, false};
+  t[0x7D] = {Op::ADC, Mode::AbsoluteX, 4, true};
+  t[0x79] = {Op::ADC, Mode::AbsoluteY, 4, true};
+  t[0x61] = {Op::ADC, Mode::IndirectX, 6, false};
+  t[0x71] = {Op::ADC, Mode::IndirectY, 5, true};
+
+  t[0x29] = {Op::AND, Mode::Immediate, 2, false};
+  t[0x25] = {Op::AND, Mode::ZeroPage, 3, false};
+  t[0x35] = {Op::AND, Mode::ZeroPageX, 4, false};
+  t[0x2D] = {Op::AND, Mode::Absolute, 4, false};
+  t[0x3D] = {Op::AND, Mode::AbsoluteX, 4, true};
+  t[0x39] = {Op::AND, Mode::AbsoluteY, 4, true};
+  t[0x21] = {Op::AND, Mode::IndirectX, 6, false};
+  t[0x31] = {Op::AND, Mode::IndirectY, 5, true};
+
+  t[0x0A] = {Op::ASL, Mode::Accumulator, 2, false};
+  t[0x06] = {Op::ASL, Mode::ZeroPage, 5, false};
+  t[0x16] = {Op::ASL, Mode::ZeroPageX, 6, false};
+  t[0x0E] = {Op::ASL, Mode::Absolute, 6, false};
+  t[0x1E] = {Op::ASL, Mode::AbsoluteX, 7, false};
+
+  t[0x90] = {Op::BCC, Mode::Relative, 2, false};
+  t[0xB0] = {Op::BCS, Mode::Relative, 2, false};
+  t[0xF0] = {Op::BEQ, Mode::Relative, 2, false};
+  t[0x30] = {Op::BMI, Mode::Relative, 2, false};
+  t[0xD0] = {Op::BNE, Mode::Relative, 2, false};
+  t[0x10] = {Op::BPL, Mode::Relative, 2, false};
+  t[0x50] = {Op::BVC, Mode::Relative, 2, false};
+  t[0x70] = {Op::BVS, Mode::Relative, 2, false};
+
+  t[0x24] = {Op::BIT, Mode::ZeroPage, 3, false};
+  t[0x2C] = {Op::BIT, Mode::Absolute, 4, false};
+
+  t[0x00] = {Op::BRK, Mode::Implied, 7, false};
+
+  t[0x18] = {Op::CLC, Mode::Implied, 2, false};
+  t[0xD8] = {Op::CLD, Mode::Implied, 2, false};
+  t[0x58] = {Op::CLI, Mode::Implied, 2, false};
+  t[0xB8] = {Op::CLV, Mode::Implied, 2, false};
+
+  t[0xC9] = {Op::CMP, Mode::Immediate, 2, false};
+  t[0xC5] = {Op::CMP, Mode::ZeroPage, 3, false};
+  t[0xD5] = {Op::CMP, Mode::ZeroPageX, 4, false};
+  t[0xCD] = {Op::CMP, Mode::Absolute, 4, false};
+  t[0xDD] = {Op::CMP, Mode::AbsoluteX, 4, true};
+  t[0xD9] = {Op::CMP, Mode::AbsoluteY, 4, true};
+  t[0xC1] = {Op::CMP, Mode::IndirectX, 6, false};
+  t[0xD1] = {Op::CMP, Mode::IndirectY, 5, true};
+
+  t[0xE0] = {Op::CPX, Mode::Immediate, 2, false};
+  t[0xE4] = {Op::CPX, Mode::ZeroPage, 3, false};
+  t[0xEC] = {Op::CPX, Mode::Absolute, 4, false};
+  t[0xC0] = {Op::CPY, Mode::Immediate, 2, false};
+  t[0xC4] = {Op::CPY, Mode::ZeroPage, 3, false};
+  t[0xCC] = {Op::CPY, Mode::Absolute, 4, false};
+
+  t[0xC6] = {Op::DEC, Mode::ZeroPage, 5, false};
+  t[0xD6] = {Op::DEC, Mode::ZeroPageX, 6, false};
+  t[0xCE] = {Op::DEC, Mode::Absolute, 6, false};
+  t[0xDE] = {Op::DEC, Mode::AbsoluteX, 7, false};
+  t[0xCA] = {Op::DEX, Mode::Implied, 2, false};
+  t[0x88] = {Op::DEY, Mode::Implied, 2, false};
+
+  t[0x49] = {Op::EOR, Mode::Immediate, 2, false};
+  t[0x45] = {Op::EOR, Mode::ZeroPage, 3, false};
+  t[0x55] = {Op::EOR, Mode::ZeroPageX, 4, false};
+  t[0x4D] = {Op::EOR, Mode::Absolute, 4, false};
+  t[0x5D] = {Op::EOR, Mode::AbsoluteX, 4, true};
+  t[0x59] = {Op::EOR, Mode::AbsoluteY, 4, true};
+  t[0x41] = {Op::EOR, Mode::IndirectX, 6, false};
+  t[0x51] = {Op::EOR, Mode::IndirectY, 5, true};
+
+  t[0xE6] = {Op::INC, Mode::ZeroPage, 5, false};
+  t[0xF6] = {Op::INC, Mode::ZeroPageX, 6, false};
+  t[0xEE] = {Op::INC, Mode::Absolute, 6, false};
+  t[0xFE] = {Op::INC, Mode::AbsoluteX, 7, false};
+  t[0xE8] = {Op::INX, Mode::Implied, 2, false};
+  t[0xC8] = {Op::INY, Mode::Implied, 2, false};
+
+  t[0x4C] = {Op::JMP, Mode::Absolute, 3, false};
+  t[0x6C] = {Op::JMP, Mode::Indirect, 5, false};
+  t[0x20] = {Op::JSR, Mode::Absolute, 6, false};
+
+  t[0xA9] = {Op::LDA, Mode::Immediate, 2, false};
+  t[0xA5] = {Op::LDA, Mode::ZeroPage, 3, false};
+  t[0xB5] = {Op::LDA, Mode::ZeroPageX, 4, false};
+  t[0xAD] = {Op::LDA, Mode::Absolute, 4, false};
+  t[0xBD] = {Op::LDA, Mode::AbsoluteX, 4, true};
+  t[0xB9] = {Op::LDA, Mode::AbsoluteY, 4, true};
+  t[0xA1] = {Op::LDA, Mode::IndirectX, 6, false};
+  t[0xB1] = {Op::LDA, Mode::IndirectY, 5, true};
+
+  t[0xA2] = {Op::LDX, Mode::Immediate, 2, false};
+  t[0xA6] = {Op::LDX, Mode::ZeroPage, 3, false};
+  t[0xB6] = {Op::LDX, Mode::ZeroPageY, 4, false};
+  t[0xAE] = {Op::LDX, Mode::Absolute, 4, false};
+  t[0xBE] = {Op::LDX, Mode::AbsoluteY, 4, true};
+
+  t[0xA0] = {Op::LDY, Mode::Immediate, 2, false};
+  t[0xA4] = {Op::LDY, Mode::ZeroPage, 3, false};
+  t[0xB4] = {Op::LDY, Mode::ZeroPageX, 4, false};
+  t[0xAC] = {Op::LDY, Mode::Absolute, 4, false};
+  t[0xBC] = {Op::LDY, Mode::AbsoluteX, 4, true};
+
+  t[0x4A] = {Op::LSR, Mode::Accumulator, 2, false};
+  t[0x46] = {Op::LSR, Mode::ZeroPage, 5, false};
+  t[0x56] = {Op::LSR, Mode::ZeroPageX, 6, false};
+  t[0x4E] = {Op::LSR, Mode::Absolute, 6, false};
+  t[0x5E] = {Op::LSR, Mode::AbsoluteX, 7, false};
+
+  t[0xEA] = {Op::NOP, Mode::Implied, 2, false};
+
+  t[0x09] = {Op::ORA, Mode::Immediate, 2, false};
+  t[0x05] = {Op::ORA, Mode::ZeroPage, 3, false};
+  t[0x15] = {Op::ORA, Mode::ZeroPageX, 4, false};
+  t[0x0D] = {Op::ORA, Mode::Absolute, 4, false};
+  t[0x1D] = {Op::ORA, Mode::AbsoluteX, 4, true};
+  t[0x19] = {Op::ORA, Mode::AbsoluteY, 4, true};
+  t[0x01] = {Op::ORA, Mode::IndirectX, 6, false};
+  t[0x11] = {Op::ORA, Mode::IndirectY, 5, true};
+
+  t[0x48] = {Op::PHA, Mode::Implied, 3, false};
+  t[0x08] = {Op::PHP, Mode::Implied, 3, false};
+  t[0x68] = {Op::PLA, Mode::Implied, 4, false};
+  t[0x28] = {Op::PLP, Mode::Implied, 4, false};
+
+  t[0x2A] = {Op::ROL, Mode::Accumulator, 2, false};
+  t[0x26] = {Op::ROL, Mode::ZeroPage, 5, false};
+  t[0x36] = {Op::ROL, Mode::ZeroPageX, 6, false};
+  t[0x2E] = {Op::ROL, Mode::Absolute, 6, false};
+  t[0x3E] = {Op::ROL, Mode::AbsoluteX, 7, false};
+
+  t[0x6A] = {Op::ROR, Mode::Accumulator, 2, false};
+  t[0x66] = {Op::ROR, Mode::ZeroPage, 5, false};
+  t[0x76] = {Op::ROR, Mode::ZeroPageX, 6, false};
+  t[0x6E] = {Op::ROR, Mode::Absolute, 6, false};
+  t[0x7E] = {Op::ROR, Mode::AbsoluteX, 7, false};
+
+  t[0x40] = {Op::RTI, Mode::Implied, 6, false};
+  t[0x60] = {Op::RTS, Mode::Implied, 6, false};
+
+  t[0xE9] = {Op::SBC, Mode::Immediate, 2, false};
+  t[0xE5] = {Op::SBC, Mode::ZeroPage, 3, false};
+  t[0xF5] = {Op::SBC, Mode::ZeroPageX, 4, false};
+  t[0xED] = {Op::SBC, Mode::Absolute, 4, false};
+  t[0xFD] = {Op::SBC, Mode::AbsoluteX, 4, true};
+  t[0xF9] = {Op::SBC, Mode::AbsoluteY, 4, true};
+  t[0xE1] = {Op::SBC, Mode::IndirectX, 6, false};
+  t[0xF1] = {Op::SBC, Mode::IndirectY, 5, true};
+
+  t[0x38] = {Op::SEC, Mode::Implied, 2, false};
+  t[0xF8] = {Op::SED, Mode::Implied, 2, false};
+  t[0x78] = {Op::SEI, Mode::Implied, 2, false};
+
+  t[0x85] = {Op::STA, Mode::ZeroPage, 3, false};
+  t[0x95] = {Op::STA, Mode::ZeroPageX, 4, false};
+  t[0x8D] = {Op::STA, Mode::Absolute, 4, false};
+  t[0x9D] = {Op::STA, Mode::AbsoluteX, 5, false};
+  t[0x99] = {Op::STA, Mode::AbsoluteY, 5, false};
+  t[0x81] = {Op::STA, Mode::IndirectX, 6, false};
+  t[0x91] = {Op::STA, Mode::IndirectY, 6, false};
+
+  t[0x86] = {Op::STX, Mode::ZeroPage, 3, false};
+  t[0x96] = {Op::STX, Mode::ZeroPageY, 4, false};
+  t[0x8E] = {Op::STX, Mode::Absolute, 4, false};
+  t[0x84] = {Op::STY, Mode::ZeroPage, 3, false};
+  t[0x94] = {Op::STY, Mode::ZeroPageX, 4, false};
+  t[0x8C] = {Op::STY, Mode::Absolute, 4, false};
+
+  t[0xAA] = {Op::TAX, Mode::Implied, 2, false};
+  t[0xA8] = {Op::TAY, Mode::Implied, 2, false};
+  t[0xBA] = {Op::TSX, Mode::Implied, 2, false};
+  t[0x8A] = {Op::TXA, Mode::Implied, 2, false};
+  t[0x9A] = {Op::TXS, Mode::Implied, 2, false};
+  t[0x98] = {Op::TYA, Mode::Implied, 2, false};
+
+  return t;
+}
+
+} // namespace detail
+
+constexpr std::array<OpInfo, 256> OpTable = detail::make_op_table();
+
+}; // namespace emu
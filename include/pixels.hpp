@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string_view>
+
+namespace emu {
+
+/// The PPU's per-pixel work, in a scalar version and SIMD versions for
+/// x86 (SSSE3 and AVX2). `best()` picks the widest one the host supports,
+/// checked once with CPUID; all of them produce identical pixels.
+///
+/// Pixels are `palette << 2 | pattern` as in the PPU's line buffers, with
+/// pattern 0 transparent. Sprite pixels also carry the PPU's "behind" (0x20)
+/// and "sprite 0" (0x40) flags.
+struct PixelKernels final {
+  const char* name;
+
+  /// Decodes `tiles` rows of planar tile data (`lo[i]`, `hi[i]`, with
+  /// `palette[i]` already shifted left by 2) into 8 pixels each.
+  void (*decode)(const std::uint8_t* lo, const std::uint8_t* hi,
+                 const std::uint8_t* palette, size_t tiles, std::uint8_t* out);
+
+  /// Draws the opaque pixels of `sprite` into `line` where it is still
+  /// empty, lower numbered sprites being drawn first.
+  void (*overlay)(const std::uint8_t* sprite, size_t count, std::uint8_t* line);
+
+  /// Resolves background/sprite priority and maps the result through the
+  /// 32-entry `palette`, masked with `gray`. Returns the index of the first
+  /// pixel where sprite 0 overlaps opaque background, or -1.
+  int (*composite)(const std::uint8_t* background, const std::uint8_t* sprites,
+                   const std::uint8_t* palette, std::uint8_t gray, size_t count,
+                   std::uint8_t* out);
+
+  static const PixelKernels& best();
+  /// The variant called `name` ("scalar", "ssse3", "avx2") if the host
+  /// supports it, else nullptr.
+  static const PixelKernels* find(std::string_view name);
+};
+
+}; // namespace emu
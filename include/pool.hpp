@@ -0,0 +1,93 @@
+#pragma once
+
+#include <bus.hpp>
+#include <cpu.hpp>
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+namespace emu {
+
+/// Thousands of bare 6502s kept for batch stepping. Round-robin over
+/// separately allocated CPUs and RAM spends its time in cache and TLB
+/// misses, so the pool keeps each register of all instances in one array
+/// (structure of arrays) and all RAM in one slab. The slab is aligned to,
+/// and where the system allows backed by, 2M huge pages, which cover 32
+/// instances' 64K each per TLB entry.
+///
+/// Instances are numbered from 0; a free list makes `allocate` and
+/// `release` O(1). Each instance's RAM is mirrored over the whole address
+/// space, as the NES mirrors its 2K.
+class InstancePool final {
+public:
+  using Id = std::uint32_t;
+  static constexpr Id None = ~Id{0};
+
+  /// How the slab is backed.
+  enum class Pages : std::uint8_t {
+    /// Reserved huge pages (MAP_HUGETLB).
+    Huge,
+    /// Normal pages the kernel may merge into huge ones (MADV_HUGEPAGE).
+    Transparent,
+    Normal,
+  };
+
+  /// `ram_size` must be a power of two from `Bus::PageSize` to 64K.
+  InstancePool(size_t capacity, size_t ram_size = 0x10000);
+  ~InstancePool();
+  InstancePool(const InstancePool&) = delete;
+  InstancePool& operator=(const InstancePool&) = delete;
+
+  /// An instance at power-on, with cleared RAM; `None` if the pool is full.
+  Id allocate();
+  /// Does nothing for an instance that is not live.
+  void release(Id id);
+
+  size_t size() const { return capacity_ - free_.size(); }
+  size_t capacity() const { return capacity_; }
+  size_t ram_size() const { return ram_size_; }
+  Pages pages() const { return pages_; }
+  bool live(Id id) const { return live_[id]; }
+
+  std::uint8_t* ram(Id id) { return slab_ + static_cast<size_t>(id) * ram_size_; }
+  const std::uint8_t* ram(Id id) const { return slab_ + static_cast<size_t>(id) * ram_size_; }
+
+  /// The instance's registers, cycles and jam flag as a CPU.
+  CPU state(Id id) const;
+  void set_state(Id id, const CPU& cpu);
+  std::uint64_t cycles(Id id) const { return cycles_[id]; }
+  bool jammed(Id id) const { return jammed_[id]; }
+
+  /// Runs the instance until its cycles reach `until` or it jams.
+  void run(Id id, std::uint64_t until);
+  /// Runs every live instance in turn, in slices of `slice` cycles, until
+  /// all have reached `until` or jammed.
+  void run_all(std::uint64_t until, std::uint64_t slice);
+
+private:
+  size_t capacity_;
+  size_t ram_size_;
+  size_t slab_size_ = 0;
+  std::uint8_t* slab_ = nullptr;
+  Pages pages_ = Pages::Normal;
+
+  std::vector<std::uint16_t> pc_;
+  std::vector<std::uint8_t> a_;
+  std::vector<std::uint8_t> x_;
+  std::vector<std::uint8_t> y_;
+  std::vector<std::uint8_t> sp_;
+  std::vector<std::uint8_t> status_;
+  std::vector<std::uint64_t> cycles_;
+  std::vector<std::uint8_t> jammed_;
+  std::vector<std::uint8_t> live_;
+  /// Free instances, the next to hand out last.
+  std::vector<Id> free_;
+
+  /// Remapped to each instance as it runs.
+  Bus bus_;
+  Id mapped_ = None;
+  CPU cpu_;
+};
+
+}; // namespace emu
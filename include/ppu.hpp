@@ -0,0 +1,166 @@
+#pragma once
+
+#include <bus.hpp>
+#include <pixels.hpp>
+
+#include <array>
+#include <cstdint>
+#include <cstddef>
+
+namespace emu {
+
+struct CPU;
+class SnapshotReader;
+class SnapshotWriter;
+
+/// The NES picture processing unit (2C02, NTSC), mapped at $2000-$3FFF.
+///
+/// The PPU runs lazily: it is only brought up to date ("caught up") with
+/// the CPU clock when the CPU touches one of its registers or the machine
+/// needs the next vblank. Catching up works a scanline at a time, not a dot
+/// at a time: the scroll register updates of a line are applied at their
+/// dots arithmetically and pixels are produced in runs, a whole line when
+/// nothing interrupts it. A register access in the middle of a line splits
+/// the run at the current dot, so mid-line changes to the mask, palette or
+/// pattern tables and sprite 0 hit polling behave as with dot-by-dot
+/// stepping. Scroll writes take effect at the next tile fetches that use
+/// them, which for a write in mid-line is the next line.
+///
+/// Timing is taken at the start of the accessing instruction, not at the
+/// exact bus cycle of the access.
+class Ppu final : public Device {
+public:
+  static constexpr int Width = 256;
+  static constexpr int Height = 240;
+  static constexpr int DotsPerLine = 341;
+  static constexpr int LinesPerFrame = 262;
+  static constexpr int VblankLine = 241;
+  static constexpr int PrerenderLine = 261;
+  /// PPU dots per CPU cycle.
+  static constexpr int DotsPerCycle = 3;
+
+  enum class Mirroring { Horizontal, Vertical, SingleLow, SingleHigh, FourScreen };
+
+  explicit Ppu(CPU& cpu);
+
+  /// Pattern memory in 1K banks, set by the cartridge. `writable` for CHR
+  /// RAM.
+  void set_chr(int bank, std::uint8_t* mem, bool writable);
+  void set_mirroring(Mirroring mirroring);
+  /// Pixel kernels to render with; `PixelKernels::best()` by default.
+  void set_kernels(const PixelKernels& kernels) { kernels_ = &kernels; }
+
+  /// In headless mode frames are not drawn unless requested. Everything the
+  /// CPU can observe is kept exact: timing, vblank and NMI, sprite overflow
+  /// and sprite 0 hit, which is found by fetching only the background under
+  /// sprite 0. The frame buffer keeps the last drawn frame.
+  void set_headless(bool headless) { headless_ = headless; }
+  bool headless() const { return headless_; }
+  /// Draws the next frame to start (at line 0) even when headless.
+  void request_frame() { frame_requested_ = true; }
+
+  /// Brings the PPU up to CPU cycle `cycle`.
+  void catch_up(std::uint64_t cycle);
+  /// Catches up with the CPU's current cycle; called before changing
+  /// anything the PPU reads, such as CHR banks or mirroring.
+  void sync();
+  /// CPU cycle at which the next vblank starts (and NMI may fire).
+  std::uint64_t next_vblank() const;
+
+  /// Saves or restores the PPU's state, see snapshot.hpp. Pattern memory
+  /// and mirroring belong to the cartridge.
+  void save(SnapshotWriter& out) const;
+  void restore(SnapshotReader& in);
+
+  std::uint8_t read(std::uint16_t addr) override;
+  void write(std::uint16_t addr, std::uint8_t value) override;
+  std::uint8_t peek(std::uint16_t addr) override;
+
+  /// OAM DMA ($4014) copies a page of CPU memory into OAM.
+  void write_oam(const std::uint8_t* page);
+
+  /// The picture as 6-bit palette entries, one byte per pixel.
+  const std::uint8_t* frame() const { return frame_.data(); }
+  std::uint64_t frame_count() const { return frames_; }
+  int scanline() const { return line_; }
+  int dot() const { return dot_; }
+
+  /// NTSC palette as 0xRRGGBB.
+  static const std::array<std::uint32_t, 64> Palette;
+
+private:
+  template <typename Archive, typename Self> static void fields(Archive& archive, Self& self);
+  bool rendering() const { return (mask_ & 0x18) != 0; }
+  std::uint8_t* vram(std::uint16_t addr);
+  std::uint8_t vram_read(std::uint16_t addr);
+  void vram_write(std::uint16_t addr, std::uint8_t value);
+
+  /// Executes dots [from, to) of the current line; `to` may be the line's
+  /// end.
+  void run_line(int from, int to);
+  /// Produces pixels [x0, x1) of the current line.
+  void render(int x0, int x1);
+  /// Sets sprite 0 hit for pixels [x0, x1) without drawing them.
+  void probe_sprite_zero(int x0, int x1);
+  /// The 2-bit background pattern at pixel `x` of the current line.
+  std::uint8_t background_pattern(int x);
+  /// Fetches the sprites of the next line into `next_sprites_`; only sprite
+  /// 0 when the frame is not drawn.
+  void evaluate_sprites();
+  void increment_x();
+  void increment_y();
+
+  CPU& cpu_;
+  const PixelKernels* kernels_ = &PixelKernels::best();
+
+  // Registers; v, t, x and w are the usual loopy names.
+  std::uint8_t ctrl_ = 0;
+  std::uint8_t mask_ = 0;
+  std::uint8_t status_ = 0;
+  std::uint8_t oam_addr_ = 0;
+  std::uint16_t v_ = 0;
+  std::uint16_t t_ = 0;
+  std::uint8_t fine_x_ = 0;
+  bool w_ = false;
+  std::uint8_t read_buffer_ = 0;
+  /// Last value written to any register, seen in the unused status bits.
+  std::uint8_t latch_ = 0;
+
+  /// v as it stood when the current line's first tiles were fetched.
+  std::uint16_t line_v_ = 0;
+  /// Fine X used for the current run of pixels.
+  std::uint8_t line_fine_x_ = 0;
+
+  /// Absolute PPU dot the PPU has reached.
+  std::uint64_t clock_ = 0;
+  int line_ = 0;
+  int dot_ = 0;
+  bool odd_frame_ = false;
+  std::uint64_t frames_ = 0;
+
+  bool headless_ = false;
+  bool frame_requested_ = false;
+  /// The current frame is being drawn.
+  bool drawing_ = true;
+
+  std::array<std::uint8_t*, 8> chr_{};
+  bool chr_writable_ = false;
+  std::array<std::uint8_t*, 4> nametables_{};
+  std::array<std::uint8_t, 0x1000> ciram_{};
+  std::array<std::uint8_t, 32> palette_{};
+  std::array<std::uint8_t, 256> oam_{};
+
+  /// Sprites of the current line, per pixel: colour (palette << 2 | pixel)
+  /// in the low bits, or 0 for none.
+  std::array<std::uint8_t, Width> sprites_{};
+  std::array<std::uint8_t, Width> next_sprites_{};
+  /// X of sprite 0 on the current and next line, or -1.
+  int zero_x_ = -1;
+  int next_zero_x_ = -1;
+  static constexpr std::uint8_t SpriteBehind = 0x20;
+  static constexpr std::uint8_t SpriteZero = 0x40;
+
+  std::array<std::uint8_t, Width * Height> frame_{};
+};
+
+}; // namespace emu
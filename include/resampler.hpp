@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+namespace emu {
+
+/// The resampler's inner loop, a dot product of 16-bit samples and 16-bit
+/// filter taps, in a scalar version and SIMD versions for x86 (SSE2 and
+/// AVX2). `count` is a multiple of 16. `best()` picks the widest one the
+/// host supports; all of them give identical results.
+struct FirKernels final {
+  const char* name;
+  std::int32_t (*dot)(const std::int16_t* samples, const std::int16_t* taps, size_t count);
+
+  static const FirKernels& best();
+  /// The variant called `name` ("scalar", "sse2", "avx2") if the host
+  /// supports it, else nullptr.
+  static const FirKernels* find(std::string_view name);
+};
+
+/// Converts audio made at a chip's native rate (a sample per clock or per
+/// few clocks, around 1-2 MHz) to an output rate such as 44.1 or 48 kHz.
+///
+/// A polyphase FIR: each output sample is one dot product of the input
+/// around its position with a windowed-sinc low-pass, taken from a table
+/// of phases by the fractional position. Input is taken a block at a time,
+/// typically a frame, and the whole block is turned into output at once.
+class Resampler final {
+public:
+  Resampler(double input_rate, int output_rate);
+
+  void set_kernels(const FirKernels& kernels) { kernels_ = &kernels; }
+  double input_rate() const { return input_rate_; }
+  int output_rate() const { return output_rate_; }
+
+  /// Resamples `count` input samples, appending the output to `out`.
+  void process(const std::int16_t* in, size_t count, std::vector<std::int16_t>& out);
+  /// Forgets past input.
+  void reset();
+
+private:
+  static constexpr int PhaseBits = 5;
+  static constexpr int FractionBits = 32;
+  static constexpr int TapBits = 15;
+
+  double input_rate_;
+  int output_rate_;
+  const FirKernels* kernels_ = &FirKernels::best();
+
+  /// Taps per phase, a multiple of 16.
+  size_t length_ = 0;
+  /// `1 << PhaseBits` phases of `length_` taps each.
+  std::vector<std::int16_t> taps_;
+  /// Input samples per output sample, 32.32 fixed point.
+  std::uint64_t step_ = 0;
+  /// Position of the next output sample's window in `input_`, 32.32.
+  std::uint64_t position_ = 0;
+  /// Input not consumed yet, starting with the next window.
+  std::vector<std::int16_t> input_;
+};
+
+}; // namespace emu
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <bus.hpp>
+#include <resampler.hpp>
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+namespace emu {
+
+struct CPU;
+class SnapshotReader;
+class SnapshotWriter;
+
+/// The C64's sound chip, a MOS 6581 SID, mapped at $D400-$D7FF: three
+/// voices with saw, triangle, pulse and noise waveforms, ADSR envelopes,
+/// ring modulation and hard sync, and a multimode filter.
+///
+/// The SID is caught up lazily. Its voices are stepped every 4 cycles
+/// rather than every cycle (a quarter of the clock is still far above
+/// audible frequencies), and each block of native samples is converted to
+/// the output rate by a `Resampler`. The filter is an idealized
+/// state-variable filter, not a model of the 6581's analog circuit, and
+/// combined waveforms are the AND of their parts.
+class Sid final : public Device {
+public:
+  Sid(CPU& cpu, double clock_rate);
+
+  /// Output sample rate; 44100 by default. Discards pending samples.
+  void set_sample_rate(int rate);
+  int sample_rate() const { return resampler_.output_rate(); }
+  /// The resampler's inner loop; `FirKernels::best()` by default.
+  void set_kernels(const FirKernels& kernels);
+
+  /// With audio off the oscillators and envelopes keep running, for the
+  /// OSC3 and ENV3 registers, but no waveforms are mixed, filtered or
+  /// resampled. On by default.
+  void set_audio(bool enabled);
+  bool audio() const { return audio_; }
+
+  void reset();
+  /// Saves or restores the SID's state, see snapshot.hpp. Samples not yet
+  /// read are discarded by a restore.
+  void save(SnapshotWriter& out) const;
+  void restore(SnapshotReader& in);
+
+  /// Brings the SID up to CPU cycle `cycle`.
+  void catch_up(std::uint64_t cycle);
+  void sync();
+
+  std::uint8_t read(std::uint16_t addr) override;
+  void write(std::uint16_t addr, std::uint8_t value) override;
+  std::uint8_t peek(std::uint16_t addr) override;
+
+  /// Samples produced up to the last catch-up. If they are not read, the
+  /// oldest are dropped once half a second has piled up.
+  size_t samples_available() const { return output_.size() - read_; }
+  size_t read_samples(std::int16_t* out, size_t max);
+
+private:
+  enum class Phase : std::uint8_t { Attack, DecaySustain, Release };
+
+  struct Voice final {
+    std::uint16_t frequency = 0;
+    std::uint16_t pulse_width = 0;
+    std::uint8_t control = 0;
+    std::uint8_t attack_decay = 0;
+    std::uint8_t sustain_release = 0;
+
+    std::uint32_t accumulator = 0;
+    std::uint32_t noise = 0x7FFFF8;
+    /// The accumulator's MSB rose in the last step, for hard sync.
+    bool msb_rising = false;
+
+    Phase phase = Phase::Release;
+    std::uint8_t envelope = 0;
+    std::uint16_t rate_counter = 0;
+    std::uint8_t exponential_counter = 0;
+
+    /// The 12-bit waveform output; `source` is the voice that modulates
+    /// this one (ring modulation and sync).
+    std::uint16_t waveform(const Voice& source) const;
+    void step_envelope(std::uint32_t cycles);
+    std::uint16_t rate_period() const;
+  };
+
+  template <typename Archive, typename Self> static void fields(Archive& archive, Self& self);
+  /// Advances the voices by one step of `Step` cycles.
+  void step_voices();
+  /// The mixed, filtered output of the current step.
+  std::int16_t mix();
+  /// Recomputes the filter coefficients from the cutoff and resonance.
+  void update_filter();
+
+  static constexpr std::uint32_t Step = 4;
+
+  CPU& cpu_;
+  /// Native sample rate, the clock rate over `Step`.
+  double native_rate_;
+  Resampler resampler_;
+  const FirKernels* kernels_ = &FirKernels::best();
+  bool audio_ = true;
+
+  Voice voices_[3];
+  std::uint16_t cutoff_ = 0;
+  std::uint8_t resonance_filter_ = 0;
+  std::uint8_t mode_volume_ = 0;
+  float frequency_ = 0;
+  float damping_ = 0;
+  float band_pass_ = 0;
+  float low_pass_ = 0;
+  /// Last value written, seen when reading write-only registers.
+  std::uint8_t bus_value_ = 0;
+
+  /// CPU cycle the SID has reached, and cycles since the last step.
+  std::uint64_t clock_ = 0;
+  std::uint32_t pending_ = 0;
+
+  std::vector<std::int16_t> native_;
+  std::vector<std::int16_t> output_;
+  size_t read_ = 0;
+};
+
+}; // namespace emu
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+namespace emu {
+
+/// Machine snapshots. Chips list the members that make up their state in
+/// one `fields(archive, self)` template, which serves both to save and to
+/// restore, so the two cannot drift apart. Values are stored as their raw
+/// bytes, so a snapshot is only valid for the build that wrote it.
+///
+/// The layout has a fixed size for a given machine and cartridge, so the
+/// size measured by a writer without a buffer also validates a snapshot
+/// before anything is restored.
+class SnapshotWriter final {
+public:
+  /// With a null `out` the writer only measures.
+  explicit SnapshotWriter(std::uint8_t* out) : out_(out) {}
+
+  void bytes(const void* data, size_t size) {
+    if (out_) std::memcpy(out_ + size_, data, size);
+    size_ += size;
+  }
+  template <typename T> void value(const T& value) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    bytes(&value, sizeof(value));
+  }
+  /// The contents only; the size is part of the machine's configuration.
+  void value(const std::vector<std::uint8_t>& value) { bytes(value.data(), value.size()); }
+  template <typename... T> void operator()(const T&... values) { (value(values), ...); }
+
+  size_t size() const { return size_; }
+
+private:
+  std::uint8_t* out_;
+  size_t size_ = 0;
+};
+
+class SnapshotReader final {
+public:
+  SnapshotReader(const std::uint8_t* in, size_t size) : in_(in), size_(size) {}
+
+  bool bytes(void* data, size_t size) {
+    if (size > size_ - at_) return false;
+    std::memcpy(data, in_ + at_, size);
+    at_ += size;
+    return true;
+  }
+  template <typename T> bool value(T& value) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    return bytes(&value, sizeof(value));
+  }
+  bool value(std::vector<std::uint8_t>& value) { return bytes(value.data(), value.size()); }
+  template <typename... T> bool operator()(T&... values) { return (value(values) && ...); }
+
+private:
+  const std::uint8_t* in_;
+  size_t size_;
+  size_t at_ = 0;
+};
+
+}; // namespace emu
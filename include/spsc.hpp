@@ -0,0 +1,101 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+namespace emu {
+
+/// Keeps the producer's and the consumer's indices on separate cache lines.
+inline constexpr size_t CacheLine = 64;
+
+/// A lock-free ring buffer between one producer thread and one consumer
+/// thread, such as the emulation thread and an audio callback. The storage
+/// is part of the object, so nothing is allocated after construction; the
+/// object itself is best allocated once, up front.
+///
+/// Indices only grow and are masked on access. Each side keeps a private
+/// copy of the other side's index and only reloads it (an acquire load)
+/// when the copy says the ring is full or empty.
+template <typename T, size_t Capacity>
+class SpscRing final {
+  static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0,
+                "capacity must be a power of two");
+
+public:
+  /// Producer: copies up to `count` items in; returns how many fit.
+  size_t write(const T* items, size_t count) {
+    const size_t head = head_.load(std::memory_order_relaxed);
+    if (Capacity - (head - cached_tail_) < count) {
+      cached_tail_ = tail_.load(std::memory_order_acquire);
+    }
+    const size_t n = std::min(count, Capacity - (head - cached_tail_));
+    for (size_t i = 0; i < n; ++i) items_[(head + i) & (Capacity - 1)] = items[i];
+    head_.store(head + n, std::memory_order_release);
+    return n;
+  }
+
+  /// Consumer: copies up to `count` items out; returns how many there were.
+  size_t read(T* items, size_t count) {
+    const size_t tail = tail_.load(std::memory_order_relaxed);
+    if (cached_head_ - tail < count) cached_head_ = head_.load(std::memory_order_acquire);
+    const size_t n = std::min(count, cached_head_ - tail);
+    for (size_t i = 0; i < n; ++i) items[i] = items_[(tail + i) & (Capacity - 1)];
+    tail_.store(tail + n, std::memory_order_release);
+    return n;
+  }
+
+  /// Items waiting; exact only when called by one side with the other idle.
+  size_t size() const {
+    return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire);
+  }
+  static constexpr size_t capacity() { return Capacity; }
+
+private:
+  alignas(CacheLine) std::atomic<size_t> head_{0};
+  size_t cached_tail_ = 0;
+  alignas(CacheLine) std::atomic<size_t> tail_{0};
+  size_t cached_head_ = 0;
+  alignas(CacheLine) std::array<T, Capacity> items_{};
+};
+
+/// Hands whole frames (pictures, blocks of samples) from one producer
+/// thread to one consumer thread through a fixed set of preallocated slots.
+/// Frames are filled and read in place, without copies or allocation.
+///
+/// The producer asks for a slot with `begin_write`, fills it and publishes
+/// it with `end_write`. When all slots are taken `begin_write` returns
+/// nullptr and the producer decides: drop the frame (video) or wait.
+/// The consumer likewise uses `begin_read` and `end_read`.
+template <typename Frame, size_t Slots>
+class FrameQueue final {
+  static_assert(Slots > 0 && (Slots & (Slots - 1)) == 0, "slots must be a power of two");
+
+public:
+  /// Producer: the slot to fill next, or nullptr if none is free.
+  Frame* begin_write() {
+    const size_t head = head_.load(std::memory_order_relaxed);
+    if (head - tail_.load(std::memory_order_acquire) == Slots) return nullptr;
+    return &slots_[head & (Slots - 1)];
+  }
+  /// Producer: publishes the slot returned by `begin_write`.
+  void end_write() { head_.store(head_.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+  /// Consumer: the oldest published frame, or nullptr if there is none.
+  const Frame* begin_read() {
+    const size_t tail = tail_.load(std::memory_order_relaxed);
+    if (head_.load(std::memory_order_acquire) == tail) return nullptr;
+    return &slots_[tail & (Slots - 1)];
+  }
+  /// Consumer: returns the frame from `begin_read` to the producer.
+  void end_read() { tail_.store(tail_.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+private:
+  alignas(CacheLine) std::atomic<size_t> head_{0};
+  alignas(CacheLine) std::atomic<size_t> tail_{0};
+  alignas(CacheLine) std::array<Frame, Slots> slots_{};
+};
+
+}; // namespace emu
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstddef>
+#include <iosfwd>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace emu {
+
+/// Guest symbols by CPU address, loaded from ld65 debug info (`--dbgfile`)
+/// or VICE label files (`al C:080d .start`).
+///
+/// Labels form an interval index: a label covers its `.proc` or declared
+/// size, or else everything up to the next label. `find` returns the
+/// innermost label containing an address with a binary search inside one
+/// 256-byte page of a flat start array, so it is cheap enough to resolve
+/// every record of a long trace. Equates (hardware registers, constants)
+/// are only matched exactly, by `at`.
+class SymbolTable final {
+public:
+  /// Detects the format from the first line.
+  bool load(std::istream& in, std::string& error);
+  bool load_dbg(std::istream& in, std::string& error);
+  bool load_vice(std::istream& in, std::string& error);
+
+  /// Adds a label, or an equate when `equate` is set. A `size` of 0 means
+  /// unknown. Call `index` once done adding; the loaders do so themselves.
+  void add(std::uint16_t addr, std::string_view name, std::uint32_t size = 0,
+           bool equate = false);
+  void index();
+
+  bool empty() const { return labels_.empty() && equates_.empty(); }
+  size_t size() const { return labels_.size() + equates_.size(); }
+
+  /// Innermost label containing `addr`, or -1.
+  std::int32_t find(std::uint16_t addr) const;
+  const char* name(std::int32_t label) const {
+    return names_.data() + labels_[static_cast<size_t>(label)].name;
+  }
+  std::uint16_t start(std::int32_t label) const {
+    return static_cast<std::uint16_t>(starts_[static_cast<size_t>(label)]);
+  }
+
+  /// Name of the label, or failing that the equate, at exactly `addr`.
+  const char* at(std::uint16_t addr) const;
+
+  /// Looks a label or equate up by name; linear, meant for user input.
+  bool address_of(std::string_view name, std::uint16_t& out) const;
+
+  /// Formats `addr` as `name` or `name+offset`, or `$addr` without a label.
+  std::string describe(std::uint16_t addr) const;
+
+private:
+  struct Label final {
+    std::uint32_t end;
+    std::int32_t parent;
+    std::uint32_t name;
+  };
+  struct Equate final {
+    std::uint16_t addr;
+    std::uint32_t name;
+  };
+  struct Pending final {
+    std::uint32_t start;
+    std::uint32_t size;
+    std::uint32_t name;
+  };
+
+  std::uint32_t intern(std::string_view name);
+
+  /// Names, each terminated by '\0'.
+  std::string names_;
+  std::vector<Pending> pending_;
+  /// Sorted by start, containers before what they contain. Starts are kept
+  /// apart from the rest so the search touches as few cache lines as
+  /// possible.
+  std::vector<std::uint32_t> starts_;
+  std::vector<Label> labels_;
+  /// First label starting in each page; the last entry is labels_.size().
+  std::array<std::uint32_t, 257> page_first_{};
+  /// Sorted by address.
+  std::vector<Equate> equates_;
+};
+
+}; // namespace emu
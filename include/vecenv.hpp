@@ -0,0 +1,96 @@
+#pragma once
+
+#include <nes.hpp>
+
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace emu {
+
+/// Many NES instances running the same cartridge, stepped together as one
+/// vectorised environment for reinforcement learning. One `step` call
+/// takes every instance's controller from a contiguous array and writes
+/// every observation, reward and end-of-episode flag into contiguous
+/// buffers owned by the caller, so a step costs no allocation and one
+/// call, however many instances there are.
+///
+/// An observation is the configured RAM slices followed, when
+/// `downscale` is set, by the last frame of the step as 8-bit luminance,
+/// averaged over `downscale` x `downscale` blocks. Only that frame is
+/// drawn; the others run headless. The reward is the weighted change of
+/// values read from RAM, such as the score, over the step.
+///
+/// Every episode starts from the state one frame after power-on, restored
+/// in place from a snapshot. An instance whose episode ends restarts at
+/// once, and its observation is the first of the new episode; its reward
+/// and flag still report the step that ended the old one.
+class VectorEnv final {
+public:
+  /// Consecutive CPU addresses copied into the observation.
+  struct RamSlice final {
+    std::uint16_t address = 0;
+    std::uint16_t size = 0;
+  };
+  /// A value of up to 4 bytes, little endian, in binary or with two BCD
+  /// digits per byte.
+  struct RewardTerm final {
+    std::uint16_t address = 0;
+    std::uint8_t size = 1;
+    bool bcd = false;
+    float weight = 1.0f;
+  };
+  struct Config final {
+    size_t count = 1;
+    /// Frames each action is held for.
+    unsigned frameskip = 4;
+    /// Frame observation block size, dividing 256 and 240; 0 for none.
+    unsigned downscale = 0;
+    std::vector<RamSlice> slices;
+    std::vector<RewardTerm> rewards;
+    /// The episode ends when the byte at `done_address` masked with
+    /// `done_mask` equals `done_value`.
+    bool done_test = false;
+    std::uint16_t done_address = 0;
+    std::uint8_t done_mask = 0xFF;
+    std::uint8_t done_value = 0;
+  };
+
+  /// Creates the instances and starts their first episodes.
+  bool load(std::vector<std::uint8_t> ines, Config config, std::string& error);
+
+  size_t size() const { return instances_.size(); }
+  /// Bytes of one observation; instance `i` writes at `i * observation_size()`.
+  size_t observation_size() const { return ram_bytes_ + frame_width() * frame_height(); }
+  size_t frame_width() const { return config_.downscale ? Ppu::Width / config_.downscale : 0; }
+  size_t frame_height() const { return config_.downscale ? Ppu::Height / config_.downscale : 0; }
+
+  /// Restarts every instance and writes the first observations.
+  void reset(std::uint8_t* observations);
+  /// Runs every instance for `frameskip` frames with its controller set to
+  /// `buttons[i]` (`Nes::Button` bits).
+  void step(const std::uint8_t* buttons, std::uint8_t* observations, float* rewards,
+            std::uint8_t* dones);
+
+  Nes& instance(size_t index) { return *instances_[index]; }
+
+private:
+  /// Puts the instance back at the start of an episode.
+  void restart(size_t index);
+  void observe(size_t index, std::uint8_t* out);
+  double value(Nes& nes, const RewardTerm& term) const;
+  double score(size_t index);
+
+  Config config_;
+  /// The state episodes start from; the snapshot leaves out the CPU.
+  std::vector<std::uint8_t> start_;
+  CPU start_cpu_;
+  std::vector<std::unique_ptr<Nes>> instances_;
+  /// Each instance's last reward values, `config_.rewards.size()` apiece.
+  std::vector<double> values_;
+  size_t ram_bytes_ = 0;
+};
+
+}; // namespace emu
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <bus.hpp>
+
+#include <cstdint>
+#include <cstddef>
+
+namespace emu {
+
+struct CPU;
+class Via;
+
+/// What is wired to a VIA's two 8-bit ports.
+class ViaPorts {
+public:
+  virtual ~ViaPorts() = default;
+  /// Value seen on `port` (0 = A, 1 = B) when the VIA drives `output`.
+  virtual std::uint8_t read_port(const Via& via, int port, std::uint8_t output) = 0;
+  /// Called when the VIA changes what it drives on `port`.
+  virtual void write_port(const Via& via, int port, std::uint8_t output) = 0;
+};
+
+/// A MOS 6522 versatile interface adapter: two I/O ports with the CA1/CA2
+/// and CB1/CB2 control lines, two 16-bit timers and an interrupt flag and
+/// enable register, wired to the CPU's IRQ.
+///
+/// Caught up lazily like `Cia`: the timers are advanced arithmetically and
+/// `next_event` gives the cycle of the next interrupt. The shift register,
+/// timer 2's pulse counting mode, PB7 output from timer 1 and the
+/// handshake modes of CA2/CB2 are not emulated.
+class Via final : public Device {
+public:
+  /// `irq_source` is the `CPU::irq_lines` bit the VIA drives.
+  Via(CPU& cpu, ViaPorts& ports, std::uint8_t irq_source);
+
+  void reset();
+
+  /// Brings the VIA up to CPU cycle `cycle`.
+  void catch_up(std::uint64_t cycle);
+  void sync();
+  /// CPU cycle of the next interrupt the VIA will raise, or UINT64_MAX.
+  std::uint64_t next_event() const;
+
+  /// What the VIA drives on `port`: the output register, inputs pulled high.
+  std::uint8_t port_output(int port) const {
+    return static_cast<std::uint8_t>(output_[port] | ~ddr_[port]);
+  }
+  /// Drives the CA1 input; the active edge, chosen by the PCR, sets its
+  /// interrupt flag.
+  void set_ca1(bool level);
+  /// Levels of CA2 and CB2 in their manual output modes; high otherwise.
+  bool ca2() const { return (pcr_ & 0x0E) != 0x0C; }
+  bool cb2() const { return (pcr_ & 0xE0) != 0xC0; }
+
+  std::uint8_t read(std::uint16_t addr) override;
+  void write(std::uint16_t addr, std::uint8_t value) override;
+  std::uint8_t peek(std::uint16_t addr) override;
+
+private:
+  void raise(std::uint8_t flags);
+  void clear(std::uint8_t flags);
+
+  CPU& cpu_;
+  ViaPorts& ports_;
+  std::uint8_t irq_source_;
+
+  std::uint8_t output_[2] = {};
+  std::uint8_t ddr_[2] = {};
+  std::uint8_t acr_ = 0;
+  std::uint8_t pcr_ = 0;
+  std::uint8_t sr_ = 0;
+  std::uint8_t ifr_ = 0;
+  std::uint8_t ier_ = 0;
+  bool ca1_ = false;
+
+  /// Timer 1 underflows after `t1_ + 1` cycles, shows $FFFF for one cycle
+  /// and then reloads from its latch; timer 2 wraps around. An armed timer
+  /// raises its interrupt on the next underflow (timer 1 on every one when
+  /// free running).
+  std::uint16_t t1_ = 0xFFFF;
+  std::uint16_t t1_latch_ = 0xFFFF;
+  bool t1_armed_ = false;
+  /// Timer 1 has underflowed and loads its latch on the next cycle.
+  bool t1_reload_ = false;
+  std::uint16_t t2_ = 0xFFFF;
+  std::uint8_t t2_latch_low_ = 0xFF;
+  bool t2_armed_ = false;
+
+  std::uint64_t clock_ = 0;
+};
+
+}; // namespace emu
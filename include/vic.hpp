@@ -0,0 +1,153 @@
+#pragma once
+
+#include <bus.hpp>
+
+#include <array>
+#include <cstdint>
+#include <cstddef>
+
+namespace emu {
+
+struct CPU;
+class SnapshotReader;
+class SnapshotWriter;
+
+/// The C64's video chip, a MOS 6569 VIC-II (PAL), mapped at $D000-$D3FF.
+///
+/// The VIC-II is caught up lazily like the NES PPU, a raster line at a
+/// time: a line is split only at the cycles where the chip's state changes
+/// (the badline fetch at cycle 14, sprite DMA at 55, the row counter at 58)
+/// and at register accesses, and the pixels in between are produced as one
+/// run. Cycles the VIC-II takes from the CPU are charged at the point they
+/// start: 43 at cycle 12 of a badline, and 3 plus 2 per sprite at cycle 55
+/// of a line whose next line shows sprites. `next_event` reports those
+/// points and the raster IRQ, so the machine stops the CPU there.
+///
+/// Timing is taken at the start of the accessing instruction. Badlines
+/// forced or cancelled in the middle of a line take effect on the next
+/// line; the light pen and sprite crunching are not emulated.
+class Vic final : public Device {
+public:
+  static constexpr int CyclesPerLine = 63;
+  static constexpr int LinesPerFrame = 312;
+  /// The visible picture, borders included.
+  static constexpr int Width = 384;
+  static constexpr int Height = 272;
+  static constexpr int FirstLine = 15;
+  /// Bit of `CPU::irq_lines` the VIC-II drives.
+  static constexpr std::uint8_t Irq = 0x02;
+
+  explicit Vic(CPU& cpu);
+
+  /// What the VIC-II sees: 64K of RAM, the character ROM (visible at
+  /// $1000-$1FFF of banks 0 and 2) and the 1K of colour RAM.
+  void set_memory(const std::uint8_t* ram, const std::uint8_t* chargen,
+                  const std::uint8_t* color_ram);
+  /// The 16K bank, 0-3, selected by CIA 2; call `sync` first.
+  void set_bank(int bank) { bank_ = bank & 3; }
+
+  /// See `Ppu::set_headless`: frames are not drawn unless requested, but
+  /// lines with sprites are still rendered off-screen for the collisions.
+  void set_headless(bool headless) { headless_ = headless; }
+  bool headless() const { return headless_; }
+  void request_frame() { frame_requested_ = true; }
+
+  /// Saves or restores the VIC-II's state, see snapshot.hpp.
+  void save(SnapshotWriter& out) const;
+  void restore(SnapshotReader& in);
+
+  /// Brings the VIC-II up to CPU cycle `cycle`.
+  void catch_up(std::uint64_t cycle);
+  void sync();
+  /// CPU cycle of the next raster IRQ or cycle stealing, or UINT64_MAX.
+  std::uint64_t next_event() const;
+  /// CPU cycle at which the next frame starts (raster line 0).
+  std::uint64_t next_frame() const;
+
+  std::uint8_t read(std::uint16_t addr) override;
+  void write(std::uint16_t addr, std::uint8_t value) override;
+  std::uint8_t peek(std::uint16_t addr) override;
+
+  /// The picture as colour indices 0-15, one byte per pixel.
+  const std::uint8_t* frame() const { return frame_.data(); }
+  std::uint64_t frame_count() const { return frames_; }
+  int raster() const { return line_; }
+
+  /// The 16 colours as 0xRRGGBB.
+  static const std::array<std::uint32_t, 16> Palette;
+
+private:
+  struct Sprite final {
+    bool dma = false;
+    /// Shown on the current line, with `data` as its 24 pixels.
+    bool shown = false;
+    /// With Y expansion, the current row is shown a second time.
+    bool repeat = false;
+    std::uint8_t base = 0;
+    std::uint32_t data = 0;
+  };
+
+  template <typename Archive, typename Self> static void fields(Archive& archive, Self& self);
+  std::uint8_t vic_read(std::uint16_t addr) const;
+  bool badline(int line) const;
+  /// Executes cycles [from, to) of the current line.
+  void run_line(int from, int to);
+  void start_line();
+  void fetch_row();
+  void update_row_counter();
+  void update_sprites();
+  /// Produces the pixels of cycles [from, to) of the current line.
+  void render(int from, int to);
+  /// Decodes the graphics of column `column` into `graphics_` and
+  /// `foreground_` at screen x `x`.
+  void decode_column(int column, int x);
+  void draw_sprites(int x0, int x1, std::uint8_t* out);
+  void raise(std::uint8_t flags);
+  /// The cycle `cycle` of the line `lines` lines from the current one.
+  std::uint64_t line_cycle(int lines, int cycle) const {
+    return clock_ - cycle_ + static_cast<std::uint64_t>(lines) * CyclesPerLine + cycle;
+  }
+
+  CPU& cpu_;
+  const std::uint8_t* ram_ = nullptr;
+  const std::uint8_t* chargen_ = nullptr;
+  const std::uint8_t* color_ram_ = nullptr;
+  int bank_ = 0;
+
+  std::array<std::uint8_t, 0x40> regs_{};
+  std::uint16_t compare_ = 0;
+  std::uint8_t irq_flags_ = 0;
+  std::uint8_t sprite_sprite_ = 0;
+  std::uint8_t sprite_background_ = 0;
+
+  /// CPU cycle the VIC-II has reached, and where that is in the frame.
+  std::uint64_t clock_ = 0;
+  int line_ = 0;
+  int cycle_ = 0;
+  std::uint64_t frames_ = 0;
+
+  // The display logic, with the names of the VIC-II article: video counter
+  // and its base, row counter, display (vs idle) state.
+  std::uint16_t vc_base_ = 0;
+  std::uint8_t rc_ = 0;
+  bool display_ = false;
+  bool den_latched_ = false;
+  bool vertical_border_ = true;
+  std::array<std::uint8_t, 40> matrix_{};
+  std::array<std::uint8_t, 40> colors_{};
+  Sprite sprites_[8];
+
+  bool headless_ = false;
+  bool frame_requested_ = false;
+  bool drawing_ = true;
+  /// The current line is rendered, to the frame or off-screen.
+  bool rendering_ = false;
+
+  /// Graphics of the current line by screen x: colour and foreground.
+  std::array<std::uint8_t, Width + 16> graphics_{};
+  std::array<std::uint8_t, Width + 16> foreground_{};
+  std::array<std::uint8_t, Width> scratch_{};
+  std::array<std::uint8_t, Width * Height> frame_{};
+};
+
+}; // namespace emu
@@ -0,0 +1,533 @@
+#include <analysis.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+namespace emu {
+
+namespace {
+
+/// Calls `fn(i)` for every i below `n` on up to `threads` threads.
+template <typename Fn>
+void parallel_for(size_t n, unsigned threads, Fn&& fn) {
+  threads = static_cast<unsigned>(std::min<size_t>(threads, n));
+  if (threads <= 1) {
+    for (size_t i = 0; i < n; ++i) fn(i);
+    return;
+  }
+  std::atomic<size_t> next{0};
+  std::vector<std::thread> pool;
+  for (unsigned t = 0; t < threads; ++t) {
+    pool.emplace_back([&] {
+      for (size_t i; (i = next.fetch_add(1)) < n;) fn(i);
+    });
+  }
+  for (auto& thread : pool) thread.join();
+}
+
+bool ends_block(Op op) {
+  return ends_flow(op) || is_branch(op) || op == Op::JSR;
+}
+
+/// What the tracer knows about a register's value within a straight run of
+/// instructions.
+struct Value final {
+  enum class Kind : std::uint8_t { Unknown, Immediate, Table };
+  Kind kind = Kind::Unknown;
+  /// The immediate, or the base address of the indexed table it was loaded
+  /// from.
+  std::uint16_t value = 0;
+};
+
+/// Traces one bank. Only reads the image outside its own bank, so tracers
+/// of different banks can run concurrently.
+class Tracer final {
+public:
+  Tracer(const RomLayout& layout, const std::vector<BankAnalysis>& banks,
+         BankAnalysis& out)
+      : layout_(layout), banks_(banks), out_(out),
+        bytes_(layout.image + static_cast<size_t>(out.bank) * bank_size(layout)),
+        kinds_(out.size, Kind::Data), leaders_(out.size, 0) {
+    rom_start_ = 0x10000;
+    for (const BankAnalysis& bank : banks) {
+      rom_start_ = std::min<std::uint32_t>(rom_start_, bank.org);
+    }
+  }
+
+  static size_t bank_size(const RomLayout& layout) {
+    return layout.bank_size ? layout.bank_size : layout.size;
+  }
+
+  /// Queues `addr` for tracing. Returns whether it was new.
+  bool seed(std::uint16_t addr, bool function) {
+    if (!out_.contains(addr)) return false;
+    std::uint8_t& leader = leaders_[addr - out_.org];
+    const std::uint8_t flags = Leader | (function ? Entry : 0);
+    if ((leader & flags) == flags) return false;
+    leader |= flags;
+    work_.push_back(addr);
+    return true;
+  }
+
+  void trace() {
+    while (!work_.empty()) {
+      const std::uint16_t entry = work_.back();
+      work_.pop_back();
+      trace_run(entry);
+    }
+  }
+
+  void finish() {
+    build_blocks();
+    build_functions();
+    classify_writes();
+  }
+
+private:
+  enum class Kind : std::uint8_t { Data, Code, Operand };
+  enum : std::uint8_t { Leader = 1, Entry = 2 };
+
+  /// Reads a byte of whichever bank is mapped at `addr` for certain: this
+  /// one, or the fixed bank.
+  bool read(std::uint16_t addr, std::uint8_t& out) const {
+    if (out_.contains(addr)) {
+      out = bytes_[addr - out_.org];
+      return true;
+    }
+    if (!layout_.fixed_last) return false;
+    const BankAnalysis& fixed = banks_.back();
+    if (!fixed.contains(addr)) return false;
+    out = layout_.image[static_cast<size_t>(fixed.bank) * bank_size(layout_) + (addr - fixed.org)];
+    return true;
+  }
+
+  bool mapped(std::uint16_t addr) const {
+    std::uint8_t byte;
+    return read(addr, byte);
+  }
+
+  void target(const Instruction& instr, std::uint16_t addr, bool call) {
+    if (out_.contains(addr)) {
+      seed(addr, call);
+    } else {
+      out_.external.push_back({instr.addr, addr, call, bank_});
+    }
+  }
+
+  void trace_run(std::uint16_t addr) {
+    a_ = x_ = y_ = Value{};
+    pushes_[0] = pushes_[1] = Value{};
+    num_stores_ = 0;
+    bank_ = -1;
+
+    while (out_.contains(addr) && kinds_[addr - out_.org] == Kind::Data) {
+      const size_t offset = addr - out_.org;
+      Instruction instr;
+      if (!decode(bytes_ + offset, out_.size - offset, addr, instr)) break;
+      bool overlaps = false;
+      for (size_t i = 1; i < instr.length; ++i) {
+        overlaps |= kinds_[offset + i] != Kind::Data;
+      }
+      if (overlaps) break;
+
+      kinds_[offset] = Kind::Code;
+      for (size_t i = 1; i < instr.length; ++i) kinds_[offset + i] = Kind::Operand;
+
+      const OpInfo& info = instr.info();
+      if (info.op == Op::ILL || info.op == Op::BRK) break;
+      if (instr.has_target()) target(instr, instr.target(), info.op == Op::JSR);
+      if (info.op == Op::RTS) dispatch_rts(instr);
+      if (info.op == Op::JMP && info.mode == Mode::Indirect) dispatch_indirect(instr);
+      if (ends_flow(info.op)) break;
+      track(instr);
+
+      addr = static_cast<std::uint16_t>(addr + instr.length);
+      if (addr < instr.addr) break;
+      // Whatever follows a block end starts a block of its own.
+      if (ends_block(info.op) && out_.contains(addr)) leaders_[addr - out_.org] |= Leader;
+    }
+  }
+
+  /// Follows register values through loads, transfers and stores, enough
+  /// to recognize jump table dispatches and mapper writes.
+  void track(const Instruction& instr) {
+    const OpInfo& info = instr.info();
+    const auto load = [&](Value& reg) {
+      if (info.mode == Mode::Immediate) {
+        reg = {Value::Kind::Immediate, instr.operand};
+      } else if (info.mode == Mode::AbsoluteX || info.mode == Mode::AbsoluteY) {
+        reg = {Value::Kind::Table, instr.operand};
+      } else {
+        reg = {};
+      }
+    };
+    const auto store = [&](const Value& reg) {
+      if (info.mode == Mode::ZeroPage || info.mode == Mode::Absolute) {
+        stores_[num_stores_++ % MaxStores] = {instr.operand, reg};
+      }
+      if (info.mode == Mode::IndirectX || info.mode == Mode::IndirectY) return;
+      writes_.push_back({instr.addr, instr.operand,
+                         reg.kind == Value::Kind::Immediate
+                             ? static_cast<std::int16_t>(reg.value & 0xFF)
+                             : std::int16_t{-1}});
+      if (!layout_.writable && instr.operand >= rom_start_ &&
+          reg.kind == Value::Kind::Immediate && (reg.value & 0xFF) < banks_.size()) {
+        bank_ = reg.value & 0xFF;
+      }
+    };
+
+    switch (info.op) {
+    case Op::LDA: load(a_); break;
+    case Op::LDX: load(x_); break;
+    case Op::LDY: load(y_); break;
+    case Op::TAX: x_ = a_; break;
+    case Op::TAY: y_ = a_; break;
+    case Op::TXA: a_ = x_; break;
+    case Op::TYA: a_ = y_; break;
+    case Op::STA: store(a_); break;
+    case Op::STX: store(x_); break;
+    case Op::STY: store(y_); break;
+    case Op::PHA:
+      pushes_[0] = pushes_[1];
+      pushes_[1] = a_;
+      break;
+    case Op::JSR:
+      a_ = x_ = y_ = Value{};
+      pushes_[0] = pushes_[1] = Value{};
+      break;
+    case Op::INX: case Op::DEX: case Op::TSX: x_ = {}; break;
+    case Op::INY: case Op::DEY: y_ = {}; break;
+    case Op::ADC: case Op::SBC: case Op::AND: case Op::ORA: case Op::EOR:
+    case Op::PLA:
+      a_ = {};
+      break;
+    case Op::ASL: case Op::LSR: case Op::ROL: case Op::ROR:
+      if (info.mode == Mode::Accumulator) a_ = {};
+      else store(Value{});
+      break;
+    case Op::INC: case Op::DEC:
+      store(Value{});
+      break;
+    default:
+      break;
+    }
+  }
+
+  const Value* stored(std::uint16_t addr) const {
+    // Newest first.
+    for (size_t i = 0; i < std::min(num_stores_, MaxStores); ++i) {
+      const Store& entry = stores_[(num_stores_ - 1 - i) % MaxStores];
+      if (entry.addr == addr) return &entry.value;
+    }
+    return nullptr;
+  }
+
+  /// `LDA hi,X / PHA / LDA lo,X / PHA / RTS`, or the same with immediates.
+  void dispatch_rts(const Instruction& instr) {
+    dispatch(instr, pushes_[1], pushes_[0], true);
+  }
+
+  /// `LDA lo,X / STA ptr / LDA hi,X / STA ptr+1 / JMP (ptr)`.
+  void dispatch_indirect(const Instruction& instr) {
+    const Value* low = stored(instr.operand);
+    const Value* high = stored(static_cast<std::uint16_t>(instr.operand + 1));
+    if (low && high) dispatch(instr, *low, *high, false);
+  }
+
+  void dispatch(const Instruction& instr, const Value& low, const Value& high,
+                bool minus_one) {
+    JumpTable table;
+    table.dispatch = instr.addr;
+    table.minus_one = minus_one;
+    const auto add = [&](std::uint8_t lo, std::uint8_t hi) {
+      const auto addr = static_cast<std::uint16_t>((lo | hi << 8) + (minus_one ? 1 : 0));
+      table.targets.push_back(addr);
+    };
+
+    if (low.kind == Value::Kind::Immediate && high.kind == Value::Kind::Immediate) {
+      add(static_cast<std::uint8_t>(low.value), static_cast<std::uint8_t>(high.value));
+    } else if (low.kind == Value::Kind::Table && high.kind == Value::Kind::Table) {
+      table.low = low.value;
+      table.high = high.value;
+      // Word tables are indexed with a doubled index.
+      const unsigned stride = high.value == low.value + 1 ? 2 : 1;
+      for (unsigned i = 0; i < 256 / stride; ++i) {
+        const auto lo_addr = static_cast<std::uint16_t>(low.value + i * stride);
+        const auto hi_addr = static_cast<std::uint16_t>(high.value + i * stride);
+        // A table of low bytes ends where the high bytes begin, and tables
+        // end where code begins.
+        if (stride == 1 && i > 0 && (lo_addr == high.value || hi_addr == low.value)) break;
+        if (is_code(lo_addr) || is_code(hi_addr)) break;
+        std::uint8_t lo, hi;
+        if (!read(lo_addr, lo) || !read(hi_addr, hi)) break;
+        const auto addr = static_cast<std::uint16_t>((lo | hi << 8) + (minus_one ? 1 : 0));
+        if (!plausible(addr)) break;
+        add(lo, hi);
+      }
+    } else {
+      return;
+    }
+    if (table.targets.empty()) return;
+    for (const std::uint16_t addr : table.targets) target(instr, addr, false);
+    out_.jump_tables.push_back(std::move(table));
+  }
+
+  bool is_code(std::uint16_t addr) const {
+    return out_.contains(addr) && kinds_[addr - out_.org] != Kind::Data;
+  }
+
+  /// A jump table entry must point into mapped code that does not start
+  /// with an undocumented opcode.
+  bool plausible(std::uint16_t addr) const {
+    if (!mapped(addr) && !layout_.writable) return false;
+    if (!out_.contains(addr)) return mapped(addr);
+    const Kind kind = kinds_[addr - out_.org];
+    if (kind == Kind::Operand) return false;
+    return kind == Kind::Code || OpTable[bytes_[addr - out_.org]].op != Op::ILL;
+  }
+
+  void build_blocks() {
+    std::sort(out_.jump_tables.begin(), out_.jump_tables.end(),
+              [](const JumpTable& a, const JumpTable& b) { return a.dispatch < b.dispatch; });
+
+    size_t offset = 0;
+    while (offset < out_.size) {
+      if (kinds_[offset] != Kind::Code) {
+        ++offset;
+        continue;
+      }
+      BasicBlock block;
+      block.start = static_cast<std::uint16_t>(out_.org + offset);
+      block.first_successor = static_cast<std::uint32_t>(out_.successors.size());
+      while (true) {
+        Instruction instr;
+        decode(bytes_ + offset, out_.size - offset,
+               static_cast<std::uint16_t>(out_.org + offset), instr);
+        const size_t next = offset + instr.length;
+        const bool falls_through = next < out_.size && kinds_[next] == Kind::Code;
+        const Op op = instr.info().op;
+        if (!ends_block(op) && falls_through && !(leaders_[next] & Leader)) {
+          offset = next;
+          continue;
+        }
+
+        block.last = instr.addr;
+        block.end = static_cast<std::uint32_t>(out_.org + next);
+        const auto successor = [&](std::uint16_t addr) { out_.successors.push_back(addr); };
+        const auto next_addr = static_cast<std::uint16_t>(out_.org + next);
+        if (is_branch(op)) {
+          block.exit = BasicBlock::Exit::Branch;
+          successor(instr.target());
+          if (falls_through) successor(next_addr);
+        } else if (op == Op::JSR) {
+          block.exit = BasicBlock::Exit::Call;
+          successor(instr.target());
+          if (falls_through) successor(next_addr);
+        } else if (op == Op::JMP && instr.info().mode == Mode::Absolute) {
+          block.exit = BasicBlock::Exit::Jump;
+          successor(instr.target());
+        } else if (op == Op::JMP || op == Op::RTS) {
+          const JumpTable* table = table_at(instr.addr);
+          block.exit = table || op == Op::JMP ? BasicBlock::Exit::Dispatch
+                                              : BasicBlock::Exit::Return;
+          if (table) {
+            for (const std::uint16_t addr : table->targets) successor(addr);
+          }
+        } else if (op == Op::RTI) {
+          block.exit = BasicBlock::Exit::Return;
+        } else if (op == Op::BRK || op == Op::ILL) {
+          block.exit = BasicBlock::Exit::Halt;
+        } else {
+          block.exit = BasicBlock::Exit::Fallthrough;
+          if (falls_through) successor(next_addr);
+        }
+        block.num_successors =
+            static_cast<std::uint32_t>(out_.successors.size()) - block.first_successor;
+        offset = next;
+        break;
+      }
+      out_.blocks.push_back(block);
+    }
+  }
+
+  const JumpTable* table_at(std::uint16_t addr) const {
+    const auto it = std::lower_bound(
+        out_.jump_tables.begin(), out_.jump_tables.end(), addr,
+        [](const JumpTable& table, std::uint16_t a) { return table.dispatch < a; });
+    return it != out_.jump_tables.end() && it->dispatch == addr ? &*it : nullptr;
+  }
+
+  std::int32_t block_index(std::uint16_t addr) const {
+    const BasicBlock* block = out_.block_at(addr);
+    return block ? static_cast<std::int32_t>(block - out_.blocks.data()) : -1;
+  }
+
+  /// Walks every function depth first without entering callees; edges back
+  /// to a block on the walk's stack are loops.
+  void build_functions() {
+    std::vector<std::uint32_t> visited(out_.blocks.size(), 0);
+    std::vector<std::uint8_t> on_stack(out_.blocks.size(), 0);
+    std::vector<std::pair<std::int32_t, std::uint32_t>> stack;
+
+    for (size_t offset = 0; offset < out_.size; ++offset) {
+      if (!(leaders_[offset] & Entry) || kinds_[offset] != Kind::Code) continue;
+      const std::int32_t entry = block_index(static_cast<std::uint16_t>(out_.org + offset));
+      if (entry < 0) continue;
+
+      Function function;
+      function.entry = static_cast<std::uint16_t>(out_.org + offset);
+      const auto index = static_cast<std::int32_t>(out_.functions.size());
+      const auto stamp = static_cast<std::uint32_t>(index + 1);
+      const auto enter = [&](std::int32_t block) {
+        visited[static_cast<size_t>(block)] = stamp;
+        on_stack[static_cast<size_t>(block)] = 1;
+        stack.push_back({block, 0});
+        BasicBlock& b = out_.blocks[static_cast<size_t>(block)];
+        if (b.function < 0) b.function = index;
+        ++function.num_blocks;
+        if (b.exit == BasicBlock::Exit::Call) ++function.num_calls;
+      };
+
+      enter(entry);
+      while (!stack.empty()) {
+        auto& [block, next] = stack.back();
+        const BasicBlock& b = out_.blocks[static_cast<size_t>(block)];
+        // The callee of a call belongs to another function.
+        const std::uint32_t first = b.exit == BasicBlock::Exit::Call ? 1 : 0;
+        if (next < first) next = first;
+        if (next >= b.num_successors) {
+          on_stack[static_cast<size_t>(block)] = 0;
+          stack.pop_back();
+          continue;
+        }
+        const std::uint16_t addr = out_.successors[b.first_successor + next++];
+        const std::int32_t succ = block_index(addr);
+        if (succ < 0) continue;
+        if (visited[static_cast<size_t>(succ)] != stamp) {
+          enter(succ);
+        } else if (on_stack[static_cast<size_t>(succ)]) {
+          out_.loops.push_back({addr, b.last});
+          ++function.num_loops;
+        }
+      }
+      out_.functions.push_back(function);
+    }
+
+    std::sort(out_.loops.begin(), out_.loops.end(), [](const Loop& a, const Loop& b) {
+      return a.header != b.header ? a.header < b.header : a.latch < b.latch;
+    });
+    out_.loops.erase(std::unique(out_.loops.begin(), out_.loops.end(),
+                                 [](const Loop& a, const Loop& b) {
+                                   return a.header == b.header && a.latch == b.latch;
+                                 }),
+                     out_.loops.end());
+  }
+
+  void classify_writes() {
+    for (const Write& write : writes_) {
+      if (layout_.writable) {
+        if (is_code(write.target)) out_.self_modifying.push_back(write);
+      } else if (write.target >= rom_start_) {
+        out_.bank_switches.push_back(write);
+      }
+    }
+  }
+
+  static constexpr size_t MaxStores = 8;
+  struct Store final {
+    std::uint16_t addr;
+    Value value;
+  };
+
+  const RomLayout& layout_;
+  const std::vector<BankAnalysis>& banks_;
+  BankAnalysis& out_;
+  const std::uint8_t* bytes_;
+  std::uint32_t rom_start_;
+  std::vector<Kind> kinds_;
+  std::vector<std::uint8_t> leaders_;
+  std::vector<std::uint16_t> work_;
+  std::vector<Write> writes_;
+
+  // Per straight run of instructions.
+  Value a_, x_, y_;
+  Value pushes_[2];
+  Store stores_[MaxStores];
+  size_t num_stores_ = 0;
+  std::int32_t bank_ = -1;
+};
+
+} // namespace
+
+const BasicBlock* BankAnalysis::block_at(std::uint16_t addr) const {
+  const auto it = std::lower_bound(
+      blocks.begin(), blocks.end(), addr,
+      [](const BasicBlock& block, std::uint16_t a) { return block.start < a; });
+  return it != blocks.end() && it->start == addr ? &*it : nullptr;
+}
+
+size_t BankAnalysis::code_bytes() const {
+  size_t total = 0;
+  for (const BasicBlock& block : blocks) total += block.end - block.start;
+  return total;
+}
+
+Analyzer::Analyzer(const RomLayout& layout) : layout_(layout) {
+  const size_t bank_size = layout.bank_size ? layout.bank_size : layout.size;
+  const size_t count = bank_size ? (layout.size + bank_size - 1) / bank_size : 0;
+  banks_.resize(count);
+  for (size_t i = 0; i < count; ++i) {
+    BankAnalysis& bank = banks_[i];
+    bank.bank = static_cast<std::uint32_t>(i);
+    bank.size = std::min(bank_size, layout.size - i * bank_size);
+    bank.org = layout.fixed_last && i + 1 == count && count > 1
+                   ? static_cast<std::uint16_t>(0x10000 - bank_size)
+                   : layout.org;
+  }
+}
+
+void Analyzer::run(unsigned threads) {
+  if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+
+  std::vector<Tracer> tracers;
+  tracers.reserve(banks_.size());
+  for (BankAnalysis& bank : banks_) tracers.emplace_back(layout_, banks_, bank);
+
+  const size_t bank_size = layout_.bank_size ? layout_.bank_size : layout_.size;
+  for (size_t i = 0; i < banks_.size(); ++i) {
+    const BankAnalysis& bank = banks_[i];
+    for (const std::uint16_t vector : {0xFFFA, 0xFFFC, 0xFFFE}) {
+      if (!bank.contains(vector) || !bank.contains(vector + 1)) continue;
+      const std::uint8_t* bytes = layout_.image + i * bank_size + (vector - bank.org);
+      tracers[i].seed(static_cast<std::uint16_t>(bytes[0] | bytes[1] << 8), true);
+    }
+    for (const std::uint16_t entry : entries_) tracers[i].seed(entry, true);
+  }
+
+  // Trace until no bank hands another one new code.
+  std::vector<size_t> routed(banks_.size(), 0);
+  while (true) {
+    parallel_for(banks_.size(), threads, [&](size_t i) { tracers[i].trace(); });
+    bool more = false;
+    for (size_t i = 0; i < banks_.size(); ++i) {
+      auto& external = banks_[i].external;
+      for (; routed[i] < external.size(); ++routed[i]) {
+        const ExternalRef& ref = external[routed[i]];
+        for (size_t j = 0; j < banks_.size(); ++j) {
+          if (!banks_[j].contains(ref.target)) continue;
+          if (ref.bank >= 0 && static_cast<size_t>(ref.bank) != j &&
+              banks_[static_cast<size_t>(ref.bank)].contains(ref.target)) {
+            continue;
+          }
+          more |= tracers[j].seed(ref.target, ref.call);
+        }
+      }
+    }
+    if (!more) break;
+  }
+
+  parallel_for(banks_.size(), threads, [&](size_t i) { tracers[i].finish(); });
+}
+
+}; // namespace emu
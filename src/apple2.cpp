@@ -0,0 +1,262 @@
+#include <apple2.hpp>
+#include <natives.hpp>
+
+#include <algorithm>
+
+namespace emu {
+
+namespace {
+
+constexpr std::uint16_t TextPages[2] = {0x0400, 0x0800};
+constexpr std::uint16_t HiresPages[2] = {0x2000, 0x4000};
+constexpr size_t TextPageSize = 0x400;
+constexpr size_t HiresPageSize = 0x2000;
+constexpr int TextRows = 24;
+constexpr int TextColumns = 40;
+/// Rows from which mixed mode shows text.
+constexpr int MixedRow = 20;
+/// Flashing characters change every 16 frames, about twice a second.
+constexpr std::uint64_t FlashFrames = 16;
+
+enum Colour : std::uint8_t {
+  Black = 0,
+  Violet = 3,
+  Blue = 6,
+  Orange = 9,
+  Green = 12,
+  White = 15,
+};
+
+/// Screen memory is interleaved: offset of text row `row` (and of the
+/// eight lines of its block in hires) within a page.
+std::uint16_t text_offset(int row) {
+  return static_cast<std::uint16_t>((row & 7) * 0x80 + (row >> 3) * 0x28);
+}
+std::uint16_t hires_offset(int y) {
+  return static_cast<std::uint16_t>((y & 7) * 0x400 + text_offset(y >> 3));
+}
+
+} // namespace
+
+const std::array<std::uint32_t, 16> Apple2::Palette = {
+    0x000000, 0x6C2940, 0x403578, 0xD93CF0, 0x135740, 0x808080, 0x2697F0, 0xBFB4F8,
+    0x404B07, 0xD9680F, 0x808080, 0xECA8BF, 0x26C30F, 0xBFCA87, 0x93D6BF, 0xFFFFFF,
+};
+
+Apple2::Apple2() {
+  rom_region_ = bus_.add_region("rom", static_cast<std::uint32_t>(rom_.size()), 0xD000);
+  bus_.map_ram(0x0000, ram_.size(), ram_.data());
+  bus_.map_device(0xC000, Bus::PageSize, this);
+  bus_.map_rom(0xD000, rom_.size(), rom_.data(), rom_region_);
+  cpu_.trap_handler = &hooks_;
+}
+
+void Apple2::set_hle(bool on) {
+  hle_ = on;
+  if (on) {
+    add_known_routines(hooks_);
+  } else {
+    hooks_.clear();
+  }
+}
+
+bool Apple2::load_roms(std::vector<std::uint8_t> rom, std::vector<std::uint8_t> chargen,
+                       std::string& error) {
+  if (rom.size() != rom_.size()) {
+    error = "Apple II ROM must be 12K";
+    return false;
+  }
+  if (chargen.size() < chargen_.size()) {
+    error = "character ROM must hold 64 glyphs";
+    return false;
+  }
+  std::copy(rom.begin(), rom.end(), rom_.begin());
+  std::copy_n(chargen.begin(), chargen_.size(), chargen_.begin());
+  reset();
+  return true;
+}
+
+void Apple2::reset() {
+  switches_ = Text;
+  key_ = 0;
+  drawn_mode_ = 0xFF;
+  cpu_.reset(bus_);
+}
+
+void Apple2::restore(const State& state) {
+  switches_ = state.switches;
+  key_ = state.key;
+  frames_ = state.frames;
+  pending_.clear();
+  drawn_mode_ = 0xFF;
+}
+
+void Apple2::run_until(std::uint64_t cycle) {
+  while (cpu_.cycles < cycle) {
+    cpu_.run(bus_, cycle);
+    if (cpu_.stop_requested || cpu_.jammed) return;
+  }
+}
+
+void Apple2::run_frame() {
+  run_until((frames_ + 1) * FrameCycles);
+  // A breakpoint leaves the frame to be finished by the next call.
+  if (cpu_.stop_requested) return;
+  render();
+  ++frames_;
+}
+
+void Apple2::type(std::string_view text) {
+  pending_.append(text);
+  next_key();
+}
+
+void Apple2::next_key() {
+  if ((key_ & 0x80) || pending_.empty()) return;
+  char c = pending_.front();
+  pending_.erase(0, 1);
+  if (c >= 'a' && c <= 'z') c = static_cast<char>(c - 'a' + 'A');
+  if (c == '\n') c = '\r';
+  key_ = static_cast<std::uint8_t>(c | 0x80);
+}
+
+bool Apple2::load(std::uint16_t addr, const std::vector<std::uint8_t>& data, std::string& error) {
+  if (addr + data.size() > ram_.size()) {
+    error = "program does not fit in RAM";
+    return false;
+  }
+  std::copy(data.begin(), data.end(), ram_.begin() + addr);
+  bus_.mark_dirty(addr, data.size());
+  if (hle_) add_known_routines(hooks_, addr, static_cast<std::uint32_t>(addr + data.size()));
+  return true;
+}
+
+void Apple2::soft_switch(std::uint16_t addr) {
+  const auto bit = static_cast<std::uint8_t>(1 << ((addr >> 1) & 3));
+  switches_ = (addr & 1) ? (switches_ | bit) : (switches_ & ~bit);
+}
+
+std::uint8_t Apple2::read(std::uint16_t addr) {
+  switch (addr & 0xF0) {
+  case 0x00:
+    return key_;
+  case 0x10: {
+    const std::uint8_t key = key_;
+    key_ &= 0x7F;
+    next_key();
+    return key;
+  }
+  case 0x50:
+    if ((addr & 0x0F) < 8) soft_switch(addr);
+    return 0;
+  default:
+    return 0;
+  }
+}
+
+void Apple2::write(std::uint16_t addr, std::uint8_t value) {
+  (void)value;
+  switch (addr & 0xF0) {
+  case 0x10:
+    key_ &= 0x7F;
+    next_key();
+    break;
+  case 0x50:
+    if ((addr & 0x0F) < 8) soft_switch(addr);
+    break;
+  default:
+    break;
+  }
+}
+
+std::uint8_t Apple2::peek(std::uint16_t addr) { return (addr & 0xF0) == 0x00 ? key_ : 0; }
+
+void Apple2::render() {
+  const bool page2 = switches_ & Page2;
+  const std::uint16_t text = TextPages[page2];
+  const std::uint16_t hires = HiresPages[page2];
+  const bool flash = (frames_ / FlashFrames) & 1;
+  const bool all = switches_ != drawn_mode_;
+  const bool flash_flipped = flash != drawn_flash_;
+
+  for (int row = 0; row < TextRows; ++row) {
+    const bool text_row = (switches_ & Text) || ((switches_ & Mixed) && row >= MixedRow);
+    if (!text_row && (switches_ & Hires)) {
+      for (int y = row * 8; y < row * 8 + 8; ++y) {
+        const auto addr = static_cast<std::uint16_t>(hires + hires_offset(y));
+        if (!all && !bus_.dirty(addr)) continue;
+        draw_hires_line(y, addr);
+        ++lines_drawn_;
+      }
+      continue;
+    }
+    const auto addr = static_cast<std::uint16_t>(text + text_offset(row));
+    if (!all && !bus_.dirty(addr) && !(text_row && flash_flipped && flashing_[row])) continue;
+    if (text_row) {
+      draw_text_row(row, addr, flash);
+    } else {
+      draw_lores_row(row, addr);
+    }
+    lines_drawn_ += 8;
+  }
+  // Pages of the other screen, or of the mode not shown, may be left
+  // dirty: switching to them redraws everything anyway.
+  bus_.clear_dirty(text, TextPageSize);
+  bus_.clear_dirty(hires, HiresPageSize);
+  drawn_mode_ = switches_;
+  drawn_flash_ = flash;
+}
+
+void Apple2::draw_text_row(int row, std::uint16_t addr, bool flash) {
+  bool flashing = false;
+  for (int column = 0; column < TextColumns; ++column) {
+    // Codes $00-$3F are inverse, $40-$7F flash and the rest normal.
+    const std::uint8_t code = ram_[addr + column];
+    const bool flashes = (code & 0xC0) == 0x40;
+    flashing |= flashes;
+    const bool inverse = code < 0x40 || (flashes && flash);
+    const std::uint8_t* glyph = &chargen_[(code & 0x3F) * 8];
+    for (int line = 0; line < 8; ++line) {
+      const std::uint8_t bits = inverse ? ~glyph[line] : glyph[line];
+      std::uint8_t* out = &frame_[(row * 8 + line) * Width + column * 7];
+      for (int x = 0; x < 7; ++x) out[x] = ((bits >> x) & 1) ? White : Black;
+    }
+  }
+  flashing_[row] = flashing;
+}
+
+void Apple2::draw_lores_row(int row, std::uint16_t addr) {
+  // Each byte is two blocks, 7 pixels wide: the low nibble on top.
+  for (int line = 0; line < 8; ++line) {
+    std::uint8_t* out = &frame_[(row * 8 + line) * Width];
+    const int shift = line < 4 ? 0 : 4;
+    for (int column = 0; column < TextColumns; ++column) {
+      std::fill_n(out + column * 7, 7, static_cast<std::uint8_t>((ram_[addr + column] >> shift) & 0x0F));
+    }
+  }
+  flashing_[row] = false;
+}
+
+void Apple2::draw_hires_line(int y, std::uint16_t addr) {
+  // The seven low bits of each byte are pixels, leftmost first; bit 7
+  // delays them half a pixel, which changes the colours they show. Two
+  // lit neighbours show white, a lone pixel the colour of its column.
+  std::array<bool, Width + 2> on{};
+  for (int column = 0; column < TextColumns; ++column) {
+    const std::uint8_t bits = ram_[addr + column];
+    for (int x = 0; x < 7; ++x) on[1 + column * 7 + x] = (bits >> x) & 1;
+  }
+  std::uint8_t* out = &frame_[y * Width];
+  for (int x = 0; x < Width; ++x) {
+    if (!on[x + 1]) {
+      out[x] = Black;
+    } else if (on[x] || on[x + 2]) {
+      out[x] = White;
+    } else {
+      const bool shifted = ram_[addr + x / 7] & 0x80;
+      out[x] = (x & 1) ? (shifted ? Orange : Green) : (shifted ? Blue : Violet);
+    }
+  }
+}
+
+}; // namespace emu
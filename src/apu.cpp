@@ -0,0 +1,535 @@
+#include <apu.hpp>
+#include <bus.hpp>
+#include <cpu.hpp>
+#include <snapshot.hpp>
+
+#include <algorithm>
+#include <limits>
+
+namespace emu {
+
+namespace {
+
+constexpr int DefaultSampleRate = 44100;
+
+// Output amplitude per unit of channel level: the usual linear
+// approximation of the DAC (0.00752 per pulse step, 0.00851 per triangle
+// step, 0.00494 per noise step and 0.00335 per DMC step), scaled so that
+// all channels at full level stay within 16 bits.
+constexpr int PulseAmplitude = 274;
+constexpr int TriangleAmplitude = 310;
+constexpr int NoiseAmplitude = 180;
+constexpr int DmcAmplitude = 122;
+
+constexpr std::uint8_t Lengths[32] = {
+    10, 254, 20, 2,  40, 4,  80, 6,  160, 8,  60, 10, 14, 12, 26, 14,
+    12, 16,  24, 18, 48, 20, 96, 22, 192, 24, 72, 26, 16, 28, 32, 30,
+};
+
+constexpr bool Duties[4][8] = {
+    {0, 1, 0, 0, 0, 0, 0, 0},
+    {0, 1, 1, 0, 0, 0, 0, 0},
+    {0, 1, 1, 1, 1, 0, 0, 0},
+    {1, 0, 0, 1, 1, 1, 1, 1},
+};
+
+constexpr std::uint8_t TriangleSequence[32] = {
+    15, 14, 13, 12, 11, 10, 9,  8,  7,  6,  5,  4,  3,  2,  1,  0,
+    0,  1,  2,  3,  4,  5,  6,  7,  8,  9,  10, 11, 12, 13, 14, 15,
+};
+
+/// Timer periods in CPU cycles.
+constexpr std::uint16_t NoisePeriods[16] = {
+    4, 8, 16, 32, 64, 96, 128, 160, 202, 254, 380, 508, 762, 1016, 2034, 4068,
+};
+constexpr std::uint16_t DmcRates[16] = {
+    428, 380, 340, 320, 286, 254, 226, 214, 190, 160, 142, 128, 106, 84, 72, 54,
+};
+
+/// A frame counter step, in CPU cycles from the start of the sequence.
+struct FrameStep final {
+  std::uint32_t at;
+  bool quarter;
+  bool half;
+  bool irq;
+};
+
+struct FrameSequence final {
+  const FrameStep* steps;
+  int count;
+  std::uint32_t period;
+};
+
+constexpr FrameStep FourSteps[] = {
+    {7457, true, false, false},
+    {14913, true, true, false},
+    {22371, true, false, false},
+    {29829, true, true, true},
+};
+constexpr FrameStep FiveSteps[] = {
+    {7457, true, false, false},
+    {14913, true, true, false},
+    {22371, true, false, false},
+    {29829, false, false, false},
+    {37281, true, true, false},
+};
+constexpr FrameSequence FourStepSequence = {FourSteps, 4, 29830};
+constexpr FrameSequence FiveStepSequence = {FiveSteps, 5, 37282};
+/// The step of the four-step sequence that raises IRQ.
+constexpr int IrqStep = 3;
+
+} // namespace
+
+void Apu::Envelope::clock() {
+  if (start) {
+    start = false;
+    decay = 15;
+    divider = period;
+  } else if (divider == 0) {
+    divider = period;
+    if (decay > 0) {
+      --decay;
+    } else if (loop) {
+      decay = 15;
+    }
+  } else {
+    --divider;
+  }
+}
+
+std::uint16_t Apu::Pulse::sweep_target() const {
+  const int change = timer >> sweep_shift;
+  if (!sweep_negate) return static_cast<std::uint16_t>(timer + change);
+  return static_cast<std::uint16_t>(std::max(0, timer - change - (ones_complement ? 1 : 0)));
+}
+
+bool Apu::Pulse::muted() const { return timer < 8 || sweep_target() > 0x7FF; }
+
+int Apu::Pulse::level() const {
+  return audible() && Duties[duty][step] ? envelope.volume() * PulseAmplitude : 0;
+}
+
+int Apu::Triangle::level() const { return TriangleSequence[step] * TriangleAmplitude; }
+
+int Apu::Noise::level() const {
+  return audible() && !(shift & 1) ? envelope.volume() * NoiseAmplitude : 0;
+}
+
+int Apu::Dmc::level() const { return dac * DmcAmplitude; }
+
+Apu::Apu(CPU& cpu, Bus& bus)
+    : cpu_(cpu), bus_(bus), blip_(ClockRate, DefaultSampleRate, DefaultSampleRate) {
+  pulse_[0].ones_complement = true;
+}
+
+void Apu::set_sample_rate(int rate) {
+  blip_ = BlipBuffer(ClockRate, rate, static_cast<size_t>(rate));
+}
+
+void Apu::set_audio(bool enabled) {
+  if (enabled == audio_) return;
+  sync();
+  audio_ = enabled;
+  blip_.clear();
+  if (!enabled) return;
+  // Restart the waveforms from silence where the timers stopped.
+  for (Pulse& pulse : pulse_) {
+    pulse.next = clock_;
+    pulse.out = 0;
+  }
+  triangle_.next = clock_;
+  triangle_.out = 0;
+  noise_.next = clock_;
+  noise_.out = 0;
+  dmc_.out = 0;
+  update_levels(clock_);
+}
+
+void Apu::catch_up(std::uint64_t cycle) {
+  if (cycle <= clock_) return;
+  for (;;) {
+    const FrameSequence& sequence = five_step_ ? FiveStepSequence : FourStepSequence;
+    const std::uint64_t step = frame_origin_ + sequence.steps[frame_step_].at;
+    if (step > cycle) break;
+    run_channels(step);
+    clock_frame(step);
+  }
+  run_channels(cycle);
+  if (!audio_) {
+    clock_ = cycle;
+    return;
+  }
+  blip_.end_frame(static_cast<std::uint32_t>(cycle - clock_));
+  clock_ = cycle;
+
+  const auto limit = static_cast<size_t>(blip_.sample_rate() / 2);
+  if (blip_.samples_available() > limit) blip_.remove_samples(blip_.samples_available() - limit);
+}
+
+void Apu::sync() { catch_up(cpu_.cycles); }
+
+std::uint64_t Apu::next_irq() const {
+  std::uint64_t next = std::numeric_limits<std::uint64_t>::max();
+  if (!five_step_ && !irq_inhibit_ && !frame_irq_) {
+    next = frame_origin_ + FourSteps[IrqStep].at;
+  }
+  if (dmc_.irq_enabled && !dmc_.loop && dmc_.remaining > 0 && !dmc_irq_) {
+    // The buffer is refilled each time the shift register takes it, every
+    // eight timer expiries; the IRQ comes with the fetch of the last byte.
+    const std::uint64_t period = DmcRates[dmc_.rate];
+    const std::uint64_t first = dmc_.next + (dmc_.bits - 1u) * period;
+    next = std::min(next, first + (dmc_.remaining - 1u) * 8u * period);
+  }
+  return next;
+}
+
+void Apu::run_channels(std::uint64_t until) {
+  if (!audio_) {
+    skip_dmc(until);
+    return;
+  }
+  run_pulse(pulse_[0], until);
+  run_pulse(pulse_[1], until);
+  run_triangle(until);
+  run_noise(until);
+  run_dmc(until);
+}
+
+void Apu::run_pulse(Pulse& pulse, std::uint64_t until) {
+  if (pulse.next > until) return;
+  const std::uint64_t period = (pulse.timer + 1u) * 2u;
+  if (!pulse.audible()) {
+    const std::uint64_t expiries = (until - pulse.next) / period + 1;
+    pulse.step = static_cast<std::uint8_t>((pulse.step + expiries) & 7);
+    pulse.next += expiries * period;
+    return;
+  }
+  const int volume = pulse.envelope.volume() * PulseAmplitude;
+  const bool* duty = Duties[pulse.duty];
+  for (; pulse.next <= until; pulse.next += period) {
+    pulse.step = (pulse.step + 1) & 7;
+    set_output(pulse.out, duty[pulse.step] ? volume : 0, pulse.next);
+  }
+}
+
+void Apu::run_triangle(std::uint64_t until) {
+  Triangle& triangle = triangle_;
+  if (triangle.next > until) return;
+  const std::uint64_t period = triangle.timer + 1u;
+  if (!triangle.stepping()) {
+    triangle.next += ((until - triangle.next) / period + 1) * period;
+    return;
+  }
+  for (; triangle.next <= until; triangle.next += period) {
+    triangle.step = (triangle.step + 1) & 31;
+    set_output(triangle.out, triangle.level(), triangle.next);
+  }
+}
+
+void Apu::run_noise(std::uint64_t until) {
+  Noise& noise = noise_;
+  if (noise.next > until) return;
+  const std::uint64_t period = NoisePeriods[noise.period];
+  if (!noise.audible()) {
+    // The shift register is not advanced while nothing can be heard.
+    noise.next += ((until - noise.next) / period + 1) * period;
+    return;
+  }
+  const int volume = noise.envelope.volume() * NoiseAmplitude;
+  const int tap = noise.short_mode ? 6 : 1;
+  for (; noise.next <= until; noise.next += period) {
+    const unsigned feedback = (noise.shift ^ (noise.shift >> tap)) & 1;
+    noise.shift = static_cast<std::uint16_t>(noise.shift >> 1 | feedback << 14);
+    set_output(noise.out, (noise.shift & 1) ? 0 : volume, noise.next);
+  }
+}
+
+void Apu::run_dmc(std::uint64_t until) {
+  Dmc& dmc = dmc_;
+  if (dmc.next > until) return;
+  const std::uint64_t period = DmcRates[dmc.rate];
+  if (dmc.silence && !dmc.buffered) {
+    // Idle until the sample restarts; only the bit counter moves.
+    const std::uint64_t expiries = (until - dmc.next) / period + 1;
+    dmc.bits = static_cast<std::uint8_t>((dmc.bits - 1u + 8u - expiries % 8u) % 8u + 1u);
+    dmc.next += expiries * period;
+    return;
+  }
+  for (; dmc.next <= until; dmc.next += period) {
+    if (!dmc.silence) {
+      if (dmc.shift & 1) {
+        if (dmc.dac <= 125) dmc.dac += 2;
+      } else if (dmc.dac >= 2) {
+        dmc.dac -= 2;
+      }
+      set_output(dmc.out, dmc.level(), dmc.next);
+    }
+    dmc.shift >>= 1;
+    if (--dmc.bits == 0) {
+      dmc.bits = 8;
+      dmc.silence = !dmc.buffered;
+      if (dmc.buffered) {
+        dmc.shift = dmc.buffer;
+        dmc.buffered = false;
+        fetch_sample();
+      }
+    }
+  }
+}
+
+void Apu::skip_dmc(std::uint64_t until) {
+  Dmc& dmc = dmc_;
+  if (dmc.next > until) return;
+  const std::uint64_t period = DmcRates[dmc.rate];
+  std::uint64_t expiries = (until - dmc.next) / period + 1;
+  if (dmc.silence && !dmc.buffered) {
+    // Idle: whole bytes pass without a fetch.
+    dmc.next += expiries / 8 * 8 * period;
+    expiries %= 8;
+  }
+  while (expiries >= dmc.bits) {
+    expiries -= dmc.bits;
+    dmc.next += dmc.bits * period;
+    dmc.bits = 8;
+    dmc.silence = !dmc.buffered;
+    if (dmc.buffered) {
+      dmc.shift = dmc.buffer;
+      dmc.buffered = false;
+      fetch_sample();
+    }
+  }
+  dmc.bits = static_cast<std::uint8_t>(dmc.bits - expiries);
+  dmc.next += expiries * period;
+}
+
+void Apu::clock_frame(std::uint64_t cycle) {
+  const FrameSequence& sequence = five_step_ ? FiveStepSequence : FourStepSequence;
+  const FrameStep& step = sequence.steps[frame_step_];
+  if (step.quarter) clock_quarter();
+  if (step.half) clock_half();
+  if (step.irq && !irq_inhibit_) set_frame_irq(true);
+  if (++frame_step_ == sequence.count) {
+    frame_step_ = 0;
+    frame_origin_ += sequence.period;
+  }
+  update_levels(cycle);
+}
+
+void Apu::clock_quarter() {
+  pulse_[0].envelope.clock();
+  pulse_[1].envelope.clock();
+  noise_.envelope.clock();
+  if (triangle_.linear_reload) {
+    triangle_.linear = triangle_.linear_period;
+  } else if (triangle_.linear > 0) {
+    --triangle_.linear;
+  }
+  if (!triangle_.control) triangle_.linear_reload = false;
+}
+
+void Apu::clock_half() {
+  for (Pulse& pulse : pulse_) {
+    if (!pulse.envelope.loop && pulse.length > 0) --pulse.length;
+    if (pulse.sweep_divider == 0 && pulse.sweep_enabled && pulse.sweep_shift > 0 && !pulse.muted()) {
+      pulse.timer = pulse.sweep_target();
+    }
+    if (pulse.sweep_divider == 0 || pulse.sweep_reload) {
+      pulse.sweep_divider = pulse.sweep_period;
+      pulse.sweep_reload = false;
+    } else {
+      --pulse.sweep_divider;
+    }
+  }
+  if (!triangle_.control && triangle_.length > 0) --triangle_.length;
+  if (!noise_.envelope.loop && noise_.length > 0) --noise_.length;
+}
+
+void Apu::update_levels(std::uint64_t cycle) {
+  set_output(pulse_[0].out, pulse_[0].level(), cycle);
+  set_output(pulse_[1].out, pulse_[1].level(), cycle);
+  set_output(triangle_.out, triangle_.level(), cycle);
+  set_output(noise_.out, noise_.level(), cycle);
+  set_output(dmc_.out, dmc_.level(), cycle);
+}
+
+void Apu::set_output(int& out, int level, std::uint64_t cycle) {
+  if (level == out || !audio_) return;
+  blip_.add_delta(static_cast<std::uint32_t>(cycle - clock_), level - out);
+  out = level;
+}
+
+void Apu::write(std::uint16_t addr, std::uint8_t value) {
+  sync();
+  if (addr < 0x4008) {
+    write_pulse(pulse_[(addr >> 2) & 1], addr & 3, value);
+  } else {
+    switch (addr) {
+    case 0x4008:
+      triangle_.control = value & 0x80;
+      triangle_.linear_period = value & 0x7F;
+      break;
+    case 0x400A:
+      triangle_.timer = static_cast<std::uint16_t>((triangle_.timer & 0x700) | value);
+      break;
+    case 0x400B:
+      triangle_.timer = static_cast<std::uint16_t>((triangle_.timer & 0xFF) | (value & 7) << 8);
+      if (triangle_.enabled) triangle_.length = Lengths[value >> 3];
+      triangle_.linear_reload = true;
+      break;
+    case 0x400C:
+      noise_.envelope.loop = value & 0x20;
+      noise_.envelope.constant = value & 0x10;
+      noise_.envelope.period = value & 0x0F;
+      break;
+    case 0x400E:
+      noise_.short_mode = value & 0x80;
+      noise_.period = value & 0x0F;
+      break;
+    case 0x400F:
+      if (noise_.enabled) noise_.length = Lengths[value >> 3];
+      noise_.envelope.start = true;
+      break;
+    case 0x4010:
+      dmc_.irq_enabled = value & 0x80;
+      dmc_.loop = value & 0x40;
+      dmc_.rate = value & 0x0F;
+      if (!dmc_.irq_enabled) set_dmc_irq(false);
+      break;
+    case 0x4011:
+      dmc_.dac = value & 0x7F;
+      break;
+    case 0x4012:
+      dmc_.start = static_cast<std::uint16_t>(0xC000 | value << 6);
+      break;
+    case 0x4013:
+      dmc_.size = static_cast<std::uint16_t>(value * 16 + 1);
+      break;
+    case 0x4015:
+      pulse_[0].enabled = value & 0x01;
+      pulse_[1].enabled = value & 0x02;
+      triangle_.enabled = value & 0x04;
+      noise_.enabled = value & 0x08;
+      if (!pulse_[0].enabled) pulse_[0].length = 0;
+      if (!pulse_[1].enabled) pulse_[1].length = 0;
+      if (!triangle_.enabled) triangle_.length = 0;
+      if (!noise_.enabled) noise_.length = 0;
+      set_dmc_irq(false);
+      if (!(value & 0x10)) {
+        dmc_.remaining = 0;
+      } else if (dmc_.remaining == 0) {
+        restart_sample();
+        fetch_sample();
+      }
+      break;
+    case 0x4017:
+      five_step_ = value & 0x80;
+      irq_inhibit_ = value & 0x40;
+      if (irq_inhibit_) set_frame_irq(false);
+      frame_origin_ = clock_;
+      frame_step_ = 0;
+      if (five_step_) {
+        clock_quarter();
+        clock_half();
+      }
+      break;
+    default:
+      break;
+    }
+  }
+  update_levels(clock_);
+  cpu_.end_run_by(next_irq());
+}
+
+void Apu::write_pulse(Pulse& pulse, int reg, std::uint8_t value) {
+  switch (reg) {
+  case 0:
+    pulse.duty = value >> 6;
+    pulse.envelope.loop = value & 0x20;
+    pulse.envelope.constant = value & 0x10;
+    pulse.envelope.period = value & 0x0F;
+    break;
+  case 1:
+    pulse.sweep_enabled = value & 0x80;
+    pulse.sweep_period = (value >> 4) & 7;
+    pulse.sweep_negate = value & 0x08;
+    pulse.sweep_shift = value & 7;
+    pulse.sweep_reload = true;
+    break;
+  case 2:
+    pulse.timer = static_cast<std::uint16_t>((pulse.timer & 0x700) | value);
+    break;
+  default:
+    pulse.timer = static_cast<std::uint16_t>((pulse.timer & 0xFF) | (value & 7) << 8);
+    if (pulse.enabled) pulse.length = Lengths[value >> 3];
+    pulse.step = 0;
+    pulse.envelope.start = true;
+    break;
+  }
+}
+
+std::uint8_t Apu::read_status() {
+  sync();
+  const std::uint8_t status = peek_status();
+  set_frame_irq(false);
+  cpu_.end_run_by(next_irq());
+  return status;
+}
+
+std::uint8_t Apu::peek_status() const {
+  return static_cast<std::uint8_t>(
+      (pulse_[0].length > 0 ? 0x01 : 0) | (pulse_[1].length > 0 ? 0x02 : 0) |
+      (triangle_.length > 0 ? 0x04 : 0) | (noise_.length > 0 ? 0x08 : 0) |
+      (dmc_.remaining > 0 ? 0x10 : 0) | (frame_irq_ ? 0x40 : 0) | (dmc_irq_ ? 0x80 : 0));
+}
+
+void Apu::fetch_sample() {
+  if (dmc_.buffered || dmc_.remaining == 0) return;
+  dmc_.buffer = bus_.read(dmc_.address);
+  dmc_.buffered = true;
+  dmc_.address = dmc_.address == 0xFFFF ? 0x8000 : static_cast<std::uint16_t>(dmc_.address + 1);
+  if (--dmc_.remaining == 0) {
+    if (dmc_.loop) {
+      restart_sample();
+    } else if (dmc_.irq_enabled) {
+      set_dmc_irq(true);
+    }
+  }
+}
+
+void Apu::restart_sample() {
+  dmc_.address = dmc_.start;
+  dmc_.remaining = dmc_.size;
+}
+
+void Apu::set_dmc_irq(bool asserted) {
+  dmc_irq_ = asserted;
+  cpu_.set_irq(DmcIrq, asserted);
+}
+
+void Apu::set_frame_irq(bool asserted) {
+  frame_irq_ = asserted;
+  cpu_.set_irq(FrameIrq, asserted);
+}
+
+template <typename Archive, typename Self> void Apu::fields(Archive& archive, Self& self) {
+  archive(self.clock_, self.pulse_, self.triangle_, self.noise_, self.dmc_);
+  archive(self.five_step_, self.irq_inhibit_, self.frame_irq_, self.dmc_irq_,
+          self.frame_origin_, self.frame_step_);
+}
+
+void Apu::save(SnapshotWriter& out) const { fields(out, *this); }
+
+void Apu::restore(SnapshotReader& in) {
+  fields(in, *this);
+  // The buffer starts again from silence at the restored clock; step it
+  // back up to the levels the channels are at.
+  blip_.clear();
+  if (!audio_) return;
+  for (int* out : {&pulse_[0].out, &pulse_[1].out, &triangle_.out, &noise_.out, &dmc_.out}) {
+    const int level = *out;
+    *out = 0;
+    set_output(*out, level, clock_);
+  }
+}
+
+}; // namespace emu
@@ -0,0 +1,110 @@
+#include <blip.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+namespace emu {
+
+namespace {
+
+constexpr int Phases = 1 << BlipBuffer::PhaseBits;
+/// The high-pass filter that removes DC decays by 1/2^BassShift per sample.
+constexpr int BassShift = 9;
+/// Cutoff of the step, as a fraction of the output Nyquist frequency.
+constexpr double Cutoff = 0.9;
+
+using Kernel = std::array<std::array<std::int32_t, BlipBuffer::Taps>, Phases>;
+
+/// Band-limited impulses (the differences of band-limited steps), one per
+/// fractional sample position, each summing to exactly 1 << KernelBits so
+/// that steps settle at their full amplitude.
+Kernel make_kernel() {
+  constexpr double Pi = 3.14159265358979323846;
+  constexpr double Half = BlipBuffer::Taps / 2.0;
+  Kernel kernel{};
+  for (int phase = 0; phase < Phases; ++phase) {
+    std::array<double, BlipBuffer::Taps> taps{};
+    double sum = 0;
+    for (int i = 0; i < BlipBuffer::Taps; ++i) {
+      const double x = i - Half - static_cast<double>(phase) / Phases;
+      if (std::abs(x) >= Half) continue;
+      const double sinc = x == 0 ? 1 : std::sin(Pi * Cutoff * x) / (Pi * Cutoff * x);
+      const double window = 0.42 + 0.5 * std::cos(Pi * x / Half) + 0.08 * std::cos(2 * Pi * x / Half);
+      taps[i] = sinc * window;
+      sum += taps[i];
+    }
+    std::int32_t total = 0;
+    size_t peak = 0;
+    for (size_t i = 0; i < taps.size(); ++i) {
+      kernel[phase][i] = static_cast<std::int32_t>(std::lround(taps[i] / sum * (1 << BlipBuffer::KernelBits)));
+      total += kernel[phase][i];
+      if (kernel[phase][i] > kernel[phase][peak]) peak = i;
+    }
+    kernel[phase][peak] += (1 << BlipBuffer::KernelBits) - total;
+  }
+  return kernel;
+}
+
+const Kernel& kernel() {
+  static const Kernel table = make_kernel();
+  return table;
+}
+
+} // namespace
+
+BlipBuffer::BlipBuffer(double clock_rate, int sample_rate, size_t capacity)
+    : buffer_(capacity + Taps + 1, 0) {
+  set_rates(clock_rate, sample_rate);
+}
+
+void BlipBuffer::set_rates(double clock_rate, int sample_rate) {
+  sample_rate_ = sample_rate;
+  factor_ = static_cast<std::uint64_t>(
+      std::llround(sample_rate / clock_rate * static_cast<double>(1ull << FractionBits)));
+}
+
+void BlipBuffer::add_delta(std::uint32_t time, int delta) {
+  const std::uint64_t position = offset_ + time * factor_;
+  const size_t index = static_cast<size_t>(position >> FractionBits);
+  if (delta == 0 || index + Taps > buffer_.size()) return;
+  const auto phase = static_cast<size_t>(position >> (FractionBits - PhaseBits)) & (Phases - 1);
+  const auto& step = kernel()[phase];
+  std::int32_t* out = buffer_.data() + index;
+  for (int i = 0; i < Taps; ++i) out[i] += step[i] * delta;
+}
+
+void BlipBuffer::end_frame(std::uint32_t clocks) { offset_ += clocks * factor_; }
+
+size_t BlipBuffer::read_samples(std::int16_t* out, size_t max) {
+  const size_t count = std::min(max, samples_available());
+  std::int32_t sum = integrator_;
+  for (size_t i = 0; i < count; ++i) {
+    std::int32_t sample = sum >> KernelBits;
+    if (out) out[i] = static_cast<std::int16_t>(std::clamp(sample, -32768, 32767));
+    sum += buffer_[i];
+    sum -= sample << (KernelBits - BassShift);
+  }
+  integrator_ = sum;
+  shift(count);
+  return count;
+}
+
+void BlipBuffer::remove_samples(size_t count) { read_samples(nullptr, count); }
+
+void BlipBuffer::clear() {
+  offset_ = 0;
+  integrator_ = 0;
+  std::fill(buffer_.begin(), buffer_.end(), 0);
+}
+
+void BlipBuffer::shift(size_t count) {
+  if (count == 0) return;
+  // Only the unread samples and the tails of their steps are non-zero.
+  const size_t used = std::min(buffer_.size(), samples_available() + Taps + 1);
+  std::copy(buffer_.begin() + count, buffer_.begin() + used, buffer_.begin());
+  std::fill(buffer_.begin() + (used - count), buffer_.begin() + used, 0);
+  offset_ -= static_cast<std::uint64_t>(count) << FractionBits;
+}
+
+}; // namespace emu
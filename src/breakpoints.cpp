@@ -0,0 +1,346 @@
+#include <breakpoints.hpp>
+#include <bus.hpp>
+
+#include <algorithm>
+#include <cctype>
+#include <initializer_list>
+#include <utility>
+
+namespace emu {
+
+namespace {
+
+enum Reg : std::int32_t { RegA, RegX, RegY, RegSP, RegP, RegPC };
+
+using Code = Condition::Code;
+using Insn = Condition::Insn;
+
+/// Recursive descent parser emitting postfix code. Tracks the stack depth
+/// the code needs so evaluation can use a fixed-size stack.
+class Parser final {
+public:
+  Parser(std::string_view text, std::vector<Insn>& out)
+      : text_(text), out_(out) {}
+
+  bool parse(std::string& error) {
+    logical_or();
+    skip_space();
+    if (error_.empty() && pos_ != text_.size()) fail("unexpected input");
+    if (error_.empty() && max_depth_ > Condition::MaxDepth) {
+      fail("expression too deep");
+    }
+    if (!error_.empty()) {
+      error = error_ + " at column " + std::to_string(error_pos_ + 1);
+      return false;
+    }
+    return true;
+  }
+
+private:
+  void fail(const char* message) {
+    if (error_.empty()) {
+      error_ = message;
+      error_pos_ = pos_;
+    }
+  }
+
+  void skip_space() {
+    while (pos_ < text_.size() && std::isspace(static_cast<unsigned char>(text_[pos_]))) {
+      ++pos_;
+    }
+  }
+
+  bool accept(std::string_view token) {
+    skip_space();
+    if (text_.substr(pos_, token.size()) != token) return false;
+    pos_ += token.size();
+    return true;
+  }
+
+  void emit(Code code, std::int32_t arg = 0) {
+    // Fold constant memory reads, the common case in conditions.
+    if ((code == Code::Peek || code == Code::Peek16) && !out_.empty() &&
+        out_.back().code == Code::Push) {
+      out_.back().code = code == Code::Peek ? Code::PeekConst : Code::Peek16Const;
+      return;
+    }
+    switch (code) {
+    case Code::Push: case Code::Reg: case Code::Flag:
+      max_depth_ = std::max(max_depth_, ++depth_);
+      break;
+    case Code::Peek: case Code::Peek16: case Code::PeekConst:
+    case Code::Peek16Const: case Code::Not: case Code::Neg: case Code::Inv:
+      break;
+    default:
+      --depth_;
+      break;
+    }
+    out_.push_back({code, arg});
+  }
+
+  void binary(void (Parser::*operand)(),
+              std::initializer_list<std::pair<std::string_view, Code>> ops) {
+    (this->*operand)();
+    while (error_.empty()) {
+      bool matched = false;
+      for (const auto& [token, code] : ops) {
+        // Do not read the first character of `&&`/`||`/`<=`... as `&`/`|`/`<`;
+        // `A--1` is a subtraction of -1.
+        skip_space();
+        if (text_.substr(pos_, token.size()) != token) continue;
+        const char after = pos_ + token.size() < text_.size() ? text_[pos_ + token.size()] : '\0';
+        const char op = token[0];
+        if (token.size() == 1 && ((after == op && (op == '&' || op == '|')) ||
+                                  (after == '=' && (op == '<' || op == '>' || op == '!')))) {
+          continue;
+        }
+        pos_ += token.size();
+        (this->*operand)();
+        emit(code);
+        matched = true;
+        break;
+      }
+      if (!matched) return;
+    }
+  }
+
+  void logical_or() { binary(&Parser::logical_and, {{"||", Code::LogOr}}); }
+  void logical_and() { binary(&Parser::bit_or, {{"&&", Code::LogAnd}}); }
+  void bit_or() { binary(&Parser::bit_xor, {{"|", Code::Or}}); }
+  void bit_xor() { binary(&Parser::bit_and, {{"^", Code::Xor}}); }
+  void bit_and() { binary(&Parser::equality, {{"&", Code::And}}); }
+  void equality() {
+    binary(&Parser::relational, {{"==", Code::Eq}, {"!=", Code::Ne}});
+  }
+  void relational() {
+    binary(&Parser::additive, {{"<=", Code::Le}, {">=", Code::Ge},
+                               {"<", Code::Lt}, {">", Code::Gt}});
+  }
+  void additive() {
+    binary(&Parser::unary, {{"+", Code::Add}, {"-", Code::Sub}});
+  }
+
+  void unary() {
+    if (accept("!")) {
+      unary();
+      emit(Code::Not);
+    } else if (accept("-")) {
+      unary();
+      emit(Code::Neg);
+    } else if (accept("~")) {
+      unary();
+      emit(Code::Inv);
+    } else {
+      primary();
+    }
+  }
+
+  void primary() {
+    skip_space();
+    if (pos_ >= text_.size()) return fail("expected an operand");
+    if (accept("(")) {
+      logical_or();
+      if (!accept(")")) fail("expected ')'");
+      return;
+    }
+    if (accept("[")) {
+      logical_or();
+      if (!accept("]")) fail("expected ']'");
+      return emit(Code::Peek);
+    }
+    if (accept("{")) {
+      logical_or();
+      if (!accept("}")) fail("expected '}'");
+      return emit(Code::Peek16);
+    }
+
+    const char c = text_[pos_];
+    if (c == '$' || c == '%' || std::isdigit(static_cast<unsigned char>(c))) {
+      return number();
+    }
+    if (!std::isalpha(static_cast<unsigned char>(c))) return fail("expected an operand");
+
+    const size_t start = pos_;
+    while (pos_ < text_.size() && std::isalnum(static_cast<unsigned char>(text_[pos_]))) {
+      ++pos_;
+    }
+    std::string name(text_.substr(start, pos_ - start));
+    for (auto& ch : name) ch = static_cast<char>(std::toupper(static_cast<unsigned char>(ch)));
+
+    static const std::pair<const char*, Reg> regs[] = {
+        {"A", RegA}, {"X", RegX}, {"Y", RegY}, {"SP", RegSP}, {"S", RegSP},
+        {"P", RegP}, {"PC", RegPC},
+    };
+    for (const auto& [reg_name, reg] : regs) {
+      if (name == reg_name) return emit(Code::Reg, reg);
+    }
+    static const std::pair<const char*, CPU::Flag> flags[] = {
+        {"C", CPU::C}, {"Z", CPU::Z}, {"I", CPU::I},
+        {"D", CPU::D}, {"V", CPU::V}, {"N", CPU::N},
+    };
+    for (const auto& [flag_name, flag] : flags) {
+      if (name == flag_name) return emit(Code::Flag, flag);
+    }
+    pos_ = start;
+    fail("unknown name");
+  }
+
+  void number() {
+    int base = 10;
+    if (accept("$")) {
+      base = 16;
+    } else if (accept("%")) {
+      base = 2;
+    } else if (accept("0x") || accept("0X")) {
+      base = 16;
+    }
+    const size_t start = pos_;
+    std::int64_t value = 0;
+    while (pos_ < text_.size()) {
+      const int ch = std::tolower(static_cast<unsigned char>(text_[pos_]));
+      const int digit = std::isdigit(ch) ? ch - '0' : (ch >= 'a' && ch <= 'f') ? ch - 'a' + 10 : 99;
+      if (digit >= base) break;
+      value = value * base + digit;
+      if (value > 0xFFFFFFF) return fail("number too large");
+      ++pos_;
+    }
+    if (pos_ == start) return fail("bad number");
+    emit(Code::Push, static_cast<std::int32_t>(value));
+  }
+
+  std::string_view text_;
+  std::vector<Insn>& out_;
+  size_t pos_ = 0;
+  size_t depth_ = 0;
+  size_t max_depth_ = 0;
+  std::string error_;
+  size_t error_pos_ = 0;
+};
+
+} // namespace
+
+bool Condition::compile(std::string_view text, Condition& out,
+                        std::string& error) {
+  out.code_.clear();
+  if (text.find_first_not_of(" \t") == std::string_view::npos) return true;
+  Parser parser(text, out.code_);
+  if (!parser.parse(error)) {
+    out.code_.clear();
+    return false;
+  }
+  return true;
+}
+
+bool Condition::eval(const CPU& cpu, const Bus& bus) const {
+  if (code_.empty()) return true;
+  std::int32_t stack[MaxDepth];
+  size_t sp = 0;
+  const auto peek16 = [&](std::int32_t addr) {
+    return bus.peek(static_cast<std::uint16_t>(addr)) |
+           (bus.peek(static_cast<std::uint16_t>(addr + 1)) << 8);
+  };
+  for (const Insn& insn : code_) {
+    switch (insn.code) {
+    case Code::Push: stack[sp++] = insn.arg; break;
+    case Code::Reg: {
+      std::int32_t value = 0;
+      switch (insn.arg) {
+      case RegA: value = cpu.A; break;
+      case RegX: value = cpu.X; break;
+      case RegY: value = cpu.Y; break;
+      case RegSP: value = cpu.SP; break;
+      case RegP: value = cpu.Status; break;
+      case RegPC: value = cpu.PC; break;
+      }
+      stack[sp++] = value;
+      break;
+    }
+    case Code::Flag: stack[sp++] = (cpu.Status & insn.arg) != 0; break;
+    case Code::PeekConst:
+      stack[sp++] = bus.peek(static_cast<std::uint16_t>(insn.arg));
+      break;
+    case Code::Peek16Const: stack[sp++] = peek16(insn.arg); break;
+    case Code::Peek:
+      stack[sp - 1] = bus.peek(static_cast<std::uint16_t>(stack[sp - 1]));
+      break;
+    case Code::Peek16: stack[sp - 1] = peek16(stack[sp - 1]); break;
+    case Code::Not: stack[sp - 1] = !stack[sp - 1]; break;
+    case Code::Neg: stack[sp - 1] = -stack[sp - 1]; break;
+    case Code::Inv: stack[sp - 1] = ~stack[sp - 1]; break;
+    default: {
+      const std::int32_t rhs = stack[--sp];
+      std::int32_t& lhs = stack[sp - 1];
+      switch (insn.code) {
+      case Code::Add: lhs += rhs; break;
+      case Code::Sub: lhs -= rhs; break;
+      case Code::And: lhs &= rhs; break;
+      case Code::Or: lhs |= rhs; break;
+      case Code::Xor: lhs ^= rhs; break;
+      case Code::LogAnd: lhs = lhs && rhs; break;
+      case Code::LogOr: lhs = lhs || rhs; break;
+      case Code::Eq: lhs = lhs == rhs; break;
+      case Code::Ne: lhs = lhs != rhs; break;
+      case Code::Lt: lhs = lhs < rhs; break;
+      case Code::Le: lhs = lhs <= rhs; break;
+      case Code::Gt: lhs = lhs > rhs; break;
+      case Code::Ge: lhs = lhs >= rhs; break;
+      default: break;
+      }
+    }
+    }
+  }
+  return stack[0] != 0;
+}
+
+Breakpoints::Entry* Breakpoints::find(std::uint16_t pc) {
+  const auto it = std::lower_bound(
+      entries_.begin(), entries_.end(), pc,
+      [](const Entry& entry, std::uint16_t addr) { return entry.pc < addr; });
+  return it != entries_.end() && it->pc == pc ? &*it : nullptr;
+}
+
+bool Breakpoints::add(std::uint16_t pc, std::string_view condition,
+                      std::string& error) {
+  Condition compiled;
+  if (!Condition::compile(condition, compiled, error)) return false;
+  if (Entry* entry = find(pc)) {
+    entry->condition = std::move(compiled);
+    return true;
+  }
+  const auto it = std::lower_bound(
+      entries_.begin(), entries_.end(), pc,
+      [](const Entry& entry, std::uint16_t addr) { return entry.pc < addr; });
+  entries_.insert(it, Entry{pc, std::move(compiled), 0});
+  bus_.set_trap(pc, true);
+  return true;
+}
+
+bool Breakpoints::remove(std::uint16_t pc) {
+  Entry* entry = find(pc);
+  if (!entry) return false;
+  entries_.erase(entries_.begin() + (entry - entries_.data()));
+  bus_.set_trap(pc, false);
+  return true;
+}
+
+void Breakpoints::clear() {
+  for (const Entry& entry : entries_) bus_.set_trap(entry.pc, false);
+  entries_.clear();
+}
+
+std::uint64_t Breakpoints::hits(std::uint16_t pc) const {
+  const auto it = std::lower_bound(
+      entries_.begin(), entries_.end(), pc,
+      [](const Entry& entry, std::uint16_t addr) { return entry.pc < addr; });
+  return it != entries_.end() && it->pc == pc ? it->hits : 0;
+}
+
+TrapHandler::Action Breakpoints::on_trap(CPU& cpu, Bus& bus) {
+  Entry* entry = find(cpu.PC);
+  if (!entry || !entry->condition.eval(cpu, bus)) return Action::Execute;
+  ++entry->hits;
+  last_hit_ = cpu.PC;
+  return Action::Stop;
+}
+
+}; // namespace emu
@@ -0,0 +1,117 @@
+#include <bus.hpp>
+#include <coverage.hpp>
+
+#include <cassert>
+#include <utility>
+
+namespace emu {
+
+Bus::Bus() {
+  regions_.push_back({"cpu", 0x10000, 0});
+  unmap(0, 0x10000);
+  dirty_.fill(1);
+}
+
+void Bus::map_ram(std::uint16_t addr, size_t size, std::uint8_t* mem,
+                  size_t mem_size) {
+  if (mem_size == 0) mem_size = size;
+  assert(addr % PageSize == 0 && size % PageSize == 0);
+  if (coverage_) coverage_->flush(addr, size);
+  assert(mem_size % PageSize == 0 && size % mem_size == 0);
+  const size_t first = addr >> PageBits;
+  for (size_t i = 0; i < size / PageSize; ++i) {
+    std::uint8_t* base = mem + (i * PageSize) % mem_size;
+    set_page(first + i, base, base, nullptr, 0,
+             static_cast<std::uint32_t>((first + i) << PageBits));
+  }
+}
+
+void Bus::map_rom(std::uint16_t addr, size_t size, const std::uint8_t* mem,
+                  std::uint16_t region, std::uint32_t offset,
+                  Device* registers) {
+  assert(addr % PageSize == 0 && size % PageSize == 0);
+  assert(region < regions_.size());
+  if (coverage_) coverage_->flush(addr, size);
+  const size_t first = addr >> PageBits;
+  for (size_t i = 0; i < size / PageSize; ++i) {
+    const auto page_offset = static_cast<std::uint32_t>(i * PageSize);
+    const std::uint32_t loc = region == 0
+                                  ? static_cast<std::uint32_t>((first + i) << PageBits)
+                                  : offset + page_offset;
+    set_page(first + i, mem + page_offset, nullptr, registers, region, loc);
+  }
+}
+
+void Bus::map_overlay(std::uint16_t addr, size_t size, const std::uint8_t* rom,
+                      std::uint8_t* ram, std::uint16_t region, std::uint32_t offset) {
+  assert(addr % PageSize == 0 && size % PageSize == 0);
+  assert(region < regions_.size());
+  if (coverage_) coverage_->flush(addr, size);
+  const size_t first = addr >> PageBits;
+  for (size_t i = 0; i < size / PageSize; ++i) {
+    const auto page_offset = static_cast<std::uint32_t>(i * PageSize);
+    const std::uint32_t loc = region == 0
+                                  ? static_cast<std::uint32_t>((first + i) << PageBits)
+                                  : offset + page_offset;
+    set_page(first + i, rom + page_offset, ram + page_offset, nullptr, region, loc);
+  }
+}
+
+void Bus::mark_dirty(std::uint16_t addr, size_t size) {
+  if (size == 0) return;
+  const size_t last = (addr + size - 1) >> PageBits;
+  for (size_t page = addr >> PageBits; page <= last && page < NumPages; ++page) dirty_[page] = 1;
+}
+
+void Bus::clear_dirty(std::uint16_t addr, size_t size) {
+  if (size == 0) return;
+  const size_t last = (addr + size - 1) >> PageBits;
+  for (size_t page = addr >> PageBits; page <= last && page < NumPages; ++page) dirty_[page] = 0;
+}
+
+void Bus::map_device(std::uint16_t addr, size_t size, Device* device) {
+  assert(addr % PageSize == 0 && size % PageSize == 0);
+  if (coverage_) coverage_->flush(addr, size);
+  const size_t first = addr >> PageBits;
+  for (size_t i = 0; i < size / PageSize; ++i) {
+    set_page(first + i, nullptr, nullptr, device, 0,
+             static_cast<std::uint32_t>((first + i) << PageBits));
+  }
+}
+
+void Bus::unmap(std::uint16_t addr, size_t size) {
+  map_device(addr, size, nullptr);
+}
+
+void Bus::set_page(size_t index, const std::uint8_t* read, std::uint8_t* write,
+                   Device* device, std::uint16_t region, std::uint32_t offset) {
+  Page& page = pages_[index];
+  page.read = read;
+  page.write = write;
+  page.device = device;
+  page.region = region;
+  page.offset = offset;
+}
+
+void Bus::set_trap(std::uint16_t addr, bool on) {
+  if (trap_users_.empty()) trap_users_.resize(0x10000);
+  std::uint8_t& users = trap_users_[addr];
+  if (on ? users++ != 0 : users == 0 || --users != 0) return;
+  traps_[addr >> 6] ^= std::uint64_t{1} << (addr & 63);
+  Page& page = pages_[addr >> PageBits];
+  if (on) {
+    ++page.traps;
+    ++num_traps_;
+  } else {
+    --page.traps;
+    --num_traps_;
+  }
+}
+
+std::uint16_t Bus::add_region(std::string name, std::uint32_t size,
+                              std::uint16_t base) {
+  regions_.push_back({std::move(name), size, base});
+  return static_cast<std::uint16_t>(regions_.size() - 1);
+}
+
+}; // namespace emu
@@ -0,0 +1,292 @@
+#include <c64.hpp>
+#include <natives.hpp>
+
+#include <algorithm>
+#include <utility>
+
+namespace emu {
+
+namespace {
+
+constexpr std::uint16_t KeyboardBuffer = 0x0277;
+constexpr std::uint16_t KeyboardCount = 0xC6;
+constexpr size_t KeyboardSize = 10;
+constexpr std::uint16_t BasicStart = 0x0801;
+/// BASIC's pointers to the end of the program, arrays and strings.
+constexpr std::uint16_t BasicEnds[] = {0x2D, 0x2F, 0x31};
+constexpr std::uint16_t EndAddress = 0xAE;
+/// Processor port bits read as 1 when they are inputs: LORAM, HIRAM,
+/// CHAREN and the (open) cassette switch.
+constexpr std::uint8_t PortPullUps = 0x17;
+
+/// PETSCII for ASCII text, unshifted: lower case letters type as the
+/// capitals of the default character set.
+std::uint8_t petscii(char c) {
+  if (c >= 'a' && c <= 'z') return static_cast<std::uint8_t>(c - 'a' + 'A');
+  if (c == '\n') return 13;
+  return static_cast<std::uint8_t>(c);
+}
+
+} // namespace
+
+C64::C64() {
+  kernal_region_ = bus_.add_region("kernal", static_cast<std::uint32_t>(kernal_.size()), 0xE000);
+  basic_region_ = bus_.add_region("basic", static_cast<std::uint32_t>(basic_.size()), 0xA000);
+  chargen_region_ = bus_.add_region("chargen", static_cast<std::uint32_t>(chargen_.size()), 0xD000);
+  cpu_.trap_handler = &hooks_;
+
+  bus_.map_ram(0x0000, ram_.size(), ram_.data());
+  bus_.map_rom(0x0000, Bus::PageSize, ram_.data(), 0, 0, this);
+  vic_.set_memory(ram_.data(), chargen_.data(), color_ram_.data());
+  update_port();
+}
+
+bool C64::load_roms(std::vector<std::uint8_t> kernal, std::vector<std::uint8_t> basic,
+                    std::vector<std::uint8_t> chargen, std::string& error) {
+  if (kernal.size() != kernal_.size()) {
+    error = "KERNAL ROM must be 8K";
+    return false;
+  }
+  if (basic.size() != basic_.size()) {
+    error = "BASIC ROM must be 8K";
+    return false;
+  }
+  if (chargen.size() != chargen_.size()) {
+    error = "character ROM must be 4K";
+    return false;
+  }
+  std::copy(kernal.begin(), kernal.end(), kernal_.begin());
+  std::copy(basic.begin(), basic.end(), basic_.begin());
+  std::copy(chargen.begin(), chargen.end(), chargen_.begin());
+  reset();
+  return true;
+}
+
+void C64::reset() {
+  port_direction_ = 0;
+  port_data_ = 0;
+  banks_ = 0xFF;
+  update_port();
+  cia1_.reset();
+  cia2_.reset();
+  vic_.set_bank(0);
+  sid_.reset();
+  cpu_.reset(bus_);
+  if (drive_) {
+    drive_->reset();
+    write_port(cia2_, 0, cia2_.port_output(0));
+  }
+}
+
+template <typename Archive, typename Self> void C64::fields(Archive& archive, Self& self) {
+  archive(self.ram_, self.color_ram_, self.port_direction_, self.port_data_, self.keys_,
+          self.joysticks_);
+}
+
+void C64::save(SnapshotWriter& out) const {
+  fields(out, *this);
+  cia1_.save(out);
+  cia2_.save(out);
+  vic_.save(out);
+  sid_.save(out);
+}
+
+void C64::restore(SnapshotReader& in) {
+  fields(in, *this);
+  cia1_.restore(in);
+  cia2_.restore(in);
+  vic_.restore(in);
+  sid_.restore(in);
+  banks_ = 0xFF;
+  update_port();
+  bus_.mark_dirty(0, 0x10000);
+}
+
+void C64::update_port() {
+  ram_[0] = port_direction_;
+  ram_[1] = static_cast<std::uint8_t>((port_data_ & port_direction_) |
+                                      (PortPullUps & ~port_direction_));
+  map_banks(ram_[1] & 0x07);
+}
+
+void C64::map_banks(std::uint8_t config) {
+  if (config == banks_) return;
+  banks_ = config;
+  const bool loram = config & 0x01;
+  const bool hiram = config & 0x02;
+  const bool charen = config & 0x04;
+
+  if (loram && hiram) {
+    bus_.map_overlay(0xA000, basic_.size(), basic_.data(), ram_.data() + 0xA000, basic_region_);
+  } else {
+    bus_.map_ram(0xA000, basic_.size(), ram_.data() + 0xA000);
+  }
+  if (hiram) {
+    bus_.map_overlay(0xE000, kernal_.size(), kernal_.data(), ram_.data() + 0xE000, kernal_region_);
+  } else {
+    bus_.map_ram(0xE000, kernal_.size(), ram_.data() + 0xE000);
+  }
+  if (!loram && !hiram) {
+    bus_.map_ram(0xD000, 0x1000, ram_.data() + 0xD000);
+  } else if (!charen) {
+    bus_.map_overlay(0xD000, chargen_.size(), chargen_.data(), ram_.data() + 0xD000, chargen_region_);
+  } else {
+    bus_.map_device(0xD000, 0x400, &vic_);
+    bus_.map_device(0xD400, 0x400, &sid_);
+    bus_.map_ram(0xD800, color_ram_.size(), color_ram_.data());
+    bus_.map_device(0xDC00, 0x100, &cia1_);
+    bus_.map_device(0xDD00, 0x100, &cia2_);
+    bus_.unmap(0xDE00, 0x200);
+  }
+}
+
+std::uint64_t C64::next_event() const {
+  return std::min({vic_.next_event(), cia1_.next_event(), cia2_.next_event()});
+}
+
+void C64::run_until(std::uint64_t cycle) {
+  while (cpu_.cycles < cycle) {
+    cpu_.run(bus_, std::min(cycle, next_event()));
+    // The VIC-II first: it may take cycles from the CPU, which the CIAs
+    // then count too.
+    vic_.catch_up(cpu_.cycles);
+    cia1_.catch_up(cpu_.cycles);
+    cia2_.catch_up(cpu_.cycles);
+    sid_.catch_up(cpu_.cycles);
+    if (cpu_.stop_requested) break;
+  }
+  if (drive_) sync_drive();
+}
+
+void C64::run_frame() { run_until(vic_.next_frame()); }
+
+void C64::set_key(int row, int column, bool pressed) {
+  const auto bit = static_cast<std::uint8_t>(1 << (column & 7));
+  std::uint8_t& keys = keys_[row & 7];
+  keys = pressed ? (keys | bit) : (keys & ~bit);
+}
+
+size_t C64::type(std::string_view text) {
+  size_t count = std::min<size_t>(ram_[KeyboardCount], KeyboardSize);
+  size_t typed = 0;
+  for (; typed < text.size() && count < KeyboardSize; ++typed) {
+    ram_[KeyboardBuffer + count++] = petscii(text[typed]);
+  }
+  ram_[KeyboardCount] = static_cast<std::uint8_t>(count);
+  return typed;
+}
+
+bool C64::load_prg(const std::vector<std::uint8_t>& prg, std::string& error) {
+  if (prg.size() < 2) {
+    error = "not a .prg file";
+    return false;
+  }
+  const std::uint16_t start = static_cast<std::uint16_t>(prg[0] | prg[1] << 8);
+  const size_t end = start + prg.size() - 2;
+  if (end > 0x10000) {
+    error = "program does not fit in memory";
+    return false;
+  }
+  std::copy(prg.begin() + 2, prg.end(), ram_.begin() + start);
+  const auto set_pointer = [&](std::uint16_t addr) {
+    ram_[addr] = static_cast<std::uint8_t>(end);
+    ram_[addr + 1] = static_cast<std::uint8_t>(end >> 8);
+  };
+  set_pointer(EndAddress);
+  if (start == BasicStart) {
+    for (const std::uint16_t pointer : BasicEnds) set_pointer(pointer);
+  }
+  add_known_routines(hooks_, start, static_cast<std::uint32_t>(end));
+  return true;
+}
+
+void C64::mount_disk(std::uint8_t device, D64 disk) {
+  if (!loader_) loader_ = std::make_unique<FastLoader>(hooks_);
+  loader_->mount_disk(device, std::move(disk));
+}
+
+bool C64::attach_drive(std::vector<std::uint8_t> rom, std::string& error) {
+  auto drive = std::make_unique<Drive1541>();
+  if (!drive->load_rom(std::move(rom), error)) return false;
+  drive_ = std::move(drive);
+  write_port(cia2_, 0, cia2_.port_output(0));
+  return true;
+}
+
+void C64::sync_drive() {
+  // The drive's 1 MHz clock in C64 cycles, without overflowing.
+  const auto rate = static_cast<std::uint64_t>(ClockRate);
+  const std::uint64_t seconds = cpu_.cycles / rate;
+  drive_->run_until(seconds * 1000000 + (cpu_.cycles % rate) * 1000000 / rate);
+}
+
+std::uint8_t C64::read(std::uint16_t addr) { return ram_[addr]; }
+
+void C64::write(std::uint16_t addr, std::uint8_t value) {
+  switch (addr) {
+  case 0x0000:
+    port_direction_ = value;
+    update_port();
+    break;
+  case 0x0001:
+    port_data_ = value;
+    update_port();
+    break;
+  default:
+    ram_[addr] = value;
+    break;
+  }
+}
+
+std::uint8_t C64::peek(std::uint16_t addr) { return ram_[addr]; }
+
+std::uint8_t C64::read_port(const Cia& cia, int port, std::uint8_t output) {
+  std::uint8_t value = output;
+  if (&cia == &cia1_) {
+    // The keyboard matrix connects the two ports, so a key pulls low
+    // whichever of its two lines is not driven low by the other side.
+    if (port == 0) {
+      const std::uint8_t columns = cia1_.port_output(1);
+      for (int row = 0; row < 8; ++row) {
+        if (keys_[row] & ~columns) value &= ~(1 << row);
+      }
+      value &= ~joysticks_[1];
+    } else {
+      const std::uint8_t rows = cia1_.port_output(0);
+      for (int row = 0; row < 8; ++row) {
+        if (!((rows >> row) & 1)) value &= ~keys_[row];
+      }
+      value &= ~joysticks_[0];
+    }
+    return value;
+  }
+  if (port == 0) {
+    // Serial bus inputs: CLK and DATA read low while the C64 itself pulls
+    // them low through the inverting outputs on bits 4 and 5, or the drive
+    // pulls them low.
+    bool clk = output & 0x10;
+    bool data = output & 0x20;
+    if (drive_) {
+      sync_drive();
+      clk = clk || drive_->pulls_clk();
+      data = data || drive_->pulls_data();
+    }
+    value = static_cast<std::uint8_t>((output & 0x3F) | (clk ? 0 : 0x40) | (data ? 0 : 0x80));
+  }
+  return value;
+}
+
+void C64::write_port(const Cia& cia, int port, std::uint8_t output) {
+  if (&cia != &cia2_ || port != 0) return;
+  // The VIC-II's bank is selected by the inverse of port A's low bits.
+  vic_.sync();
+  vic_.set_bank(3 - (output & 3));
+  if (drive_) {
+    // ATN, CLK and DATA outputs on bits 3-5; the drive sees a change at
+    // the cycle it happens.
+    sync_drive();
+    drive_->set_host_lines(output & 0x08, output & 0x10, output & 0x20);
+  }
+}
+
+}; // namespace emu
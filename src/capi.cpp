@@ -0,0 +1,517 @@
+#include <emu.h>
+
+#include <apple2.hpp>
+#include <bus.hpp>
+#include <c64.hpp>
+#include <cpu.hpp>
+#include <fastload.hpp>
+#include <idioms.hpp>
+#include <nes.hpp>
+#include <snapshot.hpp>
+#include <vecenv.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <new>
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace {
+
+using namespace emu;
+
+/// A 6502 with 64K of RAM and nothing else, as `emu run` uses.
+struct Bare final {
+  Bare() { bus.map_ram(0, ram.size(), ram.data()); }
+
+  CPU cpu;
+  Bus bus;
+  Idioms idioms;
+  std::array<std::uint8_t, 0x10000> ram{};
+};
+
+constexpr char SnapshotMagic[4] = {'E', 'M', 'U', 'S'};
+
+/// Identifies the cartridge a NES snapshot belongs to, whose ROM is not
+/// part of it.
+std::uint32_t cartridge_id(Nes& nes) {
+  return static_cast<std::uint32_t>(nes.cartridge().mapper()) << 16 |
+         static_cast<std::uint32_t>(nes.cartridge().prg_banks());
+}
+
+} // namespace
+
+struct emu_machine {
+  explicit emu_machine(emu_kind kind) : kind(kind) {
+    switch (kind) {
+    case EMU_NES: nes = std::make_unique<Nes>(); break;
+    case EMU_C64: c64 = std::make_unique<C64>(); break;
+    case EMU_APPLE2: apple2 = std::make_unique<Apple2>(); break;
+    default: bare = std::make_unique<Bare>(); break;
+    }
+  }
+
+  CPU& cpu() const {
+    if (nes) return nes->cpu();
+    if (c64) return c64->cpu();
+    if (apple2) return apple2->cpu();
+    return bare->cpu;
+  }
+
+  int fail(std::string message, int status = EMU_ERROR) {
+    error = std::move(message);
+    return status;
+  }
+  /// For exception handlers, which must not throw themselves.
+  void set_error(const char* message) const noexcept {
+    try {
+      error = message;
+    } catch (...) {
+      error.clear();
+    }
+  }
+
+  /// Hands the system ROMs over once all of them are there.
+  int install_roms() {
+    if (c64 && kernal && basic && chargen) {
+      if (!c64->load_roms(*kernal, *basic, *chargen, error)) return EMU_ERROR;
+    } else if (apple2 && rom && chargen) {
+      if (!apple2->load_roms(*rom, *chargen, error)) return EMU_ERROR;
+    }
+    return EMU_OK;
+  }
+
+  emu_kind kind;
+  std::unique_ptr<Bare> bare;
+  std::unique_ptr<Nes> nes;
+  std::unique_ptr<C64> c64;
+  std::unique_ptr<Apple2> apple2;
+  /// System ROMs loaded so far.
+  std::optional<std::vector<std::uint8_t>> kernal, basic, chargen, rom;
+  mutable std::string error;
+};
+
+namespace {
+
+/// Runs the body of an entry point. No C++ exception may cross the C ABI:
+/// one that escapes is recorded as the machine's last error, if there is a
+/// machine, and `fallback` is returned instead.
+template <typename Body, typename Result = std::invoke_result_t<Body&>>
+Result guard(const emu_machine* machine, std::common_type_t<Result> fallback,
+             Body&& body) noexcept {
+  try {
+    return body();
+  } catch (const std::exception& e) {
+    if (machine) machine->set_error(e.what());
+  } catch (...) {
+    if (machine) machine->set_error("unknown error");
+  }
+  return fallback;
+}
+
+template <typename Body> void guard(const emu_machine* machine, Body&& body) noexcept {
+  guard(machine, 0, [&] {
+    body();
+    return 0;
+  });
+}
+
+} // namespace
+
+extern "C" {
+
+int emu_api_version(void) { return EMU_API_VERSION; }
+
+emu_machine* emu_create(emu_kind kind) {
+  return guard(nullptr, nullptr, [&] { return new emu_machine(kind); });
+}
+
+void emu_destroy(emu_machine* machine) { delete machine; }
+
+const char* emu_last_error(const emu_machine* machine) { return machine->error.c_str(); }
+
+int emu_load(emu_machine* machine, emu_image image, const uint8_t* data, size_t size,
+             uint16_t address) {
+  return guard(machine, EMU_ERROR, [&]() -> int {
+    std::vector<std::uint8_t> bytes(data, data + size);
+    std::string& error = machine->error;
+    switch (image) {
+    case EMU_IMAGE_BINARY:
+      if (machine->bare) {
+        if (address + size > machine->bare->ram.size()) return machine->fail("image does not fit in memory");
+        std::memcpy(machine->bare->ram.data() + address, data, size);
+        machine->bare->bus.mark_dirty(address, size);
+        return EMU_OK;
+      }
+      if (machine->apple2) return machine->apple2->load(address, bytes, error) ? EMU_OK : EMU_ERROR;
+      break;
+    case EMU_IMAGE_INES:
+      if (machine->nes) return machine->nes->load(std::move(bytes), error) ? EMU_OK : EMU_ERROR;
+      break;
+    case EMU_IMAGE_KERNAL:
+    case EMU_IMAGE_BASIC:
+      if (!machine->c64) break;
+      (image == EMU_IMAGE_KERNAL ? machine->kernal : machine->basic) = std::move(bytes);
+      return machine->install_roms();
+    case EMU_IMAGE_CHARGEN:
+      if (!machine->c64 && !machine->apple2) break;
+      machine->chargen = std::move(bytes);
+      return machine->install_roms();
+    case EMU_IMAGE_ROM:
+      if (!machine->apple2) break;
+      machine->rom = std::move(bytes);
+      return machine->install_roms();
+    case EMU_IMAGE_PRG:
+      if (machine->c64) return machine->c64->load_prg(bytes, error) ? EMU_OK : EMU_ERROR;
+      break;
+    case EMU_IMAGE_D64:
+      if (machine->c64) {
+        D64 disk;
+        if (!disk.load(std::move(bytes), error)) return EMU_ERROR;
+        if (machine->c64->drive()) {
+          machine->c64->insert_disk(disk);
+        } else {
+          machine->c64->mount_disk(8, std::move(disk));
+        }
+        return EMU_OK;
+      }
+      break;
+    case EMU_IMAGE_DRIVE_ROM:
+      if (machine->c64) return machine->c64->attach_drive(std::move(bytes), error) ? EMU_OK : EMU_ERROR;
+      break;
+    }
+    return machine->fail("image not supported by this machine", EMU_UNSUPPORTED);
+  });
+}
+
+void emu_reset(emu_machine* machine) {
+  guard(machine, [&] {
+    if (machine->nes) machine->nes->reset();
+    if (machine->c64) machine->c64->reset();
+    if (machine->apple2) machine->apple2->reset();
+    if (machine->bare) machine->bare->cpu.reset(machine->bare->bus);
+  });
+}
+
+uint64_t emu_run_cycles(emu_machine* machine, uint64_t cycles) {
+  return guard(machine, std::uint64_t{0}, [&] {
+    CPU& cpu = machine->cpu();
+    const std::uint64_t start = cpu.cycles;
+    if (machine->nes) machine->nes->run_until(start + cycles);
+    if (machine->c64) machine->c64->run_until(start + cycles);
+    if (machine->apple2) machine->apple2->run_until(start + cycles);
+    if (machine->bare) cpu.run(machine->bare->bus, start + cycles);
+    return cpu.cycles - start;
+  });
+}
+
+int emu_run_frame(emu_machine* machine) {
+  return guard(machine, EMU_ERROR, [&]() -> int {
+    if (machine->nes) {
+      machine->nes->run_frame();
+    } else if (machine->c64) {
+      machine->c64->run_frame();
+    } else if (machine->apple2) {
+      machine->apple2->run_frame();
+    } else {
+      return machine->fail("the bare machine has no frames", EMU_UNSUPPORTED);
+    }
+    return EMU_OK;
+  });
+}
+
+void emu_set_idioms(emu_machine* machine, int enabled) {
+  guard(machine, [&] {
+    if (machine->nes) machine->nes->set_idioms(enabled);
+    if (machine->c64) machine->c64->set_idioms(enabled);
+    if (machine->apple2) machine->apple2->set_idioms(enabled);
+    if (machine->bare) machine->bare->cpu.idioms = enabled ? &machine->bare->idioms : nullptr;
+  });
+}
+
+int emu_set_strict(emu_machine* machine, int enabled) {
+  return guard(machine, EMU_ERROR, [&]() -> int {
+    if (!machine->c64) return machine->fail("the machine has no native routines", EMU_UNSUPPORTED);
+    machine->c64->set_strict(enabled);
+    return EMU_OK;
+  });
+}
+
+int emu_set_buttons(emu_machine* machine, int port, uint8_t buttons) {
+  return guard(machine, EMU_ERROR, [&]() -> int {
+    if (machine->nes) {
+      machine->nes->set_buttons(port, buttons);
+    } else if (machine->c64) {
+      machine->c64->set_joystick(port + 1, buttons);
+    } else {
+      return machine->fail("the machine has no controllers", EMU_UNSUPPORTED);
+    }
+    return EMU_OK;
+  });
+}
+
+int emu_type(emu_machine* machine, const char* text) {
+  return guard(machine, EMU_ERROR, [&]() -> int {
+    if (machine->c64) return static_cast<int>(machine->c64->type(text));
+    if (machine->apple2) {
+      machine->apple2->type(text);
+      return static_cast<int>(std::strlen(text));
+    }
+    return machine->fail("the machine has no keyboard", EMU_UNSUPPORTED);
+  });
+}
+
+emu_view emu_memory_view(emu_machine* machine, emu_memory memory) {
+  return guard(machine, emu_view{}, [&] {
+    emu_view view{};
+    if (memory == EMU_MEMORY_RAM) {
+      if (machine->nes) view = {machine->nes->ram(), 0x800, 0, 0};
+      if (machine->c64) view = {machine->c64->ram(), 0x10000, 0, 0};
+      if (machine->apple2) view = {machine->apple2->ram(), 0xC000, 0, 0};
+      if (machine->bare) view = {machine->bare->ram.data(), machine->bare->ram.size(), 0, 0};
+    } else if (memory == EMU_MEMORY_FRAME) {
+      // The frames are only read by the caller; the view is mutable for
+      // uniformity with RAM.
+      if (machine->nes) {
+        view = {const_cast<std::uint8_t*>(machine->nes->ppu().frame()),
+                size_t{Ppu::Width} * Ppu::Height, Ppu::Width, Ppu::Height};
+      } else if (machine->c64) {
+        view = {const_cast<std::uint8_t*>(machine->c64->vic().frame()),
+                size_t{Vic::Width} * Vic::Height, Vic::Width, Vic::Height};
+      } else if (machine->apple2) {
+        view = {const_cast<std::uint8_t*>(machine->apple2->frame()),
+                size_t{Apple2::Width} * Apple2::Height, Apple2::Width, Apple2::Height};
+      }
+    }
+    if (!view.data) machine->fail("the machine has no such memory", EMU_UNSUPPORTED);
+    return view;
+  });
+}
+
+void emu_memory_written(emu_machine* machine, uint16_t address, size_t size) {
+  guard(machine, [&] {
+    if (machine->nes) machine->nes->bus().mark_dirty(address, size);
+    if (machine->c64) machine->c64->bus().mark_dirty(address, size);
+    if (machine->apple2) machine->apple2->bus().mark_dirty(address, size);
+    if (machine->bare) machine->bare->bus.mark_dirty(address, size);
+  });
+}
+
+const uint32_t* emu_palette(const emu_machine* machine, size_t* count) {
+  const std::uint32_t* colours = nullptr;
+  size_t size = 0;
+  if (machine->nes) {
+    colours = Ppu::Palette.data();
+    size = Ppu::Palette.size();
+  } else if (machine->c64) {
+    colours = Vic::Palette.data();
+    size = Vic::Palette.size();
+  } else if (machine->apple2) {
+    colours = Apple2::Palette.data();
+    size = Apple2::Palette.size();
+  }
+  if (count) *count = size;
+  return colours;
+}
+
+void emu_get_cpu(const emu_machine* machine, emu_cpu_state* state) {
+  guard(machine, [&] {
+    const CPU& cpu = machine->cpu();
+    *state = {cpu.PC, cpu.A, cpu.X, cpu.Y, cpu.SP, cpu.Status, cpu.cycles};
+  });
+}
+
+void emu_set_cpu(emu_machine* machine, const emu_cpu_state* state) {
+  guard(machine, [&] {
+    CPU& cpu = machine->cpu();
+    cpu.PC = state->pc;
+    cpu.A = state->a;
+    cpu.X = state->x;
+    cpu.Y = state->y;
+    cpu.SP = state->sp;
+    cpu.Status = state->status | CPU::U;
+    cpu.cycles = state->cycles;
+  });
+}
+
+} // extern "C"
+
+namespace {
+
+/// Writes the snapshot to `out`, or only measures it when `out` is null.
+/// Returns 0 for machines without snapshots.
+size_t write_snapshot(const emu_machine* machine, std::uint8_t* out) {
+  if (machine->nes && machine->nes->cartridge().prg_banks() == 0) return 0;
+  if (machine->c64 && machine->c64->drive()) return 0;
+  const CPU& cpu = machine->cpu();
+  SnapshotWriter writer(out);
+  writer.bytes(SnapshotMagic, sizeof(SnapshotMagic));
+  writer.value(static_cast<std::uint8_t>(machine->kind));
+  if (machine->nes) writer.value(cartridge_id(*machine->nes));
+  writer.value(cpu.PC);
+  for (const CPU::Register reg : {cpu.A, cpu.X, cpu.Y, cpu.SP, cpu.Status, cpu.irq_lines}) {
+    writer.value(reg);
+  }
+  writer.value(cpu.cycles);
+  writer.value(static_cast<std::uint8_t>(cpu.nmi_pending | cpu.jammed << 1));
+  if (machine->bare) {
+    writer.bytes(machine->bare->ram.data(), machine->bare->ram.size());
+  } else if (machine->apple2) {
+    const Apple2::State state = machine->apple2->state();
+    writer.value(state.switches);
+    writer.value(state.key);
+    writer.value(state.frames);
+    writer.bytes(machine->apple2->ram(), 0xC000);
+  } else if (machine->nes) {
+    machine->nes->save(writer);
+  } else {
+    machine->c64->save(writer);
+  }
+  return writer.size();
+}
+
+} // namespace
+
+extern "C" {
+
+size_t emu_snapshot_size(const emu_machine* machine) { return write_snapshot(machine, nullptr); }
+
+int emu_save(const emu_machine* machine, uint8_t* buffer, size_t size) {
+  return guard(machine, EMU_ERROR, [&]() -> int {
+    const size_t needed = write_snapshot(machine, nullptr);
+    if (needed == 0) return EMU_UNSUPPORTED;
+    if (size < needed) return EMU_BAD_SIZE;
+    write_snapshot(machine, buffer);
+    return EMU_OK;
+  });
+}
+
+int emu_restore(emu_machine* machine, const uint8_t* buffer, size_t size) {
+  return guard(machine, EMU_ERROR, [&]() -> int {
+    const size_t needed = write_snapshot(machine, nullptr);
+    if (needed == 0) return machine->fail("the machine has no snapshots", EMU_UNSUPPORTED);
+    if (size != needed) return machine->fail("snapshot size does not match", EMU_BAD_SIZE);
+
+    // Everything is read before anything changes, so a bad snapshot leaves
+    // the machine as it was.
+    SnapshotReader reader(buffer, size);
+    char magic[4];
+    std::uint8_t kind = 0, flags = 0;
+    CPU::Register regs[6];
+    std::uint16_t pc = 0;
+    std::uint64_t cycles = 0;
+    std::uint32_t cartridge = 0;
+    reader.bytes(magic, sizeof(magic));
+    reader.value(kind);
+    if (machine->nes) reader.value(cartridge);
+    reader.value(pc);
+    for (CPU::Register& reg : regs) reader.value(reg);
+    reader.value(cycles);
+    reader.value(flags);
+    if (std::memcmp(magic, SnapshotMagic, sizeof(magic)) != 0 || kind != machine->kind) {
+      return machine->fail("not a snapshot of this machine");
+    }
+    if (machine->nes && cartridge != cartridge_id(*machine->nes)) {
+      return machine->fail("snapshot of another cartridge");
+    }
+    Apple2::State state;
+    if (machine->apple2) {
+      reader.value(state.switches);
+      reader.value(state.key);
+      reader.value(state.frames);
+    }
+
+    CPU& cpu = machine->cpu();
+    cpu.PC = pc;
+    cpu.A = regs[0];
+    cpu.X = regs[1];
+    cpu.Y = regs[2];
+    cpu.SP = regs[3];
+    cpu.Status = regs[4];
+    cpu.irq_lines = regs[5];
+    cpu.cycles = cycles;
+    cpu.nmi_pending = flags & 1;
+    cpu.jammed = flags & 2;
+    if (machine->bare) {
+      reader.bytes(machine->bare->ram.data(), machine->bare->ram.size());
+      machine->bare->bus.mark_dirty(0, machine->bare->ram.size());
+    } else if (machine->apple2) {
+      machine->apple2->restore(state);
+      reader.bytes(machine->apple2->ram(), 0xC000);
+      machine->apple2->bus().mark_dirty(0, 0xC000);
+    } else if (machine->nes) {
+      machine->nes->restore(reader);
+    } else {
+      machine->c64->restore(reader);
+    }
+    return EMU_OK;
+  });
+}
+
+} // extern "C"
+
+struct emu_vec {
+  VectorEnv env;
+};
+
+extern "C" {
+
+emu_vec* emu_vec_create(const emu_vec_config* config, char* error, size_t error_size) {
+  std::string message;
+  try {
+    VectorEnv::Config settings;
+    settings.count = config->count;
+    settings.frameskip = config->frameskip;
+    settings.downscale = config->downscale;
+    for (size_t i = 0; i < config->num_slices; ++i) {
+      settings.slices.push_back({config->slices[i].address, config->slices[i].size});
+    }
+    for (size_t i = 0; i < config->num_rewards; ++i) {
+      const emu_reward_term& term = config->rewards[i];
+      settings.rewards.push_back({term.address, term.size, term.bcd != 0, term.weight});
+    }
+    settings.done_test = config->done_test != 0;
+    settings.done_address = config->done_address;
+    settings.done_mask = config->done_mask;
+    settings.done_value = config->done_value;
+
+    auto vec = std::make_unique<emu_vec>();
+    if (vec->env.load({config->ines, config->ines + config->ines_size}, std::move(settings),
+                      message)) {
+      return vec.release();
+    }
+  } catch (const std::bad_alloc&) {
+    message = "out of memory";
+  } catch (...) {
+    message = "internal error";
+  }
+  if (error && error_size) {
+    const size_t length = std::min(message.size(), error_size - 1);
+    std::memcpy(error, message.data(), length);
+    error[length] = '\0';
+  }
+  return nullptr;
+}
+
+void emu_vec_destroy(emu_vec* vec) { delete vec; }
+
+size_t emu_vec_observation_size(const emu_vec* vec) { return vec->env.observation_size(); }
+
+int emu_vec_reset(emu_vec* vec, uint8_t* observations) {
+  vec->env.reset(observations);
+  return EMU_OK;
+}
+
+void emu_vec_step(emu_vec* vec, const uint8_t* buttons, uint8_t* observations, float* rewards,
+                  uint8_t* dones) {
+  guard(nullptr, [&] {
+    vec->env.step(buttons, observations, rewards, dones);
+  });
+}
+
+} // extern "C"
@@ -0,0 +1,282 @@
+#include <cia.hpp>
+#include <cpu.hpp>
+#include <snapshot.hpp>
+
+#include <algorithm>
+#include <limits>
+
+namespace emu {
+
+namespace {
+
+constexpr std::uint8_t IcrTimerA = 0x01;
+constexpr std::uint8_t IcrTimerB = 0x02;
+constexpr std::uint8_t IcrAlarm = 0x04;
+constexpr std::uint8_t ControlStart = 0x01;
+constexpr std::uint8_t ControlLoad = 0x10;
+constexpr std::uint8_t ControlAlarm = 0x80;
+
+std::uint8_t bcd_increment(std::uint8_t value) {
+  return static_cast<std::uint8_t>((value & 0x0F) == 9 ? (value & 0xF0) + 0x10 : value + 1);
+}
+
+} // namespace
+
+std::uint64_t Cia::Timer::advance(std::uint64_t ticks) {
+  if (ticks < remaining()) {
+    counter = static_cast<std::uint16_t>(counter - ticks);
+    return 0;
+  }
+  ticks -= remaining();
+  if (one_shot()) {
+    counter = latch;
+    control &= ~ControlStart;
+    return 1;
+  }
+  const std::uint64_t period = latch + std::uint64_t{1};
+  counter = static_cast<std::uint16_t>(latch - ticks % period);
+  return 1 + ticks / period;
+}
+
+Cia::Cia(CPU& cpu, CiaPorts& ports, Line line, std::uint8_t irq_source, std::uint32_t tod_period)
+    : cpu_(cpu), ports_(ports), line_(line), irq_source_(irq_source), tod_period_(tod_period) {
+  reset();
+}
+
+void Cia::reset() {
+  std::fill(std::begin(data_), std::end(data_), 0);
+  std::fill(std::begin(ddr_), std::end(ddr_), 0);
+  timer_[0] = Timer{};
+  timer_[1] = Timer{};
+  icr_ = 0;
+  mask_ = 0;
+  set_line(false);
+  sdr_ = 0;
+  std::fill(std::begin(tod_), std::end(tod_), 0);
+  tod_[3] = 0x01;
+  std::fill(std::begin(alarm_), std::end(alarm_), 0);
+  tod_latched_ = false;
+  tod_stopped_ = false;
+  next_tod_ = clock_ + tod_period_;
+}
+
+bool Cia::counting(int timer) const {
+  const Timer& t = timer_[timer];
+  if (!t.started()) return false;
+  // Counting CNT pulses, which nothing drives.
+  return timer == 0 ? !(t.control & 0x20) : (t.control & 0x60) != 0x20;
+}
+
+void Cia::catch_up(std::uint64_t cycle) {
+  if (cycle <= clock_) return;
+  for (; next_tod_ <= cycle; next_tod_ += tod_period_) tick_tod();
+  const std::uint64_t elapsed = cycle - clock_;
+  std::uint64_t a_underflows = 0;
+  if (counting(0)) {
+    a_underflows = timer_[0].advance(elapsed);
+    if (a_underflows) raise(IcrTimerA);
+  }
+  if (counting(1)) {
+    const std::uint64_t ticks = b_counts_a() ? a_underflows : elapsed;
+    if (ticks && timer_[1].advance(ticks)) raise(IcrTimerB);
+  }
+  clock_ = cycle;
+}
+
+void Cia::sync() { catch_up(cpu_.cycles); }
+
+std::uint64_t Cia::next_event() const {
+  std::uint64_t next = std::numeric_limits<std::uint64_t>::max();
+  // Nothing changes the line until the ICR is read.
+  if (asserted_) return next;
+  if ((mask_ & IcrTimerA) && counting(0)) next = clock_ + timer_[0].remaining();
+  if ((mask_ & IcrTimerB) && counting(1)) {
+    if (!b_counts_a()) {
+      next = std::min(next, clock_ + timer_[1].remaining());
+    } else if (counting(0) && (!timer_[0].one_shot() || timer_[1].remaining() == 1)) {
+      const std::uint64_t first = clock_ + timer_[0].remaining();
+      next = std::min(next, first + (timer_[1].remaining() - 1) * (timer_[0].latch + std::uint64_t{1}));
+    }
+  }
+  if ((mask_ & IcrAlarm) && !tod_stopped_) next = std::min(next, next_tod_);
+  return next;
+}
+
+void Cia::tick_tod() {
+  if (tod_stopped_) return;
+  if ((tod_[0] & 0x0F) < 9) {
+    ++tod_[0];
+  } else {
+    tod_[0] = 0;
+    tod_[1] = tod_[1] == 0x59 ? 0 : bcd_increment(tod_[1]);
+    if (tod_[1] == 0) {
+      tod_[2] = tod_[2] == 0x59 ? 0 : bcd_increment(tod_[2]);
+      if (tod_[2] == 0) {
+        // 12-hour clock: 11 to 12 flips AM/PM, 12 goes to 1.
+        std::uint8_t hours = tod_[3] & 0x1F;
+        std::uint8_t pm = tod_[3] & 0x80;
+        if (hours == 0x11) {
+          hours = 0x12;
+          pm ^= 0x80;
+        } else {
+          hours = hours == 0x12 ? 0x01 : bcd_increment(hours);
+        }
+        tod_[3] = static_cast<std::uint8_t>(pm | hours);
+      }
+    }
+  }
+  if (std::equal(std::begin(tod_), std::end(tod_), std::begin(alarm_))) raise(IcrAlarm);
+}
+
+void Cia::raise(std::uint8_t flags) {
+  icr_ |= flags;
+  if (icr_ & mask_) set_line(true);
+}
+
+void Cia::set_line(bool asserted) {
+  if (line_ == Line::Irq) {
+    cpu_.set_irq(irq_source_, asserted);
+  } else if (asserted && !asserted_) {
+    cpu_.nmi();
+  }
+  asserted_ = asserted;
+}
+
+std::uint8_t Cia::read(std::uint16_t addr) {
+  sync();
+  const int reg = addr & 0x0F;
+  switch (reg) {
+  case 0x0:
+  case 0x1:
+    return ports_.read_port(*this, reg, port_output(reg));
+  case 0x8:
+    if (tod_latched_) {
+      tod_latched_ = false;
+      return latched_[0];
+    }
+    return tod_[0];
+  case 0xB:
+    // Reading the hours freezes the registers until the tenths are read.
+    if (!tod_latched_) std::copy(std::begin(tod_), std::end(tod_), std::begin(latched_));
+    tod_latched_ = true;
+    return latched_[3];
+  case 0xD: {
+    const std::uint8_t value = static_cast<std::uint8_t>(icr_ | (asserted_ ? 0x80 : 0));
+    icr_ = 0;
+    set_line(false);
+    cpu_.end_run_by(next_event());
+    return value;
+  }
+  default:
+    return peek(addr);
+  }
+}
+
+std::uint8_t Cia::peek(std::uint16_t addr) {
+  const int reg = addr & 0x0F;
+  switch (reg) {
+  case 0x0:
+  case 0x1:
+    return port_output(reg);
+  case 0x2:
+  case 0x3:
+    return ddr_[reg - 2];
+  case 0x4:
+  case 0x6:
+    return static_cast<std::uint8_t>(timer_[(reg - 4) / 2].counter);
+  case 0x5:
+  case 0x7:
+    return static_cast<std::uint8_t>(timer_[(reg - 4) / 2].counter >> 8);
+  case 0x8:
+  case 0x9:
+  case 0xA:
+  case 0xB:
+    return tod_latched_ ? latched_[reg - 8] : tod_[reg - 8];
+  case 0xC:
+    return sdr_;
+  case 0xD:
+    return static_cast<std::uint8_t>(icr_ | (asserted_ ? 0x80 : 0));
+  default:
+    return static_cast<std::uint8_t>(timer_[reg - 0xE].control & ~ControlLoad);
+  }
+}
+
+void Cia::write(std::uint16_t addr, std::uint8_t value) {
+  sync();
+  const int reg = addr & 0x0F;
+  switch (reg) {
+  case 0x0:
+  case 0x1:
+    data_[reg] = value;
+    ports_.write_port(*this, reg, port_output(reg));
+    break;
+  case 0x2:
+  case 0x3:
+    ddr_[reg - 2] = value;
+    ports_.write_port(*this, reg - 2, port_output(reg - 2));
+    break;
+  case 0x4:
+  case 0x6: {
+    Timer& timer = timer_[(reg - 4) / 2];
+    timer.latch = static_cast<std::uint16_t>((timer.latch & 0xFF00) | value);
+    break;
+  }
+  case 0x5:
+  case 0x7: {
+    // Writing the high byte of a stopped timer also loads it.
+    Timer& timer = timer_[(reg - 4) / 2];
+    timer.latch = static_cast<std::uint16_t>((timer.latch & 0x00FF) | value << 8);
+    if (!timer.started()) timer.counter = timer.latch;
+    break;
+  }
+  case 0x8:
+  case 0x9:
+  case 0xA:
+  case 0xB: {
+    static constexpr std::uint8_t Masks[4] = {0x0F, 0x7F, 0x7F, 0x9F};
+    const std::uint8_t masked = value & Masks[reg - 8];
+    if (timer_[1].control & ControlAlarm) {
+      alarm_[reg - 8] = masked;
+      break;
+    }
+    tod_[reg - 8] = masked;
+    // Writing the hours stops the clock until the tenths are written.
+    if (reg == 0xB) tod_stopped_ = true;
+    if (reg == 0x8 && tod_stopped_) {
+      tod_stopped_ = false;
+      next_tod_ = clock_ + tod_period_;
+    }
+    break;
+  }
+  case 0xC:
+    sdr_ = value;
+    break;
+  case 0xD:
+    if (value & 0x80) {
+      mask_ |= value & 0x1F;
+    } else {
+      mask_ &= ~value;
+    }
+    if (icr_ & mask_) set_line(true);
+    break;
+  default: {
+    Timer& timer = timer_[reg - 0xE];
+    timer.control = value;
+    if (value & ControlLoad) timer.counter = timer.latch;
+    break;
+  }
+  }
+  cpu_.end_run_by(next_event());
+}
+
+template <typename Archive, typename Self> void Cia::fields(Archive& archive, Self& self) {
+  archive(self.data_, self.ddr_, self.timer_, self.icr_, self.mask_, self.asserted_, self.sdr_);
+  archive(self.tod_, self.alarm_, self.latched_, self.tod_latched_, self.tod_stopped_,
+          self.next_tod_, self.clock_);
+}
+
+void Cia::save(SnapshotWriter& out) const { fields(out, *this); }
+
+void Cia::restore(SnapshotReader& in) { fields(in, *this); }
+
+}; // namespace emu
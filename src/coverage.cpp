@@ -0,0 +1,172 @@
+#include <coverage.hpp>
+#include <opcodes.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <ostream>
+
+namespace emu {
+
+namespace {
+
+bool any(const std::vector<std::uint64_t>& bits) {
+  return std::any_of(bits.begin(), bits.end(),
+                     [](std::uint64_t word) { return word != 0; });
+}
+
+} // namespace
+
+Coverage::Coverage(Bus& bus) : bus_(bus) {
+  constexpr size_t live_words = 0x10000 / 64;
+  live_ = {Bitmap(live_words), Bitmap(live_words), Bitmap(live_words), {}, {}};
+  for (const auto& region : bus.regions()) {
+    const size_t words = (region.size + 63) / 64;
+    regions_.push_back({Bitmap(words), Bitmap(words), Bitmap(words), Bitmap(words),
+                        Bitmap(words)});
+  }
+  bus_.attach(this);
+}
+
+Coverage::~Coverage() { bus_.attach(nullptr); }
+
+void Coverage::flush(std::uint16_t addr, size_t size) {
+  const auto fold = [&](Bitmap& live, Bitmap Bitmaps::*into) {
+    for (size_t word = addr / 64; word < (addr + size) / 64; ++word) {
+      std::uint64_t bits = live[word];
+      live[word] = 0;
+      while (bits) {
+        const auto bit = static_cast<unsigned>(__builtin_ctzll(bits));
+        bits &= bits - 1;
+        const auto loc = bus_.locate(static_cast<std::uint16_t>(word * 64 + bit));
+        set(regions_[loc.region].*into, loc.offset);
+      }
+    }
+  };
+  fold(live_.exec, &Bitmaps::exec);
+  fold(live_.taken, &Bitmaps::taken);
+  fold(live_.not_taken, &Bitmaps::not_taken);
+}
+
+bool Coverage::executed(Bus::Location loc) {
+  flush();
+  return test(regions_[loc.region].exec, loc.offset);
+}
+
+void Coverage::trace(std::uint16_t addr) {
+  std::vector<std::uint16_t> pending{addr};
+  while (!pending.empty()) {
+    std::uint16_t pc = pending.back();
+    pending.pop_back();
+    while (bus_.plain(pc)) {
+      const Bus::Location loc = bus_.locate(pc);
+      Bitmaps& bitmaps = regions_[loc.region];
+      const OpInfo& info = OpTable[bus_.peek(pc)];
+      if (test(bitmaps.code, loc.offset) || info.op == Op::ILL) break;
+      set(bitmaps.code, loc.offset);
+      const auto next = static_cast<std::uint16_t>(pc + instr_length(info.mode));
+      const auto operand = static_cast<std::uint16_t>(
+          bus_.peek(static_cast<std::uint16_t>(pc + 1)) |
+          bus_.peek(static_cast<std::uint16_t>(pc + 2)) << 8);
+      if (is_branch(info.op)) {
+        set(bitmaps.branches, loc.offset);
+        pending.push_back(static_cast<std::uint16_t>(
+            next + static_cast<std::int8_t>(operand & 0xFF)));
+      } else if ((info.op == Op::JMP || info.op == Op::JSR) && info.mode == Mode::Absolute) {
+        pending.push_back(operand);
+      }
+      if (ends_flow(info.op)) break;
+      pc = next;
+    }
+  }
+}
+
+void Coverage::clear() {
+  const auto zero = [](Bitmaps& bitmaps) {
+    std::fill(bitmaps.exec.begin(), bitmaps.exec.end(), 0);
+    std::fill(bitmaps.taken.begin(), bitmaps.taken.end(), 0);
+    std::fill(bitmaps.not_taken.begin(), bitmaps.not_taken.end(), 0);
+    std::fill(bitmaps.code.begin(), bitmaps.code.end(), 0);
+    std::fill(bitmaps.branches.begin(), bitmaps.branches.end(), 0);
+  };
+  zero(live_);
+  for (auto& bitmaps : regions_) zero(bitmaps);
+}
+
+void Coverage::merge(Coverage& other) {
+  assert(other.regions_.size() == regions_.size());
+  flush();
+  other.flush();
+  const auto merge_bits = [](Bitmap& into, const Bitmap& from) {
+    for (size_t i = 0; i < into.size(); ++i) into[i] |= from[i];
+  };
+  for (size_t r = 0; r < regions_.size(); ++r) {
+    merge_bits(regions_[r].exec, other.regions_[r].exec);
+    merge_bits(regions_[r].taken, other.regions_[r].taken);
+    merge_bits(regions_[r].not_taken, other.regions_[r].not_taken);
+    merge_bits(regions_[r].code, other.regions_[r].code);
+    merge_bits(regions_[r].branches, other.regions_[r].branches);
+  }
+}
+
+void Coverage::write_lcov(std::ostream& out, const SymbolFn& symbol,
+                          std::string_view test_name) {
+  flush();
+  // Whatever ran and is still mapped leads to the code around it.
+  for (std::uint32_t addr = 0; addr < 0x10000; ++addr) {
+    const auto loc = bus_.locate(static_cast<std::uint16_t>(addr));
+    if (test(regions_[loc.region].exec, loc.offset)) trace(static_cast<std::uint16_t>(addr));
+  }
+  const auto& regions = bus_.regions();
+  for (size_t r = 0; r < regions_.size(); ++r) {
+    const auto& bitmaps = regions_[r];
+    const auto& region = regions[r];
+    if (!any(bitmaps.exec) && !any(bitmaps.code)) continue;
+
+    out << "TN:" << test_name << '\n';
+    out << "SF:" << region.name << '\n';
+    const auto line = [&](std::uint32_t offset) {
+      return region.base + offset;
+    };
+
+    if (symbol) {
+      size_t found = 0, hit = 0;
+      for (std::uint32_t offset = 0; offset < region.size; ++offset) {
+        const std::string name = symbol(static_cast<std::uint16_t>(r), offset);
+        if (name.empty()) continue;
+        const bool executed = test(bitmaps.exec, offset);
+        out << "FN:" << line(offset) << ',' << name << '\n';
+        out << "FNDA:" << (executed ? 1 : 0) << ',' << name << '\n';
+        ++found;
+        hit += executed;
+      }
+      out << "FNF:" << found << "\nFNH:" << hit << '\n';
+    }
+
+    size_t branches = 0, branches_hit = 0;
+    for (std::uint32_t offset = 0; offset < region.size; ++offset) {
+      const bool taken = test(bitmaps.taken, offset);
+      const bool not_taken = test(bitmaps.not_taken, offset);
+      const bool ran = taken || not_taken;
+      if (!ran && !test(bitmaps.branches, offset)) continue;
+      out << "BRDA:" << line(offset) << ",0,0," << (ran ? (taken ? "1" : "0") : "-") << '\n';
+      out << "BRDA:" << line(offset) << ",0,1," << (ran ? (not_taken ? "1" : "0") : "-")
+          << '\n';
+      branches += 2;
+      branches_hit += taken + not_taken;
+    }
+    out << "BRF:" << branches << "\nBRH:" << branches_hit << '\n';
+
+    size_t lines = 0, lines_hit = 0;
+    for (std::uint32_t offset = 0; offset < region.size; ++offset) {
+      const bool executed = test(bitmaps.exec, offset);
+      if (!executed && !test(bitmaps.code, offset)) continue;
+      out << "DA:" << line(offset) << ',' << (executed ? 1 : 0) << '\n';
+      ++lines;
+      lines_hit += executed;
+    }
+    out << "LF:" << lines << "\nLH:" << lines_hit << '\n';
+    out << "end_of_record\n";
+  }
+}
+
+}; // namespace emu
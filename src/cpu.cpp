@@ -0,0 +1,437 @@
+#include <cpu.hpp>
+#include <bus.hpp>
+#include <coverage.hpp>
+#include <idioms.hpp>
+#include <opcodes.hpp>
+
+namespace emu {
+
+namespace {
+
+constexpr std::uint16_t StackPage = 0x0100;
+constexpr std::uint16_t NmiVector = 0xFFFA;
+constexpr std::uint16_t ResetVector = 0xFFFC;
+constexpr std::uint16_t IrqVector = 0xFFFE;
+constexpr std::uint32_t InterruptCycles = 7;
+
+std::uint16_t read16(Bus& bus, std::uint16_t addr) {
+  return static_cast<std::uint16_t>(bus.read(addr) |
+                                    (bus.read(addr + 1) << 8));
+}
+
+/// Reads a pointer from the zero page, wrapping within it.
+std::uint16_t read16_zp(Bus& bus, std::uint8_t addr) {
+  return static_cast<std::uint16_t>(
+      bus.read(addr) | (bus.read(static_cast<std::uint8_t>(addr + 1)) << 8));
+}
+
+void push(CPU& cpu, Bus& bus, std::uint8_t value) {
+  bus.write(StackPage | cpu.SP, value);
+  --cpu.SP;
+}
+
+std::uint8_t pull(CPU& cpu, Bus& bus) {
+  ++cpu.SP;
+  return bus.read(StackPage | cpu.SP);
+}
+
+void set_nz(CPU& cpu, std::uint8_t value) {
+  cpu.Status = static_cast<std::uint8_t>((cpu.Status & ~(CPU::N | CPU::Z)) |
+                                         (value & CPU::N) |
+                                         (value == 0 ? CPU::Z : 0));
+}
+
+void set_flag(CPU& cpu, CPU::Flag flag, bool on) {
+  cpu.Status = static_cast<std::uint8_t>(on ? (cpu.Status | flag)
+                                            : (cpu.Status & ~flag));
+}
+
+void interrupt(CPU& cpu, Bus& bus, std::uint16_t vector, bool brk) {
+  push(cpu, bus, static_cast<std::uint8_t>(cpu.PC >> 8));
+  push(cpu, bus, static_cast<std::uint8_t>(cpu.PC));
+  push(cpu, bus, static_cast<std::uint8_t>(cpu.Status | CPU::U |
+                                           (brk ? CPU::B : 0)));
+  cpu.Status |= CPU::I;
+  cpu.PC = read16(bus, vector);
+}
+
+void adc(CPU& cpu, std::uint8_t value) {
+  const unsigned carry = cpu.Status & CPU::C;
+  const unsigned sum = cpu.A + value + carry;
+  if ((cpu.Status & CPU::D) && cpu.decimal_mode) {
+    // NMOS behaviour: Z comes from the binary sum, N and V from the
+    // intermediate result before the high nibble is adjusted.
+    unsigned lo = (cpu.A & 0x0F) + (value & 0x0F) + carry;
+    if (lo > 0x09) lo += 0x06;
+    unsigned hi = (cpu.A >> 4) + (value >> 4) + (lo > 0x0F ? 1 : 0);
+    set_flag(cpu, CPU::Z, (sum & 0xFF) == 0);
+    set_flag(cpu, CPU::N, (hi & 0x08) != 0);
+    set_flag(cpu, CPU::V, (~(cpu.A ^ value) & (cpu.A ^ (hi << 4)) & 0x80) != 0);
+    if (hi > 0x09) hi += 0x06;
+    set_flag(cpu, CPU::C, hi > 0x0F);
+    cpu.A = static_cast<std::uint8_t>((hi << 4) | (lo & 0x0F));
+    return;
+  }
+  set_flag(cpu, CPU::C, sum > 0xFF);
+  set_flag(cpu, CPU::V, (~(cpu.A ^ value) & (cpu.A ^ sum) & 0x80) != 0);
+  cpu.A = static_cast<std::uint8_t>(sum);
+  set_nz(cpu, cpu.A);
+}
+
+void sbc(CPU& cpu, std::uint8_t value) {
+  if ((cpu.Status & CPU::D) && cpu.decimal_mode) {
+    // NMOS behaviour: all flags come from the binary subtraction.
+    const unsigned borrow = (cpu.Status & CPU::C) ? 0 : 1;
+    const unsigned diff = cpu.A - value - borrow;
+    int lo = (cpu.A & 0x0F) - (value & 0x0F) - static_cast<int>(borrow);
+    int hi = (cpu.A >> 4) - (value >> 4);
+    if (lo < 0) {
+      lo -= 0x06;
+      --hi;
+    }
+    if (hi < 0) hi -= 0x06;
+    set_flag(cpu, CPU::C, diff < 0x100);
+    set_flag(cpu, CPU::V, ((cpu.A ^ value) & (cpu.A ^ diff) & 0x80) != 0);
+    set_nz(cpu, static_cast<std::uint8_t>(diff));
+    cpu.A = static_cast<std::uint8_t>((hi << 4) | (lo & 0x0F));
+    return;
+  }
+  const bool decimal = cpu.decimal_mode;
+  cpu.decimal_mode = false;
+  adc(cpu, static_cast<std::uint8_t>(~value));
+  cpu.decimal_mode = decimal;
+}
+
+void compare(CPU& cpu, std::uint8_t reg, std::uint8_t value) {
+  set_flag(cpu, CPU::C, reg >= value);
+  set_nz(cpu, static_cast<std::uint8_t>(reg - value));
+}
+
+bool branch_taken(const CPU& cpu, Op op) {
+  switch (op) {
+  case Op::BCC: return !(cpu.Status & CPU::C);
+  case Op::BCS: return cpu.Status & CPU::C;
+  case Op::BNE: return !(cpu.Status & CPU::Z);
+  case Op::BEQ: return cpu.Status & CPU::Z;
+  case Op::BPL: return !(cpu.Status & CPU::N);
+  case Op::BMI: return cpu.Status & CPU::N;
+  case Op::BVC: return !(cpu.Status & CPU::V);
+  case Op::BVS: return cpu.Status & CPU::V;
+  default: return false;
+  }
+}
+
+/// Optional per-instruction work, selected once per `run` so that runs
+/// without a coverage recorder or execute traps do not even test for them.
+enum Feature : unsigned {
+  Covered = 1,
+  Trapped = 2,
+  Bulk = 4,
+};
+
+/// `until` is only used to bound bulk loops.
+template <unsigned Features>
+std::uint32_t execute(CPU& cpu, Bus& bus, std::uint64_t until) {
+  if (cpu.nmi_pending) {
+    cpu.nmi_pending = false;
+    interrupt(cpu, bus, NmiVector, false);
+    cpu.cycles += InterruptCycles;
+    return InterruptCycles;
+  }
+  if (cpu.irq_lines && !(cpu.Status & CPU::I)) {
+    interrupt(cpu, bus, IrqVector, false);
+    cpu.cycles += InterruptCycles;
+    return InterruptCycles;
+  }
+
+  const std::uint16_t pc = cpu.PC;
+  if constexpr ((Features & Trapped) != 0) {
+    if (bus.trapped(pc)) {
+      if (pc == cpu.trap_skip) {
+        cpu.trap_skip = CPU::NoTrapSkip;
+      } else {
+        switch (cpu.trap_handler->on_trap(cpu, bus)) {
+        case TrapHandler::Action::Execute:
+          break;
+        case TrapHandler::Action::Resume:
+          return 0;
+        case TrapHandler::Action::Stop:
+          cpu.stop_requested = true;
+          cpu.trap_skip = pc;
+          return 0;
+        }
+      }
+    }
+  }
+  if constexpr ((Features & Covered) != 0) cpu.coverage->exec(pc);
+
+  const OpInfo& info = OpTable[bus.read(pc)];
+  std::uint32_t cycles = info.cycles;
+  const auto next = static_cast<std::uint16_t>(pc + instr_length(info.mode));
+
+  std::uint16_t addr = 0;
+  switch (info.mode) {
+  case Mode::Implied:
+  case Mode::Accumulator:
+    break;
+  case Mode::Immediate:
+    addr = static_cast<std::uint16_t>(pc + 1);
+    break;
+  case Mode::ZeroPage:
+    addr = bus.read(pc + 1);
+    break;
+  case Mode::ZeroPageX:
+    addr = static_cast<std::uint8_t>(bus.read(pc + 1) + cpu.X);
+    break;
+  case Mode::ZeroPageY:
+    addr = static_cast<std::uint8_t>(bus.read(pc + 1) + cpu.Y);
+    break;
+  case Mode::Relative:
+    addr = static_cast<std::uint16_t>(
+        next + static_cast<std::int8_t>(bus.read(pc + 1)));
+    break;
+  case Mode::Absolute:
+    addr = read16(bus, pc + 1);
+    break;
+  case Mode::AbsoluteX:
+  case Mode::AbsoluteY: {
+    const std::uint16_t base = read16(bus, pc + 1);
+    addr = static_cast<std::uint16_t>(
+        base + (info.mode == Mode::AbsoluteX ? cpu.X : cpu.Y));
+    if (info.page_penalty && ((base ^ addr) & 0xFF00)) ++cycles;
+    break;
+  }
+  case Mode::Indirect: {
+    // The pointer's high byte is fetched without carrying into the page.
+    const std::uint16_t ptr = read16(bus, pc + 1);
+    const auto hi = static_cast<std::uint16_t>((ptr & 0xFF00) |
+                                               ((ptr + 1) & 0x00FF));
+    addr = static_cast<std::uint16_t>(bus.read(ptr) | (bus.read(hi) << 8));
+    break;
+  }
+  case Mode::IndirectX:
+    addr = read16_zp(bus, static_cast<std::uint8_t>(bus.read(pc + 1) + cpu.X));
+    break;
+  case Mode::IndirectY: {
+    const std::uint16_t base = read16_zp(bus, bus.read(pc + 1));
+    addr = static_cast<std::uint16_t>(base + cpu.Y);
+    if (info.page_penalty && ((base ^ addr) & 0xFF00)) ++cycles;
+    break;
+  }
+  }
+
+  cpu.PC = next;
+
+  // Shared body of the shift and rotate instructions.
+  const auto modify = [&](auto fn) {
+    if (info.mode == Mode::Accumulator) {
+      cpu.A = fn(cpu.A);
+      set_nz(cpu, cpu.A);
+    } else {
+      const std::uint8_t value = fn(bus.read(addr));
+      bus.write(addr, value);
+      set_nz(cpu, value);
+    }
+  };
+
+  switch (info.op) {
+  case Op::ADC: adc(cpu, bus.read(addr)); break;
+  case Op::SBC: sbc(cpu, bus.read(addr)); break;
+  case Op::AND: cpu.A &= bus.read(addr); set_nz(cpu, cpu.A); break;
+  case Op::ORA: cpu.A |= bus.read(addr); set_nz(cpu, cpu.A); break;
+  case Op::EOR: cpu.A ^= bus.read(addr); set_nz(cpu, cpu.A); break;
+
+  case Op::ASL:
+    modify([&](std::uint8_t v) {
+      set_flag(cpu, CPU::C, v & 0x80);
+      return static_cast<std::uint8_t>(v << 1);
+    });
+    break;
+  case Op::LSR:
+    modify([&](std::uint8_t v) {
+      set_flag(cpu, CPU::C, v & 0x01);
+      return static_cast<std::uint8_t>(v >> 1);
+    });
+    break;
+  case Op::ROL:
+    modify([&](std::uint8_t v) {
+      const std::uint8_t carry = cpu.Status & CPU::C;
+      set_flag(cpu, CPU::C, v & 0x80);
+      return static_cast<std::uint8_t>((v << 1) | carry);
+    });
+    break;
+  case Op::ROR:
+    modify([&](std::uint8_t v) {
+      const std::uint8_t carry = (cpu.Status & CPU::C) ? 0x80 : 0;
+      set_flag(cpu, CPU::C, v & 0x01);
+      return static_cast<std::uint8_t>((v >> 1) | carry);
+    });
+    break;
+
+  case Op::BCC: case Op::BCS: case Op::BEQ: case Op::BMI:
+  case Op::BNE: case Op::BPL: case Op::BVC: case Op::BVS: {
+    const bool taken = branch_taken(cpu, info.op);
+    if constexpr ((Features & Covered) != 0) cpu.coverage->branch(pc, taken);
+    if (taken) {
+      cycles += ((addr ^ next) & 0xFF00) ? 2 : 1;
+      cpu.PC = addr;
+      if constexpr ((Features & Bulk) != 0) {
+        if (addr < pc) cycles += cpu.idioms->loop(cpu, bus, pc, cpu.cycles + cycles, until);
+      }
+    }
+    break;
+  }
+
+  case Op::BIT: {
+    const std::uint8_t value = bus.read(addr);
+    cpu.Status = static_cast<std::uint8_t>(
+        (cpu.Status & ~(CPU::N | CPU::V | CPU::Z)) |
+        (value & (CPU::N | CPU::V)) | ((cpu.A & value) ? 0 : CPU::Z));
+    break;
+  }
+
+  case Op::BRK:
+    cpu.PC = static_cast<std::uint16_t>(pc + 2);
+    interrupt(cpu, bus, IrqVector, true);
+    break;
+
+  case Op::CLC: cpu.Status &= ~CPU::C; break;
+  case Op::CLD: cpu.Status &= ~CPU::D; break;
+  case Op::CLI: cpu.Status &= ~CPU::I; break;
+  case Op::CLV: cpu.Status &= ~CPU::V; break;
+  case Op::SEC: cpu.Status |= CPU::C; break;
+  case Op::SED: cpu.Status |= CPU::D; break;
+  case Op::SEI: cpu.Status |= CPU::I; break;
+
+  case Op::CMP: compare(cpu, cpu.A, bus.read(addr)); break;
+  case Op::CPX: compare(cpu, cpu.X, bus.read(addr)); break;
+  case Op::CPY: compare(cpu, cpu.Y, bus.read(addr)); break;
+
+  case Op::DEC: {
+    const auto value = static_cast<std::uint8_t>(bus.read(addr) - 1);
+    bus.write(addr, value);
+    set_nz(cpu, value);
+    break;
+  }
+  case Op::INC: {
+    const auto value = static_cast<std::uint8_t>(bus.read(addr) + 1);
+    bus.write(addr, value);
+    set_nz(cpu, value);
+    break;
+  }
+  case Op::DEX: set_nz(cpu, --cpu.X); break;
+  case Op::DEY: set_nz(cpu, --cpu.Y); break;
+  case Op::INX: set_nz(cpu, ++cpu.X); break;
+  case Op::INY: set_nz(cpu, ++cpu.Y); break;
+
+  case Op::JMP: cpu.PC = addr; break;
+  case Op::JSR: {
+    const auto ret = static_cast<std::uint16_t>(next - 1);
+    push(cpu, bus, static_cast<std::uint8_t>(ret >> 8));
+    push(cpu, bus, static_cast<std::uint8_t>(ret));
+    cpu.PC = addr;
+    break;
+  }
+  case Op::RTS: {
+    const std::uint8_t lo = pull(cpu, bus);
+    const std::uint8_t hi = pull(cpu, bus);
+    cpu.PC = static_cast<std::uint16_t>(((hi << 8) | lo) + 1);
+    break;
+  }
+  case Op::RTI: {
+    cpu.Status = static_cast<std::uint8_t>((pull(cpu, bus) & ~CPU::B) | CPU::U);
+    const std::uint8_t lo = pull(cpu, bus);
+    const std::uint8_t hi = pull(cpu, bus);
+    cpu.PC = static_cast<std::uint16_t>((hi << 8) | lo);
+    break;
+  }
+
+  case Op::LDA: cpu.A = bus.read(addr); set_nz(cpu, cpu.A); break;
+  case Op::LDX: cpu.X = bus.read(addr); set_nz(cpu, cpu.X); break;
+  case Op::LDY: cpu.Y = bus.read(addr); set_nz(cpu, cpu.Y); break;
+  case Op::STA: bus.write(addr, cpu.A); break;
+  case Op::STX: bus.write(addr, cpu.X); break;
+  case Op::STY: bus.write(addr, cpu.Y); break;
+
+  case Op::PHA: push(cpu, bus, cpu.A); break;
+  case Op::PHP: push(cpu, bus, cpu.Status | CPU::B | CPU::U); break;
+  case Op::PLA: cpu.A = pull(cpu, bus); set_nz(cpu, cpu.A); break;
+  case Op::PLP:
+    cpu.Status = static_cast<std::uint8_t>((pull(cpu, bus) & ~CPU::B) | CPU::U);
+    break;
+
+  case Op::TAX: cpu.X = cpu.A; set_nz(cpu, cpu.X); break;
+  case Op::TAY: cpu.Y = cpu.A; set_nz(cpu, cpu.Y); break;
+  case Op::TSX: cpu.X = cpu.SP; set_nz(cpu, cpu.X); break;
+  case Op::TXA: cpu.A = cpu.X; set_nz(cpu, cpu.A); break;
+  case Op::TXS: cpu.SP = cpu.X; break;
+  case Op::TYA: cpu.A = cpu.Y; set_nz(cpu, cpu.A); break;
+
+  case Op::NOP: break;
+  case Op::ILL:
+    cpu.PC = pc;
+    cpu.jammed = true;
+    break;
+  }
+
+  cpu.cycles += cycles;
+  return cycles;
+}
+
+/// Bulk loops would skip per-instruction coverage and traps, so they are
+/// only used without either.
+unsigned features(const CPU& cpu, const Bus& bus) {
+  const unsigned features = (cpu.coverage ? unsigned{Covered} : 0u) |
+                            (cpu.trap_handler && bus.has_traps() ? unsigned{Trapped} : 0u);
+  return features == 0 && cpu.idioms ? unsigned{Bulk} : features;
+}
+
+template <unsigned Features>
+void run_until(CPU& cpu, Bus& bus) {
+  while (cpu.cycles < cpu.run_end && !cpu.stop_requested && !cpu.jammed) {
+    execute<Features>(cpu, bus, cpu.run_end);
+  }
+}
+
+} // namespace
+
+void CPU::reset(Bus& bus) {
+  SP = static_cast<Register>(SP - 3);
+  Status |= I | U;
+  PC = read16(bus, ResetVector);
+  jammed = false;
+  nmi_pending = false;
+  cycles += InterruptCycles;
+}
+
+std::uint32_t CPU::step(Bus& bus) {
+  if (jammed) return 0;
+  stop_requested = false;
+  if (PC != trap_skip) trap_skip = NoTrapSkip;
+  // A single step never runs a loop in bulk.
+  switch (features(*this, bus) & ~Bulk) {
+  case 0: return execute<0>(*this, bus, 0);
+  case Covered: return execute<Covered>(*this, bus, 0);
+  case Trapped: return execute<Trapped>(*this, bus, 0);
+  default: return execute<Covered | Trapped>(*this, bus, 0);
+  }
+}
+
+std::uint64_t CPU::run(Bus& bus, std::uint64_t until) {
+  const std::uint64_t start = cycles;
+  stop_requested = false;
+  run_end = until;
+  // A skip only applies if execution resumes where the handler stopped.
+  if (PC != trap_skip) trap_skip = NoTrapSkip;
+  switch (features(*this, bus)) {
+  case 0: run_until<0>(*this, bus); break;
+  case Bulk: run_until<Bulk>(*this, bus); break;
+  case Covered: run_until<Covered>(*this, bus); break;
+  case Trapped: run_until<Trapped>(*this, bus); break;
+  default: run_until<Covered | Trapped>(*this, bus); break;
+  }
+  if (jammed && cycles < until) cycles = until;
+  return cycles - start;
+}
+
+}; // namespace emu
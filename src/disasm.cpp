@@ -0,0 +1,330 @@
+#include <disasm.hpp>
+#include <symbols.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <string_view>
+
+namespace emu {
+
+namespace {
+
+constexpr char HexDigits[] = "0123456789ABCDEF";
+
+char* put(char* out, const char* text) {
+  while (*text) *out++ = *text++;
+  return out;
+}
+
+char* put_hex8(char* out, std::uint8_t value) {
+  *out++ = '$';
+  *out++ = HexDigits[value >> 4];
+  *out++ = HexDigits[value & 0xF];
+  return out;
+}
+
+char* put_digits16(char* out, std::uint16_t value) {
+  *out++ = HexDigits[value >> 12];
+  *out++ = HexDigits[(value >> 8) & 0xF];
+  *out++ = HexDigits[(value >> 4) & 0xF];
+  *out++ = HexDigits[value & 0xF];
+  return out;
+}
+
+char* put_hex16(char* out, std::uint16_t value) {
+  *out++ = '$';
+  return put_digits16(out, value);
+}
+
+/// Writes an absolute address, preferring its label.
+char* put_addr(char* out, std::uint16_t addr, LabelFn label, const void* ctx) {
+  if (label) {
+    if (const char* name = label(ctx, addr)) return put(out, name);
+  }
+  return put_hex16(out, addr);
+}
+
+} // namespace
+
+bool decode(const std::uint8_t* bytes, size_t avail, std::uint16_t addr,
+            Instruction& out) {
+  if (avail == 0) return false;
+  const OpInfo& info = OpTable[bytes[0]];
+  const std::uint8_t length =
+      info.op == Op::ILL ? std::uint8_t{1} : instr_length(info.mode);
+  if (length > avail) return false;
+  out.addr = addr;
+  out.opcode = bytes[0];
+  out.length = length;
+  out.operand = length == 1   ? 0
+                : length == 2 ? bytes[1]
+                              : static_cast<std::uint16_t>(bytes[1] | (bytes[2] << 8));
+  return true;
+}
+
+size_t format(const Instruction& instr, char* out, LabelFn label,
+              const void* ctx) {
+  char* const start = out;
+  const OpInfo& info = instr.info();
+  if (info.op == Op::ILL) {
+    out = put(out, ".byte ");
+    out = put_hex8(out, instr.opcode);
+    return static_cast<size_t>(out - start);
+  }
+
+  const std::string_view name = mnemonic(info.op);
+  std::memcpy(out, name.data(), name.size());
+  out += name.size();
+  if (info.mode == Mode::Implied) return static_cast<size_t>(out - start);
+  *out++ = ' ';
+
+  const auto byte = static_cast<std::uint8_t>(instr.operand);
+  switch (info.mode) {
+  case Mode::Implied:
+    break;
+  case Mode::Accumulator:
+    *out++ = 'A';
+    break;
+  case Mode::Immediate:
+    *out++ = '#';
+    out = put_hex8(out, byte);
+    break;
+  case Mode::ZeroPage:
+    out = put_hex8(out, byte);
+    break;
+  case Mode::ZeroPageX:
+    out = put(put_hex8(out, byte), ",X");
+    break;
+  case Mode::ZeroPageY:
+    out = put(put_hex8(out, byte), ",Y");
+    break;
+  case Mode::Relative:
+  case Mode::Absolute:
+    out = put_addr(out, instr.target(), label, ctx);
+    break;
+  case Mode::AbsoluteX:
+    out = put(put_addr(out, instr.operand, label, ctx), ",X");
+    break;
+  case Mode::AbsoluteY:
+    out = put(put_addr(out, instr.operand, label, ctx), ",Y");
+    break;
+  case Mode::Indirect:
+    *out++ = '(';
+    out = put(put_addr(out, instr.operand, label, ctx), ")");
+    break;
+  case Mode::IndirectX:
+    *out++ = '(';
+    out = put(put_hex8(out, byte), ",X)");
+    break;
+  case Mode::IndirectY:
+    *out++ = '(';
+    out = put(put_hex8(out, byte), "),Y");
+    break;
+  }
+  return static_cast<size_t>(out - start);
+}
+
+Disassembler::Disassembler(const std::uint8_t* image, size_t size,
+                           std::uint16_t org)
+    : image_(image), size_(size), org_(org), kinds_(size, Kind::Data),
+      labels_(size, Label::None) {}
+
+void Disassembler::trace(std::uint16_t entry) {
+  std::vector<std::uint16_t> work{entry};
+  while (!work.empty()) {
+    std::uint16_t addr = work.back();
+    work.pop_back();
+    while (contains(addr) && kinds_[addr - org_] == Kind::Data) {
+      const size_t offset = addr - org_;
+      Instruction instr;
+      if (!decode(image_ + offset, size_ - offset, addr, instr)) break;
+      const OpInfo& info = instr.info();
+      if (info.op == Op::ILL) break;
+      bool overlaps = false;
+      for (size_t i = 1; i < instr.length; ++i) {
+        overlaps |= kinds_[offset + i] != Kind::Data;
+      }
+      if (overlaps) break;
+
+      kinds_[offset] = Kind::Code;
+      for (size_t i = 1; i < instr.length; ++i) kinds_[offset + i] = Kind::Operand;
+
+      if (instr.has_target() && contains(instr.target())) {
+        name(instr.target(), info.op == Op::JSR ? Label::Sub : Label::Local);
+        work.push_back(instr.target());
+      }
+      if (ends_flow(info.op)) break;
+      addr = static_cast<std::uint16_t>(addr + instr.length);
+      if (addr < instr.addr) break; // wrapped around the address space
+    }
+  }
+}
+
+void Disassembler::trace_vectors() {
+  static constexpr struct {
+    std::uint16_t addr;
+    Label name;
+  } vectors[] = {{0xFFFA, Label::Nmi}, {0xFFFC, Label::Reset},
+                 {0xFFFE, Label::Irq}};
+  for (const auto& vector : vectors) {
+    if (!contains(vector.addr) || !contains(vector.addr + 1)) continue;
+    const size_t offset = vector.addr - org_;
+    const auto target =
+        static_cast<std::uint16_t>(image_[offset] | (image_[offset + 1] << 8));
+    if (!contains(target)) continue;
+    name(target, vector.name);
+    trace(target);
+  }
+}
+
+void Disassembler::trace_linear() {
+  size_t offset = 0;
+  while (offset < size_) {
+    Instruction instr;
+    const auto addr = static_cast<std::uint16_t>(org_ + offset);
+    if (!decode(image_ + offset, size_ - offset, addr, instr) ||
+        instr.info().op == Op::ILL) {
+      ++offset;
+      continue;
+    }
+    kinds_[offset] = Kind::Code;
+    for (size_t i = 1; i < instr.length; ++i) kinds_[offset + i] = Kind::Operand;
+    if (instr.has_target() && contains(instr.target())) {
+      name(instr.target(),
+           instr.info().op == Op::JSR ? Label::Sub : Label::Local);
+    }
+    offset += instr.length;
+  }
+}
+
+void Disassembler::use_symbols(const SymbolTable& symbols) {
+  symbols_ = &symbols;
+  for (size_t offset = 0; offset < size_; ++offset) {
+    if (symbols.at(static_cast<std::uint16_t>(org_ + offset))) {
+      labels_[offset] = Label::Symbol;
+    }
+  }
+  // Operands may name any address, inside the image or not.
+  for (std::uint32_t addr = 0; addr < 0x10000; ++addr) {
+    if (const char* symbol = symbols.at(static_cast<std::uint16_t>(addr))) {
+      label_length_ = std::max(label_length_, std::strlen(symbol));
+    }
+  }
+}
+
+const char* Disassembler::label(std::uint16_t addr) const {
+  if (symbols_) {
+    if (const char* symbol = symbols_->at(addr)) return symbol;
+  }
+  if (!contains(addr)) return nullptr;
+  char* p = label_text_;
+  switch (labels_[addr - org_]) {
+  case Label::None: case Label::Symbol: return nullptr;
+  case Label::Nmi: return "nmi";
+  case Label::Reset: return "reset";
+  case Label::Irq: return "irq";
+  case Label::Local: p = put(p, "L_"); break;
+  case Label::Sub: p = put(p, "sub_"); break;
+  }
+  *put_digits16(p, addr) = '\0';
+  return label_text_;
+}
+
+void Disassembler::write(std::string& out) const {
+  constexpr size_t BytesPerLine = 8;
+  const size_t max_line = label_length_ + MaxInstructionText + 16;
+  const LabelFn label_fn = [](const void* ctx, std::uint16_t addr) {
+    return static_cast<const Disassembler*>(ctx)->label(addr);
+  };
+
+  // Lines are formatted into a local chunk that is appended to `out` when
+  // nearly full, so the string is not touched once per line.
+  std::vector<char> chunk(std::max<size_t>(size_t{1} << 16, max_line));
+  char* p = chunk.data();
+  const auto reserve_line = [&] {
+    if (p + max_line > chunk.data() + chunk.size()) {
+      out.append(chunk.data(), p);
+      p = chunk.data();
+    }
+  };
+
+  p = put(p, "        .org ");
+  p = put_hex16(p, org_);
+  *p++ = '\n';
+
+  // Symbols outside the image that operands refer to become equates.
+  if (symbols_) {
+    std::vector<std::uint16_t> external;
+    for (size_t offset = 0; offset < size_; ++offset) {
+      if (kinds_[offset] != Kind::Code) continue;
+      Instruction instr;
+      decode(image_ + offset, size_ - offset, static_cast<std::uint16_t>(org_ + offset), instr);
+      // Only absolute operands are printed with labels.
+      const Mode mode = instr.info().mode;
+      if (mode != Mode::Relative && mode != Mode::Absolute && mode != Mode::AbsoluteX &&
+          mode != Mode::AbsoluteY && mode != Mode::Indirect) {
+        continue;
+      }
+      const std::uint16_t target = instr.target();
+      if (!contains(target) && symbols_->at(target)) external.push_back(target);
+    }
+    std::sort(external.begin(), external.end());
+    external.erase(std::unique(external.begin(), external.end()), external.end());
+    for (const std::uint16_t addr : external) {
+      reserve_line();
+      p = put(p, label(addr));
+      p = put(p, " = ");
+      p = put_hex16(p, addr);
+      *p++ = '\n';
+    }
+  }
+
+  // Labels that point into the middle of an instruction cannot be placed in
+  // the listing, so they become equates.
+  for (size_t offset = 0; offset < size_; ++offset) {
+    if (labels_[offset] == Label::None || kinds_[offset] != Kind::Operand) {
+      continue;
+    }
+    reserve_line();
+    p = put(p, label(static_cast<std::uint16_t>(org_ + offset)));
+    p = put(p, " = ");
+    p = put_hex16(p, static_cast<std::uint16_t>(org_ + offset));
+    *p++ = '\n';
+  }
+
+  size_t offset = 0;
+  while (offset < size_) {
+    reserve_line();
+    const auto addr = static_cast<std::uint16_t>(org_ + offset);
+    if (labels_[offset] != Label::None && kinds_[offset] != Kind::Operand) {
+      p = put(p, label(addr));
+      *p++ = ':';
+      *p++ = '\n';
+      reserve_line();
+    }
+
+    if (kinds_[offset] == Kind::Code) {
+      Instruction instr;
+      decode(image_ + offset, size_ - offset, addr, instr);
+      p = put(p, "        ");
+      p += format(instr, p, label_fn, this);
+      *p++ = '\n';
+      offset += instr.length;
+      continue;
+    }
+
+    p = put(p, "        .byte ");
+    size_t count = 0;
+    do {
+      if (count) p = put(p, ", ");
+      p = put_hex8(p, image_[offset]);
+      ++offset;
+      ++count;
+    } while (offset < size_ && count < BytesPerLine &&
+             kinds_[offset] != Kind::Code && labels_[offset] == Label::None);
+    *p++ = '\n';
+  }
+  out.append(chunk.data(), p);
+}
+
+}; // namespace emu
@@ -0,0 +1,232 @@
+#include <drive.hpp>
+
+#include <algorithm>
+#include <limits>
+
+namespace emu {
+
+namespace {
+
+/// Five bit codes of the nibbles, chosen so that no more than two zero
+/// bits follow each other on disk.
+constexpr std::uint8_t Gcr[16] = {0x0A, 0x0B, 0x12, 0x13, 0x0E, 0x0F, 0x16, 0x17,
+                                  0x09, 0x19, 0x1A, 0x1B, 0x0D, 0x1D, 0x1E, 0x15};
+constexpr size_t SyncBytes = 5;
+constexpr size_t HeaderGap = 9;
+constexpr size_t SectorGap = 8;
+constexpr std::uint8_t GapByte = 0x55;
+
+/// Bytes on a track written at its zone's speed, 300 rpm.
+size_t track_bytes(std::uint8_t track) {
+  if (track <= 17) return 7692;
+  if (track <= 24) return 7142;
+  if (track <= 30) return 6666;
+  return 6250;
+}
+
+/// Appends the GCR encoding of `size` bytes, a multiple of four; every four
+/// bytes become five.
+void append_gcr(std::vector<std::uint8_t>& out, const std::uint8_t* data, size_t size) {
+  for (size_t i = 0; i < size; i += 4) {
+    std::uint64_t bits = 0;
+    for (size_t j = 0; j < 4; ++j) {
+      bits = bits << 10 | std::uint64_t{Gcr[data[i + j] >> 4]} << 5 | Gcr[data[i + j] & 0x0F];
+    }
+    for (int j = 4; j >= 0; --j) out.push_back(static_cast<std::uint8_t>(bits >> (8 * j)));
+  }
+}
+
+} // namespace
+
+Drive1541::Drive1541() {
+  rom_region_ = bus_.add_region("dos", static_cast<std::uint32_t>(rom_.size()), 0xC000);
+  bus_.map_ram(0x0000, ram_.size(), ram_.data());
+  bus_.map_device(0x1800, 0x400, &via1_);
+  bus_.map_device(0x1C00, 0x400, &via2_);
+  bus_.map_rom(0x8000, rom_.size(), rom_.data(), rom_region_);
+  bus_.map_rom(0xC000, rom_.size(), rom_.data(), rom_region_);
+}
+
+bool Drive1541::load_rom(std::vector<std::uint8_t> rom, std::string& error) {
+  if (rom.size() != rom_.size()) {
+    error = "1541 DOS ROM must be 16K";
+    return false;
+  }
+  std::copy(rom.begin(), rom.end(), rom_.begin());
+  reset();
+  return true;
+}
+
+void Drive1541::reset() {
+  via1_.reset();
+  via2_.reset();
+  lines_ = 0;
+  phase_ = 0;
+  motor_ = false;
+  sync_ = false;
+  last_activity_ = cpu_.cycles;
+  cpu_.reset(bus_);
+}
+
+void Drive1541::insert(const D64& disk) {
+  eject();
+  // The disk ID in the BAM is repeated in every sector header.
+  const std::uint8_t* bam = disk.sector(18, 0);
+  const std::uint8_t id1 = bam ? bam[0xA2] : '0';
+  const std::uint8_t id2 = bam ? bam[0xA3] : '0';
+  std::uint8_t block[260];
+  for (std::uint8_t track = 1; track <= disk.tracks() && track <= HalfTracks / 2; ++track) {
+    std::vector<std::uint8_t>& gcr = tracks_[(track - 1) * 2];
+    gcr.reserve(track_bytes(track));
+    for (std::uint8_t sector = 0; sector < D64::sectors_in(track); ++sector) {
+      const std::uint8_t header[8] = {0x08, static_cast<std::uint8_t>(sector ^ track ^ id2 ^ id1),
+                                      sector, track, id2, id1, 0x0F, 0x0F};
+      gcr.insert(gcr.end(), SyncBytes, 0xFF);
+      append_gcr(gcr, header, sizeof(header));
+      gcr.insert(gcr.end(), HeaderGap, GapByte);
+
+      const std::uint8_t* data = disk.sector(track, sector);
+      block[0] = 0x07;
+      std::uint8_t checksum = 0;
+      for (size_t i = 0; i < 256; ++i) {
+        block[1 + i] = data[i];
+        checksum ^= data[i];
+      }
+      block[257] = checksum;
+      block[258] = 0;
+      block[259] = 0;
+      gcr.insert(gcr.end(), SyncBytes, 0xFF);
+      append_gcr(gcr, block, sizeof(block));
+      gcr.insert(gcr.end(), SectorGap, GapByte);
+    }
+    gcr.resize(track_bytes(track), GapByte);
+  }
+  head_ = 0;
+  sync_ = false;
+}
+
+void Drive1541::eject() {
+  for (std::vector<std::uint8_t>& gcr : tracks_) gcr.clear();
+  sync_ = false;
+}
+
+bool Drive1541::idle() const {
+  return !motor_ && !host_atn_ && cpu_.cycles - last_activity_ >= IdleDelay;
+}
+
+std::uint64_t Drive1541::next_event() const {
+  return std::min({via1_.next_event(), via2_.next_event(),
+                   motor_ ? next_byte_ : std::numeric_limits<std::uint64_t>::max()});
+}
+
+void Drive1541::run_until(std::uint64_t cycle) {
+  while (cpu_.cycles < cycle) {
+    if (idle()) {
+      // Nothing the CPU does now can be seen from outside.
+      idle_cycles_ += cycle - cpu_.cycles;
+      cpu_.cycles = cycle;
+      via1_.catch_up(cycle);
+      via2_.catch_up(cycle);
+      return;
+    }
+    cpu_.run(bus_, std::min(cycle, next_event()));
+    via1_.catch_up(cpu_.cycles);
+    via2_.catch_up(cpu_.cycles);
+    rotate(cpu_.cycles);
+  }
+}
+
+void Drive1541::set_host_lines(bool atn, bool clk, bool data) {
+  if (atn == host_atn_ && clk == host_clk_ && data == host_data_) return;
+  host_clk_ = clk;
+  host_data_ = data;
+  last_activity_ = cpu_.cycles;
+  if (atn == host_atn_) return;
+  host_atn_ = atn;
+  // ATN reaches CA1 through an inverter, so asserting it is a rising edge.
+  via1_.sync();
+  via1_.set_ca1(atn);
+}
+
+std::uint32_t Drive1541::byte_period() const {
+  // Zone 3, the outer tracks, is the fastest at 26 cycles per byte.
+  return 32 - 2 * ((via2_.port_output(1) >> 5) & 3);
+}
+
+void Drive1541::rotate(std::uint64_t cycle) {
+  if (!motor_ || cycle < next_byte_) return;
+  const std::uint32_t period = byte_period();
+  const std::uint64_t bytes = (cycle - next_byte_) / period + 1;
+  next_byte_ += bytes * period;
+
+  std::vector<std::uint8_t>& gcr = tracks_[half_track_];
+  if (gcr.empty()) return;
+  const size_t size = gcr.size();
+  head_ %= size;
+  if (!via2_.cb2()) {
+    // Write mode: the byte in port A goes to disk at each boundary.
+    const std::uint8_t value = via2_.port_output(0);
+    const std::uint64_t written = std::min<std::uint64_t>(bytes, size);
+    for (std::uint64_t i = 0; i < written; ++i) {
+      gcr[head_] = value;
+      head_ = (head_ + 1) % size;
+    }
+    head_ = static_cast<size_t>((head_ + (bytes - written)) % size);
+    sync_ = false;
+  } else {
+    head_ = static_cast<size_t>((head_ + bytes) % size);
+    latch_ = gcr[(head_ + size - 1) % size];
+    sync_ = latch_ == 0xFF && gcr[(head_ + size - 2) % size] == 0xFF;
+  }
+  if (via2_.ca2() && !sync_) cpu_.Status |= CPU::V;
+}
+
+std::uint8_t Drive1541::read_port(const Via& via, int port, std::uint8_t output) {
+  if (&via == &via1_) {
+    if (port == 0) return output;
+    // Serial bus inputs read 1 while a line is low, from either side.
+    const bool data = host_data_ || pulls_data();
+    const bool clk = host_clk_ || pulls_clk();
+    return static_cast<std::uint8_t>((output & 0x1A) | (data ? 0x01 : 0) | (clk ? 0x04 : 0) |
+                                      device_ << 5 | (host_atn_ ? 0x80 : 0));
+  }
+  rotate(cpu_.cycles);
+  if (port == 0) return via2_.cb2() ? latch_ : output;
+  // The disk is never write protected; SYNC reads 0 during a sync mark.
+  return static_cast<std::uint8_t>((output & 0x6F) | 0x10 | (sync_ ? 0 : 0x80));
+}
+
+void Drive1541::write_port(const Via& via, int port, std::uint8_t output) {
+  if (&via == &via1_) {
+    if (port != 1) return;
+    if ((output & 0x1A) != (lines_ & 0x1A)) last_activity_ = cpu_.cycles;
+    lines_ = output;
+    return;
+  }
+  if (port != 1) return;
+  rotate(cpu_.cycles);
+
+  // The stepper moves half a track per phase, in the direction of the
+  // phase change.
+  const std::uint8_t phase = output & 0x03;
+  const int old_track = half_track_;
+  if (phase == ((phase_ + 1) & 3) && half_track_ < HalfTracks - 1) {
+    ++half_track_;
+  } else if (phase == ((phase_ - 1) & 3) && half_track_ > 0) {
+    --half_track_;
+  }
+  phase_ = phase;
+  if (half_track_ != old_track) sync_ = false;
+
+  const bool motor = (output & 0x04) != 0;
+  if (motor != motor_) {
+    motor_ = motor;
+    last_activity_ = cpu_.cycles;
+    if (motor_) {
+      next_byte_ = cpu_.cycles + byte_period();
+      cpu_.end_run_by(next_byte_);
+    }
+  }
+}
+
+}; // namespace emu
@@ -0,0 +1,163 @@
+#include <farm.hpp>
+
+#include <algorithm>
+
+namespace emu {
+
+void WorkQueue::reserve(size_t capacity) {
+  size_t size = 1;
+  while (size < capacity) size <<= 1;
+  if (size > mask_ + 1 || !jobs_) {
+    jobs_ = std::make_unique<std::atomic<size_t>[]>(size);
+    mask_ = size - 1;
+  }
+  top_.store(0, std::memory_order_relaxed);
+  bottom_.store(0, std::memory_order_relaxed);
+}
+
+void WorkQueue::push(size_t job) {
+  const std::int64_t bottom = bottom_.load(std::memory_order_relaxed);
+  jobs_[static_cast<size_t>(bottom) & mask_].store(job, std::memory_order_relaxed);
+  bottom_.store(bottom + 1, std::memory_order_release);
+}
+
+bool WorkQueue::take(size_t& job) {
+  std::int64_t top = top_.load(std::memory_order_acquire);
+  const std::int64_t bottom = bottom_.load(std::memory_order_acquire);
+  if (top >= bottom) return false;
+  // The slot may be reused once another thread moves the top past it; the
+  // exchange then fails and the value read is dropped.
+  job = jobs_[static_cast<size_t>(top) & mask_].load(std::memory_order_relaxed);
+  return top_.compare_exchange_strong(top, top + 1, std::memory_order_acq_rel,
+                                      std::memory_order_relaxed);
+}
+
+Farm::Farm(unsigned threads) {
+  if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+  for (unsigned t = 0; t < threads; ++t) queues_.push_back(std::make_unique<WorkQueue>());
+  for (unsigned t = 0; t < threads; ++t) workers_.emplace_back([this, t] { work(t); });
+}
+
+Farm::~Farm() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    quit_ = true;
+  }
+  start_.notify_all();
+  for (auto& worker : workers_) worker.join();
+}
+
+void Farm::run(size_t count, unsigned frames, const Job& job) {
+  if (count == 0) return;
+  const size_t threads = workers_.size();
+  for (size_t t = 0; t < threads; ++t) {
+    WorkQueue& queue = *queues_[t];
+    queue.reserve(count);
+    for (size_t i = t * count / threads; i < (t + 1) * count / threads; ++i) queue.push(i);
+  }
+  job_ = &job;
+  frames_ = std::max(1u, frames);
+  remaining_.store(count, std::memory_order_relaxed);
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  finished_ = 0;
+  ++batch_;
+  start_.notify_all();
+  // Every worker must be done with the batch, not just the jobs, before
+  // the queues can be set up for the next one.
+  finish_.wait(lock, [&] { return finished_ == threads; });
+}
+
+void Farm::work(unsigned self) {
+  std::uint64_t seen = 0;
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      start_.wait(lock, [&] { return quit_ || batch_ != seen; });
+      if (quit_) return;
+      seen = batch_;
+    }
+    run_batch(self);
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (++finished_ == workers_.size()) finish_.notify_one();
+  }
+}
+
+void Farm::run_batch(unsigned self) {
+  // Failed rounds of stealing before an idle worker parks.
+  constexpr unsigned SpinRounds = 16;
+  std::uint64_t random = 0x9E3779B97F4A7C15ull * (self + 1);
+  std::uint64_t slices = 0;
+  std::uint64_t steals = 0;
+  unsigned idle_rounds = 0;
+  WorkQueue& own = *queues_[self];
+  while (remaining_.load(std::memory_order_acquire) > 0) {
+    size_t job;
+    bool mine = own.take(job);
+    bool found = mine || steal(self, random, job);
+    if (!found && ++idle_rounds < SpinRounds) {
+      // The last jobs are running elsewhere; one may yet come back
+      // unfinished.
+      std::this_thread::yield();
+      continue;
+    }
+    if (!found) {
+      std::unique_lock<std::mutex> lock(idle_mutex_);
+      parked_.fetch_add(1, std::memory_order_seq_cst);
+      // A job pushed before the count went up is visible to this attempt;
+      // one pushed after it wakes the worker.
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      const std::uint64_t wakeups = wakeups_;
+      mine = own.take(job);
+      found = mine || steal(self, random, job);
+      if (!found) {
+        idle_.wait(lock, [&] {
+          return wakeups_ != wakeups || remaining_.load(std::memory_order_acquire) == 0;
+        });
+      }
+      parked_.fetch_sub(1, std::memory_order_relaxed);
+      if (!found) continue;
+    }
+    idle_rounds = 0;
+    if (!mine) ++steals;
+    ++slices;
+    if ((*job_)(job, frames_)) {
+      if (remaining_.fetch_sub(1, std::memory_order_acq_rel) == 1) wake(true);
+    } else {
+      own.push(job);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (parked_.load(std::memory_order_relaxed) > 0) wake(false);
+    }
+  }
+  slices_.fetch_add(slices, std::memory_order_relaxed);
+  steals_.fetch_add(steals, std::memory_order_relaxed);
+}
+
+void Farm::wake(bool all) {
+  {
+    std::lock_guard<std::mutex> lock(idle_mutex_);
+    ++wakeups_;
+  }
+  if (all) {
+    idle_.notify_all();
+  } else {
+    idle_.notify_one();
+  }
+}
+
+bool Farm::steal(unsigned self, std::uint64_t& random, size_t& job) {
+  const size_t threads = queues_.size();
+  if (threads < 2) return false;
+  // Visit the other workers from a random one on (xorshift).
+  random ^= random << 13;
+  random ^= random >> 7;
+  random ^= random << 17;
+  const size_t first = random % threads;
+  for (size_t i = 0; i < threads; ++i) {
+    const size_t victim = (first + i) % threads;
+    if (victim != self && queues_[victim]->take(job)) return true;
+  }
+  return false;
+}
+
+}; // namespace emu
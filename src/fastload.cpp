@@ -0,0 +1,459 @@
+#include <fastload.hpp>
+#include <bus.hpp>
+#include <natives.hpp>
+
+#include <algorithm>
+#include <utility>
+
+namespace emu {
+
+namespace {
+
+constexpr size_t SectorSize = 256;
+constexpr std::uint8_t DirectoryTrack = 18;
+constexpr std::uint8_t NamePadding = 0xA0;
+/// Data bytes per sector, after the link to the next one.
+constexpr size_t BlockSize = SectorSize - 2;
+/// Tracks the BAM at 18/0 covers.
+constexpr std::uint8_t BamTracks = 35;
+/// Sectors the 1541 skips between the blocks of a file and of the
+/// directory, so that the next one comes by as the last is handled.
+constexpr std::uint8_t FileInterleave = 10;
+constexpr std::uint8_t DirectoryInterleave = 3;
+
+/// KERNAL zero page locations.
+constexpr std::uint16_t Status = 0x90;
+constexpr std::uint16_t EndAddress = 0xAE;
+constexpr std::uint16_t NameLength = 0xB7;
+constexpr std::uint16_t SecondaryAddress = 0xB9;
+constexpr std::uint16_t DeviceNumber = 0xBA;
+constexpr std::uint16_t NamePointer = 0xBB;
+constexpr std::uint16_t LoadAddress = 0xC3;
+constexpr std::uint16_t SaveAddress = 0xC1;
+
+/// KERNAL error codes, returned in A with carry set.
+constexpr std::uint8_t FileNotFound = 4;
+constexpr std::uint8_t MissingFileName = 8;
+
+constexpr std::uint8_t StatusVerifyError = 0x10;
+constexpr std::uint8_t StatusEndOfFile = 0x40;
+
+/// Drops the drive prefix ("0:") and the type and mode suffix (",P,R").
+std::string_view file_part(std::string_view pattern) {
+  if (const size_t colon = pattern.find(':'); colon != std::string_view::npos && colon <= 1) {
+    pattern.remove_prefix(colon + 1);
+  }
+  return pattern.substr(0, pattern.find(','));
+}
+
+bool matches(std::string_view pattern, std::string_view name) {
+  size_t i = 0;
+  for (; i < pattern.size(); ++i) {
+    if (pattern[i] == '*') return true;
+    if (i == name.size() || (pattern[i] != '?' && pattern[i] != name[i])) return false;
+  }
+  return i == name.size();
+}
+
+/// The name set with SETNAM.
+std::string file_name(Bus& bus) {
+  std::string name(bus.read(NameLength), '\0');
+  const auto pointer = static_cast<std::uint16_t>(bus.read(NamePointer) |
+                                                  bus.read(NamePointer + 1) << 8);
+  for (size_t i = 0; i < name.size(); ++i) {
+    name[i] = static_cast<char>(bus.read(static_cast<std::uint16_t>(pointer + i)));
+  }
+  return name;
+}
+
+void write_pointer(Bus& bus, std::uint16_t at, std::uint16_t addr) {
+  bus.write(at, static_cast<std::uint8_t>(addr));
+  bus.write(static_cast<std::uint16_t>(at + 1), static_cast<std::uint8_t>(addr >> 8));
+}
+
+/// Returns from LOAD or SAVE with a KERNAL error.
+bool fail(CPU& cpu, Bus& bus, std::uint8_t code) {
+  cpu.A = code;
+  cpu.Status |= CPU::C;
+  return_from_subroutine(cpu, bus);
+  return true;
+}
+
+} // namespace
+
+bool D64::load(std::vector<std::uint8_t> image, std::string& error) {
+  switch (image.size()) {
+  case 174848: case 175531: tracks_ = 35; break;
+  case 196608: case 197376: tracks_ = 40; break;
+  default:
+    error = "not a d64 image (size " + std::to_string(image.size()) + ")";
+    return false;
+  }
+  image_ = std::move(image);
+  return read_directory(error);
+}
+
+bool D64::read_directory(std::string& error) {
+  directory_.clear();
+
+  // The directory chain starts at 18/1; the link in the BAM points there.
+  std::uint8_t track = DirectoryTrack, sector = 1;
+  for (size_t visited = 0; track != 0; ++visited) {
+    const long at = offset(track, sector);
+    if (at < 0 || visited > sectors_in(DirectoryTrack)) {
+      error = "broken directory chain";
+      return false;
+    }
+    const std::uint8_t* data = image_.data() + at;
+    for (size_t slot = 0; slot < SectorSize; slot += 32) {
+      const std::uint8_t* raw = data + slot;
+      if ((raw[2] & 0x07) == 0 && !(raw[2] & 0x80)) continue;
+      Entry entry;
+      entry.type = raw[2];
+      entry.track = raw[3];
+      entry.sector = raw[4];
+      const std::uint8_t* name = raw + 5;
+      const std::uint8_t* end = std::find(name, name + 16, NamePadding);
+      entry.name.assign(name, end);
+      entry.blocks = static_cast<std::uint16_t>(raw[30] | raw[31] << 8);
+      directory_.push_back(std::move(entry));
+    }
+    track = data[0];
+    sector = data[1];
+  }
+  return true;
+}
+
+std::uint8_t D64::sectors_in(std::uint8_t track) {
+  if (track <= 17) return 21;
+  if (track <= 24) return 19;
+  if (track <= 30) return 18;
+  return 17;
+}
+
+const std::uint8_t* D64::sector(std::uint8_t track, std::uint8_t sector) const {
+  const long at = offset(track, sector);
+  return at < 0 ? nullptr : image_.data() + at;
+}
+
+long D64::offset(std::uint8_t track, std::uint8_t sector) const {
+  if (track == 0 || track > tracks_ || sector >= sectors_in(track)) return -1;
+  size_t index = sector;
+  for (std::uint8_t t = 1; t < track; ++t) index += sectors_in(t);
+  return static_cast<long>(index * SectorSize);
+}
+
+const D64::Entry* D64::find(std::string_view pattern) const {
+  pattern = file_part(pattern);
+  for (const Entry& entry : directory_) {
+    if ((entry.type & 0x80) && matches(pattern, entry.name)) return &entry;
+  }
+  return nullptr;
+}
+
+bool D64::read(const Entry& entry, std::vector<std::uint8_t>& out, std::string& error) const {
+  out.clear();
+  const size_t max_sectors = image_.size() / SectorSize;
+  std::uint8_t track = entry.track, sector = entry.sector;
+  for (size_t visited = 0; track != 0; ++visited) {
+    const long at = offset(track, sector);
+    if (at < 0 || visited >= max_sectors) {
+      error = "broken sector chain in " + entry.name;
+      return false;
+    }
+    const std::uint8_t* data = image_.data() + at;
+    // The last sector's link holds the index of its last byte instead.
+    const size_t end = data[0] == 0 ? std::max<size_t>(data[1] + 1u, 2) : SectorSize;
+    out.insert(out.end(), data + 2, data + end);
+    track = data[0];
+    sector = data[1];
+  }
+  return true;
+}
+
+bool D64::allocate(std::uint8_t track, std::uint8_t from, std::uint8_t& sector) {
+  std::uint8_t* bam = image_.data() + offset(DirectoryTrack, 0) + 4 * track;
+  const std::uint8_t count = sectors_in(track);
+  for (std::uint8_t i = 0; i < count && bam[0] != 0; ++i) {
+    const auto s = static_cast<std::uint8_t>((from + i) % count);
+    const auto bit = static_cast<std::uint8_t>(1 << (s & 7));
+    if (bam[1 + s / 8] & bit) {
+      bam[1 + s / 8] &= static_cast<std::uint8_t>(~bit);
+      --bam[0];
+      sector = s;
+      return true;
+    }
+  }
+  return false;
+}
+
+void D64::release(std::uint8_t track, std::uint8_t sector) {
+  std::uint8_t* bam = image_.data() + offset(DirectoryTrack, 0) + 4 * track;
+  const auto bit = static_cast<std::uint8_t>(1 << (sector & 7));
+  if (bam[1 + sector / 8] & bit) return;
+  bam[1 + sector / 8] |= bit;
+  ++bam[0];
+}
+
+bool D64::write(std::string_view name, const std::vector<std::uint8_t>& data, bool replace,
+                std::string& error) {
+  if (name.empty() || name.size() > 16) {
+    error = "bad file name";
+    return false;
+  }
+  const std::vector<std::uint8_t> before = image_;
+  const auto undo = [&](const char* message) {
+    image_ = before;
+    error = message;
+    return false;
+  };
+
+  // Directory slots, in the order of the chain.
+  std::vector<std::uint8_t*> slots;
+  std::uint8_t last_track = DirectoryTrack, last_sector = 1;
+  for (std::uint8_t track = DirectoryTrack, sector = 1, visited = 0; track != 0; ++visited) {
+    const long at = offset(track, sector);
+    if (at < 0 || visited > sectors_in(DirectoryTrack)) return undo("broken directory chain");
+    for (size_t slot = 0; slot < SectorSize; slot += 32) slots.push_back(&image_[at + slot]);
+    last_track = track;
+    last_sector = sector;
+    track = image_[at];
+    sector = image_[at + 1];
+  }
+
+  for (std::uint8_t* raw : slots) {
+    const std::uint8_t* end = std::find(raw + 5, raw + 21, NamePadding);
+    if (!(raw[2] & 0x80) || std::string_view(reinterpret_cast<const char*>(raw + 5),
+                                             static_cast<size_t>(end - raw - 5)) != name) {
+      continue;
+    }
+    if (!replace) return undo("file exists");
+    size_t visited = 0;
+    for (std::uint8_t track = raw[3], sector = raw[4]; track != 0 && track <= BamTracks;) {
+      const long at = offset(track, sector);
+      if (at < 0 || visited++ >= image_.size() / SectorSize) break;
+      release(track, sector);
+      track = image_[at];
+      sector = image_[at + 1];
+    }
+    raw[2] = 0;
+  }
+
+  // Blocks from the tracks nearest the directory outwards, FileInterleave
+  // sectors apart on a track.
+  const size_t blocks = std::max<size_t>(1, (data.size() + BlockSize - 1) / BlockSize);
+  std::vector<std::pair<std::uint8_t, std::uint8_t>> chain;
+  for (std::uint8_t distance = 1; distance < DirectoryTrack && chain.size() < blocks; ++distance) {
+    for (const int track : {DirectoryTrack - distance, DirectoryTrack + distance}) {
+      if (track < 1 || track > BamTracks) continue;
+      std::uint8_t from = 0, sector = 0;
+      while (chain.size() < blocks && allocate(static_cast<std::uint8_t>(track), from, sector)) {
+        chain.emplace_back(static_cast<std::uint8_t>(track), sector);
+        from = static_cast<std::uint8_t>(sector + FileInterleave);
+      }
+    }
+  }
+  if (chain.size() < blocks) return undo("disk full");
+
+  for (size_t i = 0; i < blocks; ++i) {
+    std::uint8_t* out = image_.data() + offset(chain[i].first, chain[i].second);
+    const size_t begin = i * BlockSize;
+    const size_t size = std::min(BlockSize, data.size() - std::min(begin, data.size()));
+    std::fill(out, out + SectorSize, 0);
+    if (i + 1 < blocks) {
+      out[0] = chain[i + 1].first;
+      out[1] = chain[i + 1].second;
+    } else {
+      // The last sector's link holds the index of its last byte.
+      out[1] = static_cast<std::uint8_t>(size + 1);
+    }
+    std::copy(data.begin() + static_cast<long>(begin),
+              data.begin() + static_cast<long>(begin + size), out + 2);
+  }
+
+  const auto free_slot = std::find_if(slots.begin(), slots.end(),
+                                      [](const std::uint8_t* raw) { return raw[2] == 0; });
+  std::uint8_t* raw = nullptr;
+  if (free_slot != slots.end()) {
+    raw = *free_slot;
+  } else {
+    std::uint8_t sector = 0;
+    if (!allocate(DirectoryTrack, static_cast<std::uint8_t>(last_sector + DirectoryInterleave),
+                  sector)) {
+      return undo("directory full");
+    }
+    std::uint8_t* last = image_.data() + offset(last_track, last_sector);
+    last[0] = DirectoryTrack;
+    last[1] = sector;
+    raw = image_.data() + offset(DirectoryTrack, sector);
+    std::fill(raw, raw + SectorSize, 0);
+    raw[1] = 0xFF;
+  }
+  raw[2] = 0x80 | Prg;
+  raw[3] = chain[0].first;
+  raw[4] = chain[0].second;
+  std::fill(raw + 5, raw + 21, NamePadding);
+  std::copy(name.begin(), name.end(), raw + 5);
+  std::fill(raw + 21, raw + 30, 0);
+  raw[30] = static_cast<std::uint8_t>(blocks);
+  raw[31] = static_cast<std::uint8_t>(blocks >> 8);
+
+  return read_directory(error);
+}
+
+FastLoader::FastLoader(Hooks& hooks, std::uint16_t load_entry, std::uint16_t save_entry)
+    : hooks_(hooks), load_entry_(load_entry), save_entry_(save_entry) {
+  install();
+}
+
+FastLoader::~FastLoader() {
+  if (!strict_) uninstall();
+}
+
+void FastLoader::install() {
+  hooks_.add(load_entry_, "LOAD", [this](CPU& cpu, Bus& bus) { return load(cpu, bus); });
+  hooks_.add(save_entry_, "SAVE", [this](CPU& cpu, Bus& bus) { return save(cpu, bus); });
+}
+
+void FastLoader::uninstall() {
+  hooks_.remove(load_entry_);
+  hooks_.remove(save_entry_);
+}
+
+void FastLoader::set_strict(bool strict) {
+  if (strict == strict_) return;
+  strict_ = strict;
+  if (strict_) {
+    uninstall();
+  } else {
+    install();
+  }
+}
+
+FastLoader::Medium* FastLoader::find(std::uint8_t device) {
+  for (Medium& medium : media_) {
+    if (medium.device == device) return &medium;
+  }
+  return nullptr;
+}
+
+const FastLoader::Medium* FastLoader::find(std::uint8_t device) const {
+  return const_cast<FastLoader*>(this)->find(device);
+}
+
+const D64* FastLoader::disk(std::uint8_t device) const {
+  const Medium* medium = find(device);
+  return medium && medium->disk ? &medium->image : nullptr;
+}
+
+const std::vector<std::uint8_t>* FastLoader::file(std::uint8_t device) const {
+  const Medium* medium = find(device);
+  return medium && !medium->disk ? &medium->file : nullptr;
+}
+
+void FastLoader::mount_disk(std::uint8_t device, D64 disk) {
+  unmount(device);
+  media_.push_back({device, true, std::move(disk), {}});
+}
+
+void FastLoader::mount_file(std::uint8_t device, std::vector<std::uint8_t> prg) {
+  unmount(device);
+  media_.push_back({device, false, {}, std::move(prg)});
+}
+
+void FastLoader::unmount(std::uint8_t device) {
+  media_.erase(std::remove_if(media_.begin(), media_.end(),
+                              [&](const Medium& medium) { return medium.device == device; }),
+               media_.end());
+}
+
+bool FastLoader::load(CPU& cpu, Bus& bus) {
+  const Medium* medium = find(bus.read(DeviceNumber));
+  if (!medium) return false;
+
+  const std::string name = file_name(bus);
+  if (medium->disk && !name.empty() && name[0] == '$') return false;
+
+  std::vector<std::uint8_t> contents;
+  const std::vector<std::uint8_t>* file = &medium->file;
+  if (medium->disk) {
+    if (name.empty()) return fail(cpu, bus, MissingFileName);
+    const D64::Entry* entry = medium->image.find(name);
+    std::string error;
+    if (!entry || !medium->image.read(*entry, contents, error)) {
+      return fail(cpu, bus, FileNotFound);
+    }
+    file = &contents;
+  }
+  if (file->size() < 2) return fail(cpu, bus, FileNotFound);
+
+  // Secondary address 0 relocates to X/Y, otherwise the file's own address.
+  const bool verify = cpu.A != 0;
+  const auto start = bus.read(SecondaryAddress) == 0
+                         ? static_cast<std::uint16_t>(cpu.X | cpu.Y << 8)
+                         : static_cast<std::uint16_t>((*file)[0] | (*file)[1] << 8);
+  std::uint8_t status = StatusEndOfFile;
+  std::uint16_t addr = start;
+  for (auto it = file->begin() + 2; it != file->end(); ++it, ++addr) {
+    if (!verify) {
+      bus.write(addr, *it);
+    } else if (bus.read(addr) != *it) {
+      status |= StatusVerifyError;
+    }
+  }
+
+  if (!verify) {
+    add_known_routines(hooks_, start, start + static_cast<std::uint32_t>(file->size() - 2));
+  }
+
+  write_pointer(bus, LoadAddress, start);
+  write_pointer(bus, EndAddress, addr);
+  bus.write(Status, status);
+  cpu.X = static_cast<CPU::Register>(addr);
+  cpu.Y = static_cast<CPU::Register>(addr >> 8);
+  cpu.Status &= static_cast<CPU::Register>(~CPU::C);
+  return_from_subroutine(cpu, bus);
+  ++loads_;
+  return true;
+}
+
+bool FastLoader::save(CPU& cpu, Bus& bus) {
+  Medium* medium = find(bus.read(DeviceNumber));
+  if (!medium) return false;
+
+  // A holds the zero page address of the start pointer, X/Y the end, which
+  // is not saved.
+  const std::uint8_t pointer = cpu.A;
+  const auto start = static_cast<std::uint16_t>(bus.read(pointer) |
+                                                bus.read(static_cast<std::uint8_t>(pointer + 1)) << 8);
+  const auto end = static_cast<std::uint16_t>(cpu.X | cpu.Y << 8);
+  write_pointer(bus, SaveAddress, start);
+  write_pointer(bus, EndAddress, end);
+
+  const std::string full_name = file_name(bus);
+  std::string_view name = full_name;
+  if (medium->disk && name.empty()) return fail(cpu, bus, MissingFileName);
+
+  std::vector<std::uint8_t> contents = {static_cast<std::uint8_t>(start),
+                                        static_cast<std::uint8_t>(start >> 8)};
+  for (std::uint32_t addr = start; addr < end; ++addr) {
+    contents.push_back(bus.read(static_cast<std::uint16_t>(addr)));
+  }
+  if (medium->disk) {
+    // "@0:NAME" replaces NAME.
+    const bool replace = name[0] == '@';
+    if (replace) name.remove_prefix(1);
+    std::string error;
+    if (medium->image.write(file_part(name), contents, replace, error)) ++saves_;
+  } else {
+    medium->file = std::move(contents);
+    ++saves_;
+  }
+
+  bus.write(Status, 0);
+  cpu.Status &= static_cast<CPU::Register>(~CPU::C);
+  return_from_subroutine(cpu, bus);
+  return true;
+}
+
+}; // namespace emu
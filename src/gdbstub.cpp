@@ -0,0 +1,474 @@
+#include <gdbstub.hpp>
+#include <breakpoints.hpp>
+#include <bus.hpp>
+#include <cpu.hpp>
+#include <symbols.hpp>
+
+#include <cerrno>
+#include <cstring>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace emu {
+
+namespace {
+
+constexpr char HexDigits[] = "0123456789abcdef";
+constexpr char Interrupt = '\x03';
+
+/// Stop replies: SIGTRAP for breakpoints and steps, SIGINT for interrupts.
+constexpr std::string_view StopTrap = "S05";
+constexpr std::string_view StopInterrupt = "S02";
+
+constexpr std::string_view TargetXml =
+    "<?xml version=\"1.0\"?>\n"
+    "<!DOCTYPE target SYSTEM \"gdb-target.dtd\">\n"
+    "<target version=\"1.0\">\n"
+    "  <feature name=\"org.mos6502.cpu\">\n"
+    "    <reg name=\"a\" bitsize=\"8\" type=\"uint8\"/>\n"
+    "    <reg name=\"x\" bitsize=\"8\" type=\"uint8\"/>\n"
+    "    <reg name=\"y\" bitsize=\"8\" type=\"uint8\"/>\n"
+    "    <reg name=\"p\" bitsize=\"8\" type=\"uint8\"/>\n"
+    "    <reg name=\"sp\" bitsize=\"8\" type=\"uint8\"/>\n"
+    "    <reg name=\"pc\" bitsize=\"16\" type=\"code_ptr\"/>\n"
+    "  </feature>\n"
+    "</target>\n";
+
+void put_hex(std::string& out, std::uint8_t byte) {
+  out += HexDigits[byte >> 4];
+  out += HexDigits[byte & 0xF];
+}
+
+int hex_digit(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+/// Parses a hex number, advancing `text` past it.
+bool parse_hex(std::string_view& text, std::uint32_t& out) {
+  size_t i = 0;
+  std::uint32_t value = 0;
+  while (i < text.size() && hex_digit(text[i]) >= 0 && i < 8) {
+    value = value << 4 | static_cast<std::uint32_t>(hex_digit(text[i]));
+    ++i;
+  }
+  if (i == 0) return false;
+  text.remove_prefix(i);
+  out = value;
+  return true;
+}
+
+bool parse_hex_bytes(std::string_view hex, std::string& out) {
+  if (hex.size() % 2) return false;
+  for (size_t i = 0; i < hex.size(); i += 2) {
+    const int hi = hex_digit(hex[i]), lo = hex_digit(hex[i + 1]);
+    if (hi < 0 || lo < 0) return false;
+    out += static_cast<char>(hi << 4 | lo);
+  }
+  return true;
+}
+
+std::string to_hex(std::string_view text) {
+  std::string out;
+  for (const char c : text) put_hex(out, static_cast<std::uint8_t>(c));
+  return out;
+}
+
+void set_nonblocking(int fd) {
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+}
+
+/// Accepts `$hex` as well as plain hex for monitor commands.
+bool parse_address(std::string_view text, std::uint16_t& out) {
+  if (!text.empty() && text[0] == '$') text.remove_prefix(1);
+  if (text.size() > 2 && text[0] == '0' && (text[1] == 'x' || text[1] == 'X')) {
+    text.remove_prefix(2);
+  }
+  std::uint32_t value = 0;
+  if (!parse_hex(text, value) || !text.empty() || value > 0xFFFF) return false;
+  out = static_cast<std::uint16_t>(value);
+  return true;
+}
+
+} // namespace
+
+GdbStub::GdbStub(CPU& cpu, Bus& bus, Breakpoints& breakpoints)
+    : cpu_(cpu), bus_(bus), breakpoints_(breakpoints) {}
+
+GdbStub::~GdbStub() {
+  disconnect();
+  if (listener_ >= 0) close(listener_);
+  if (!unix_path_.empty()) unlink(unix_path_.c_str());
+}
+
+bool GdbStub::listen_tcp(std::uint16_t port, std::string& error) {
+  listener_ = socket(AF_INET, SOCK_STREAM, 0);
+  if (listener_ < 0) {
+    error = std::strerror(errno);
+    return false;
+  }
+  const int yes = 1;
+  setsockopt(listener_, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (bind(listener_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 ||
+      listen(listener_, 1) < 0) {
+    error = std::strerror(errno);
+    close(listener_);
+    listener_ = -1;
+    return false;
+  }
+  set_nonblocking(listener_);
+  return true;
+}
+
+bool GdbStub::listen_unix(const std::string& path, std::string& error) {
+  sockaddr_un addr{};
+  if (path.size() >= sizeof(addr.sun_path)) {
+    error = "socket path too long";
+    return false;
+  }
+  listener_ = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listener_ < 0) {
+    error = std::strerror(errno);
+    return false;
+  }
+  addr.sun_family = AF_UNIX;
+  std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+  unlink(path.c_str());
+  if (bind(listener_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 ||
+      listen(listener_, 1) < 0) {
+    error = std::strerror(errno);
+    close(listener_);
+    listener_ = -1;
+    return false;
+  }
+  unix_path_ = path;
+  set_nonblocking(listener_);
+  return true;
+}
+
+void GdbStub::disconnect() {
+  if (client_ >= 0) close(client_);
+  client_ = -1;
+  input_.clear();
+  halted_ = false;
+}
+
+bool GdbStub::poll() {
+  if (killed_) return false;
+  if (client_ < 0 && listener_ >= 0) {
+    client_ = accept(listener_, nullptr, nullptr);
+    if (client_ >= 0) {
+      const int yes = 1;
+      setsockopt(client_, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+      // Debuggers expect the target to be stopped once they attach.
+      halted_ = true;
+    }
+  }
+  if (client_ < 0) return true;
+
+  std::string packet;
+  if (!halted_) {
+    if (!read_some(false)) {
+      disconnect();
+      return true;
+    }
+    while (!halted_ && next_packet(packet, false)) {
+      if (packet[0] == Interrupt) {
+        halted_ = true;
+        send(StopInterrupt);
+      }
+    }
+  }
+  while (halted_ && client_ >= 0) {
+    if (!next_packet(packet, true)) {
+      disconnect();
+      break;
+    }
+    if (packet[0] != Interrupt) handle(packet);
+  }
+  return !killed_;
+}
+
+void GdbStub::stopped() {
+  if (client_ < 0) return;
+  halted_ = true;
+  send(StopTrap);
+}
+
+bool GdbStub::read_some(bool block) {
+  char buffer[4096];
+  const ssize_t n = recv(client_, buffer, sizeof(buffer), block ? 0 : MSG_DONTWAIT);
+  if (n > 0) {
+    input_.append(buffer, static_cast<size_t>(n));
+    return true;
+  }
+  if (n < 0 && !block && (errno == EAGAIN || errno == EWOULDBLOCK)) return true;
+  if (n < 0 && errno == EINTR) return true;
+  return false;
+}
+
+bool GdbStub::next_packet(std::string& packet, bool block) {
+  while (true) {
+    // Acknowledgements carry no information for a reliable transport.
+    size_t start = 0;
+    while (start < input_.size() && (input_[start] == '+' || input_[start] == '-')) {
+      ++start;
+    }
+    input_.erase(0, start);
+
+    if (!input_.empty() && input_[0] == Interrupt) {
+      input_.erase(0, 1);
+      packet.assign(1, Interrupt);
+      return true;
+    }
+    const size_t begin = input_.find('$');
+    const size_t end = input_.find('#', begin == std::string::npos ? 0 : begin);
+    // The checksum is not verified: the transport is already reliable.
+    if (begin != std::string::npos && end != std::string::npos &&
+        end + 3 <= input_.size()) {
+      packet = input_.substr(begin + 1, end - begin - 1);
+      input_.erase(0, end + 3);
+      const char ack = '+';
+      ::send(client_, &ack, 1, MSG_NOSIGNAL);
+      return true;
+    }
+    if (!block) return false;
+    if (!read_some(true)) return false;
+  }
+}
+
+void GdbStub::send(std::string_view payload) {
+  if (client_ < 0) return;
+  std::string frame = "$";
+  std::uint8_t sum = 0;
+  for (const char c : payload) {
+    if (c == '$' || c == '#' || c == '}' || c == '*') {
+      frame += '}';
+      frame += static_cast<char>(c ^ 0x20);
+      sum = static_cast<std::uint8_t>(sum + '}' + (c ^ 0x20));
+    } else {
+      frame += c;
+      sum = static_cast<std::uint8_t>(sum + c);
+    }
+  }
+  frame += '#';
+  put_hex(frame, sum);
+  size_t sent = 0;
+  while (sent < frame.size()) {
+    const ssize_t n = ::send(client_, frame.data() + sent, frame.size() - sent, MSG_NOSIGNAL);
+    if (n <= 0) {
+      if (n < 0 && errno == EINTR) continue;
+      return;
+    }
+    sent += static_cast<size_t>(n);
+  }
+}
+
+std::string GdbStub::read_registers() const {
+  std::string out;
+  put_hex(out, cpu_.A);
+  put_hex(out, cpu_.X);
+  put_hex(out, cpu_.Y);
+  put_hex(out, cpu_.Status);
+  put_hex(out, cpu_.SP);
+  put_hex(out, static_cast<std::uint8_t>(cpu_.PC));
+  put_hex(out, static_cast<std::uint8_t>(cpu_.PC >> 8));
+  return out;
+}
+
+void GdbStub::write_registers(std::string_view hex) {
+  std::string bytes;
+  if (!parse_hex_bytes(hex, bytes) || bytes.size() < 7) return;
+  const auto byte = [&](size_t i) { return static_cast<std::uint8_t>(bytes[i]); };
+  cpu_.A = byte(0);
+  cpu_.X = byte(1);
+  cpu_.Y = byte(2);
+  cpu_.Status = byte(3);
+  cpu_.SP = byte(4);
+  cpu_.PC = static_cast<std::uint16_t>(byte(5) | byte(6) << 8);
+}
+
+std::string GdbStub::read_memory(std::string_view args) const {
+  std::uint32_t addr = 0, length = 0;
+  if (!parse_hex(args, addr) || args.empty() || args[0] != ',') return "E01";
+  args.remove_prefix(1);
+  if (!parse_hex(args, length)) return "E01";
+  std::string out;
+  for (std::uint32_t i = 0; i < length && i < 0x10000; ++i) {
+    put_hex(out, bus_.peek(static_cast<std::uint16_t>(addr + i)));
+  }
+  return out;
+}
+
+std::string GdbStub::write_memory(std::string_view args) {
+  std::uint32_t addr = 0, length = 0;
+  if (!parse_hex(args, addr) || args.empty() || args[0] != ',') return "E01";
+  args.remove_prefix(1);
+  if (!parse_hex(args, length) || args.empty() || args[0] != ':') return "E01";
+  std::string bytes;
+  if (!parse_hex_bytes(args.substr(1), bytes) || bytes.size() != length) return "E01";
+  for (size_t i = 0; i < bytes.size(); ++i) {
+    bus_.write(static_cast<std::uint16_t>(addr + i), static_cast<std::uint8_t>(bytes[i]));
+  }
+  return "OK";
+}
+
+std::string GdbStub::monitor(std::string_view hex) {
+  std::string command;
+  if (!parse_hex_bytes(hex, command)) return "E01";
+  std::string_view text = command;
+  const size_t space = text.find(' ');
+  const std::string_view verb = text.substr(0, space);
+  std::string_view rest = space == std::string_view::npos ? "" : text.substr(space + 1);
+  const size_t arg_end = rest.find(' ');
+  std::uint16_t addr = 0;
+  const std::string_view where = rest.substr(0, arg_end);
+  if ((verb == "break" || verb == "delete") && !parse_address(where, addr) &&
+      !(symbols_ && symbols_->address_of(where, addr))) {
+    return to_hex("invalid address\n");
+  }
+  if (verb == "break") {
+    std::string error;
+    const std::string_view condition =
+        arg_end == std::string_view::npos ? "" : rest.substr(arg_end + 1);
+    if (!breakpoints_.add(addr, condition, error)) return to_hex(error + "\n");
+    return "OK";
+  }
+  if (verb == "delete") {
+    return breakpoints_.remove(addr) ? "OK" : to_hex("no breakpoint there\n");
+  }
+  return to_hex("commands: break ADDR [COND], delete ADDR\n");
+}
+
+std::string GdbStub::features(std::string_view args) const {
+  // args: "target.xml:OFFSET,LENGTH"
+  const std::string_view annex = "target.xml:";
+  if (args.substr(0, annex.size()) != annex) return "E00";
+  args.remove_prefix(annex.size());
+  std::uint32_t offset = 0, length = 0;
+  if (!parse_hex(args, offset) || args.empty() || args[0] != ',') return "E01";
+  args.remove_prefix(1);
+  if (!parse_hex(args, length)) return "E01";
+  if (offset >= TargetXml.size()) return "l";
+  const std::string_view chunk = TargetXml.substr(offset, length);
+  return (offset + chunk.size() < TargetXml.size() ? "m" : "l") + std::string(chunk);
+}
+
+void GdbStub::handle(const std::string& packet) {
+  if (packet.empty()) return send("");
+  const std::string_view args = std::string_view(packet).substr(1);
+  switch (packet[0]) {
+  case '?':
+    return send(StopTrap);
+  case 'g':
+    return send(read_registers());
+  case 'G':
+    write_registers(args);
+    return send("OK");
+  case 'p': {
+    std::string_view text = args;
+    std::uint32_t reg = 0;
+    if (!parse_hex(text, reg) || reg > 5) return send("E01");
+    const std::string all = read_registers();
+    return send(reg == 5 ? all.substr(10, 4) : all.substr(reg * 2, 2));
+  }
+  case 'P': {
+    std::string_view text = args;
+    std::uint32_t reg = 0;
+    std::string bytes;
+    if (!parse_hex(text, reg) || text.empty() || text[0] != '=' ||
+        !parse_hex_bytes(text.substr(1), bytes) || bytes.empty() || reg > 5) {
+      return send("E01");
+    }
+    const auto value = static_cast<std::uint8_t>(bytes[0]);
+    switch (reg) {
+    case 0: cpu_.A = value; break;
+    case 1: cpu_.X = value; break;
+    case 2: cpu_.Y = value; break;
+    case 3: cpu_.Status = value; break;
+    case 4: cpu_.SP = value; break;
+    default:
+      cpu_.PC = static_cast<std::uint16_t>(
+          value | (bytes.size() > 1 ? static_cast<std::uint8_t>(bytes[1]) << 8 : 0));
+      break;
+    }
+    return send("OK");
+  }
+  case 'm':
+    return send(read_memory(args));
+  case 'M':
+    return send(write_memory(args));
+  case 'c':
+  case 's': {
+    std::string_view text = args;
+    std::uint32_t addr = 0;
+    if (parse_hex(text, addr)) cpu_.PC = static_cast<std::uint16_t>(addr);
+    // Resuming from a breakpoint must not hit it again straight away.
+    cpu_.trap_skip = cpu_.PC;
+    if (packet[0] == 'c') {
+      halted_ = false;
+      return;
+    }
+    cpu_.step(bus_);
+    return send(StopTrap);
+  }
+  case 'Z':
+  case 'z': {
+    // Software and hardware execution breakpoints are both execute traps.
+    if (args.size() < 2 || (args[0] != '0' && args[0] != '1') || args[1] != ',') {
+      return send("");
+    }
+    std::string_view text = args.substr(2);
+    std::uint32_t addr = 0;
+    if (!parse_hex(text, addr) || addr > 0xFFFF) return send("E01");
+    if (packet[0] == 'z') {
+      breakpoints_.remove(static_cast<std::uint16_t>(addr));
+      return send("OK");
+    }
+    std::string error;
+    return send(breakpoints_.add(static_cast<std::uint16_t>(addr), "", error) ? "OK" : "E01");
+  }
+  case 'k':
+    killed_ = true;
+    disconnect();
+    return;
+  case 'D':
+    send("OK");
+    disconnect();
+    return;
+  case 'H':
+    return send("OK");
+  case 'q': {
+    if (packet.rfind("qSupported", 0) == 0) {
+      return send("PacketSize=4000;qXfer:features:read+");
+    }
+    if (packet == "qAttached") return send("1");
+    if (packet == "qC") return send("QC1");
+    if (packet == "qfThreadInfo") return send("m1");
+    if (packet == "qsThreadInfo") return send("l");
+    if (packet.rfind("qXfer:features:read:", 0) == 0) {
+      return send(features(std::string_view(packet).substr(20)));
+    }
+    if (packet.rfind("qRcmd,", 0) == 0) {
+      return send(monitor(std::string_view(packet).substr(6)));
+    }
+    return send("");
+  }
+  default:
+    return send("");
+  }
+}
+
+}; // namespace emu
@@ -0,0 +1,149 @@
+#include <hle.hpp>
+#include <bus.hpp>
+
+#include <algorithm>
+#include <utility>
+
+namespace emu {
+
+namespace {
+
+constexpr std::uint64_t HashBase = 0x100000001B3;
+
+/// Bytes are offset by one so that runs of zeros still change the hash.
+std::uint64_t mix(std::uint64_t hash, std::uint8_t byte) {
+  return hash * HashBase + byte + 1;
+}
+
+constexpr std::uint8_t JsrOpcode = 0x20;
+
+constexpr auto ByAddr = [](const auto& entry, std::uint16_t addr) {
+  return entry.addr < addr;
+};
+
+} // namespace
+
+void return_from_subroutine(CPU& cpu, Bus& bus) {
+  const auto pop = [&] {
+    cpu.SP = static_cast<CPU::Register>(cpu.SP + 1);
+    return bus.read(static_cast<std::uint16_t>(0x100 | cpu.SP));
+  };
+  const std::uint8_t lo = pop();
+  const std::uint8_t hi = pop();
+  cpu.PC = static_cast<std::uint16_t>((lo | hi << 8) + 1);
+  cpu.cycles += 6;
+}
+
+bool called_by_jsr(const CPU& cpu, const Bus& bus) {
+  const auto lo = bus.peek(static_cast<std::uint16_t>(0x100 | ((cpu.SP + 1) & 0xFF)));
+  const auto hi = bus.peek(static_cast<std::uint16_t>(0x100 | ((cpu.SP + 2) & 0xFF)));
+  // JSR pushes the address of its own last byte.
+  return bus.peek(static_cast<std::uint16_t>((lo | hi << 8) - 2)) == JsrOpcode;
+}
+
+std::uint64_t Hooks::hash(const Bus& bus, std::uint16_t addr, std::uint16_t length) {
+  std::uint64_t hash = 0;
+  for (std::uint32_t i = 0; i < length; ++i) {
+    hash = mix(hash, bus.peek(static_cast<std::uint16_t>(addr + i)));
+  }
+  return hash;
+}
+
+std::uint64_t Hooks::hash(const std::uint8_t* code, size_t length) {
+  std::uint64_t hash = 0;
+  for (size_t i = 0; i < length; ++i) hash = mix(hash, code[i]);
+  return hash;
+}
+
+Hooks::Entry* Hooks::find(std::uint16_t addr) {
+  const auto it = std::lower_bound(entries_.begin(), entries_.end(), addr,
+                                   ByAddr);
+  return it != entries_.end() && it->addr == addr ? &*it : nullptr;
+}
+
+void Hooks::insert(Entry entry) {
+  if (running_) {
+    added_.push_back(std::move(entry));
+    return;
+  }
+  if (Entry* existing = find(entry.addr)) {
+    *existing = std::move(entry);
+    return;
+  }
+  const auto it = std::lower_bound(entries_.begin(), entries_.end(), entry.addr,
+                                   ByAddr);
+  if (enabled_) bus_.set_trap(entry.addr, true);
+  entries_.insert(it, std::move(entry));
+}
+
+void Hooks::add(std::uint16_t addr, std::string name, NativeRoutine routine) {
+  insert({addr, std::move(name), std::move(routine), 0, 0, 0});
+}
+
+size_t Hooks::add_by_hash(std::uint64_t hash, std::uint16_t length,
+                          const std::string& name, const NativeRoutine& routine,
+                          std::uint16_t begin, std::uint32_t end) {
+  if (length == 0 || begin + std::uint32_t{length} > end) return 0;
+
+  // Weight of the byte leaving the window.
+  std::uint64_t top = 1;
+  for (std::uint16_t i = 1; i < length; ++i) top *= HashBase;
+
+  std::uint64_t window = Hooks::hash(bus_, begin, length);
+  size_t found = 0;
+  for (std::uint32_t addr = begin;; ++addr) {
+    if (window == hash) {
+      insert({static_cast<std::uint16_t>(addr), name, routine, length, hash, 0});
+      ++found;
+    }
+    if (addr + length >= end) break;
+    const std::uint8_t out = bus_.peek(static_cast<std::uint16_t>(addr));
+    const std::uint8_t in = bus_.peek(static_cast<std::uint16_t>(addr + length));
+    window = mix(window - (out + std::uint64_t{1}) * top, in);
+  }
+  return found;
+}
+
+bool Hooks::remove(std::uint16_t addr) {
+  Entry* entry = find(addr);
+  if (!entry) return false;
+  if (enabled_) bus_.set_trap(addr, false);
+  entries_.erase(entries_.begin() + (entry - entries_.data()));
+  return true;
+}
+
+void Hooks::clear() {
+  set_enabled(false);
+  entries_.clear();
+  enabled_ = true;
+}
+
+void Hooks::set_enabled(bool enabled) {
+  if (enabled == enabled_) return;
+  enabled_ = enabled;
+  for (const Entry& entry : entries_) bus_.set_trap(entry.addr, enabled);
+}
+
+std::uint64_t Hooks::calls(std::uint16_t addr) const {
+  const auto it = std::lower_bound(entries_.begin(), entries_.end(), addr,
+                                   ByAddr);
+  return it != entries_.end() && it->addr == addr ? it->calls : 0;
+}
+
+TrapHandler::Action Hooks::on_trap(CPU& cpu, Bus& bus) {
+  Entry* entry = find(cpu.PC);
+  if (!entry || !enabled_) return Action::Execute;
+  if (entry->length && hash(bus, entry->addr, entry->length) != entry->hash) {
+    return Action::Execute;
+  }
+  if (!called_by_jsr(cpu, bus)) return Action::Execute;
+  running_ = true;
+  const bool handled = entry->routine(cpu, bus);
+  if (handled) ++entry->calls;
+  running_ = false;
+  for (Entry& added : added_) insert(std::move(added));
+  added_.clear();
+  return handled ? Action::Resume : Action::Execute;
+}
+
+}; // namespace emu
@@ -0,0 +1,246 @@
+#include <idioms.hpp>
+#include <bus.hpp>
+#include <cpu.hpp>
+
+#include <algorithm>
+#include <cstring>
+
+namespace emu {
+
+namespace {
+
+bool uses_x(Mode mode) {
+  return mode == Mode::AbsoluteX || mode == Mode::ZeroPageX;
+}
+
+} // namespace
+
+bool Idioms::recognize(Bus& bus, std::uint16_t pc, std::uint16_t head,
+                       Body& out) const {
+  if (!bus.plain(head) || !bus.plain(pc)) return false;
+  const Op branch = OpTable[bus.peek(pc)].op;
+  if (branch != Op::BNE && branch != Op::BPL) return false;
+  out.until_zero = branch == Op::BNE;
+  out.head = head;
+
+  bool stepped = false, stores = false;
+  std::uint16_t addr = head;
+  while (addr != pc) {
+    const OpInfo& info = OpTable[bus.peek(addr)];
+    const std::uint16_t length = instr_length(info.mode);
+    if (stepped || addr + length > pc) return false;
+    const std::uint16_t operand =
+        length == 2 ? bus.peek(addr + 1)
+                    : static_cast<std::uint16_t>(bus.peek(addr + 1) |
+                                                 bus.peek(addr + 2) << 8);
+    switch (info.op) {
+    case Op::INX: case Op::DEX: case Op::INY: case Op::DEY:
+      // The step closes the body, right before the branch.
+      out.index_x = info.op == Op::INX || info.op == Op::DEX;
+      out.step = info.op == Op::INX || info.op == Op::INY ? 1 : -1;
+      stepped = true;
+      break;
+    case Op::LDA: case Op::STA: {
+      const bool immediate = info.mode == Mode::Immediate;
+      if (out.num_ops == MaxOps || (immediate && info.op == Op::STA)) return false;
+      if (!immediate && info.mode != Mode::AbsoluteX && info.mode != Mode::AbsoluteY &&
+          info.mode != Mode::ZeroPageX && info.mode != Mode::ZeroPageY &&
+          info.mode != Mode::IndirectY) {
+        return false;
+      }
+      stores |= info.op == Op::STA;
+      out.ops[out.num_ops++] = {info.op == Op::STA, immediate, info.mode, operand,
+                                info.cycles, info.page_penalty};
+      break;
+    }
+    default:
+      return false;
+    }
+    addr = static_cast<std::uint16_t>(addr + length);
+  }
+  if (!stepped || !stores) return false;
+  for (size_t i = 0; i < out.num_ops; ++i) {
+    const Access& op = out.ops[i];
+    if (!op.immediate && uses_x(op.mode) != out.index_x) return false;
+  }
+  return true;
+}
+
+std::uint32_t Idioms::loop(CPU& cpu, Bus& bus, std::uint16_t pc,
+                           std::uint64_t cycles, std::uint64_t until) {
+  std::uint32_t& miss = misses_[pc & 0xFF];
+  if (miss == pc + 1u) return 0;
+  // An interrupt would be taken before the next instruction.
+  if (cpu.nmi_pending || (cpu.irq_lines && !(cpu.Status & CPU::I))) return 0;
+
+  Body body;
+  if (!recognize(bus, pc, cpu.PC, body)) {
+    miss = pc + 1u;
+    return 0;
+  }
+
+  // (zp),Y pointers stay put as long as no store hits them.
+  std::uint16_t pointers[MaxOps] = {};
+  for (size_t i = 0; i < body.num_ops; ++i) {
+    const Access& op = body.ops[i];
+    if (op.mode != Mode::IndirectY) continue;
+    const auto lo = static_cast<std::uint8_t>(op.operand);
+    const auto hi = static_cast<std::uint8_t>(lo + 1);
+    if (!bus.plain(lo)) return 0;
+    pointers[i] = static_cast<std::uint16_t>(bus.peek(lo) | bus.peek(hi) << 8);
+  }
+  const auto address = [&](size_t i, std::uint8_t index, bool& crossed) {
+    const Access& op = body.ops[i];
+    std::uint16_t base = op.operand;
+    if (op.mode == Mode::ZeroPageX || op.mode == Mode::ZeroPageY) {
+      crossed = false;
+      return static_cast<std::uint16_t>(static_cast<std::uint8_t>(base + index));
+    }
+    if (op.mode == Mode::IndirectY) base = pointers[i];
+    const auto addr = static_cast<std::uint16_t>(base + index);
+    crossed = ((base ^ addr) & 0xFF00) != 0;
+    return addr;
+  };
+  const auto hits_pointer = [&](std::uint16_t addr) {
+    for (size_t i = 0; i < body.num_ops; ++i) {
+      const Access& op = body.ops[i];
+      if (op.mode == Mode::IndirectY &&
+          (addr == (op.operand & 0xFF) || addr == ((op.operand + 1) & 0xFF))) {
+        return true;
+      }
+    }
+    return false;
+  };
+
+  // Plan: count the iterations that can run without touching a device or
+  // the loop itself and that end before the budget does.
+  const auto next = static_cast<std::uint16_t>(pc + 2);
+  const std::uint32_t taken_cycles = ((body.head ^ next) & 0xFF00) ? 4 : 3;
+  const std::uint8_t start = body.index_x ? cpu.X : cpu.Y;
+  std::uint16_t low[MaxOps], high[MaxOps];
+  std::uint8_t index = start;
+  std::uint64_t spent = 0;
+  std::uint32_t count = 0;
+  bool finished = false;
+  while (true) {
+    std::uint32_t cost = 2; // the step
+    std::uint16_t addrs[MaxOps];
+    bool safe = true;
+    for (size_t i = 0; i < body.num_ops && safe; ++i) {
+      const Access& op = body.ops[i];
+      if (op.immediate) {
+        cost += op.cycles;
+        continue;
+      }
+      bool crossed;
+      const std::uint16_t addr = addrs[i] = address(i, index, crossed);
+      safe = bus.plain(addr) &&
+             !(op.store && ((addr >= body.head && addr < next) || hits_pointer(addr)));
+      cost += op.cycles + (op.page_penalty && crossed ? 1 : 0);
+    }
+    if (!safe) break;
+    const auto stepped = static_cast<std::uint8_t>(index + body.step);
+    const bool taken = body.until_zero ? stepped != 0 : !(stepped & 0x80);
+    cost += taken ? taken_cycles : 2;
+    if (cycles + spent + cost >= until) break;
+    for (size_t i = 0; i < body.num_ops; ++i) {
+      if (body.ops[i].immediate) continue;
+      low[i] = count ? std::min(low[i], addrs[i]) : addrs[i];
+      high[i] = count ? std::max(high[i], addrs[i]) : addrs[i];
+    }
+    spent += cost;
+    ++count;
+    index = stepped;
+    if (!taken) {
+      finished = true;
+      break;
+    }
+  }
+  if (count == 0) return 0;
+
+  // Execute: fills of constants and single non-overlapping copies that stay
+  // within a page of host memory are done with memset/memcpy, anything else
+  // iteration by iteration.
+  const auto same_page = [&](size_t i) { return (low[i] ^ high[i]) < 0x100; };
+  const Access* ops = body.ops;
+  // Zero page indexing wraps, so only these walk a contiguous range.
+  const bool contiguous = std::all_of(ops, ops + body.num_ops, [](const Access& op) {
+    return op.immediate || (op.mode != Mode::ZeroPageX && op.mode != Mode::ZeroPageY);
+  });
+  const bool has_loads = std::any_of(ops, ops + body.num_ops, [](const Access& op) {
+    return !op.store && !op.immediate;
+  });
+  const bool constant_a = !has_loads && (ops[0].immediate ||
+                                         std::none_of(ops, ops + body.num_ops,
+                                                      [](const Access& op) { return op.immediate; }));
+  const bool copy = body.num_ops == 2 && !ops[0].store && !ops[0].immediate &&
+                    ops[1].store && (high[0] < low[1] || high[1] < low[0]);
+
+  bool bulk = contiguous && (constant_a || copy);
+  for (size_t i = 0; i < body.num_ops && bulk; ++i) {
+    if (ops[i].immediate) continue;
+    bulk = same_page(i) &&
+           (ops[i].store ? bus.direct_write(low[i]) != nullptr : bus.direct_read(low[i]) != nullptr);
+  }
+  if (bulk && !copy) {
+    // Filling store by store rather than iteration by iteration is only
+    // right if no two stores of different values meet at an address.
+    std::uint8_t values[MaxOps];
+    std::uint8_t value = cpu.A;
+    for (size_t i = 0; i < body.num_ops; ++i) {
+      if (ops[i].immediate) value = static_cast<std::uint8_t>(ops[i].operand);
+      values[i] = value;
+    }
+    for (size_t i = 0; i < body.num_ops && bulk; ++i) {
+      for (size_t j = i + 1; j < body.num_ops && bulk; ++j) {
+        if (!ops[i].store || !ops[j].store || values[i] == values[j]) continue;
+        bulk = high[i] < low[j] || high[j] < low[i];
+      }
+    }
+  }
+
+  std::uint8_t a = cpu.A;
+  if (bulk && copy) {
+    std::memcpy(bus.direct_write(low[1]), bus.direct_read(low[0]), count);
+    // A holds the byte loaded by the last iteration.
+    const auto last = static_cast<std::uint8_t>(start + (count - 1) * body.step);
+    bool crossed;
+    a = *bus.direct_read(address(0, last, crossed));
+  } else if (bulk) {
+    for (size_t i = 0; i < body.num_ops; ++i) {
+      if (ops[i].immediate) {
+        a = static_cast<std::uint8_t>(ops[i].operand);
+      } else {
+        std::memset(bus.direct_write(low[i]), a, high[i] - low[i] + 1u);
+      }
+    }
+  } else {
+    index = start;
+    for (std::uint32_t n = 0; n < count; ++n) {
+      for (size_t i = 0; i < body.num_ops; ++i) {
+        const Access& op = ops[i];
+        bool crossed;
+        if (op.immediate) {
+          a = static_cast<std::uint8_t>(op.operand);
+        } else if (op.store) {
+          bus.write(address(i, index, crossed), a);
+        } else {
+          a = bus.read(address(i, index, crossed));
+        }
+      }
+      index = static_cast<std::uint8_t>(index + body.step);
+    }
+  }
+
+  cpu.A = a;
+  (body.index_x ? cpu.X : cpu.Y) = index;
+  // The step sets the flags last; loads and stores leave C and V alone.
+  cpu.Status = static_cast<std::uint8_t>((cpu.Status & ~(CPU::N | CPU::Z)) |
+                                         (index & CPU::N) | (index == 0 ? CPU::Z : 0));
+  cpu.PC = finished ? next : body.head;
+  ++loops_;
+  iterations_ += count;
+  return static_cast<std::uint32_t>(spent);
+}
+
+}; // namespace emu
@@ -0,0 +1,532 @@
+#include <lanes.hpp>
+#include <opcodes.hpp>
+
+#include <algorithm>
+#include <cstring>
+
+namespace emu {
+
+namespace {
+
+constexpr size_t Lanes = CpuLanes::Lanes;
+constexpr std::uint16_t StackPage = 0x0100;
+constexpr std::uint16_t IrqVector = 0xFFFE;
+constexpr std::uint32_t MemorySize = 0x10000;
+
+/// One lane's ADC and SBC, with the NMOS decimal mode as in cpu.cpp.
+void adc_lane(std::uint8_t& a, std::uint8_t& status, std::uint8_t value, bool decimal) {
+  const unsigned carry = status & CPU::C;
+  const unsigned sum = a + value + carry;
+  unsigned flags = status & ~(CPU::C | CPU::V | CPU::N | CPU::Z);
+  if (decimal) {
+    unsigned lo = (a & 0x0F) + (value & 0x0F) + carry;
+    if (lo > 0x09) lo += 0x06;
+    unsigned hi = (a >> 4) + (value >> 4) + (lo > 0x0F ? 1 : 0);
+    if ((sum & 0xFF) == 0) flags |= CPU::Z;
+    if (hi & 0x08) flags |= CPU::N;
+    if (~(a ^ value) & (a ^ (hi << 4)) & 0x80) flags |= CPU::V;
+    if (hi > 0x09) hi += 0x06;
+    if (hi > 0x0F) flags |= CPU::C;
+    a = static_cast<std::uint8_t>((hi << 4) | (lo & 0x0F));
+  } else {
+    if (sum > 0xFF) flags |= CPU::C;
+    if (~(a ^ value) & (a ^ sum) & 0x80) flags |= CPU::V;
+    a = static_cast<std::uint8_t>(sum);
+    flags |= (a & CPU::N) | (a == 0 ? CPU::Z : 0);
+  }
+  status = static_cast<std::uint8_t>(flags);
+}
+
+void sbc_lane(std::uint8_t& a, std::uint8_t& status, std::uint8_t value, bool decimal) {
+  if (!decimal) {
+    adc_lane(a, status, static_cast<std::uint8_t>(~value), false);
+    return;
+  }
+  // All flags come from the binary subtraction.
+  const unsigned borrow = (status & CPU::C) ? 0 : 1;
+  const unsigned diff = a - value - borrow;
+  int lo = (a & 0x0F) - (value & 0x0F) - static_cast<int>(borrow);
+  int hi = (a >> 4) - (value >> 4);
+  if (lo < 0) {
+    lo -= 0x06;
+    --hi;
+  }
+  if (hi < 0) hi -= 0x06;
+  const auto result = static_cast<std::uint8_t>(diff);
+  unsigned flags = status & ~(CPU::C | CPU::V | CPU::N | CPU::Z);
+  if (diff < 0x100) flags |= CPU::C;
+  if ((a ^ value) & (a ^ diff) & 0x80) flags |= CPU::V;
+  flags |= (result & CPU::N) | (result == 0 ? CPU::Z : 0);
+  status = static_cast<std::uint8_t>(flags);
+  a = static_cast<std::uint8_t>((hi << 4) | (lo & 0x0F));
+}
+
+template <typename T>
+void blend(CpuLanes::Vector<T>& reg, const CpuLanes::Vector<T>& value,
+           const CpuLanes::Vector<std::uint8_t>& active) {
+  for (size_t l = 0; l < Lanes; ++l) reg[l] = active[l] ? value[l] : reg[l];
+}
+
+} // namespace
+
+CpuLanes::CpuLanes() : memory_(MemorySize * Lanes) {
+  for (size_t l = 0; l < Lanes; ++l) set_state(l, CPU{});
+}
+
+void CpuLanes::load(std::uint16_t address, const std::uint8_t* data, size_t size) {
+  size = std::min<size_t>(size, MemorySize - address);
+  for (size_t i = 0; i < size; ++i) {
+    std::fill_n(&memory_[(address + i) * Lanes], Lanes, data[i]);
+  }
+}
+
+CPU CpuLanes::state(size_t lane) const {
+  CPU cpu;
+  cpu.PC = pc_[lane];
+  cpu.A = a_[lane];
+  cpu.X = x_[lane];
+  cpu.Y = y_[lane];
+  cpu.SP = sp_[lane];
+  cpu.Status = status_[lane];
+  cpu.cycles = cycles_[lane];
+  cpu.jammed = jammed_[lane];
+  cpu.decimal_mode = decimal_mode_;
+  return cpu;
+}
+
+void CpuLanes::set_state(size_t lane, const CPU& cpu) {
+  pc_[lane] = cpu.PC;
+  a_[lane] = cpu.A;
+  x_[lane] = cpu.X;
+  y_[lane] = cpu.Y;
+  sp_[lane] = cpu.SP;
+  status_[lane] = cpu.Status;
+  cycles_[lane] = cpu.cycles;
+  jammed_[lane] = cpu.jammed;
+}
+
+bool CpuLanes::uniform(const Words& addr, const Mask& active) const {
+  const std::uint16_t lead = addr[lead_];
+  unsigned differs = 0;
+  for (size_t l = 0; l < Lanes; ++l) differs |= active[l] & (addr[l] != lead);
+  return differs == 0;
+}
+
+CpuLanes::Bytes CpuLanes::read(const Words& addr, const Mask& active) const {
+  Bytes value;
+  if (uniform(addr, active)) {
+    std::memcpy(value.data(), &memory_[addr[lead_] * Lanes], Lanes);
+  } else {
+    for (size_t l = 0; l < Lanes; ++l) value[l] = memory_[addr[l] * Lanes + l];
+  }
+  return value;
+}
+
+CpuLanes::Words CpuLanes::read16(const Words& lo, const Words& hi, const Mask& active) const {
+  const Bytes low = read(lo, active);
+  const Bytes high = read(hi, active);
+  Words value;
+  for (size_t l = 0; l < Lanes; ++l) {
+    value[l] = static_cast<std::uint16_t>(low[l] | (high[l] << 8));
+  }
+  return value;
+}
+
+void CpuLanes::write(const Words& addr, const Bytes& value, const Mask& active) {
+  if (uniform(addr, active)) {
+    std::uint8_t* row = &memory_[addr[lead_] * Lanes];
+    for (size_t l = 0; l < Lanes; ++l) row[l] = active[l] ? value[l] : row[l];
+  } else {
+    for (size_t l = 0; l < Lanes; ++l) {
+      if (active[l]) memory_[addr[l] * Lanes + l] = value[l];
+    }
+  }
+}
+
+void CpuLanes::push(const Bytes& value, const Mask& active) {
+  Words addr;
+  for (size_t l = 0; l < Lanes; ++l) {
+    addr[l] = static_cast<std::uint16_t>(StackPage | sp_[l]);
+    sp_[l] = static_cast<std::uint8_t>(sp_[l] - (active[l] ? 1 : 0));
+  }
+  write(addr, value, active);
+}
+
+CpuLanes::Bytes CpuLanes::pull(const Mask& active) {
+  Words addr;
+  for (size_t l = 0; l < Lanes; ++l) {
+    sp_[l] = static_cast<std::uint8_t>(sp_[l] + (active[l] ? 1 : 0));
+    addr[l] = static_cast<std::uint16_t>(StackPage | sp_[l]);
+  }
+  return read(addr, active);
+}
+
+void CpuLanes::set_nz(const Bytes& value, const Mask& active) {
+  for (size_t l = 0; l < Lanes; ++l) {
+    const auto flags = static_cast<std::uint8_t>((status_[l] & ~(CPU::N | CPU::Z)) |
+                                                 (value[l] & CPU::N) |
+                                                 (value[l] == 0 ? CPU::Z : 0));
+    status_[l] = active[l] ? flags : status_[l];
+  }
+}
+
+void CpuLanes::set_flag(CPU::Flag flag, const Mask& on, const Mask& active) {
+  for (size_t l = 0; l < Lanes; ++l) {
+    const auto flags = static_cast<std::uint8_t>(on[l] ? (status_[l] | flag) : (status_[l] & ~flag));
+    status_[l] = active[l] ? flags : status_[l];
+  }
+}
+
+void CpuLanes::adc(const Bytes& value, const Mask& active) {
+  for (size_t l = 0; l < Lanes; ++l) {
+    if (active[l]) adc_lane(a_[l], status_[l], value[l], decimal_mode_ && (status_[l] & CPU::D));
+  }
+}
+
+void CpuLanes::sbc(const Bytes& value, const Mask& active) {
+  for (size_t l = 0; l < Lanes; ++l) {
+    if (active[l]) sbc_lane(a_[l], status_[l], value[l], decimal_mode_ && (status_[l] & CPU::D));
+  }
+}
+
+bool CpuLanes::issue(std::uint64_t until) {
+  Mask live;
+  std::uint16_t pc = 0xFFFF;
+  unsigned any = 0;
+  for (size_t l = 0; l < Lanes; ++l) {
+    live[l] = !jammed_[l] && cycles_[l] < until && pc_[l] != exit_;
+    any |= live[l];
+    pc = std::min<std::uint16_t>(pc, live[l] ? pc_[l] : 0xFFFF);
+  }
+  if (!any) return false;
+
+  // The lowest PC goes first, with the opcode of its first lane.
+  Mask active;
+  for (size_t l = 0; l < Lanes; ++l) active[l] = live[l] && pc_[l] == pc;
+  lead_ = static_cast<size_t>(std::find(active.begin(), active.end(), 1) - active.begin());
+  const std::uint8_t* row = &memory_[pc * Lanes];
+  const std::uint8_t opcode = row[lead_];
+  unsigned count = 0;
+  for (size_t l = 0; l < Lanes; ++l) {
+    active[l] = active[l] && row[l] == opcode;
+    count += active[l];
+  }
+  ++issued_;
+  executed_ += count;
+
+  const OpInfo& info = OpTable[opcode];
+  const auto next = static_cast<std::uint16_t>(pc + instr_length(info.mode));
+  Bytes lo, hi;
+  std::memcpy(lo.data(), &memory_[static_cast<std::uint16_t>(pc + 1) * Lanes], Lanes);
+  std::memcpy(hi.data(), &memory_[static_cast<std::uint16_t>(pc + 2) * Lanes], Lanes);
+
+  Words addr{};
+  Bytes extra{};
+  const auto indexed = [&](const Bytes& index) {
+    for (size_t l = 0; l < Lanes; ++l) {
+      const auto base = static_cast<std::uint16_t>(lo[l] | (hi[l] << 8));
+      addr[l] = static_cast<std::uint16_t>(base + index[l]);
+      extra[l] = info.page_penalty && ((base ^ addr[l]) & 0xFF00);
+    }
+  };
+  switch (info.mode) {
+  case Mode::Implied:
+  case Mode::Accumulator:
+    break;
+  case Mode::Immediate:
+    addr.fill(static_cast<std::uint16_t>(pc + 1));
+    break;
+  case Mode::ZeroPage:
+    for (size_t l = 0; l < Lanes; ++l) addr[l] = lo[l];
+    break;
+  case Mode::ZeroPageX:
+    for (size_t l = 0; l < Lanes; ++l) addr[l] = static_cast<std::uint8_t>(lo[l] + x_[l]);
+    break;
+  case Mode::ZeroPageY:
+    for (size_t l = 0; l < Lanes; ++l) addr[l] = static_cast<std::uint8_t>(lo[l] + y_[l]);
+    break;
+  case Mode::Relative:
+    for (size_t l = 0; l < Lanes; ++l) {
+      addr[l] = static_cast<std::uint16_t>(next + static_cast<std::int8_t>(lo[l]));
+    }
+    break;
+  case Mode::Absolute:
+    for (size_t l = 0; l < Lanes; ++l) addr[l] = static_cast<std::uint16_t>(lo[l] | (hi[l] << 8));
+    break;
+  case Mode::AbsoluteX:
+    indexed(x_);
+    break;
+  case Mode::AbsoluteY:
+    indexed(y_);
+    break;
+  case Mode::Indirect: {
+    // The pointer's high byte is fetched without carrying into the page.
+    Words ptr, ptr_hi;
+    for (size_t l = 0; l < Lanes; ++l) {
+      ptr[l] = static_cast<std::uint16_t>(lo[l] | (hi[l] << 8));
+      ptr_hi[l] = static_cast<std::uint16_t>((ptr[l] & 0xFF00) | ((ptr[l] + 1) & 0x00FF));
+    }
+    addr = read16(ptr, ptr_hi, active);
+    break;
+  }
+  case Mode::IndirectX: {
+    Words ptr, ptr_hi;
+    for (size_t l = 0; l < Lanes; ++l) {
+      ptr[l] = static_cast<std::uint8_t>(lo[l] + x_[l]);
+      ptr_hi[l] = static_cast<std::uint8_t>(ptr[l] + 1);
+    }
+    addr = read16(ptr, ptr_hi, active);
+    break;
+  }
+  case Mode::IndirectY: {
+    Words ptr, ptr_hi;
+    for (size_t l = 0; l < Lanes; ++l) {
+      ptr[l] = lo[l];
+      ptr_hi[l] = static_cast<std::uint8_t>(lo[l] + 1);
+    }
+    const Words base = read16(ptr, ptr_hi, active);
+    for (size_t l = 0; l < Lanes; ++l) {
+      addr[l] = static_cast<std::uint16_t>(base[l] + y_[l]);
+      extra[l] = info.page_penalty && ((base[l] ^ addr[l]) & 0xFF00);
+    }
+    break;
+  }
+  }
+
+  for (size_t l = 0; l < Lanes; ++l) pc_[l] = active[l] ? next : pc_[l];
+
+  Bytes value, result;
+  Mask flag;
+  // Shared body of the shift and rotate instructions: `fn` sets `result`
+  // and the carry `flag` of each lane from `value`.
+  const auto modify = [&](auto fn) {
+    value = info.mode == Mode::Accumulator ? a_ : read(addr, active);
+    for (size_t l = 0; l < Lanes; ++l) fn(l);
+    set_flag(CPU::C, flag, active);
+    if (info.mode == Mode::Accumulator) {
+      blend(a_, result, active);
+    } else {
+      write(addr, result, active);
+    }
+    set_nz(result, active);
+  };
+  const auto load = [&](Bytes& reg) {
+    blend(reg, read(addr, active), active);
+    set_nz(reg, active);
+  };
+  const auto transfer = [&](Bytes& to, const Bytes& from) {
+    blend(to, from, active);
+    set_nz(to, active);
+  };
+  const auto compare = [&](const Bytes& reg) {
+    value = read(addr, active);
+    for (size_t l = 0; l < Lanes; ++l) {
+      flag[l] = reg[l] >= value[l];
+      result[l] = static_cast<std::uint8_t>(reg[l] - value[l]);
+    }
+    set_flag(CPU::C, flag, active);
+    set_nz(result, active);
+  };
+  const auto step = [&](Bytes& reg, int delta) {
+    for (size_t l = 0; l < Lanes; ++l) {
+      reg[l] = static_cast<std::uint8_t>(reg[l] + (active[l] ? delta : 0));
+    }
+    set_nz(reg, active);
+  };
+  const auto step_memory = [&](int delta) {
+    value = read(addr, active);
+    for (size_t l = 0; l < Lanes; ++l) result[l] = static_cast<std::uint8_t>(value[l] + delta);
+    write(addr, result, active);
+    set_nz(result, active);
+  };
+  const auto change_flag = [&](CPU::Flag bit, bool on) {
+    flag.fill(on);
+    set_flag(bit, flag, active);
+  };
+  const auto push16 = [&](const Words& word) {
+    for (size_t l = 0; l < Lanes; ++l) value[l] = static_cast<std::uint8_t>(word[l] >> 8);
+    push(value, active);
+    for (size_t l = 0; l < Lanes; ++l) value[l] = static_cast<std::uint8_t>(word[l]);
+    push(value, active);
+  };
+  const auto pull16 = [&]() {
+    const Bytes low = pull(active);
+    const Bytes high = pull(active);
+    Words word;
+    for (size_t l = 0; l < Lanes; ++l) word[l] = static_cast<std::uint16_t>(low[l] | (high[l] << 8));
+    return word;
+  };
+
+  switch (info.op) {
+  case Op::ADC: adc(read(addr, active), active); break;
+  case Op::SBC: sbc(read(addr, active), active); break;
+  case Op::AND:
+    value = read(addr, active);
+    for (size_t l = 0; l < Lanes; ++l) result[l] = a_[l] & value[l];
+    transfer(a_, result);
+    break;
+  case Op::ORA:
+    value = read(addr, active);
+    for (size_t l = 0; l < Lanes; ++l) result[l] = a_[l] | value[l];
+    transfer(a_, result);
+    break;
+  case Op::EOR:
+    value = read(addr, active);
+    for (size_t l = 0; l < Lanes; ++l) result[l] = a_[l] ^ value[l];
+    transfer(a_, result);
+    break;
+
+  case Op::ASL:
+    modify([&](size_t l) {
+      flag[l] = value[l] >> 7;
+      result[l] = static_cast<std::uint8_t>(value[l] << 1);
+    });
+    break;
+  case Op::LSR:
+    modify([&](size_t l) {
+      flag[l] = value[l] & 0x01;
+      result[l] = static_cast<std::uint8_t>(value[l] >> 1);
+    });
+    break;
+  case Op::ROL:
+    modify([&](size_t l) {
+      flag[l] = value[l] >> 7;
+      result[l] = static_cast<std::uint8_t>((value[l] << 1) | (status_[l] & CPU::C));
+    });
+    break;
+  case Op::ROR:
+    modify([&](size_t l) {
+      flag[l] = value[l] & 0x01;
+      result[l] = static_cast<std::uint8_t>((value[l] >> 1) | ((status_[l] & CPU::C) << 7));
+    });
+    break;
+
+  case Op::BCC: case Op::BCS: case Op::BEQ: case Op::BMI:
+  case Op::BNE: case Op::BPL: case Op::BVC: case Op::BVS: {
+    // Bits 7-6 of the opcode pick the flag, bit 5 the value it must have.
+    static constexpr std::uint8_t Flags[4] = {CPU::N, CPU::V, CPU::C, CPU::Z};
+    const std::uint8_t mask = Flags[opcode >> 6];
+    const bool set = opcode & 0x20;
+    for (size_t l = 0; l < Lanes; ++l) {
+      const bool taken = active[l] && ((status_[l] & mask) != 0) == set;
+      extra[l] = taken ? (((addr[l] ^ next) & 0xFF00) ? 2 : 1) : 0;
+      pc_[l] = taken ? addr[l] : pc_[l];
+    }
+    break;
+  }
+
+  case Op::BIT:
+    value = read(addr, active);
+    for (size_t l = 0; l < Lanes; ++l) {
+      const auto flags = static_cast<std::uint8_t>(
+          (status_[l] & ~(CPU::N | CPU::V | CPU::Z)) | (value[l] & (CPU::N | CPU::V)) |
+          ((a_[l] & value[l]) ? 0 : CPU::Z));
+      status_[l] = active[l] ? flags : status_[l];
+    }
+    break;
+
+  case Op::BRK: {
+    Words ret;
+    ret.fill(static_cast<std::uint16_t>(pc + 2));
+    push16(ret);
+    for (size_t l = 0; l < Lanes; ++l) value[l] = status_[l] | CPU::B | CPU::U;
+    push(value, active);
+    change_flag(CPU::I, true);
+    Words vector, vector_hi;
+    vector.fill(IrqVector);
+    vector_hi.fill(IrqVector + 1);
+    blend(pc_, read16(vector, vector_hi, active), active);
+    break;
+  }
+
+  case Op::CLC: change_flag(CPU::C, false); break;
+  case Op::CLD: change_flag(CPU::D, false); break;
+  case Op::CLI: change_flag(CPU::I, false); break;
+  case Op::CLV: change_flag(CPU::V, false); break;
+  case Op::SEC: change_flag(CPU::C, true); break;
+  case Op::SED: change_flag(CPU::D, true); break;
+  case Op::SEI: change_flag(CPU::I, true); break;
+
+  case Op::CMP: compare(a_); break;
+  case Op::CPX: compare(x_); break;
+  case Op::CPY: compare(y_); break;
+
+  case Op::DEC: step_memory(-1); break;
+  case Op::INC: step_memory(1); break;
+  case Op::DEX: step(x_, -1); break;
+  case Op::DEY: step(y_, -1); break;
+  case Op::INX: step(x_, 1); break;
+  case Op::INY: step(y_, 1); break;
+
+  case Op::JMP: blend(pc_, addr, active); break;
+  case Op::JSR: {
+    Words ret;
+    ret.fill(static_cast<std::uint16_t>(next - 1));
+    push16(ret);
+    blend(pc_, addr, active);
+    break;
+  }
+  case Op::RTS: {
+    Words ret = pull16();
+    for (size_t l = 0; l < Lanes; ++l) ret[l] = static_cast<std::uint16_t>(ret[l] + 1);
+    blend(pc_, ret, active);
+    break;
+  }
+  case Op::RTI:
+    value = pull(active);
+    for (size_t l = 0; l < Lanes; ++l) result[l] = (value[l] & ~CPU::B) | CPU::U;
+    blend(status_, result, active);
+    blend(pc_, pull16(), active);
+    break;
+
+  case Op::LDA: load(a_); break;
+  case Op::LDX: load(x_); break;
+  case Op::LDY: load(y_); break;
+  case Op::STA: write(addr, a_, active); break;
+  case Op::STX: write(addr, x_, active); break;
+  case Op::STY: write(addr, y_, active); break;
+
+  case Op::PHA: push(a_, active); break;
+  case Op::PHP:
+    for (size_t l = 0; l < Lanes; ++l) value[l] = status_[l] | CPU::B | CPU::U;
+    push(value, active);
+    break;
+  case Op::PLA: transfer(a_, pull(active)); break;
+  case Op::PLP:
+    value = pull(active);
+    for (size_t l = 0; l < Lanes; ++l) result[l] = (value[l] & ~CPU::B) | CPU::U;
+    blend(status_, result, active);
+    break;
+
+  case Op::TAX: transfer(x_, a_); break;
+  case Op::TAY: transfer(y_, a_); break;
+  case Op::TSX: transfer(x_, sp_); break;
+  case Op::TXA: transfer(a_, x_); break;
+  case Op::TXS: blend(sp_, x_, active); break;
+  case Op::TYA: transfer(a_, y_); break;
+
+  case Op::NOP: break;
+  case Op::ILL:
+    for (size_t l = 0; l < Lanes; ++l) {
+      pc_[l] = active[l] ? pc : pc_[l];
+      jammed_[l] |= active[l];
+    }
+    break;
+  }
+
+  for (size_t l = 0; l < Lanes; ++l) {
+    cycles_[l] += active[l] ? info.cycles + extra[l] : 0;
+  }
+  return true;
+}
+
+void CpuLanes::run(std::uint64_t until) {
+  while (issue(until)) {
+  }
+  // As on one CPU, a jammed lane's clock keeps running.
+  for (size_t l = 0; l < Lanes; ++l) {
+    if (jammed_[l] && cycles_[l] < until) cycles_[l] = until;
+  }
+}
+
+}; // namespace emu
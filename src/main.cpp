@@ -1,11 +1,1149 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
 #include <iostream>
-#include <cpu.hpp>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
 
+#include <analysis.hpp>
+#include <asm.hpp>
+#include <breakpoints.hpp>
+#include <bus.hpp>
+#include <apple2.hpp>
+#include <c64.hpp>
+#include <coverage.hpp>
+#include <cpu.hpp>
+#include <disasm.hpp>
+#include <farm.hpp>
+#include <gdbstub.hpp>
+#include <hle.hpp>
+#include <idioms.hpp>
+#include <lanes.hpp>
+#include <natives.hpp>
+#include <nes.hpp>
+#include <pool.hpp>
+#include <spsc.hpp>
+#include <symbols.hpp>
 
 using namespace emu;
 
-int main() {
-  std::cout << "Hello world" << std::endl;
+namespace {
+
+/// Accepts `$hex`, `0xhex` and decimal numbers.
+bool parse_number(std::string_view text, std::uint64_t& out) {
+  int base = 10;
+  if (!text.empty() && text[0] == '$') {
+    text.remove_prefix(1);
+    base = 16;
+  } else if (text.size() > 2 && text[0] == '0' && (text[1] == 'x' || text[1] == 'X')) {
+    text.remove_prefix(2);
+    base = 16;
+  }
+  if (text.empty()) return false;
+  std::uint64_t value = 0;
+  for (const char c : text) {
+    int digit;
+    if (c >= '0' && c <= '9') digit = c - '0';
+    else if (c >= 'a' && c <= 'f') digit = c - 'a' + 10;
+    else if (c >= 'A' && c <= 'F') digit = c - 'A' + 10;
+    else return false;
+    if (digit >= base) return false;
+    value = value * base + digit;
+  }
+  out = value;
+  return true;
+}
+
+bool read_file(const std::string& path, std::vector<std::uint8_t>& out) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) return false;
+  out.assign(std::istreambuf_iterator<char>(file), {});
+  return true;
+}
+
+/// Writes a 16-bit mono WAV header for `samples` samples.
+void write_wav_header(std::ostream& out, size_t samples, int rate) {
+  const auto put = [&](std::uint32_t value, int bytes) {
+    for (int i = 0; i < bytes; ++i) out.put(static_cast<char>(value >> (8 * i)));
+  };
+  const auto data_size = static_cast<std::uint32_t>(samples * 2);
+  out.write("RIFF", 4);
+  put(36 + data_size, 4);
+  out.write("WAVEfmt ", 8);
+  put(16, 4);
+  put(1, 2); // PCM
+  put(1, 2); // mono
+  put(static_cast<std::uint32_t>(rate), 4);
+  put(static_cast<std::uint32_t>(rate * 2), 4);
+  put(2, 2);
+  put(16, 2);
+  out.write("data", 4);
+  put(data_size, 4);
+}
+
+/// `--name value` pairs following a subcommand, plus positional arguments.
+struct Args final {
+  std::vector<std::pair<std::string_view, std::string_view>> options;
+  std::vector<std::string_view> positional;
+
+  static bool parse(int argc, char** argv, Args& out) {
+    for (int i = 0; i < argc; ++i) {
+      const std::string_view arg = argv[i];
+      if (arg.substr(0, 2) != "--") {
+        out.positional.push_back(arg);
+        continue;
+      }
+      if (i + 1 >= argc) {
+        std::cerr << "missing value for " << arg << std::endl;
+        return false;
+      }
+      out.options.emplace_back(arg.substr(2), argv[++i]);
+    }
+    return true;
+  }
+
+  const std::string_view* get(std::string_view name) const {
+    for (const auto& [key, value] : options) {
+      if (key == name) return &value;
+    }
+    return nullptr;
+  }
+
+  std::vector<std::string_view> all(std::string_view name) const {
+    std::vector<std::string_view> values;
+    for (const auto& [key, value] : options) {
+      if (key == name) values.push_back(value);
+    }
+    return values;
+  }
+
+  bool number(std::string_view name, std::uint64_t& out) const {
+    const auto* value = get(name);
+    if (!value) return true;
+    if (parse_number(*value, out)) return true;
+    std::cerr << "invalid number for --" << name << ": " << *value << std::endl;
+    return false;
+  }
+};
+
+/// Loads every `--symbols` file.
+bool load_symbols(const Args& args, SymbolTable& symbols) {
+  for (const auto path : args.all("symbols")) {
+    std::ifstream in{std::string(path)};
+    std::string error;
+    if (!in) {
+      std::cerr << "cannot read " << path << std::endl;
+      return false;
+    }
+    if (!symbols.load(in, error)) {
+      std::cerr << path << ": " << error << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+/// Listens for gdb on `--gdb PORT` or `--gdb-socket PATH`. The target
+/// keeps running until a debugger attaches.
+bool listen_gdb(const Args& args, GdbStub& stub) {
+  const auto* gdb_port = args.get("gdb");
+  const auto* gdb_socket = args.get("gdb-socket");
+  std::uint64_t port = 0;
+  std::string error;
+  if (gdb_port && (!args.number("gdb", port) || port > 0xFFFF)) return false;
+  if (gdb_port ? !stub.listen_tcp(static_cast<std::uint16_t>(port), error)
+               : !stub.listen_unix(std::string(*gdb_socket), error)) {
+    std::cerr << "cannot listen for gdb: " << error << std::endl;
+    return false;
+  }
+  std::cerr << "gdb can attach on "
+            << (gdb_port ? "localhost:" + std::string(*gdb_port) : std::string(*gdb_socket))
+            << std::endl;
+  return true;
+}
+
+/// gdb access to a machine's CPU. Breakpoints are asked before the
+/// machine's own trap handler (its native routines), so that a breakpoint
+/// on a hooked routine still stops there.
+class Debugger final {
+public:
+  Debugger(CPU& cpu, Bus& bus)
+      : cpu_(cpu), previous_(cpu.trap_handler), breakpoints_(bus),
+        stub_(cpu, bus, breakpoints_) {
+    chain_.add(&breakpoints_);
+    if (previous_) chain_.add(previous_);
+    cpu.trap_handler = &chain_;
+  }
+  ~Debugger() { cpu_.trap_handler = previous_; }
+
+  Debugger(const Debugger&) = delete;
+  Debugger& operator=(const Debugger&) = delete;
+
+  GdbStub& stub() { return stub_; }
+
+  /// Runs a frame with `run_frame`, serving the debugger after it: a
+  /// breakpoint halts the machine until gdb resumes it, and the frame is
+  /// then finished. Returns false once gdb has killed the target.
+  template <typename Run> bool run(Run run_frame) {
+    while (true) {
+      run_frame();
+      const bool stopped = cpu_.stop_requested || cpu_.jammed;
+      if (stopped) stub_.stopped();
+      if (!stub_.poll()) return false;
+      if (!stopped || cpu_.jammed) return true;
+    }
+  }
+
+private:
+  CPU& cpu_;
+  TrapHandler* previous_;
+  Breakpoints breakpoints_;
+  TrapChain chain_;
+  GdbStub stub_;
+};
+
+/// Creates a debugger for the machine if `--gdb` or `--gdb-socket` asks for
+/// one; false if it cannot listen.
+bool start_debugger(const Args& args, CPU& cpu, Bus& bus, std::unique_ptr<Debugger>& out) {
+  if (!args.get("gdb") && !args.get("gdb-socket")) return true;
+  out = std::make_unique<Debugger>(cpu, bus);
+  return listen_gdb(args, out->stub());
+}
+
+/// Runs one frame of `machine`, under the debugger if there is one.
+template <typename Machine> bool run_frame(Machine& machine, Debugger* debugger) {
+  if (!debugger) {
+    machine.run_frame();
+    return true;
+  }
+  return debugger->run([&] { machine.run_frame(); });
+}
+
+/// Accepts a number or a symbol name.
+bool parse_address(std::string_view text, const SymbolTable& symbols,
+                   std::uint16_t& out) {
+  std::uint64_t value = 0;
+  if (parse_number(text, value) && value <= 0xFFFF) {
+    out = static_cast<std::uint16_t>(value);
+    return true;
+  }
+  return symbols.address_of(text, out);
+}
+
+int usage() {
+  std::cerr << "usage: emu run <image> [--org ADDR] [--entry ADDR]"
+               " [--cycles N] [--coverage FILE] [--break ADDR[:COND]]...\n"
+               "               [--gdb PORT | --gdb-socket PATH] [--symbols FILE]... [--idioms on|off]\n"
+               "               [--hle on|off]\n"
+               "       emu dis <image> [--org ADDR] [--bank-size N]"
+               " [--entry ADDR] [--mode trace|linear] [--out FILE]\n"
+               "               [--symbols FILE]...\n"
+               "       emu cfg <image> [--org ADDR] [--bank-size N]"
+               " [--layout rom|fixed-last|ram] [--entry ADDR]...\n"
+               "               [--threads N] [--symbols FILE]...\n"
+               "       emu nes <rom.nes> [--frames N] [--ppm FILE] [--pixels scalar|ssse3|avx2]\n"
+               "               [--headless on|off] [--wav FILE] [--idioms on|off] [--hle on|off]\n"
+               "               [--gdb PORT | --gdb-socket PATH]\n"
+               "       emu farm <rom.nes> [--instances N] [--frames N] [--slice N] [--threads N]\n"
+               "       emu c64 --kernal FILE --basic FILE --chargen FILE [--prg FILE] [--d64 FILE]\n"
+               "               [--drive-rom FILE] [--type TEXT] [--frames N] [--ppm FILE] [--wav FILE] [--headless on|off]\n"
+               "               [--idioms on|off] [--strict on|off] [--gdb PORT | --gdb-socket PATH]\n"
+               "       emu apple2 --rom FILE --chargen FILE [--bin FILE --org ADDR] [--type TEXT]\n"
+               "               [--frames N] [--ppm FILE] [--idioms on|off] [--hle on|off]\n"
+               "               [--gdb PORT | --gdb-socket PATH]\n"
+               "       emu bench [--cycles N] [--idioms on|off] [--lanes on|off] [--instances N]\n";
+  return 1;
+}
+
+/// Runs a flat binary on a bare 6502 with 64K of RAM.
+int cmd_run(const Args& args) {
+  if (args.positional.size() != 1) return usage();
+
+  std::uint64_t org = 0, entry = 0, budget = 1'000'000;
+  if (!args.number("org", org) || !args.number("cycles", budget)) return 1;
+
+  std::vector<std::uint8_t> image;
+  if (!read_file(std::string(args.positional[0]), image)) {
+    std::cerr << "cannot read " << args.positional[0] << std::endl;
+    return 1;
+  }
+  if (org + image.size() > 0x10000) {
+    std::cerr << "image does not fit at $" << std::hex << org << std::endl;
+    return 1;
+  }
+
+  std::vector<std::uint8_t> ram(0x10000);
+  std::copy(image.begin(), image.end(), ram.begin() + org);
+  Bus bus;
+  bus.map_ram(0, ram.size(), ram.data());
+
+  SymbolTable symbols;
+  if (!load_symbols(args, symbols)) return 1;
+
+  CPU cpu;
+  Coverage coverage(bus);
+  const auto* coverage_path = args.get("coverage");
+  if (coverage_path) cpu.coverage = &coverage;
+  Idioms idioms;
+  const auto* idioms_mode = args.get("idioms");
+  const bool use_idioms = idioms_mode && *idioms_mode == "on";
+  if (idioms_mode && !use_idioms && *idioms_mode != "off") return usage();
+  if (use_idioms) cpu.idioms = &idioms;
+  Hooks hooks(bus);
+  const auto* hle = args.get("hle");
+  if (hle && *hle != "on" && *hle != "off") return usage();
+  if (hle && *hle == "on") add_known_routines(hooks);
+
+  Breakpoints breakpoints(bus);
+  for (const auto spec : args.all("break")) {
+    // Scoped symbol names contain "::", conditions never do.
+    size_t colon = spec.find(':');
+    while (colon != std::string_view::npos && colon + 1 < spec.size() && spec[colon + 1] == ':') {
+      colon = spec.find(':', colon + 2);
+    }
+    std::uint16_t addr = 0;
+    std::string error;
+    if (!parse_address(spec.substr(0, colon), symbols, addr)) {
+      std::cerr << "invalid breakpoint address: " << spec << std::endl;
+      return 1;
+    }
+    const auto condition =
+        colon == std::string_view::npos ? std::string_view{} : spec.substr(colon + 1);
+    if (!breakpoints.add(addr, condition, error)) {
+      std::cerr << "invalid breakpoint condition: " << error << std::endl;
+      return 1;
+    }
+  }
+  // Breakpoints first, so that one on a hooked routine still stops.
+  TrapChain traps;
+  traps.add(&breakpoints);
+  traps.add(&hooks);
+  cpu.trap_handler = &traps;
+
+  cpu.reset(bus);
+  if (args.get("entry")) {
+    if (!args.number("entry", entry)) return 1;
+    cpu.PC = static_cast<std::uint16_t>(entry);
+  }
+
+  const auto* gdb_port = args.get("gdb");
+  const auto* gdb_socket = args.get("gdb-socket");
+  if (!gdb_port && !gdb_socket) {
+    cpu.run(bus, cpu.cycles + budget);
+    if (cpu.stop_requested) {
+      std::cout << "breakpoint at " << symbols.describe(breakpoints.last_hit())
+                << std::endl;
+    }
+  } else {
+    GdbStub stub(cpu, bus, breakpoints);
+    stub.use_symbols(symbols);
+    if (!listen_gdb(args, stub)) return 1;
+
+    // Run in slices so that a debugger can attach and interrupt; under a
+    // debugger the cycle budget is unlimited unless given.
+    constexpr std::uint64_t Slice = 20'000;
+    const std::uint64_t end = args.get("cycles") ? cpu.cycles + budget : UINT64_MAX;
+    while (cpu.cycles < end && stub.poll()) {
+      cpu.run(bus, std::min(end, cpu.cycles + Slice));
+      if (cpu.stop_requested || (cpu.jammed && stub.connected())) stub.stopped();
+      if (cpu.jammed && !stub.connected()) break;
+    }
+  }
+
+  std::cout << std::hex << "PC=" << cpu.PC << " A=" << +cpu.A << " X=" << +cpu.X
+            << " Y=" << +cpu.Y << " SP=" << +cpu.SP << " P=" << +cpu.Status
+            << std::dec << " cycles=" << cpu.cycles
+            << (cpu.jammed ? " (jammed)" : "") << std::endl;
+
+  if (coverage_path) {
+    std::ofstream out{std::string(*coverage_path)};
+    coverage.write_lcov(out, [&](std::uint16_t region, std::uint32_t offset) {
+      // Only labels: equates name registers and constants, not code.
+      const std::int32_t label = region == 0 ? symbols.find(static_cast<std::uint16_t>(offset)) : -1;
+      return label >= 0 && symbols.start(label) == offset ? std::string(symbols.name(label))
+                                                          : std::string();
+    });
+  }
+  return 0;
+}
+
+/// Disassembles an image, one bank at a time. Every bank is assumed to be
+/// mapped at `--org` (by default the image or bank ends at $FFFF).
+int cmd_dis(const Args& args) {
+  if (args.positional.size() != 1) return usage();
+
+  std::vector<std::uint8_t> image;
+  if (!read_file(std::string(args.positional[0]), image) || image.empty()) {
+    std::cerr << "cannot read " << args.positional[0] << std::endl;
+    return 1;
+  }
+
+  std::uint64_t bank_size = std::min<size_t>(image.size(), 0x10000);
+  if (!args.number("bank-size", bank_size)) return 1;
+  if (bank_size == 0 || bank_size > 0x10000) {
+    std::cerr << "bank size must be between 1 and 65536" << std::endl;
+    return 1;
+  }
+  std::uint64_t org = 0x10000 - bank_size, entry = 0;
+  if (!args.number("org", org) || !args.number("entry", entry)) return 1;
+  if (org + bank_size > 0x10000) {
+    std::cerr << "bank does not fit at $" << std::hex << org << std::endl;
+    return 1;
+  }
+
+  const auto* mode = args.get("mode");
+  const bool linear = mode && *mode == "linear";
+  if (mode && !linear && *mode != "trace") return usage();
+
+  std::ofstream file;
+  if (const auto* path = args.get("out")) {
+    file.open(std::string(*path), std::ios::binary);
+    if (!file) {
+      std::cerr << "cannot write " << *path << std::endl;
+      return 1;
+    }
+  }
+  std::ostream& out = file.is_open() ? file : std::cout;
+
+  SymbolTable symbols;
+  if (!load_symbols(args, symbols)) return 1;
+
+  std::string listing;
+  for (size_t start = 0; start < image.size(); start += bank_size) {
+    const size_t size = std::min<size_t>(bank_size, image.size() - start);
+    Disassembler dis(image.data() + start, size, static_cast<std::uint16_t>(org));
+    if (!symbols.empty()) dis.use_symbols(symbols);
+    if (linear) {
+      dis.trace_linear();
+    } else {
+      dis.trace_vectors();
+      if (args.get("entry")) dis.trace(static_cast<std::uint16_t>(entry));
+    }
+    listing.clear();
+    if (image.size() > bank_size) {
+      listing += "; bank " + std::to_string(start / bank_size) + "\n";
+    }
+    dis.write(listing);
+    out.write(listing.data(), static_cast<std::streamsize>(listing.size()));
+  }
+  return 0;
+}
+
+/// Recovers the control-flow graph of every bank and reports functions,
+/// loops, jump tables and writes into code or mapper registers.
+int cmd_cfg(const Args& args) {
+  if (args.positional.size() != 1) return usage();
+
+  std::vector<std::uint8_t> image;
+  if (!read_file(std::string(args.positional[0]), image) || image.empty()) {
+    std::cerr << "cannot read " << args.positional[0] << std::endl;
+    return 1;
+  }
+
+  std::uint64_t bank_size = std::min<size_t>(image.size(), 0x10000), threads = 0;
+  if (!args.number("bank-size", bank_size) || !args.number("threads", threads)) return 1;
+  if (bank_size == 0 || bank_size > 0x10000) {
+    std::cerr << "bank size must be between 1 and 65536" << std::endl;
+    return 1;
+  }
+  std::uint64_t org = 0x10000 - bank_size;
+  if (!args.number("org", org)) return 1;
+  if (org + bank_size > 0x10000) {
+    std::cerr << "bank does not fit at $" << std::hex << org << std::endl;
+    return 1;
+  }
+
+  SymbolTable symbols;
+  if (!load_symbols(args, symbols)) return 1;
+
+  RomLayout layout;
+  layout.image = image.data();
+  layout.size = image.size();
+  layout.bank_size = bank_size;
+  layout.org = static_cast<std::uint16_t>(org);
+  const auto* kind = args.get("layout");
+  layout.fixed_last = kind && *kind == "fixed-last";
+  layout.writable = kind && *kind == "ram";
+  if (kind && !layout.fixed_last && !layout.writable && *kind != "rom") return usage();
+
+  Analyzer analyzer(layout);
+  for (const auto text : args.all("entry")) {
+    std::uint16_t entry = 0;
+    if (!parse_address(text, symbols, entry)) {
+      std::cerr << "invalid entry point: " << text << std::endl;
+      return 1;
+    }
+    analyzer.add_entry(entry);
+  }
+  analyzer.run(static_cast<unsigned>(threads));
+
+  const auto hex = [](unsigned value) {
+    static constexpr char Digits[] = "0123456789abcdef";
+    std::string out = "$";
+    for (int shift = 12; shift >= 0; shift -= 4) out += Digits[(value >> shift) & 0xF];
+    return out;
+  };
+  const auto where = [&](std::uint16_t addr) {
+    return symbols.empty() ? hex(addr) : symbols.describe(addr);
+  };
+
+  for (const BankAnalysis& bank : analyzer.banks()) {
+    std::cout << "bank " << bank.bank << " at " << hex(bank.org) << ": "
+              << bank.blocks.size() << " blocks, " << bank.code_bytes()
+              << " code bytes, " << bank.functions.size() << " functions\n";
+    for (const Function& function : bank.functions) {
+      std::cout << "  function " << where(function.entry) << ": "
+                << function.num_blocks << " blocks, " << function.num_calls
+                << " calls, " << function.num_loops << " loops\n";
+    }
+    for (const Loop& loop : bank.loops) {
+      std::cout << "  loop " << where(loop.header) << " <- " << where(loop.latch) << '\n';
+    }
+    for (const JumpTable& table : bank.jump_tables) {
+      std::cout << "  jump table at " << where(table.dispatch) << ": "
+                << table.targets.size() << " entries";
+      if (table.low != table.high) std::cout << " from " << hex(table.low) << '/' << hex(table.high);
+      std::cout << '\n';
+    }
+    for (const Write& write : bank.self_modifying) {
+      std::cout << "  self-modifying write at " << where(write.at) << " to "
+                << where(write.target) << '\n';
+    }
+    for (const Write& write : bank.bank_switches) {
+      std::cout << "  mapper write at " << where(write.at) << " to " << hex(write.target);
+      if (write.value >= 0) std::cout << " = " << write.value;
+      std::cout << '\n';
+    }
+  }
   return 0;
 }
 
+/// Saves the sound and the last picture of `emu nes` and `emu c64` on a
+/// thread of its own, fed through lock-free queues, so file I/O never
+/// stalls emulation. Pictures are palette indices.
+template <int Width, int Height, size_t Colors>
+class OutputWriter final {
+public:
+  using Picture = std::array<std::uint8_t, Width * Height>;
+  using Palette = std::array<std::uint32_t, Colors>;
+
+  OutputWriter(const std::string_view* wav, const std::string_view* ppm, int rate,
+               const Palette& palette)
+      : rate_(rate), palette_(palette) {
+    if (wav) {
+      wav_.open(std::string(*wav), std::ios::binary);
+      write_wav_header(wav_, 0, rate_);
+      ok_ = static_cast<bool>(wav_);
+    }
+    if (ppm) ppm_path_ = std::string(*ppm);
+    thread_ = std::thread([this] { run(); });
+  }
+  ~OutputWriter() { finish(); }
+
+  /// Hands over samples, waiting for room if the writer is behind.
+  void push_audio(const std::int16_t* samples, size_t count) {
+    while (count > 0) {
+      const size_t written = audio_.write(samples, count);
+      samples += written;
+      count -= written;
+      if (count > 0) std::this_thread::yield();
+    }
+  }
+
+  /// Hands over a picture, or drops it if the writer has no free slot.
+  void push_picture(const std::uint8_t* frame) {
+    if (Picture* slot = pictures_.begin_write()) {
+      std::copy(frame, frame + slot->size(), slot->begin());
+      pictures_.end_write();
+    }
+  }
+
+  /// Writes out everything handed over; false if a file could not be written.
+  bool finish() {
+    if (thread_.joinable()) {
+      done_.store(true, std::memory_order_release);
+      thread_.join();
+      if (wav_.is_open()) {
+        wav_.seekp(0);
+        write_wav_header(wav_, samples_, rate_);
+        wav_.flush();
+        ok_ = ok_ && static_cast<bool>(wav_);
+      }
+    }
+    return ok_;
+  }
+
+private:
+  void run() {
+    std::array<std::int16_t, 4096> block;
+    for (;;) {
+      const bool done = done_.load(std::memory_order_acquire);
+      while (const size_t count = audio_.read(block.data(), block.size())) {
+        for (size_t i = 0; i < count; ++i) {
+          const auto sample = static_cast<std::uint16_t>(block[i]);
+          wav_.put(static_cast<char>(sample)).put(static_cast<char>(sample >> 8));
+        }
+        samples_ += count;
+      }
+      while (const Picture* picture = pictures_.begin_read()) {
+        write_ppm(*picture);
+        pictures_.end_read();
+      }
+      if (done) return;
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+
+  void write_ppm(const Picture& picture) {
+    std::ofstream out{ppm_path_, std::ios::binary};
+    out << "P6\n" << Width << ' ' << Height << "\n255\n";
+    for (const std::uint8_t entry : picture) {
+      const std::uint32_t rgb = palette_[entry];
+      const char pixel[3] = {static_cast<char>(rgb >> 16), static_cast<char>(rgb >> 8),
+                             static_cast<char>(rgb)};
+      out.write(pixel, 3);
+    }
+    ok_ = ok_ && static_cast<bool>(out);
+  }
+
+  int rate_;
+  const Palette& palette_;
+  std::ofstream wav_;
+  std::string ppm_path_;
+  size_t samples_ = 0;
+  bool ok_ = true;
+
+  SpscRing<std::int16_t, 1 << 16> audio_;
+  FrameQueue<Picture, 2> pictures_;
+  std::atomic<bool> done_{false};
+  std::thread thread_;
+};
+
+/// Runs an NES ROM for a number of frames and optionally saves the last
+/// one as a PPM image and the sound as a WAV file.
+int cmd_nes(const Args& args) {
+  if (args.positional.size() != 1) return usage();
+  std::uint64_t frames = 60;
+  if (!args.number("frames", frames)) return 1;
+
+  std::vector<std::uint8_t> image;
+  if (!read_file(std::string(args.positional[0]), image)) {
+    std::cerr << "cannot read " << args.positional[0] << std::endl;
+    return 1;
+  }
+  Nes nes;
+  std::string error;
+  if (!nes.load(std::move(image), error)) {
+    std::cerr << args.positional[0] << ": " << error << std::endl;
+    return 1;
+  }
+  if (const auto* name = args.get("pixels")) {
+    const PixelKernels* kernels = PixelKernels::find(*name);
+    if (!kernels) {
+      std::cerr << "pixel kernels not available: " << *name << std::endl;
+      return 1;
+    }
+    nes.ppu().set_kernels(*kernels);
+  }
+  const auto* headless = args.get("headless");
+  if (headless && *headless != "on" && *headless != "off") return usage();
+  nes.ppu().set_headless(headless && *headless == "on");
+  const auto* idioms = args.get("idioms");
+  if (idioms && *idioms != "on" && *idioms != "off") return usage();
+  nes.set_idioms(idioms && *idioms == "on");
+  const auto* hle = args.get("hle");
+  if (hle && *hle != "on" && *hle != "off") return usage();
+  nes.set_hle(hle && *hle == "on");
+
+  // Sound is only synthesized when it is saved.
+  const auto* wav = args.get("wav");
+  const auto* ppm = args.get("ppm");
+  nes.apu().set_audio(wav != nullptr);
+  using Writer = OutputWriter<Ppu::Width, Ppu::Height, 64>;
+  std::unique_ptr<Writer> writer;
+  if (wav || ppm) writer = std::make_unique<Writer>(wav, ppm, nes.apu().sample_rate(), Ppu::Palette);
+  std::array<std::int16_t, 2048> samples;
+  std::unique_ptr<Debugger> debugger;
+  if (!start_debugger(args, nes.cpu(), nes.bus(), debugger)) return 1;
+
+  const auto start = std::chrono::steady_clock::now();
+  for (std::uint64_t i = 0; i < frames && !nes.cpu().jammed; ++i) {
+    // Headless, only the frame that gets saved is drawn.
+    if (i + 1 == frames) nes.ppu().request_frame();
+    if (!run_frame(nes, debugger.get())) break;
+    while (const size_t count = nes.apu().read_samples(samples.data(), samples.size())) {
+      writer->push_audio(samples.data(), count);
+    }
+  }
+  const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  std::cout << frames << " frames, " << nes.cpu().cycles << " cycles, "
+            << frames / elapsed.count() << " fps" << std::endl;
+  if (nes.cpu().jammed) std::cout << "CPU jammed at $" << std::hex << nes.cpu().PC << std::endl;
+
+  if (!writer) return 0;
+  if (ppm) writer->push_picture(nes.ppu().frame());
+  if (!writer->finish()) {
+    std::cerr << "cannot write output files" << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+/// Runs many headless NES instances of one cartridge on all cores.
+int cmd_farm(const Args& args) {
+  if (args.positional.size() != 1) return usage();
+  std::uint64_t instances = 1024, frames = 600, slice = 8, threads = 0;
+  if (!args.number("instances", instances) || !args.number("frames", frames) ||
+      !args.number("slice", slice) || !args.number("threads", threads)) {
+    return 1;
+  }
+  std::vector<std::uint8_t> image;
+  if (!read_file(std::string(args.positional[0]), image)) {
+    std::cerr << "cannot read " << args.positional[0] << std::endl;
+    return 1;
+  }
+  std::string error;
+  if (!Nes().load(image, error)) {
+    std::cerr << args.positional[0] << ": " << error << std::endl;
+    return 1;
+  }
+
+  // Each instance is created by the thread that first runs it, so its
+  // memory starts out close to that core, and freed once it is done.
+  std::vector<std::unique_ptr<Nes>> machines(instances);
+  std::vector<std::uint64_t> ran(instances), cycles(instances);
+  const auto job = [&](size_t i, unsigned count) {
+    if (!machines[i]) {
+      machines[i] = std::make_unique<Nes>();
+      std::string ignored;
+      machines[i]->load(image, ignored);
+      machines[i]->ppu().set_headless(true);
+      machines[i]->apu().set_audio(false);
+    }
+    Nes& nes = *machines[i];
+    for (unsigned f = 0; f < count && ran[i] < frames && !nes.cpu().jammed; ++f, ++ran[i]) {
+      nes.run_frame();
+    }
+    if (ran[i] < frames && !nes.cpu().jammed) return false;
+    cycles[i] = nes.cpu().cycles;
+    machines[i].reset();
+    return true;
+  };
+
+  Farm farm(static_cast<unsigned>(threads));
+  const auto start = std::chrono::steady_clock::now();
+  farm.run(instances, static_cast<unsigned>(slice), job);
+  const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+  std::uint64_t total_frames = 0, total_cycles = 0;
+  for (size_t i = 0; i < instances; ++i) {
+    total_frames += ran[i];
+    total_cycles += cycles[i];
+  }
+  std::cout << instances << " instances on " << farm.threads() << " threads, " << total_frames
+            << " frames, " << total_cycles << " cycles, " << total_frames / elapsed.count()
+            << " fps" << std::endl;
+  std::cout << farm.slices() << " slices, " << farm.steals() << " stolen" << std::endl;
+  return 0;
+}
+
+/// The --type option, where a backslash and n types RETURN.
+std::string typed_text(const Args& args) {
+  std::string text;
+  if (const auto* typed = args.get("type")) {
+    for (size_t i = 0; i < typed->size(); ++i) {
+      if ((*typed)[i] == '\\' && i + 1 < typed->size() && (*typed)[i + 1] == 'n') {
+        text += '\n';
+        ++i;
+      } else {
+        text += (*typed)[i];
+      }
+    }
+  }
+  return text;
+}
+
+/// Runs a C64 for a number of frames, optionally loading a program or
+/// mounting a disk and typing into BASIC, and saves the last frame and the
+/// sound like `emu nes`.
+int cmd_c64(const Args& args) {
+  if (!args.positional.empty()) return usage();
+  // Cold start takes about three seconds; programs are loaded and text is
+  // typed after that.
+  constexpr std::uint64_t BootFrames = 150;
+  std::uint64_t frames = BootFrames + 50;
+  if (!args.number("frames", frames)) return 1;
+
+  std::vector<std::uint8_t> roms[3];
+  const char* const rom_names[3] = {"kernal", "basic", "chargen"};
+  for (int i = 0; i < 3; ++i) {
+    const auto* path = args.get(rom_names[i]);
+    if (!path) return usage();
+    if (!read_file(std::string(*path), roms[i])) {
+      std::cerr << "cannot read " << *path << std::endl;
+      return 1;
+    }
+  }
+  C64 c64;
+  std::string error;
+  if (!c64.load_roms(std::move(roms[0]), std::move(roms[1]), std::move(roms[2]), error)) {
+    std::cerr << error << std::endl;
+    return 1;
+  }
+  // With a DOS ROM, disks go into a real 1541; otherwise LOADs are served
+  // from the image directly.
+  if (const auto* path = args.get("drive-rom")) {
+    std::vector<std::uint8_t> rom;
+    if (!read_file(std::string(*path), rom)) {
+      std::cerr << "cannot read " << *path << std::endl;
+      return 1;
+    }
+    if (!c64.attach_drive(std::move(rom), error)) {
+      std::cerr << error << std::endl;
+      return 1;
+    }
+  }
+  // Strict runs the KERNAL's own LOAD, which only reaches a real drive.
+  const auto* strict = args.get("strict");
+  if (strict && *strict != "on" && *strict != "off") return usage();
+  c64.set_strict(strict && *strict == "on");
+  if (c64.strict() && args.get("d64") && !c64.drive()) {
+    std::cerr << "--strict on needs --drive-rom to load from a disk" << std::endl;
+    return 1;
+  }
+  if (const auto* path = args.get("d64")) {
+    std::vector<std::uint8_t> image;
+    D64 disk;
+    if (!read_file(std::string(*path), image)) {
+      std::cerr << "cannot read " << *path << std::endl;
+      return 1;
+    }
+    if (!disk.load(std::move(image), error)) {
+      std::cerr << *path << ": " << error << std::endl;
+      return 1;
+    }
+    if (c64.drive()) {
+      c64.insert_disk(disk);
+    } else {
+      c64.mount_disk(8, std::move(disk));
+    }
+  }
+  std::vector<std::uint8_t> prg;
+  const auto* prg_path = args.get("prg");
+  if (prg_path && !read_file(std::string(*prg_path), prg)) {
+    std::cerr << "cannot read " << *prg_path << std::endl;
+    return 1;
+  }
+  std::string text = typed_text(args);
+  const auto* headless = args.get("headless");
+  if (headless && *headless != "on" && *headless != "off") return usage();
+  c64.vic().set_headless(headless && *headless == "on");
+  const auto* idioms = args.get("idioms");
+  if (idioms && *idioms != "on" && *idioms != "off") return usage();
+  c64.set_idioms(idioms && *idioms == "on");
+
+  const auto* wav = args.get("wav");
+  const auto* ppm = args.get("ppm");
+  c64.sid().set_audio(wav != nullptr);
+  using Writer = OutputWriter<Vic::Width, Vic::Height, 16>;
+  std::unique_ptr<Writer> writer;
+  if (wav || ppm) writer = std::make_unique<Writer>(wav, ppm, c64.sid().sample_rate(), Vic::Palette);
+  std::array<std::int16_t, 2048> samples;
+  std::unique_ptr<Debugger> debugger;
+  if (!start_debugger(args, c64.cpu(), c64.bus(), debugger)) return 1;
+
+  const auto start = std::chrono::steady_clock::now();
+  for (std::uint64_t i = 0; i < frames && !c64.cpu().jammed; ++i) {
+    if (i == BootFrames && !prg.empty() && !c64.load_prg(prg, error)) {
+      std::cerr << *prg_path << ": " << error << std::endl;
+      return 1;
+    }
+    if (i >= BootFrames && !text.empty()) text.erase(0, c64.type(text));
+    if (i + 1 == frames) c64.vic().request_frame();
+    if (!run_frame(c64, debugger.get())) break;
+    while (const size_t count = c64.sid().read_samples(samples.data(), samples.size())) {
+      writer->push_audio(samples.data(), count);
+    }
+  }
+  const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  std::cout << frames << " frames, " << c64.cpu().cycles << " cycles, "
+            << frames / elapsed.count() << " fps" << std::endl;
+  if (Drive1541* drive = c64.drive()) {
+    std::cout << "1541 idle for " << drive->idle_cycles() << " of " << drive->cpu().cycles
+              << " cycles" << std::endl;
+  }
+  if (c64.cpu().jammed) std::cout << "CPU jammed at $" << std::hex << c64.cpu().PC << std::endl;
+
+  if (!writer) return 0;
+  if (ppm) writer->push_picture(c64.vic().frame());
+  if (!writer->finish()) {
+    std::cerr << "cannot write output files" << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+/// Runs an Apple II+ for a number of frames, optionally loading a binary
+/// and typing into Applesoft, and saves the last frame.
+int cmd_apple2(const Args& args) {
+  if (!args.positional.empty()) return usage();
+  // The ROM reaches the Applesoft prompt in about half a second.
+  constexpr std::uint64_t BootFrames = 60;
+  std::uint64_t frames = BootFrames + 60, org = 0;
+  if (!args.number("frames", frames) || !args.number("org", org)) return 1;
+
+  std::vector<std::uint8_t> roms[2];
+  const char* const rom_names[2] = {"rom", "chargen"};
+  for (int i = 0; i < 2; ++i) {
+    const auto* path = args.get(rom_names[i]);
+    if (!path) return usage();
+    if (!read_file(std::string(*path), roms[i])) {
+      std::cerr << "cannot read " << *path << std::endl;
+      return 1;
+    }
+  }
+  Apple2 apple;
+  std::string error;
+  if (!apple.load_roms(std::move(roms[0]), std::move(roms[1]), error)) {
+    std::cerr << error << std::endl;
+    return 1;
+  }
+  std::vector<std::uint8_t> bin;
+  const auto* bin_path = args.get("bin");
+  if (bin_path && !read_file(std::string(*bin_path), bin)) {
+    std::cerr << "cannot read " << *bin_path << std::endl;
+    return 1;
+  }
+  const std::string text = typed_text(args);
+  const auto* idioms = args.get("idioms");
+  if (idioms && *idioms != "on" && *idioms != "off") return usage();
+  apple.set_idioms(idioms && *idioms == "on");
+  const auto* hle = args.get("hle");
+  if (hle && *hle != "on" && *hle != "off") return usage();
+  apple.set_hle(hle && *hle == "on");
+
+  const auto* ppm = args.get("ppm");
+  using Writer = OutputWriter<Apple2::Width, Apple2::Height, 16>;
+  std::unique_ptr<Writer> writer;
+  if (ppm) writer = std::make_unique<Writer>(nullptr, ppm, 0, Apple2::Palette);
+  std::unique_ptr<Debugger> debugger;
+  if (!start_debugger(args, apple.cpu(), apple.bus(), debugger)) return 1;
+
+  const auto start = std::chrono::steady_clock::now();
+  for (std::uint64_t i = 0; i < frames && !apple.cpu().jammed; ++i) {
+    if (i == BootFrames) {
+      if (!bin.empty() && !apple.load(static_cast<std::uint16_t>(org), bin, error)) {
+        std::cerr << *bin_path << ": " << error << std::endl;
+        return 1;
+      }
+      apple.type(text);
+    }
+    if (!run_frame(apple, debugger.get())) break;
+  }
+  const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  std::cout << frames << " frames, " << apple.cpu().cycles << " cycles, "
+            << frames / elapsed.count() << " fps, " << apple.lines_drawn() << " of "
+            << frames * Apple2::Height << " lines drawn" << std::endl;
+  if (apple.cpu().jammed) std::cout << "CPU jammed at $" << std::hex << apple.cpu().PC << std::endl;
+
+  if (!writer) return 0;
+  writer->push_picture(apple.frame());
+  if (!writer->finish()) {
+    std::cerr << "cannot write output files" << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+/// Benchmark kernels, assembled at compile time. Each one loops forever.
+struct Kernel final {
+  const char* name;
+  const std::uint8_t* code;
+  size_t size;
+};
+
+constexpr auto FillKernel = EMU_ASM(R"(
+        .org $0600
+frame:  LDA #$00
+        LDX #$00
+fill:   STA $0200,X
+        STA $0300,X
+        STA $0400,X
+        STA $0500,X
+        INX
+        BNE fill
+        JMP frame
+)");
+
+constexpr auto CopyKernel = EMU_ASM(R"(
+        .org $0600
+frame:  LDY #$00
+copy:   LDA ($10),Y
+        STA ($12),Y
+        INY
+        BNE copy
+        INC $11
+        LDA $11
+        CMP #$20
+        BNE frame
+        LDA #$10
+        STA $11
+        JMP frame
+)");
+
+constexpr auto AluKernel = EMU_ASM(R"(
+        .org $0600
+        LDX #$00
+        LDY #$00
+loop:   TXA
+        CLC
+        ADC $20
+        STA $20
+        EOR #$5A
+        ASL
+        ROL $21
+        SEC
+        SBC $21
+        LSR
+        ROR $22
+        AND #$7F
+        ORA $22
+        CMP #$40
+        BCC skip
+        INY
+skip:   BIT $20
+        DEX
+        BNE loop
+        JMP loop
+)");
+
+constexpr auto CallKernel = EMU_ASM(R"(
+        .org $0600
+loop:   JSR outer
+        JSR inner
+        JMP loop
+outer:  PHA
+        JSR inner
+        PLA
+        RTS
+inner:  INX
+        PHP
+        PLP
+        RTS
+)");
+
+int cmd_bench(const Args& args) {
+  std::uint64_t budget = 100'000'000, instances = 0;
+  if (!args.number("cycles", budget) || !args.number("instances", instances)) return 1;
+  if (instances > budget) {
+    // Each instance needs at least one cycle of the shared budget.
+    std::cerr << "more instances than cycles" << std::endl;
+    return 1;
+  }
+  const auto* idioms_mode = args.get("idioms");
+  const bool use_idioms = idioms_mode && *idioms_mode == "on";
+  if (idioms_mode && !use_idioms && *idioms_mode != "off") return usage();
+  const auto* lanes_mode = args.get("lanes");
+  const bool use_lanes = lanes_mode && *lanes_mode == "on";
+  if (lanes_mode && !use_lanes && *lanes_mode != "off") return usage();
+
+  const Kernel kernels[] = {
+      {"fill", FillKernel.data(), FillKernel.size()},
+      {"copy", CopyKernel.data(), CopyKernel.size()},
+      {"alu", AluKernel.data(), AluKernel.size()},
+      {"call", CallKernel.data(), CallKernel.size()},
+  };
+  for (const auto& kernel : kernels) {
+    if (instances) {
+      // The budget is shared by the instances, which take turns.
+      constexpr std::uint64_t Slice = 10000;
+      InstancePool pool(instances);
+      CPU cpu;
+      cpu.PC = 0x0600;
+      for (std::uint64_t i = 0; i < instances; ++i) {
+        const InstancePool::Id id = pool.allocate();
+        std::uint8_t* ram = pool.ram(id);
+        std::copy(kernel.code, kernel.code + kernel.size, ram + 0x0600);
+        ram[0x11] = 0x10;
+        ram[0x13] = 0x40;
+        pool.set_state(id, cpu);
+      }
+
+      const auto start = std::chrono::steady_clock::now();
+      pool.run_all(budget / instances, Slice);
+      const std::chrono::duration<double> elapsed =
+          std::chrono::steady_clock::now() - start;
+      std::uint64_t cycles = 0;
+      for (InstancePool::Id id = 0; id < instances; ++id) cycles += pool.cycles(id);
+      const char* const pages[] = {"huge", "transparent huge", "normal"};
+      std::cout << kernel.name << ": " << cycles / elapsed.count() / 1e6 << " MHz over "
+                << instances << " instances, " << pages[static_cast<int>(pool.pages())]
+                << " pages" << std::endl;
+      continue;
+    }
+    if (use_lanes) {
+      // Every lane runs the kernel; the rate is summed over the lanes.
+      auto lanes = std::make_unique<CpuLanes>();
+      lanes->load(0x0600, kernel.code, kernel.size);
+      const std::uint8_t pointers[] = {0x10, 0x00, 0x40};
+      lanes->load(0x11, pointers, sizeof pointers);
+      CPU cpu;
+      cpu.PC = 0x0600;
+      for (size_t l = 0; l < CpuLanes::Lanes; ++l) lanes->set_state(l, cpu);
+
+      const auto start = std::chrono::steady_clock::now();
+      lanes->run(budget);
+      const std::chrono::duration<double> elapsed =
+          std::chrono::steady_clock::now() - start;
+      std::uint64_t cycles = 0;
+      for (size_t l = 0; l < CpuLanes::Lanes; ++l) cycles += lanes->state(l).cycles;
+      std::cout << kernel.name << ": " << cycles / elapsed.count() / 1e6 << " MHz, "
+                << static_cast<double>(lanes->executed()) / lanes->issued()
+                << " lanes per instruction" << std::endl;
+      continue;
+    }
+    std::vector<std::uint8_t> ram(0x10000);
+    std::copy(kernel.code, kernel.code + kernel.size, ram.begin() + 0x0600);
+    ram[0x11] = 0x10;
+    ram[0x13] = 0x40;
+    Bus bus;
+    bus.map_ram(0, ram.size(), ram.data());
+    CPU cpu;
+    cpu.PC = 0x0600;
+    Idioms idioms;
+    if (use_idioms) cpu.idioms = &idioms;
+
+    const auto start = std::chrono::steady_clock::now();
+    cpu.run(bus, budget);
+    const std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    std::cout << kernel.name << ": " << cpu.cycles / elapsed.count() / 1e6
+              << " MHz" << std::endl;
+  }
+  return 0;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  if (argc < 2) return usage();
+  Args args;
+  if (!Args::parse(argc - 2, argv + 2, args)) return 1;
+
+  const std::string_view command = argv[1];
+  if (command == "run") return cmd_run(args);
+  if (command == "dis") return cmd_dis(args);
+  if (command == "cfg") return cmd_cfg(args);
+  if (command == "nes") return cmd_nes(args);
+  if (command == "farm") return cmd_farm(args);
+  if (command == "c64") return cmd_c64(args);
+  if (command == "apple2") return cmd_apple2(args);
+  if (command == "bench") return cmd_bench(args);
+  return usage();
+}
@@ -0,0 +1,303 @@
+#include <natives.hpp>
+#include <bus.hpp>
+#include <cpu.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <initializer_list>
+
+namespace emu {
+
+namespace {
+
+using routines::Copy;
+using routines::Divide16;
+using routines::Fill;
+using routines::Multiply16;
+using routines::Multiply8;
+
+// Where the natives below expect the routines' branches.
+static_assert(Fill[5] == 0xD0 && Fill[10] == 0xD0);
+static_assert(Copy[7] == 0xD0 && Copy[14] == 0xD0);
+static_assert(Multiply8[6] == 0x90 && Multiply8[15] == 0xD0);
+static_assert(Multiply16[12] == 0x90 && Multiply16[36] == 0xD0);
+static_assert(Divide16[26] == 0x90 && Divide16[35] == 0xD0);
+
+/// Bytes the routine reads while it runs.
+struct Span final {
+  std::uint16_t addr;
+  std::uint16_t size;
+};
+
+bool can_run(const CPU& cpu, bool arithmetic) {
+  if (cpu.nmi_pending || (cpu.irq_lines && !(cpu.Status & CPU::I))) return false;
+  return !(arithmetic && cpu.decimal_mode && (cpu.Status & CPU::D));
+}
+
+/// Cycles of a branch at `at` to `target`.
+std::uint32_t branch(std::uint16_t at, std::uint16_t target, bool taken) {
+  if (!taken) return 2;
+  return ((at + 2) ^ target) & 0xFF00 ? 4 : 3;
+}
+
+std::uint16_t word(Bus& bus, std::uint8_t addr) {
+  return static_cast<std::uint16_t>(bus.read(addr) | bus.read(static_cast<std::uint8_t>(addr + 1)) << 8);
+}
+
+void set_flag(CPU& cpu, CPU::Flag flag, bool on) {
+  cpu.Status = static_cast<std::uint8_t>(on ? (cpu.Status | flag) : (cpu.Status & ~flag));
+}
+
+bool carry(const CPU& cpu) { return (cpu.Status & CPU::C) != 0; }
+
+std::uint8_t set_nz(CPU& cpu, std::uint8_t value) {
+  cpu.Status = static_cast<std::uint8_t>((cpu.Status & ~(CPU::N | CPU::Z)) | (value & CPU::N) |
+                                         (value == 0 ? CPU::Z : 0));
+  return value;
+}
+
+/// Binary ADC; SBC is ADC of the complement.
+std::uint8_t add(CPU& cpu, std::uint8_t a, std::uint8_t value) {
+  const unsigned sum = a + value + (cpu.Status & CPU::C);
+  const auto result = static_cast<std::uint8_t>(sum);
+  set_flag(cpu, CPU::C, sum > 0xFF);
+  set_flag(cpu, CPU::V, (~(a ^ value) & (a ^ result) & 0x80) != 0);
+  return set_nz(cpu, result);
+}
+
+std::uint8_t subtract(CPU& cpu, std::uint8_t a, std::uint8_t value) {
+  return add(cpu, a, static_cast<std::uint8_t>(~value));
+}
+
+/// ASL and ROL, LSR and ROR.
+std::uint8_t shift_left(CPU& cpu, std::uint8_t value, bool in) {
+  set_flag(cpu, CPU::C, value & 0x80);
+  return set_nz(cpu, static_cast<std::uint8_t>(value << 1 | (in ? 1 : 0)));
+}
+
+std::uint8_t shift_right(CPU& cpu, std::uint8_t value, bool in) {
+  set_flag(cpu, CPU::C, value & 0x01);
+  return set_nz(cpu, static_cast<std::uint8_t>(value >> 1 | (in ? 0x80 : 0)));
+}
+
+/// Whether `pages` pages from `addr` on are plain memory and, if they are
+/// written, miss what the routine reads while it runs. Host memory is
+/// compared, so mirrors count too.
+bool block_safe(Bus& bus, std::uint16_t addr, unsigned pages, bool written,
+                std::initializer_list<Span> reads) {
+  const unsigned touched = std::min(256u, pages + ((addr & 0xFF) ? 1 : 0));
+  for (unsigned i = 0; i < touched; ++i) {
+    const auto page = static_cast<std::uint16_t>((addr & 0xFF00) + i * Bus::PageSize);
+    if (!bus.plain(page)) return false;
+    if (!written) continue;
+    const std::uint8_t* host = bus.direct_write(page);
+    if (!host) continue;
+    for (const Span& span : reads) {
+      for (std::uint16_t b = 0; b < span.size; ++b) {
+        const std::uint8_t* cell = bus.direct_read(static_cast<std::uint16_t>(span.addr + b));
+        if (cell >= host && cell < host + Bus::PageSize) return false;
+      }
+    }
+  }
+  return true;
+}
+
+bool fill(CPU& cpu, Bus& bus) {
+  if (!can_run(cpu, false)) return false;
+  const std::uint16_t entry = cpu.PC;
+  const unsigned pages = cpu.X ? cpu.X : 256;
+  std::uint16_t to = word(bus, 0xFB);
+  if (!block_safe(bus, to, pages, true, {{entry, Fill.size()}, {0xFB, 2}})) return false;
+
+  for (std::uint32_t count = pages * Bus::PageSize; count;) {
+    const std::uint32_t n = std::min<std::uint32_t>(count, 0x100 - (to & 0xFF));
+    if (std::uint8_t* host = bus.direct_write(to)) std::memset(host, cpu.A, n);
+    to = static_cast<std::uint16_t>(to + n);
+    count -= n;
+  }
+  bus.write(0xFC, static_cast<std::uint8_t>(bus.read(0xFC) + pages));
+
+  const std::uint32_t inner = branch(entry + 5, entry + 2, true);
+  const std::uint32_t outer = branch(entry + 10, entry + 2, true);
+  cpu.cycles += 2 + pages * (255 * (6 + 2 + inner) + (6 + 2 + 2) + 5 + 2) + (pages - 1) * outer + 2;
+  cpu.X = 0;
+  cpu.Y = 0;
+  set_nz(cpu, 0);
+  return_from_subroutine(cpu, bus);
+  return true;
+}
+
+bool copy(CPU& cpu, Bus& bus) {
+  if (!can_run(cpu, false)) return false;
+  const std::uint16_t entry = cpu.PC;
+  const unsigned pages = cpu.X ? cpu.X : 256;
+  std::uint16_t from = word(bus, 0xFB), to = word(bus, 0xFD);
+  const unsigned crossings = from & 0xFF;
+  if (!block_safe(bus, from, pages, false, {}) ||
+      !block_safe(bus, to, pages, true, {{entry, Copy.size()}, {0xFB, 4}})) {
+    return false;
+  }
+
+  // In ascending order, as the loop copies, so overlapping blocks repeat
+  // as they would; the last byte apart for A.
+  for (std::uint32_t count = pages * Bus::PageSize - 1; count;) {
+    const std::uint32_t n =
+        std::min<std::uint32_t>({count, 0x100u - (from & 0xFF), 0x100u - (to & 0xFF)});
+    const std::uint8_t* source = bus.direct_read(from);
+    std::uint8_t* target = bus.direct_write(to);
+    if (source && target && (target <= source || target >= source + n)) {
+      std::memmove(target, source, n);
+    } else {
+      for (std::uint32_t i = 0; i < n; ++i) {
+        bus.write(static_cast<std::uint16_t>(to + i), bus.read(static_cast<std::uint16_t>(from + i)));
+      }
+    }
+    from = static_cast<std::uint16_t>(from + n);
+    to = static_cast<std::uint16_t>(to + n);
+    count -= n;
+  }
+  cpu.A = bus.read(from);
+  bus.write(to, cpu.A);
+  bus.write(0xFC, static_cast<std::uint8_t>(bus.read(0xFC) + pages));
+  bus.write(0xFE, static_cast<std::uint8_t>(bus.read(0xFE) + pages));
+
+  const std::uint32_t inner = branch(entry + 7, entry + 2, true);
+  const std::uint32_t outer = branch(entry + 14, entry + 2, true);
+  cpu.cycles += 2 + pages * (255 * (5 + 6 + 2 + inner) + (5 + 6 + 2 + 2) + crossings + 5 + 5 + 2) +
+                (pages - 1) * outer + 2;
+  cpu.X = 0;
+  cpu.Y = 0;
+  set_nz(cpu, 0);
+  return_from_subroutine(cpu, bus);
+  return true;
+}
+
+bool multiply8(CPU& cpu, Bus& bus) {
+  if (!can_run(cpu, true)) return false;
+  const std::uint16_t entry = cpu.PC;
+  std::uint8_t low = bus.read(0xFB);
+  const std::uint8_t factor = bus.read(0xFC);
+  std::uint8_t a = 0;
+  std::uint64_t cycles = 2 + 2 + 5;
+  low = shift_right(cpu, low, false);
+  for (std::uint8_t x = 8; x != 0;) {
+    const bool add_factor = carry(cpu);
+    cycles += branch(entry + 6, entry + 11, !add_factor);
+    if (add_factor) {
+      set_flag(cpu, CPU::C, false);
+      a = add(cpu, a, factor);
+      cycles += 2 + 3;
+    }
+    a = shift_right(cpu, a, carry(cpu));
+    low = shift_right(cpu, low, carry(cpu));
+    set_nz(cpu, --x);
+    cycles += 2 + 5 + 2 + branch(entry + 15, entry + 6, x != 0);
+  }
+  bus.write(0xFB, low);
+  cpu.A = a;
+  cpu.X = 0;
+  cpu.cycles += cycles;
+  return_from_subroutine(cpu, bus);
+  return true;
+}
+
+bool multiply16(CPU& cpu, Bus& bus) {
+  if (!can_run(cpu, true)) return false;
+  const std::uint16_t entry = cpu.PC;
+  std::uint8_t product[4] = {bus.read(0xF7), bus.read(0xF8), 0, 0};
+  std::uint8_t low = bus.read(0xFB), high = bus.read(0xFC);
+  const std::uint8_t factor_low = bus.read(0xFD), factor_high = bus.read(0xFE);
+  std::uint8_t a = 0;
+  std::uint64_t cycles = 2 + 3 + 3 + 2;
+  for (std::uint8_t x = 16; x != 0;) {
+    high = shift_right(cpu, high, false);
+    low = shift_right(cpu, low, carry(cpu));
+    const bool add_factor = carry(cpu);
+    cycles += 5 + 5 + branch(entry + 12, entry + 27, !add_factor);
+    if (add_factor) {
+      set_flag(cpu, CPU::C, false);
+      product[2] = a = add(cpu, product[2], factor_low);
+      product[3] = a = add(cpu, product[3], factor_high);
+      cycles += 3 + 2 + 3 + 3 + 3 + 3 + 3;
+    }
+    for (int i = 3; i >= 0; --i) product[i] = shift_right(cpu, product[i], carry(cpu));
+    set_nz(cpu, --x);
+    cycles += 4 * 5 + 2 + branch(entry + 36, entry + 8, x != 0);
+  }
+  for (std::uint8_t i = 0; i < 4; ++i) bus.write(static_cast<std::uint8_t>(0xF7 + i), product[i]);
+  bus.write(0xFB, low);
+  bus.write(0xFC, high);
+  cpu.A = a;
+  cpu.X = 0;
+  cpu.cycles += cycles;
+  return_from_subroutine(cpu, bus);
+  return true;
+}
+
+bool divide16(CPU& cpu, Bus& bus) {
+  if (!can_run(cpu, true)) return false;
+  const std::uint16_t entry = cpu.PC;
+  std::uint8_t low = bus.read(0xFB), high = bus.read(0xFC);
+  const std::uint8_t divisor_low = bus.read(0xFD), divisor_high = bus.read(0xFE);
+  std::uint8_t rest_low = 0, rest_high = 0;
+  std::uint8_t a = 0, y = cpu.Y;
+  std::uint64_t cycles = 2 + 3 + 3 + 2;
+  for (std::uint8_t x = 16; x != 0;) {
+    low = shift_left(cpu, low, false);
+    high = shift_left(cpu, high, carry(cpu));
+    rest_low = shift_left(cpu, rest_low, carry(cpu));
+    rest_high = shift_left(cpu, rest_high, carry(cpu));
+    set_flag(cpu, CPU::C, true);
+    y = subtract(cpu, rest_low, divisor_low);
+    a = subtract(cpu, rest_high, divisor_high);
+    const bool fits = carry(cpu);
+    cycles += 4 * 5 + 3 + 2 + 3 + 2 + 3 + 3 + branch(entry + 26, entry + 34, !fits);
+    if (fits) {
+      rest_high = a;
+      rest_low = y;
+      low = set_nz(cpu, static_cast<std::uint8_t>(low + 1));
+      cycles += 3 + 3 + 5;
+    }
+    set_nz(cpu, --x);
+    cycles += 2 + branch(entry + 35, entry + 8, x != 0);
+  }
+  bus.write(0xF7, rest_low);
+  bus.write(0xF8, rest_high);
+  bus.write(0xFB, low);
+  bus.write(0xFC, high);
+  cpu.A = a;
+  cpu.X = 0;
+  cpu.Y = y;
+  cpu.cycles += cycles;
+  return_from_subroutine(cpu, bus);
+  return true;
+}
+
+struct Known final {
+  const char* name;
+  const std::uint8_t* code;
+  size_t size;
+  bool (*native)(CPU& cpu, Bus& bus);
+};
+
+const Known KnownRoutines[] = {
+    {"fill", Fill.data(), Fill.size(), fill},
+    {"copy", Copy.data(), Copy.size(), copy},
+    {"multiply8", Multiply8.data(), Multiply8.size(), multiply8},
+    {"multiply16", Multiply16.data(), Multiply16.size(), multiply16},
+    {"divide16", Divide16.data(), Divide16.size(), divide16},
+};
+
+} // namespace
+
+size_t add_known_routines(Hooks& hooks, std::uint16_t begin, std::uint32_t end) {
+  size_t found = 0;
+  for (const Known& known : KnownRoutines) {
+    found += hooks.add_by_hash(Hooks::hash(known.code, known.size),
+                               static_cast<std::uint16_t>(known.size), known.name, known.native,
+                               begin, end);
+  }
+  return found;
+}
+
+}; // namespace emu
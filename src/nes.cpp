@@ -0,0 +1,255 @@
+#include <nes.hpp>
+#include <natives.hpp>
+
+#include <algorithm>
+#include <utility>
+
+namespace emu {
+
+namespace {
+
+constexpr size_t HeaderSize = 16;
+constexpr size_t TrainerSize = 512;
+constexpr std::uint32_t OamDmaCycles = 513;
+
+} // namespace
+
+bool Cartridge::load(std::vector<std::uint8_t> ines, std::string& error) {
+  if (ines.size() < HeaderSize || ines[0] != 'N' || ines[1] != 'E' || ines[2] != 'S' ||
+      ines[3] != 0x1A) {
+    error = "not an iNES image";
+    return false;
+  }
+  const std::uint8_t flags6 = ines[6], flags7 = ines[7];
+  mapper_ = flags6 >> 4;
+  // Old dumping tools left text in bytes 12-15; flags 7 is then garbage too.
+  const bool dirty = (flags7 & 0x0C) == 0 &&
+                     std::any_of(ines.begin() + 12, ines.begin() + 16,
+                                 [](std::uint8_t byte) { return byte != 0; });
+  if (!dirty) mapper_ |= flags7 & 0xF0;
+  if (mapper_ != 0 && mapper_ != 2 && mapper_ != 3 && mapper_ != 7) {
+    error = "unsupported mapper " + std::to_string(mapper_);
+    return false;
+  }
+
+  const size_t prg_size = ines[4] * PrgBankSize;
+  const size_t chr_size = ines[5] * ChrBankSize;
+  const size_t start = HeaderSize + ((flags6 & 0x04) ? TrainerSize : 0);
+  if (prg_size == 0 || ines.size() < start + prg_size + chr_size) {
+    error = "truncated iNES image";
+    return false;
+  }
+  prg_.assign(ines.begin() + start, ines.begin() + start + prg_size);
+  chr_ram_ = chr_size == 0;
+  if (chr_ram_) {
+    chr_.assign(ChrBankSize, 0);
+  } else {
+    chr_.assign(ines.begin() + start + prg_size, ines.begin() + start + prg_size + chr_size);
+  }
+  if (flags6 & 0x08) {
+    mirroring_ = Ppu::Mirroring::FourScreen;
+  } else {
+    mirroring_ = (flags6 & 0x01) ? Ppu::Mirroring::Vertical : Ppu::Mirroring::Horizontal;
+  }
+  if (mapper_ == 7) mirroring_ = Ppu::Mirroring::SingleLow;
+  prg_bank_ = 0;
+  chr_bank_ = 0;
+  return true;
+}
+
+void Cartridge::attach(Bus& bus, Ppu& ppu) {
+  bus_ = &bus;
+  ppu_ = &ppu;
+  for (size_t i = 0; i < prg_banks(); ++i) {
+    const std::uint16_t region = bus.add_region(
+        "prg" + std::to_string(i), static_cast<std::uint32_t>(PrgBankSize), 0x8000);
+    if (i == 0) first_region_ = region;
+  }
+  ppu.set_mirroring(mirroring_);
+  map_prg();
+  map_chr();
+}
+
+void Cartridge::map_prg() {
+  const size_t banks = prg_banks();
+  size_t low = 0, high = banks - 1;
+  switch (mapper_) {
+  case 2:
+    low = prg_bank_ % banks;
+    break;
+  case 7:
+    low = (prg_bank_ * 2u) % banks;
+    high = (low + 1) % banks;
+    break;
+  default:
+    high = std::min<size_t>(1, banks - 1);
+    break;
+  }
+  const auto map = [&](std::uint16_t addr, size_t bank) {
+    bus_->map_rom(addr, PrgBankSize, prg_.data() + bank * PrgBankSize,
+                  static_cast<std::uint16_t>(first_region_ + bank), 0, this);
+  };
+  map(0x8000, low);
+  map(0xC000, high);
+}
+
+void Cartridge::map_chr() {
+  std::uint8_t* base = chr_.data() + (chr_bank_ % (chr_.size() / ChrBankSize)) * ChrBankSize;
+  for (int i = 0; i < 8; ++i) ppu_->set_chr(i, base + i * 0x400, chr_ram_);
+}
+
+std::uint8_t Cartridge::read(std::uint16_t addr) {
+  return static_cast<std::uint8_t>(addr >> 8);
+}
+
+void Cartridge::write(std::uint16_t addr, std::uint8_t value) {
+  (void)addr;
+  switch (mapper_) {
+  case 2:
+    prg_bank_ = value;
+    map_prg();
+    break;
+  case 3:
+    ppu_->sync();
+    chr_bank_ = value;
+    map_chr();
+    break;
+  case 7:
+    ppu_->sync();
+    prg_bank_ = value & 0x07;
+    mirroring_ = (value & 0x10) ? Ppu::Mirroring::SingleHigh : Ppu::Mirroring::SingleLow;
+    ppu_->set_mirroring(mirroring_);
+    map_prg();
+    break;
+  default:
+    break;
+  }
+}
+
+template <typename Archive, typename Self>
+void Cartridge::fields(Archive& archive, Self& self) {
+  archive(self.prg_bank_, self.chr_bank_, self.mirroring_);
+  if (self.chr_ram_) archive(self.chr_);
+}
+
+void Cartridge::save(SnapshotWriter& out) const { fields(out, *this); }
+
+void Cartridge::restore(SnapshotReader& in) {
+  fields(in, *this);
+  ppu_->set_mirroring(mirroring_);
+  map_prg();
+  map_chr();
+}
+
+Nes::Nes() {
+  cpu_.decimal_mode = false;
+  bus_.map_ram(0x0000, 0x2000, ram_.data(), ram_.size());
+  bus_.map_device(0x2000, 0x2000, &ppu_);
+  bus_.map_device(0x4000, 0x100, this);
+  bus_.map_ram(0x6000, prg_ram_.size(), prg_ram_.data());
+  cpu_.trap_handler = &hooks_;
+}
+
+void Nes::set_hle(bool on) {
+  if (on) {
+    add_known_routines(hooks_);
+  } else {
+    hooks_.clear();
+  }
+}
+
+bool Nes::load(std::vector<std::uint8_t> ines, std::string& error) {
+  if (!cartridge_.load(std::move(ines), error)) return false;
+  cartridge_.attach(bus_, ppu_);
+  reset();
+  return true;
+}
+
+void Nes::reset() { cpu_.reset(bus_); }
+
+template <typename Archive, typename Self> void Nes::fields(Archive& archive, Self& self) {
+  archive(self.ram_, self.prg_ram_, self.buttons_, self.shift_, self.strobe_);
+}
+
+void Nes::save(SnapshotWriter& out) const {
+  fields(out, *this);
+  cartridge_.save(out);
+  ppu_.save(out);
+  apu_.save(out);
+}
+
+void Nes::restore(SnapshotReader& in) {
+  fields(in, *this);
+  // The cartridge first: it points the PPU at its banks.
+  cartridge_.restore(in);
+  ppu_.restore(in);
+  apu_.restore(in);
+  bus_.mark_dirty(0, 0x10000);
+}
+
+std::uint64_t Nes::next_event() const { return std::min(ppu_.next_vblank(), apu_.next_irq()); }
+
+void Nes::run_until(std::uint64_t cycle) {
+  while (cpu_.cycles < cycle) {
+    cpu_.run(bus_, std::min(cycle, next_event()));
+    ppu_.catch_up(cpu_.cycles);
+    apu_.catch_up(cpu_.cycles);
+    if (cpu_.stop_requested) return;
+  }
+}
+
+void Nes::run_frame() { run_until(ppu_.next_vblank()); }
+
+std::uint8_t Nes::read(std::uint16_t addr) {
+  switch (addr) {
+  case 0x4015:
+    return apu_.read_status();
+  case 0x4016:
+  case 0x4017: {
+    const int port = addr & 1;
+    if (strobe_) shift_[port] = buttons_[port];
+    const std::uint8_t bit = shift_[port] & 1;
+    // Once the eight buttons are out, the register reads 1.
+    if (!strobe_) shift_[port] = static_cast<std::uint8_t>(shift_[port] >> 1 | 0x80);
+    return 0x40 | bit;
+  }
+  default:
+    return static_cast<std::uint8_t>(addr >> 8);
+  }
+}
+
+void Nes::write(std::uint16_t addr, std::uint8_t value) {
+  switch (addr) {
+  case 0x4014: {
+    // OAM DMA stalls the CPU for 513 cycles, plus one on an odd cycle.
+    ppu_.sync();
+    std::uint8_t page[256];
+    for (int i = 0; i < 256; ++i) page[i] = bus_.read(static_cast<std::uint16_t>(value << 8 | i));
+    ppu_.write_oam(page);
+    cpu_.cycles += OamDmaCycles + (cpu_.cycles & 1);
+    break;
+  }
+  case 0x4015:
+  case 0x4017:
+    apu_.write(addr, value);
+    break;
+  case 0x4016:
+    strobe_ = value & 1;
+    if (strobe_) {
+      shift_[0] = buttons_[0];
+      shift_[1] = buttons_[1];
+    }
+    break;
+  default:
+    if (addr < 0x4014) apu_.write(addr, value);
+    break;
+  }
+}
+
+std::uint8_t Nes::peek(std::uint16_t addr) {
+  if (addr == 0x4015) return apu_.peek_status();
+  if (addr == 0x4016 || addr == 0x4017) return 0x40 | (shift_[addr & 1] & 1);
+  return static_cast<std::uint8_t>(addr >> 8);
+}
+
+}; // namespace emu
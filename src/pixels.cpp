@@ -0,0 +1,258 @@
+#include <pixels.hpp>
+
+#include <array>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define EMU_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+namespace emu {
+
+namespace {
+
+constexpr std::uint8_t SpriteBehind = 0x20;
+constexpr std::uint8_t SpriteZero = 0x40;
+
+/// A bitplane byte spread to one byte per pixel, leftmost pixel in the low
+/// byte.
+constexpr std::array<std::uint64_t, 256> make_planes() {
+  std::array<std::uint64_t, 256> planes{};
+  for (unsigned byte = 0; byte < 256; ++byte) {
+    for (unsigned pixel = 0; pixel < 8; ++pixel) {
+      if ((byte >> (7 - pixel)) & 1) planes[byte] |= std::uint64_t{1} << (8 * pixel);
+    }
+  }
+  return planes;
+}
+
+constexpr auto Planes = make_planes();
+
+void decode_scalar(const std::uint8_t* lo, const std::uint8_t* hi,
+                   const std::uint8_t* palette, size_t tiles, std::uint8_t* out) {
+  for (size_t tile = 0; tile < tiles; ++tile, out += 8) {
+    const std::uint64_t pattern = Planes[lo[tile]] | Planes[hi[tile]] << 1;
+    for (unsigned pixel = 0; pixel < 8; ++pixel) {
+      const auto value = static_cast<std::uint8_t>(pattern >> (8 * pixel));
+      out[pixel] = value ? static_cast<std::uint8_t>(palette[tile] | value) : 0;
+    }
+  }
+}
+
+void overlay_scalar(const std::uint8_t* sprite, size_t count, std::uint8_t* line) {
+  for (size_t i = 0; i < count; ++i) {
+    if (sprite[i] && !line[i]) line[i] = sprite[i];
+  }
+}
+
+int composite_scalar(const std::uint8_t* background, const std::uint8_t* sprites,
+                     const std::uint8_t* palette, std::uint8_t gray, size_t count,
+                     std::uint8_t* out) {
+  int hit = -1;
+  for (size_t i = 0; i < count; ++i) {
+    const std::uint8_t b = background[i], s = sprites[i];
+    if (hit < 0 && (b & 3) && (s & SpriteZero)) hit = static_cast<int>(i);
+    std::uint8_t color = (b & 3) ? b : 0;
+    if ((s & 3) && (!(b & 3) || !(s & SpriteBehind))) color = 0x10 | (s & 0x0F);
+    out[i] = palette[color] & gray;
+  }
+  return hit;
+}
+
+#ifdef EMU_X86_SIMD
+
+constexpr std::uint64_t EveryByte = 0x0101010101010101;
+
+/// Tile bytes repeated over the 8 pixels of their tile, two tiles per
+/// 128 bits.
+__attribute__((target("ssse3"))) __m128i spread2(const std::uint8_t* bytes) {
+  return _mm_set_epi64x(static_cast<long long>(bytes[1] * EveryByte),
+                        static_cast<long long>(bytes[0] * EveryByte));
+}
+
+/// Pixels of two tiles from their spread bytes.
+__attribute__((target("ssse3"))) __m128i pixels2(__m128i lo, __m128i hi, __m128i palette) {
+  // Pixel 0 is the most significant bit.
+  const __m128i bits = _mm_set_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+  const __m128i low = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(lo, bits), bits), _mm_set1_epi8(1));
+  const __m128i high = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(hi, bits), bits), _mm_set1_epi8(2));
+  const __m128i pattern = _mm_or_si128(low, high);
+  const __m128i clear = _mm_cmpeq_epi8(pattern, _mm_setzero_si128());
+  return _mm_or_si128(pattern, _mm_andnot_si128(clear, palette));
+}
+
+__attribute__((target("ssse3")))
+void decode_ssse3(const std::uint8_t* lo, const std::uint8_t* hi,
+                  const std::uint8_t* palette, size_t tiles, std::uint8_t* out) {
+  size_t tile = 0;
+  for (; tile + 2 <= tiles; tile += 2) {
+    const __m128i pixels = pixels2(spread2(lo + tile), spread2(hi + tile), spread2(palette + tile));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + tile * 8), pixels);
+  }
+  decode_scalar(lo + tile, hi + tile, palette + tile, tiles - tile, out + tile * 8);
+}
+
+__attribute__((target("ssse3")))
+void overlay_ssse3(const std::uint8_t* sprite, size_t count, std::uint8_t* line) {
+  if (count != 8) {
+    overlay_scalar(sprite, count, line);
+    return;
+  }
+  const __m128i s = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(sprite));
+  const __m128i l = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(line));
+  const __m128i empty = _mm_cmpeq_epi8(l, _mm_setzero_si128());
+  _mm_storel_epi64(reinterpret_cast<__m128i*>(line), _mm_or_si128(l, _mm_and_si128(empty, s)));
+}
+
+/// Priority and palette lookup for 16 pixels; sets `hits` to the sprite 0
+/// hit mask.
+__attribute__((target("ssse3")))
+__m128i composite16(__m128i b, __m128i s, __m128i palette_lo, __m128i palette_hi, __m128i& hits) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i three = _mm_set1_epi8(3);
+  const __m128i behind = _mm_set1_epi8(SpriteBehind);
+  const __m128i sprite0 = _mm_set1_epi8(SpriteZero);
+  const __m128i upper = _mm_set1_epi8(0x10);
+
+  const __m128i clear_b = _mm_cmpeq_epi8(_mm_and_si128(b, three), zero);
+  const __m128i clear_s = _mm_cmpeq_epi8(_mm_and_si128(s, three), zero);
+  const __m128i front = _mm_cmpeq_epi8(_mm_and_si128(s, behind), zero);
+  const __m128i use_sprite = _mm_andnot_si128(clear_s, _mm_or_si128(clear_b, front));
+  const __m128i sprite_color = _mm_or_si128(_mm_and_si128(s, _mm_set1_epi8(0x0F)), upper);
+  const __m128i color = _mm_or_si128(_mm_and_si128(use_sprite, sprite_color),
+                                     _mm_andnot_si128(use_sprite, _mm_andnot_si128(clear_b, b)));
+  hits = _mm_andnot_si128(clear_b, _mm_cmpeq_epi8(_mm_and_si128(s, sprite0), sprite0));
+
+  // pshufb looks up 16 entries; the upper half of the palette is a second
+  // lookup.
+  const __m128i in_upper = _mm_cmpeq_epi8(_mm_and_si128(color, upper), upper);
+  return _mm_or_si128(_mm_and_si128(in_upper, _mm_shuffle_epi8(palette_hi, color)),
+                      _mm_andnot_si128(in_upper, _mm_shuffle_epi8(palette_lo, color)));
+}
+
+__attribute__((target("ssse3")))
+int composite_ssse3(const std::uint8_t* background, const std::uint8_t* sprites,
+                    const std::uint8_t* palette, std::uint8_t gray, size_t count,
+                    std::uint8_t* out) {
+  const __m128i palette_lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(palette));
+  const __m128i palette_hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(palette + 16));
+  const __m128i mask = _mm_set1_epi8(static_cast<char>(gray));
+  int hit = -1;
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    __m128i hits;
+    const __m128i pixels = composite16(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(background + i)),
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(sprites + i)), palette_lo, palette_hi,
+        hits);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_and_si128(pixels, mask));
+    if (hit < 0) {
+      if (const int bits = _mm_movemask_epi8(hits)) hit = static_cast<int>(i) + __builtin_ctz(bits);
+    }
+  }
+  const int rest = composite_scalar(background + i, sprites + i, palette, gray, count - i, out + i);
+  return hit < 0 && rest >= 0 ? static_cast<int>(i) + rest : hit;
+}
+
+__attribute__((target("avx2"))) __m256i spread4(const std::uint8_t* bytes) {
+  return _mm256_set_epi64x(static_cast<long long>(bytes[3] * EveryByte),
+                           static_cast<long long>(bytes[2] * EveryByte),
+                           static_cast<long long>(bytes[1] * EveryByte),
+                           static_cast<long long>(bytes[0] * EveryByte));
+}
+
+__attribute__((target("avx2")))
+void decode_avx2(const std::uint8_t* lo, const std::uint8_t* hi,
+                 const std::uint8_t* palette, size_t tiles, std::uint8_t* out) {
+  const __m256i bits = _mm256_set1_epi64x(static_cast<long long>(0x0102040810204080));
+  const __m256i zero = _mm256_setzero_si256();
+  size_t tile = 0;
+  for (; tile + 4 <= tiles; tile += 4) {
+    const __m256i lo4 = spread4(lo + tile), hi4 = spread4(hi + tile);
+    const __m256i low = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(lo4, bits), bits),
+                                         _mm256_set1_epi8(1));
+    const __m256i high = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(hi4, bits), bits),
+                                          _mm256_set1_epi8(2));
+    const __m256i pattern = _mm256_or_si256(low, high);
+    const __m256i clear = _mm256_cmpeq_epi8(pattern, zero);
+    const __m256i pixels = _mm256_or_si256(pattern, _mm256_andnot_si256(clear, spread4(palette + tile)));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + tile * 8), pixels);
+  }
+  decode_ssse3(lo + tile, hi + tile, palette + tile, tiles - tile, out + tile * 8);
+}
+
+__attribute__((target("avx2")))
+int composite_avx2(const std::uint8_t* background, const std::uint8_t* sprites,
+                   const std::uint8_t* palette, std::uint8_t gray, size_t count,
+                   std::uint8_t* out) {
+  // vpshufb works within 128-bit lanes, so each lane gets the whole table.
+  const __m256i palette_lo = _mm256_broadcastsi128_si256(
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(palette)));
+  const __m256i palette_hi = _mm256_broadcastsi128_si256(
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(palette + 16)));
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i three = _mm256_set1_epi8(3);
+  const __m256i behind = _mm256_set1_epi8(SpriteBehind);
+  const __m256i sprite0 = _mm256_set1_epi8(SpriteZero);
+  const __m256i upper = _mm256_set1_epi8(0x10);
+  const __m256i mask = _mm256_set1_epi8(static_cast<char>(gray));
+  int hit = -1;
+  size_t i = 0;
+  for (; i + 32 <= count; i += 32) {
+    const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(background + i));
+    const __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(sprites + i));
+    const __m256i clear_b = _mm256_cmpeq_epi8(_mm256_and_si256(b, three), zero);
+    const __m256i clear_s = _mm256_cmpeq_epi8(_mm256_and_si256(s, three), zero);
+    const __m256i front = _mm256_cmpeq_epi8(_mm256_and_si256(s, behind), zero);
+    const __m256i use_sprite = _mm256_andnot_si256(clear_s, _mm256_or_si256(clear_b, front));
+    const __m256i sprite_color =
+        _mm256_or_si256(_mm256_and_si256(s, _mm256_set1_epi8(0x0F)), upper);
+    const __m256i color =
+        _mm256_blendv_epi8(_mm256_andnot_si256(clear_b, b), sprite_color, use_sprite);
+    const __m256i in_upper = _mm256_cmpeq_epi8(_mm256_and_si256(color, upper), upper);
+    const __m256i pixels = _mm256_blendv_epi8(_mm256_shuffle_epi8(palette_lo, color),
+                                              _mm256_shuffle_epi8(palette_hi, color), in_upper);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_and_si256(pixels, mask));
+    if (hit < 0) {
+      const __m256i hits =
+          _mm256_andnot_si256(clear_b, _mm256_cmpeq_epi8(_mm256_and_si256(s, sprite0), sprite0));
+      if (const auto bits = static_cast<unsigned>(_mm256_movemask_epi8(hits))) {
+        hit = static_cast<int>(i) + __builtin_ctz(bits);
+      }
+    }
+  }
+  const int rest = composite_ssse3(background + i, sprites + i, palette, gray, count - i, out + i);
+  return hit < 0 && rest >= 0 ? static_cast<int>(i) + rest : hit;
+}
+
+#endif
+
+const PixelKernels Scalar{"scalar", decode_scalar, overlay_scalar, composite_scalar};
+#ifdef EMU_X86_SIMD
+const PixelKernels Ssse3{"ssse3", decode_ssse3, overlay_ssse3, composite_ssse3};
+const PixelKernels Avx2{"avx2", decode_avx2, overlay_ssse3, composite_avx2};
+#endif
+
+} // namespace
+
+const PixelKernels* PixelKernels::find(std::string_view name) {
+  if (name == Scalar.name) return &Scalar;
+#ifdef EMU_X86_SIMD
+  __builtin_cpu_init();
+  if (name == Ssse3.name && __builtin_cpu_supports("ssse3")) return &Ssse3;
+  if (name == Avx2.name && __builtin_cpu_supports("avx2")) return &Avx2;
+#endif
+  return nullptr;
+}
+
+const PixelKernels& PixelKernels::best() {
+  static const PixelKernels& chosen = []() -> const PixelKernels& {
+    for (const char* name : {"avx2", "ssse3"}) {
+      if (const PixelKernels* kernels = find(name)) return *kernels;
+    }
+    return Scalar;
+  }();
+  return chosen;
+}
+
+}; // namespace emu
@@ -0,0 +1,145 @@
+#include <pool.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <new>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+namespace emu {
+
+namespace {
+
+constexpr size_t HugePageSize = size_t{2} << 20;
+
+size_t round_up(size_t size, size_t unit) { return (size + unit - 1) / unit * unit; }
+
+/// Maps `size` bytes, a multiple of the huge page size, aligned to it.
+std::uint8_t* map_slab(size_t size, InstancePool::Pages& pages) {
+#ifdef __linux__
+  void* slab = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  if (slab != MAP_FAILED) {
+    pages = InstancePool::Pages::Huge;
+    return static_cast<std::uint8_t*>(slab);
+  }
+  // Without reserved huge pages, map one huge page more than needed and
+  // trim the ends so that the kernel can back the slab with whole ones.
+  void* mapping = mmap(nullptr, size + HugePageSize, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mapping == MAP_FAILED) throw std::bad_alloc();
+  auto* start = static_cast<std::uint8_t*>(mapping);
+  auto* aligned = reinterpret_cast<std::uint8_t*>(
+      round_up(reinterpret_cast<std::uintptr_t>(start), HugePageSize));
+  if (aligned != start) munmap(start, static_cast<size_t>(aligned - start));
+  const size_t tail = static_cast<size_t>(start + size + HugePageSize - (aligned + size));
+  if (tail) munmap(aligned + size, tail);
+  pages = madvise(aligned, size, MADV_HUGEPAGE) == 0 ? InstancePool::Pages::Transparent
+                                                     : InstancePool::Pages::Normal;
+  return aligned;
+#else
+  pages = InstancePool::Pages::Normal;
+  return static_cast<std::uint8_t*>(::operator new(size, std::align_val_t{HugePageSize}));
+#endif
+}
+
+void unmap_slab(std::uint8_t* slab, size_t size) {
+#ifdef __linux__
+  munmap(slab, size);
+#else
+  (void)size;
+  ::operator delete(slab, std::align_val_t{HugePageSize});
+#endif
+}
+
+} // namespace
+
+InstancePool::InstancePool(size_t capacity, size_t ram_size)
+    : capacity_(capacity), ram_size_(ram_size) {
+  assert(ram_size >= Bus::PageSize && ram_size <= 0x10000 && (ram_size & (ram_size - 1)) == 0);
+  assert(capacity < None);
+  pc_.resize(capacity);
+  a_.resize(capacity);
+  x_.resize(capacity);
+  y_.resize(capacity);
+  sp_.resize(capacity);
+  status_.resize(capacity);
+  cycles_.resize(capacity);
+  jammed_.resize(capacity);
+  live_.resize(capacity);
+  free_.resize(capacity);
+  // Lowest numbers first, so a partly used pool touches the start of the slab.
+  for (size_t i = 0; i < capacity; ++i) free_[i] = static_cast<Id>(capacity - 1 - i);
+  slab_size_ = round_up(std::max<size_t>(capacity * ram_size, 1), HugePageSize);
+  slab_ = map_slab(slab_size_, pages_);
+}
+
+InstancePool::~InstancePool() { unmap_slab(slab_, slab_size_); }
+
+InstancePool::Id InstancePool::allocate() {
+  if (free_.empty()) return None;
+  const Id id = free_.back();
+  free_.pop_back();
+  live_[id] = true;
+  set_state(id, CPU{});
+  std::memset(ram(id), 0, ram_size_);
+  return id;
+}
+
+void InstancePool::release(Id id) {
+  // A second release would put the instance on the free list twice.
+  if (id >= capacity_ || !live_[id]) return;
+  live_[id] = false;
+  free_.push_back(id);
+}
+
+CPU InstancePool::state(Id id) const {
+  CPU cpu;
+  cpu.PC = pc_[id];
+  cpu.A = a_[id];
+  cpu.X = x_[id];
+  cpu.Y = y_[id];
+  cpu.SP = sp_[id];
+  cpu.Status = status_[id];
+  cpu.cycles = cycles_[id];
+  cpu.jammed = jammed_[id];
+  return cpu;
+}
+
+void InstancePool::set_state(Id id, const CPU& cpu) {
+  pc_[id] = cpu.PC;
+  a_[id] = cpu.A;
+  x_[id] = cpu.X;
+  y_[id] = cpu.Y;
+  sp_[id] = cpu.SP;
+  status_[id] = cpu.Status;
+  cycles_[id] = cpu.cycles;
+  jammed_[id] = cpu.jammed;
+}
+
+void InstancePool::run(Id id, std::uint64_t until) {
+  if (!live_[id] || jammed_[id] || cycles_[id] >= until) return;
+  cpu_ = state(id);
+  if (id != mapped_) {
+    bus_.map_ram(0, 0x10000, ram(id), ram_size_);
+    mapped_ = id;
+  }
+  cpu_.run(bus_, until);
+  set_state(id, cpu_);
+}
+
+void InstancePool::run_all(std::uint64_t until, std::uint64_t slice) {
+  for (bool pending = true; pending;) {
+    pending = false;
+    for (Id id = 0; id < capacity_; ++id) {
+      if (!live_[id] || jammed_[id] || cycles_[id] >= until) continue;
+      run(id, std::min(until, cycles_[id] + slice));
+      pending |= !jammed_[id] && cycles_[id] < until;
+    }
+  }
+}
+
+}; // namespace emu
@@ -0,0 +1,438 @@
+#include <ppu.hpp>
+#include <cpu.hpp>
+#include <snapshot.hpp>
+
+#include <algorithm>
+#include <utility>
+
+namespace emu {
+
+namespace {
+
+constexpr int SkippedDot = 339;
+constexpr int FrameDots = Ppu::DotsPerLine * Ppu::LinesPerFrame;
+
+constexpr std::uint8_t CtrlNmi = 0x80;
+constexpr std::uint8_t CtrlTallSprites = 0x20;
+constexpr std::uint8_t CtrlBackgroundTable = 0x10;
+constexpr std::uint8_t CtrlSpriteTable = 0x08;
+constexpr std::uint8_t CtrlIncrement32 = 0x04;
+constexpr std::uint8_t MaskSprites = 0x10;
+constexpr std::uint8_t MaskBackground = 0x08;
+constexpr std::uint8_t MaskLeftSprites = 0x04;
+constexpr std::uint8_t MaskLeftBackground = 0x02;
+constexpr std::uint8_t MaskGrayscale = 0x01;
+constexpr std::uint8_t StatusVblank = 0x80;
+constexpr std::uint8_t StatusSpriteZero = 0x40;
+constexpr std::uint8_t StatusOverflow = 0x20;
+
+/// Bytes with their bits in reverse order, for horizontally flipped
+/// sprites.
+constexpr std::array<std::uint8_t, 256> make_reversed() {
+  std::array<std::uint8_t, 256> reversed{};
+  for (unsigned byte = 0; byte < 256; ++byte) {
+    for (unsigned bit = 0; bit < 8; ++bit) {
+      if ((byte >> bit) & 1) reversed[byte] |= static_cast<std::uint8_t>(0x80 >> bit);
+    }
+  }
+  return reversed;
+}
+
+constexpr auto Reversed = make_reversed();
+
+/// $3F10/$3F14/$3F18/$3F1C mirror the backdrop entries below them.
+unsigned palette_index(std::uint16_t addr) {
+  unsigned index = addr & 0x1F;
+  if ((index & 0x13) == 0x10) index &= ~0x10u;
+  return index;
+}
+
+/// v advanced by `tiles` coarse X steps, crossing into the next nametable.
+std::uint16_t advance_x(std::uint16_t v, int tiles) {
+  const int coarse = (v & 0x1F) + tiles;
+  v = static_cast<std::uint16_t>((v & ~0x1F) | (coarse & 0x1F));
+  return coarse >= 32 ? static_cast<std::uint16_t>(v ^ 0x0400) : v;
+}
+
+} // namespace
+
+const std::array<std::uint32_t, 64> Ppu::Palette = {
+    0x666666, 0x002A88, 0x1412A7, 0x3B00A4, 0x5C007E, 0x6E0040, 0x6C0600, 0x561D00,
+    0x333500, 0x0B4800, 0x005200, 0x004F08, 0x00404D, 0x000000, 0x000000, 0x000000,
+    0xADADAD, 0x155FD9, 0x4240FF, 0x7527FE, 0xA01ACC, 0xB71E7B, 0xB53120, 0x994E00,
+    0x6B6D00, 0x388700, 0x0C9300, 0x008F32, 0x007C8D, 0x000000, 0x000000, 0x000000,
+    0xFFFEFF, 0x64B0FF, 0x9290FF, 0xC676FF, 0xF36AFF, 0xFE6ECC, 0xFE8170, 0xEA9E22,
+    0xBCBE00, 0x88D800, 0x5CE430, 0x45E082, 0x48CDDE, 0x4F4F4F, 0x000000, 0x000000,
+    0xFFFEFF, 0xC0DFFF, 0xD3D2FF, 0xE8C8FF, 0xFBC2FF, 0xFEC4EA, 0xFECCC5, 0xF7D8A5,
+    0xE4E594, 0xCFEF96, 0xBDF4AB, 0xB3F3CC, 0xB5EBF2, 0xB8B8B8, 0x000000, 0x000000,
+};
+
+Ppu::Ppu(CPU& cpu) : cpu_(cpu) {
+  set_mirroring(Mirroring::Horizontal);
+}
+
+void Ppu::set_chr(int bank, std::uint8_t* mem, bool writable) {
+  chr_[bank] = mem;
+  chr_writable_ = writable;
+}
+
+void Ppu::set_mirroring(Mirroring mirroring) {
+  static constexpr std::uint8_t Layouts[][4] = {
+      {0, 0, 1, 1}, {0, 1, 0, 1}, {0, 0, 0, 0}, {1, 1, 1, 1}, {0, 1, 2, 3}};
+  const auto& layout = Layouts[static_cast<int>(mirroring)];
+  for (int i = 0; i < 4; ++i) nametables_[i] = ciram_.data() + layout[i] * 0x400;
+}
+
+std::uint8_t* Ppu::vram(std::uint16_t addr) {
+  addr &= 0x3FFF;
+  if (addr < 0x2000) return chr_[addr >> 10] + (addr & 0x3FF);
+  if (addr < 0x3F00) return nametables_[(addr >> 10) & 3] + (addr & 0x3FF);
+  return palette_.data() + palette_index(addr);
+}
+
+std::uint8_t Ppu::vram_read(std::uint16_t addr) { return *vram(addr); }
+
+void Ppu::vram_write(std::uint16_t addr, std::uint8_t value) {
+  addr &= 0x3FFF;
+  if (addr < 0x2000 && !chr_writable_) return;
+  *vram(addr) = addr >= 0x3F00 ? value & 0x3F : value;
+}
+
+void Ppu::catch_up(std::uint64_t cycle) {
+  const std::uint64_t target = cycle * DotsPerCycle;
+  while (clock_ < target) {
+    const bool skip = line_ == PrerenderLine && odd_frame_ && rendering();
+    const int length = skip ? DotsPerLine - 1 : DotsPerLine;
+    const int from = dot_;
+    const auto to = static_cast<int>(
+        std::min<std::uint64_t>(length, from + (target - clock_)));
+    run_line(from, to);
+    clock_ += to - from;
+    dot_ = to;
+    if (dot_ < length) break;
+
+    dot_ = 0;
+    std::swap(sprites_, next_sprites_);
+    next_sprites_.fill(0);
+    zero_x_ = next_zero_x_;
+    next_zero_x_ = -1;
+    if (line_ == PrerenderLine) {
+      line_ = 0;
+      odd_frame_ = !odd_frame_;
+      ++frames_;
+      drawing_ = !headless_ || frame_requested_;
+      frame_requested_ = false;
+    } else {
+      ++line_;
+    }
+  }
+}
+
+void Ppu::sync() { catch_up(cpu_.cycles); }
+
+std::uint64_t Ppu::next_vblank() const {
+  const int position = line_ * DotsPerLine + dot_;
+  // Vblank starts once dot 1 of the vblank line has run.
+  const int start = VblankLine * DotsPerLine + 2;
+  int dots = (start - position + FrameDots) % FrameDots;
+  if (dots == 0) dots = FrameDots;
+  const int skipped = PrerenderLine * DotsPerLine + SkippedDot;
+  if (odd_frame_ && rendering() && position <= skipped && position + dots > skipped) --dots;
+  return (clock_ + dots + DotsPerCycle - 1) / DotsPerCycle;
+}
+
+void Ppu::run_line(int from, int to) {
+  const bool visible = line_ < Height;
+  const bool prerender = line_ == PrerenderLine;
+  const auto at = [&](int dot) { return from <= dot && dot < to; };
+
+  if (at(1)) {
+    if (line_ == VblankLine) {
+      status_ |= StatusVblank;
+      if (ctrl_ & CtrlNmi) cpu_.nmi();
+    } else if (prerender) {
+      status_ &= ~(StatusVblank | StatusSpriteZero | StatusOverflow);
+    }
+  }
+  if (visible) {
+    const int x0 = std::max(from, 1) - 1;
+    const int x1 = std::min(to, Width + 1) - 1;
+    if (x0 < x1) {
+      if (drawing_) {
+        render(x0, x1);
+      } else {
+        probe_sprite_zero(x0, x1);
+      }
+    }
+  }
+  if (!rendering() || !(visible || prerender)) return;
+
+  // Scroll updates, each at its dot.
+  for (int dot = std::max((from + 7) / 8 * 8, 8); dot < to && dot <= 256; dot += 8) {
+    increment_x();
+  }
+  if (at(256)) increment_y();
+  if (at(257)) {
+    v_ = static_cast<std::uint16_t>((v_ & ~0x041F) | (t_ & 0x041F));
+    if (visible) evaluate_sprites();
+  }
+  if (prerender && from < 305 && to > 280) {
+    v_ = static_cast<std::uint16_t>((v_ & ~0x7BE0) | (t_ & 0x7BE0));
+  }
+  if (at(321)) {
+    line_v_ = v_;
+    line_fine_x_ = fine_x_;
+  }
+  if (at(328)) increment_x();
+  if (at(336)) increment_x();
+}
+
+void Ppu::increment_x() {
+  if ((v_ & 0x1F) == 31) {
+    v_ = static_cast<std::uint16_t>((v_ & ~0x1F) ^ 0x0400);
+  } else {
+    ++v_;
+  }
+}
+
+void Ppu::increment_y() {
+  if ((v_ & 0x7000) != 0x7000) {
+    v_ = static_cast<std::uint16_t>(v_ + 0x1000);
+    return;
+  }
+  v_ &= ~0x7000;
+  int coarse = (v_ >> 5) & 0x1F;
+  if (coarse == 29) {
+    coarse = 0;
+    v_ ^= 0x0800;
+  } else if (coarse == 31) {
+    coarse = 0;
+  } else {
+    ++coarse;
+  }
+  v_ = static_cast<std::uint16_t>((v_ & ~0x03E0) | coarse << 5);
+}
+
+void Ppu::render(int x0, int x1) {
+  std::uint8_t* out = frame_.data() + line_ * Width;
+  if (!rendering()) {
+    // The backdrop, or the palette entry v points at.
+    const std::uint8_t color =
+        (v_ & 0x3F00) == 0x3F00 ? palette_[palette_index(v_)] : palette_[0];
+    std::fill(out + x0, out + x1, color);
+    return;
+  }
+
+  // Background tiles covering the run: fetched one by one, decoded in bulk.
+  std::uint8_t background[Width + 16] = {};
+  const int first = (x0 + line_fine_x_) >> 3;
+  if (mask_ & MaskBackground) {
+    const int tiles = ((x1 - 1 + line_fine_x_) >> 3) - first + 1;
+    std::uint8_t lo[Width / 8 + 2], hi[Width / 8 + 2], palettes[Width / 8 + 2];
+    std::uint16_t v = advance_x(line_v_, first);
+    const std::uint16_t table = (ctrl_ & CtrlBackgroundTable) ? 0x1000 : 0;
+    const unsigned fine_y = (v >> 12) & 7;
+    for (int tile = 0; tile < tiles; ++tile) {
+      const std::uint8_t index = vram_read(0x2000 | (v & 0x0FFF));
+      const std::uint8_t attribute = vram_read(
+          0x23C0 | (v & 0x0C00) | ((v >> 4) & 0x38) | ((v >> 2) & 0x07));
+      palettes[tile] = static_cast<std::uint8_t>(
+          ((attribute >> (((v >> 4) & 4) | (v & 2))) & 3) << 2);
+      const auto pattern = static_cast<std::uint16_t>(table | index << 4 | fine_y);
+      lo[tile] = vram_read(pattern);
+      hi[tile] = vram_read(pattern | 8);
+      v = advance_x(v, 1);
+    }
+    kernels_->decode(lo, hi, palettes, tiles, background);
+  }
+  std::uint8_t* bg = background + line_fine_x_ - first * 8;
+  if (x0 < 8 && !(mask_ & MaskLeftBackground)) std::fill(bg + x0, bg + std::min(x1, 8), 0);
+
+  const std::uint8_t* sprites = sprites_.data();
+  std::uint8_t clipped[Width];
+  if (!(mask_ & MaskSprites)) {
+    std::fill(clipped + x0, clipped + x1, 0);
+    sprites = clipped;
+  } else if (x0 < 8 && !(mask_ & MaskLeftSprites)) {
+    std::copy(sprites_.begin() + x0, sprites_.begin() + x1, clipped + x0);
+    std::fill(clipped + x0, clipped + std::min(x1, 8), 0);
+    sprites = clipped;
+  }
+
+  const std::uint8_t gray = (mask_ & MaskGrayscale) ? 0x30 : 0x3F;
+  const int hit = kernels_->composite(bg + x0, sprites + x0, palette_.data(), gray,
+                                      static_cast<size_t>(x1 - x0), out + x0);
+  if (hit >= 0 && x0 + hit != Width - 1) status_ |= StatusSpriteZero;
+}
+
+void Ppu::probe_sprite_zero(int x0, int x1) {
+  constexpr std::uint8_t Both = MaskBackground | MaskSprites;
+  if (zero_x_ < 0 || (status_ & StatusSpriteZero) || (mask_ & Both) != Both) return;
+  const bool left_shown = (mask_ & MaskLeftBackground) && (mask_ & MaskLeftSprites);
+  const int begin = std::max({x0, zero_x_, left_shown ? 0 : 8});
+  const int end = std::min({x1, zero_x_ + 8, Width - 1});
+  for (int x = begin; x < end; ++x) {
+    if ((sprites_[x] & SpriteZero) && background_pattern(x)) {
+      status_ |= StatusSpriteZero;
+      return;
+    }
+  }
+}
+
+std::uint8_t Ppu::background_pattern(int x) {
+  const int column = x + line_fine_x_;
+  const std::uint16_t v = advance_x(line_v_, column >> 3);
+  const std::uint8_t index = vram_read(0x2000 | (v & 0x0FFF));
+  const auto pattern = static_cast<std::uint16_t>(
+      ((ctrl_ & CtrlBackgroundTable) ? 0x1000 : 0) | index << 4 | ((v >> 12) & 7));
+  const unsigned bit = 7 - (column & 7);
+  return static_cast<std::uint8_t>(((vram_read(pattern) >> bit) & 1) |
+                                   ((vram_read(pattern | 8) >> bit) & 1) << 1);
+}
+
+void Ppu::evaluate_sprites() {
+  const int height = (ctrl_ & CtrlTallSprites) ? 16 : 8;
+  int found = 0;
+  for (int i = 0; i < 64; ++i) {
+    const std::uint8_t* sprite = oam_.data() + i * 4;
+    const int row = line_ - sprite[0];
+    if (row < 0 || row >= height) continue;
+    if (found == 8) {
+      status_ |= StatusOverflow;
+      break;
+    }
+    ++found;
+    if (i == 0) {
+      next_zero_x_ = sprite[3];
+    } else if (!drawing_) {
+      continue;
+    }
+
+    const std::uint8_t tile = sprite[1], attributes = sprite[2], left = sprite[3];
+    const int r = (attributes & 0x80) ? height - 1 - row : row;
+    std::uint16_t addr;
+    if (height == 16) {
+      addr = static_cast<std::uint16_t>((tile & 1) << 12 | (tile & 0xFE) << 4 |
+                                        (r & 8) << 1 | (r & 7));
+    } else {
+      addr = static_cast<std::uint16_t>(((ctrl_ & CtrlSpriteTable) ? 0x1000 : 0) |
+                                        tile << 4 | r);
+    }
+    std::uint8_t lo = vram_read(addr), hi = vram_read(addr | 8);
+    if (attributes & 0x40) {
+      lo = Reversed[lo];
+      hi = Reversed[hi];
+    }
+    // The flags ride along with the palette bits.
+    const auto flags = static_cast<std::uint8_t>(
+        (attributes & 3) << 2 | ((attributes & 0x20) ? SpriteBehind : 0) |
+        (i == 0 ? SpriteZero : 0));
+    std::uint8_t pixels[8];
+    kernels_->decode(&lo, &hi, &flags, 1, pixels);
+    // Lower numbered sprites are overlaid first and win.
+    kernels_->overlay(pixels, std::min(8, Width - left), next_sprites_.data() + left);
+  }
+}
+
+void Ppu::write_oam(const std::uint8_t* page) {
+  for (int i = 0; i < 256; ++i) oam_[(oam_addr_ + i) & 0xFF] = page[i];
+}
+
+std::uint8_t Ppu::read(std::uint16_t addr) {
+  sync();
+  switch (addr & 7) {
+  case 2: {
+    const auto value = static_cast<std::uint8_t>((status_ & 0xE0) | (latch_ & 0x1F));
+    status_ &= ~StatusVblank;
+    w_ = false;
+    return value;
+  }
+  case 4:
+    return oam_[oam_addr_];
+  case 7: {
+    std::uint8_t value;
+    if ((v_ & 0x3F00) == 0x3F00) {
+      // Palette reads are not buffered; the buffer gets the nametable below.
+      value = vram_read(v_);
+      read_buffer_ = vram_read(static_cast<std::uint16_t>(v_ - 0x1000));
+    } else {
+      value = read_buffer_;
+      read_buffer_ = vram_read(v_);
+    }
+    v_ = static_cast<std::uint16_t>((v_ + ((ctrl_ & CtrlIncrement32) ? 32 : 1)) & 0x7FFF);
+    return value;
+  }
+  default:
+    return latch_;
+  }
+}
+
+void Ppu::write(std::uint16_t addr, std::uint8_t value) {
+  sync();
+  latch_ = value;
+  switch (addr & 7) {
+  case 0: {
+    const bool was_enabled = ctrl_ & CtrlNmi;
+    ctrl_ = value;
+    t_ = static_cast<std::uint16_t>((t_ & 0xF3FF) | (value & 3) << 10);
+    // Enabling NMI during vblank fires it right away.
+    if (!was_enabled && (value & CtrlNmi) && (status_ & StatusVblank)) cpu_.nmi();
+    break;
+  }
+  case 1:
+    mask_ = value;
+    break;
+  case 3:
+    oam_addr_ = value;
+    break;
+  case 4:
+    oam_[oam_addr_++] = value;
+    break;
+  case 5:
+    if (!w_) {
+      t_ = static_cast<std::uint16_t>((t_ & ~0x001F) | value >> 3);
+      fine_x_ = value & 7;
+    } else {
+      t_ = static_cast<std::uint16_t>((t_ & 0x0C1F) | (value & 7) << 12 | (value & 0xF8) << 2);
+    }
+    w_ = !w_;
+    break;
+  case 6:
+    if (!w_) {
+      t_ = static_cast<std::uint16_t>((t_ & 0x00FF) | (value & 0x3F) << 8);
+    } else {
+      t_ = static_cast<std::uint16_t>((t_ & 0xFF00) | value);
+      v_ = t_;
+    }
+    w_ = !w_;
+    break;
+  case 7:
+    vram_write(v_, value);
+    v_ = static_cast<std::uint16_t>((v_ + ((ctrl_ & CtrlIncrement32) ? 32 : 1)) & 0x7FFF);
+    break;
+  }
+}
+
+std::uint8_t Ppu::peek(std::uint16_t addr) {
+  switch (addr & 7) {
+  case 2: return static_cast<std::uint8_t>((status_ & 0xE0) | (latch_ & 0x1F));
+  case 4: return oam_[oam_addr_];
+  case 7: return read_buffer_;
+  default: return latch_;
+  }
+}
+
+template <typename Archive, typename Self> void Ppu::fields(Archive& archive, Self& self) {
+  archive(self.ctrl_, self.mask_, self.status_, self.oam_addr_, self.v_, self.t_, self.fine_x_,
+          self.w_, self.read_buffer_, self.latch_, self.line_v_, self.line_fine_x_);
+  archive(self.clock_, self.line_, self.dot_, self.odd_frame_, self.frames_,
+          self.frame_requested_, self.drawing_);
+  archive(self.ciram_, self.palette_, self.oam_, self.sprites_, self.next_sprites_,
+          self.zero_x_, self.next_zero_x_, self.frame_);
+}
+
+void Ppu::save(SnapshotWriter& out) const { fields(out, *this); }
+
+void Ppu::restore(SnapshotReader& in) { fields(in, *this); }
+
+}; // namespace emu
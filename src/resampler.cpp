@@ -0,0 +1,139 @@
+#include <resampler.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define EMU_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+namespace emu {
+
+namespace {
+
+/// Width of the low-pass window, in zero crossings of the sinc.
+constexpr double ZeroCrossings = 16;
+/// Cutoff as a fraction of the lower of the two Nyquist frequencies.
+constexpr double Cutoff = 0.9;
+
+std::int32_t dot_scalar(const std::int16_t* samples, const std::int16_t* taps, size_t count) {
+  std::int32_t sum = 0;
+  for (size_t i = 0; i < count; ++i) sum += samples[i] * taps[i];
+  return sum;
+}
+
+#ifdef EMU_X86_SIMD
+
+__attribute__((target("sse2")))
+std::int32_t dot_sse2(const std::int16_t* samples, const std::int16_t* taps, size_t count) {
+  __m128i sum = _mm_setzero_si128();
+  for (size_t i = 0; i < count; i += 8) {
+    const __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(samples + i));
+    const __m128i t = _mm_loadu_si128(reinterpret_cast<const __m128i*>(taps + i));
+    sum = _mm_add_epi32(sum, _mm_madd_epi16(s, t));
+  }
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+  return _mm_cvtsi128_si32(sum);
+}
+
+__attribute__((target("avx2")))
+std::int32_t dot_avx2(const std::int16_t* samples, const std::int16_t* taps, size_t count) {
+  __m256i sum = _mm256_setzero_si256();
+  for (size_t i = 0; i < count; i += 16) {
+    const __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(samples + i));
+    const __m256i t = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(taps + i));
+    sum = _mm256_add_epi32(sum, _mm256_madd_epi16(s, t));
+  }
+  __m128i half = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+  half = _mm_add_epi32(half, _mm_shuffle_epi32(half, _MM_SHUFFLE(1, 0, 3, 2)));
+  half = _mm_add_epi32(half, _mm_shuffle_epi32(half, _MM_SHUFFLE(2, 3, 0, 1)));
+  return _mm_cvtsi128_si32(half);
+}
+
+#endif
+
+const FirKernels Scalar{"scalar", dot_scalar};
+#ifdef EMU_X86_SIMD
+const FirKernels Sse2{"sse2", dot_sse2};
+const FirKernels Avx2{"avx2", dot_avx2};
+#endif
+
+} // namespace
+
+const FirKernels* FirKernels::find(std::string_view name) {
+  if (name == Scalar.name) return &Scalar;
+#ifdef EMU_X86_SIMD
+  __builtin_cpu_init();
+  if (name == Sse2.name && __builtin_cpu_supports("sse2")) return &Sse2;
+  if (name == Avx2.name && __builtin_cpu_supports("avx2")) return &Avx2;
+#endif
+  return nullptr;
+}
+
+const FirKernels& FirKernels::best() {
+  static const FirKernels& chosen = []() -> const FirKernels& {
+    for (const char* name : {"avx2", "sse2"}) {
+      if (const FirKernels* kernels = find(name)) return *kernels;
+    }
+    return Scalar;
+  }();
+  return chosen;
+}
+
+Resampler::Resampler(double input_rate, int output_rate)
+    : input_rate_(input_rate), output_rate_(output_rate) {
+  constexpr double Pi = 3.14159265358979323846;
+  constexpr int Phases = 1 << PhaseBits;
+  const double ratio = input_rate / output_rate;
+  // Cutoff in cycles per input sample.
+  const double cutoff = Cutoff * 0.5 / std::max(ratio, 1.0);
+  length_ = (static_cast<size_t>(std::ceil(ZeroCrossings * std::max(ratio, 1.0))) + 15) & ~size_t{15};
+  step_ = static_cast<std::uint64_t>(std::llround(ratio * static_cast<double>(1ull << FractionBits)));
+
+  taps_.assign(length_ * Phases, 0);
+  const double center = length_ / 2.0;
+  for (int phase = 0; phase < Phases; ++phase) {
+    std::vector<double> taps(length_);
+    double sum = 0;
+    for (size_t i = 0; i < length_; ++i) {
+      const double x = i - center - static_cast<double>(phase) / Phases;
+      if (std::abs(x) >= center) continue;
+      const double sinc = x == 0 ? 1 : std::sin(2 * Pi * cutoff * x) / (2 * Pi * cutoff * x);
+      const double window =
+          0.42 + 0.5 * std::cos(Pi * x / center) + 0.08 * std::cos(2 * Pi * x / center);
+      taps[i] = sinc * window;
+      sum += taps[i];
+    }
+    // Unity gain at DC for every phase.
+    std::int16_t* out = taps_.data() + phase * length_;
+    for (size_t i = 0; i < length_; ++i) {
+      out[i] = static_cast<std::int16_t>(std::lround(taps[i] / sum * (1 << TapBits)));
+    }
+  }
+  reset();
+}
+
+void Resampler::reset() {
+  position_ = 0;
+  input_.assign(length_, 0);
+}
+
+void Resampler::process(const std::int16_t* in, size_t count, std::vector<std::int16_t>& out) {
+  input_.insert(input_.end(), in, in + count);
+  const size_t phase_mask = (size_t{1} << PhaseBits) - 1;
+  for (;;) {
+    const auto index = static_cast<size_t>(position_ >> FractionBits);
+    if (index + length_ > input_.size()) break;
+    const size_t phase = static_cast<size_t>(position_ >> (FractionBits - PhaseBits)) & phase_mask;
+    const std::int32_t sum = kernels_->dot(input_.data() + index, taps_.data() + phase * length_, length_);
+    out.push_back(static_cast<std::int16_t>(std::clamp(sum >> TapBits, -32768, 32767)));
+    position_ += step_;
+  }
+  const size_t used = std::min(static_cast<size_t>(position_ >> FractionBits), input_.size());
+  input_.erase(input_.begin(), input_.begin() + used);
+  position_ -= static_cast<std::uint64_t>(used) << FractionBits;
+}
+
+}; // namespace emu
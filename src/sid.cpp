@@ -0,0 +1,318 @@
+#include <sid.hpp>
+#include <cpu.hpp>
+#include <snapshot.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+namespace emu {
+
+namespace {
+
+/// Cycles per envelope step for each attack, decay and release setting.
+constexpr std::uint16_t RatePeriods[16] = {
+    9, 32, 63, 95, 149, 220, 267, 313, 392, 977, 1954, 3126, 3907, 11720, 19532, 31251,
+};
+
+constexpr std::uint8_t Gate = 0x01;
+constexpr std::uint8_t Sync = 0x02;
+constexpr std::uint8_t RingMod = 0x04;
+constexpr std::uint8_t Test = 0x08;
+constexpr std::uint8_t Triangle = 0x10;
+constexpr std::uint8_t Sawtooth = 0x20;
+constexpr std::uint8_t Pulse = 0x40;
+constexpr std::uint8_t Noise = 0x80;
+
+constexpr std::uint32_t NoiseSeed = 0x7FFFF8;
+/// The 6581's voices have a DC offset, which is what makes writes to the
+/// volume register audible.
+constexpr int VoiceOffset = 0x38000;
+
+/// Decay and release slow down as the envelope falls, approximating an
+/// exponential curve.
+int exponential_period(std::uint8_t envelope) {
+  if (envelope > 0x5D) return 1;
+  if (envelope > 0x36) return 2;
+  if (envelope > 0x1A) return 4;
+  if (envelope > 0x0E) return 8;
+  if (envelope > 0x06) return 16;
+  return 30;
+}
+
+} // namespace
+
+std::uint16_t Sid::Voice::waveform(const Voice& source) const {
+  if (!(control & 0xF0)) return 0;
+  std::uint32_t out = 0xFFF;
+  if (control & Triangle) {
+    const std::uint32_t msb = ((control & RingMod) ? accumulator ^ source.accumulator : accumulator) & 0x800000;
+    out &= ((msb ? ~accumulator : accumulator) >> 11) & 0xFFF;
+  }
+  if (control & Sawtooth) out &= accumulator >> 12;
+  if (control & Pulse) out &= ((control & Test) || (accumulator >> 12) >= pulse_width) ? 0xFFF : 0;
+  if (control & Noise) {
+    // Eight taps of the shift register form the top of the output.
+    out &= (noise >> 11 & 0x800) | (noise >> 10 & 0x400) | (noise >> 7 & 0x200) |
+           (noise >> 5 & 0x100) | (noise >> 4 & 0x080) | (noise >> 1 & 0x040) |
+           (noise << 1 & 0x020) | (noise << 2 & 0x010);
+  }
+  return static_cast<std::uint16_t>(out);
+}
+
+std::uint16_t Sid::Voice::rate_period() const {
+  switch (phase) {
+  case Phase::Attack:
+    return RatePeriods[attack_decay >> 4];
+  case Phase::DecaySustain:
+    return RatePeriods[attack_decay & 0x0F];
+  default:
+    return RatePeriods[sustain_release & 0x0F];
+  }
+}
+
+void Sid::Voice::step_envelope(std::uint32_t cycles) {
+  const std::uint16_t period = rate_period();
+  rate_counter = static_cast<std::uint16_t>(rate_counter + cycles);
+  if (rate_counter < period) return;
+  // Periods are longer than a step, so at most one envelope step is due;
+  // a counter left past a shortened period starts over.
+  rate_counter = static_cast<std::uint16_t>(rate_counter - period);
+  if (rate_counter >= period) rate_counter = 0;
+
+  if (phase == Phase::Attack) {
+    exponential_counter = 0;
+    if (++envelope == 0xFF) phase = Phase::DecaySustain;
+    return;
+  }
+  if (++exponential_counter < exponential_period(envelope)) return;
+  exponential_counter = 0;
+  if (phase == Phase::DecaySustain) {
+    if (envelope != (sustain_release >> 4) * 0x11) --envelope;
+  } else if (envelope > 0) {
+    --envelope;
+  }
+}
+
+Sid::Sid(CPU& cpu, double clock_rate)
+    : cpu_(cpu), native_rate_(clock_rate / Step), resampler_(native_rate_, 44100) {
+  reset();
+}
+
+void Sid::set_sample_rate(int rate) {
+  resampler_ = Resampler(native_rate_, rate);
+  resampler_.set_kernels(*kernels_);
+  output_.clear();
+  read_ = 0;
+}
+
+void Sid::set_kernels(const FirKernels& kernels) {
+  kernels_ = &kernels;
+  resampler_.set_kernels(kernels);
+}
+
+void Sid::set_audio(bool enabled) {
+  sync();
+  audio_ = enabled;
+  if (!audio_) {
+    resampler_.reset();
+    output_.clear();
+    read_ = 0;
+  }
+}
+
+void Sid::reset() {
+  for (Voice& voice : voices_) voice = Voice{};
+  cutoff_ = 0;
+  resonance_filter_ = 0;
+  mode_volume_ = 0;
+  band_pass_ = 0;
+  low_pass_ = 0;
+  bus_value_ = 0;
+  update_filter();
+}
+
+void Sid::update_filter() {
+  constexpr float Pi = 3.14159265f;
+  // The 6581's cutoff runs from about 30 Hz to 12 kHz, roughly linearly.
+  const float cutoff = 30.0f + cutoff_ * 5.8f;
+  frequency_ = 2.0f * std::sin(Pi * cutoff / static_cast<float>(native_rate_));
+  damping_ = 1.0f / (0.707f + (resonance_filter_ >> 4) / 15.0f);
+}
+
+void Sid::step_voices() {
+  for (Voice& voice : voices_) {
+    if (voice.control & Test) {
+      voice.accumulator = 0;
+      voice.msb_rising = false;
+      continue;
+    }
+    const std::uint32_t previous = voice.accumulator;
+    voice.accumulator = (previous + voice.frequency * Step) & 0xFFFFFF;
+    const std::uint32_t rising = ~previous & voice.accumulator;
+    voice.msb_rising = (rising & 0x800000) != 0;
+    // A step is too short for bit 19 to rise twice.
+    if (rising & 0x080000) {
+      const std::uint32_t bit = ((voice.noise >> 22) ^ (voice.noise >> 17)) & 1;
+      voice.noise = ((voice.noise << 1) | bit) & 0x7FFFFF;
+    }
+  }
+  // Voice 1 is synced by voice 3, voice 2 by voice 1, voice 3 by voice 2.
+  for (int i = 0; i < 3; ++i) {
+    if ((voices_[i].control & Sync) && voices_[(i + 2) % 3].msb_rising) voices_[i].accumulator = 0;
+  }
+  for (Voice& voice : voices_) voice.step_envelope(Step);
+}
+
+std::int16_t Sid::mix() {
+  int direct = VoiceOffset, filtered = 0;
+  for (int i = 0; i < 3; ++i) {
+    const Voice& voice = voices_[i];
+    const bool filter = (resonance_filter_ >> i) & 1;
+    // 3OFF mutes voice 3 unless it goes through the filter.
+    if (i == 2 && (mode_volume_ & 0x80) && !filter) continue;
+    const int out = (voice.waveform(voices_[(i + 2) % 3]) - 0x800) * voice.envelope;
+    (filter ? filtered : direct) += out;
+  }
+
+  const float high = static_cast<float>(filtered) - low_pass_ - damping_ * band_pass_;
+  band_pass_ += frequency_ * high;
+  low_pass_ += frequency_ * band_pass_;
+  float output = 0;
+  if (mode_volume_ & 0x10) output += low_pass_;
+  if (mode_volume_ & 0x20) output += band_pass_;
+  if (mode_volume_ & 0x40) output += high;
+
+  const int mixed = (direct + static_cast<int>(output)) * (mode_volume_ & 0x0F) >> 10;
+  return static_cast<std::int16_t>(std::clamp(mixed, -32768, 32767));
+}
+
+void Sid::catch_up(std::uint64_t cycle) {
+  if (cycle <= clock_) return;
+  const std::uint64_t total = cycle - clock_ + pending_;
+  clock_ = cycle;
+  pending_ = static_cast<std::uint32_t>(total % Step);
+  for (std::uint64_t steps = total / Step; steps > 0; --steps) {
+    step_voices();
+    if (audio_) native_.push_back(mix());
+  }
+  if (native_.empty()) return;
+  resampler_.process(native_.data(), native_.size(), output_);
+  native_.clear();
+  const size_t limit = static_cast<size_t>(sample_rate()) / 2;
+  if (samples_available() > limit) read_ = output_.size() - limit;
+  if (read_ > limit) {
+    output_.erase(output_.begin(), output_.begin() + static_cast<std::ptrdiff_t>(read_));
+    read_ = 0;
+  }
+}
+
+void Sid::sync() { catch_up(cpu_.cycles); }
+
+size_t Sid::read_samples(std::int16_t* out, size_t max) {
+  const size_t count = std::min(max, samples_available());
+  std::copy(output_.begin() + static_cast<std::ptrdiff_t>(read_),
+            output_.begin() + static_cast<std::ptrdiff_t>(read_ + count), out);
+  read_ += count;
+  if (read_ == output_.size()) {
+    output_.clear();
+    read_ = 0;
+  }
+  return count;
+}
+
+std::uint8_t Sid::read(std::uint16_t addr) {
+  const int reg = addr & 0x1F;
+  if (reg == 0x1B || reg == 0x1C) sync();
+  return peek(addr);
+}
+
+std::uint8_t Sid::peek(std::uint16_t addr) {
+  switch (addr & 0x1F) {
+  case 0x19:
+  case 0x1A:
+    // No paddles.
+    return 0xFF;
+  case 0x1B:
+    return static_cast<std::uint8_t>(voices_[2].waveform(voices_[1]) >> 4);
+  case 0x1C:
+    return voices_[2].envelope;
+  default:
+    return bus_value_;
+  }
+}
+
+void Sid::write(std::uint16_t addr, std::uint8_t value) {
+  sync();
+  bus_value_ = value;
+  const int reg = addr & 0x1F;
+  if (reg < 21) {
+    Voice& voice = voices_[reg / 7];
+    switch (reg % 7) {
+    case 0:
+      voice.frequency = static_cast<std::uint16_t>((voice.frequency & 0xFF00) | value);
+      break;
+    case 1:
+      voice.frequency = static_cast<std::uint16_t>((voice.frequency & 0x00FF) | value << 8);
+      break;
+    case 2:
+      voice.pulse_width = static_cast<std::uint16_t>((voice.pulse_width & 0x0F00) | value);
+      break;
+    case 3:
+      voice.pulse_width = static_cast<std::uint16_t>((voice.pulse_width & 0x00FF) | (value & 0x0F) << 8);
+      break;
+    case 4:
+      if ((value & Gate) && !(voice.control & Gate)) voice.phase = Phase::Attack;
+      if (!(value & Gate) && (voice.control & Gate)) voice.phase = Phase::Release;
+      if (value & Test) {
+        voice.accumulator = 0;
+        voice.noise = NoiseSeed;
+      }
+      voice.control = value;
+      break;
+    case 5:
+      voice.attack_decay = value;
+      break;
+    default:
+      voice.sustain_release = value;
+      break;
+    }
+    return;
+  }
+  switch (reg) {
+  case 0x15:
+    cutoff_ = static_cast<std::uint16_t>((cutoff_ & 0x7F8) | (value & 0x07));
+    update_filter();
+    break;
+  case 0x16:
+    cutoff_ = static_cast<std::uint16_t>((cutoff_ & 0x007) | value << 3);
+    update_filter();
+    break;
+  case 0x17:
+    resonance_filter_ = value;
+    update_filter();
+    break;
+  case 0x18:
+    mode_volume_ = value;
+    break;
+  default:
+    break;
+  }
+}
+
+template <typename Archive, typename Self> void Sid::fields(Archive& archive, Self& self) {
+  archive(self.voices_, self.cutoff_, self.resonance_filter_, self.mode_volume_);
+  archive(self.frequency_, self.damping_, self.band_pass_, self.low_pass_, self.bus_value_);
+  archive(self.clock_, self.pending_);
+}
+
+void Sid::save(SnapshotWriter& out) const { fields(out, *this); }
+
+void Sid::restore(SnapshotReader& in) {
+  fields(in, *this);
+  resampler_.reset();
+  native_.clear();
+  output_.clear();
+  read_ = 0;
+}
+
+}; // namespace emu
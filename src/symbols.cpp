@@ -0,0 +1,336 @@
+#include <symbols.hpp>
+
+#include <algorithm>
+#include <cstdlib>
+#include <istream>
+#include <utility>
+
+namespace emu {
+
+namespace {
+
+constexpr std::uint32_t None = ~std::uint32_t{0};
+
+/// Splits an ld65 debug info line, `kind<TAB>key=value,key="string",...`,
+/// and hands every field to `field`.
+template <typename Fn>
+void fields(std::string_view line, Fn&& field) {
+  size_t pos = 0;
+  while (pos < line.size()) {
+    const size_t eq = line.find('=', pos);
+    if (eq == std::string_view::npos) return;
+    const std::string_view key = line.substr(pos, eq - pos);
+    size_t end;
+    std::string_view value;
+    if (eq + 1 < line.size() && line[eq + 1] == '"') {
+      end = line.find('"', eq + 2);
+      if (end == std::string_view::npos) return;
+      value = line.substr(eq + 2, end - eq - 2);
+      end = line.find(',', end);
+    } else {
+      end = line.find(',', eq);
+      value = line.substr(eq + 1, end == std::string_view::npos ? end : end - eq - 1);
+    }
+    field(key, value);
+    if (end == std::string_view::npos) return;
+    pos = end + 1;
+  }
+}
+
+/// Parses decimal or 0x-prefixed hex.
+std::uint32_t number(std::string_view text) {
+  return static_cast<std::uint32_t>(std::strtoul(std::string(text).c_str(), nullptr, 0));
+}
+
+struct DbgScope final {
+  std::string name;
+  std::string type;
+  std::uint32_t parent = None;
+  std::uint32_t sym = None;
+  std::uint32_t size = 0;
+};
+
+struct DbgSym final {
+  std::string name;
+  std::string type;
+  std::uint32_t scope = None;
+  std::uint32_t parent = None;
+  std::uint32_t val = None;
+  std::uint32_t size = 0;
+};
+
+template <typename T>
+T& slot(std::vector<T>& items, std::uint32_t id) {
+  if (id >= items.size()) items.resize(id + 1);
+  return items[id];
+}
+
+} // namespace
+
+std::uint32_t SymbolTable::intern(std::string_view name) {
+  const auto offset = static_cast<std::uint32_t>(names_.size());
+  names_.append(name);
+  names_ += '\0';
+  return offset;
+}
+
+void SymbolTable::add(std::uint16_t addr, std::string_view name,
+                      std::uint32_t size, bool equate) {
+  if (equate) {
+    equates_.push_back({addr, intern(name)});
+  } else {
+    pending_.push_back({addr, size, intern(name)});
+  }
+}
+
+void SymbolTable::index() {
+  std::stable_sort(equates_.begin(), equates_.end(),
+                   [](const Equate& a, const Equate& b) { return a.addr < b.addr; });
+
+  // Containers sort before the labels they contain: larger sizes first, and
+  // labels of unknown size (which cover the least) last.
+  std::stable_sort(pending_.begin(), pending_.end(),
+                   [](const Pending& a, const Pending& b) {
+                     if (a.start != b.start) return a.start < b.start;
+                     return a.size > b.size;
+                   });
+  const size_t count = pending_.size();
+  starts_.resize(count);
+  labels_.resize(count);
+
+  // A label of unknown size runs to the next label that starts after it.
+  std::uint32_t next_start = 0x10000;
+  for (size_t i = count; i-- > 0;) {
+    const Pending& label = pending_[i];
+    starts_[i] = label.start;
+    labels_[i].name = label.name;
+    labels_[i].end = label.size ? std::min<std::uint32_t>(label.start + label.size, 0x10000)
+                                : next_start;
+    if (i == 0 || pending_[i - 1].start != label.start) next_start = label.start;
+  }
+
+  // Nesting. Labels of unknown size are clipped to their container, which
+  // keeps the intervals properly nested.
+  std::vector<std::int32_t> open;
+  for (size_t i = 0; i < count; ++i) {
+    while (!open.empty() && labels_[static_cast<size_t>(open.back())].end <= starts_[i]) {
+      open.pop_back();
+    }
+    labels_[i].parent = open.empty() ? -1 : open.back();
+    if (!open.empty() && pending_[i].size == 0) {
+      labels_[i].end = std::min(labels_[i].end, labels_[static_cast<size_t>(open.back())].end);
+    }
+    open.push_back(static_cast<std::int32_t>(i));
+  }
+
+  size_t label = 0;
+  for (std::uint32_t page = 0; page <= 256; ++page) {
+    while (label < count && starts_[label] < page << 8) ++label;
+    page_first_[page] = static_cast<std::uint32_t>(label);
+  }
+}
+
+std::int32_t SymbolTable::find(std::uint16_t addr) const {
+  const std::uint32_t page = addr >> 8;
+  const auto first = starts_.begin() + page_first_[page];
+  const auto last = starts_.begin() + page_first_[page + 1];
+  auto label = static_cast<std::int32_t>(std::upper_bound(first, last, addr) - starts_.begin()) - 1;
+  while (label >= 0 && addr >= labels_[static_cast<size_t>(label)].end) {
+    label = labels_[static_cast<size_t>(label)].parent;
+  }
+  return label;
+}
+
+const char* SymbolTable::at(std::uint16_t addr) const {
+  const auto first = starts_.begin() + page_first_[addr >> 8];
+  const auto last = starts_.begin() + page_first_[(addr >> 8) + 1];
+  const auto label = std::lower_bound(first, last, addr);
+  if (label != last && *label == addr) return name(static_cast<std::int32_t>(label - starts_.begin()));
+  const auto equate = std::lower_bound(
+      equates_.begin(), equates_.end(), addr,
+      [](const Equate& e, std::uint16_t a) { return e.addr < a; });
+  if (equate != equates_.end() && equate->addr == addr) {
+    return names_.data() + equate->name;
+  }
+  return nullptr;
+}
+
+bool SymbolTable::address_of(std::string_view name, std::uint16_t& out) const {
+  for (size_t i = 0; i < labels_.size(); ++i) {
+    if (name == names_.data() + labels_[i].name) {
+      out = static_cast<std::uint16_t>(starts_[i]);
+      return true;
+    }
+  }
+  for (const Equate& equate : equates_) {
+    if (name == names_.data() + equate.name) {
+      out = equate.addr;
+      return true;
+    }
+  }
+  return false;
+}
+
+std::string SymbolTable::describe(std::uint16_t addr) const {
+  static constexpr char Hex[] = "0123456789abcdef";
+  const auto hex = [](std::string& out, unsigned value, int digits) {
+    for (int shift = (digits - 1) * 4; shift >= 0; shift -= 4) out += Hex[(value >> shift) & 0xF];
+  };
+  std::string out;
+  const std::int32_t label = find(addr);
+  if (label < 0) {
+    out += '$';
+    hex(out, addr, 4);
+    return out;
+  }
+  out = name(label);
+  if (const unsigned offset = addr - start(label)) {
+    out += "+$";
+    hex(out, offset, offset > 0xFF ? 4 : 2);
+  }
+  return out;
+}
+
+bool SymbolTable::load(std::istream& in, std::string& error) {
+  std::string first;
+  const auto mark = in.tellg();
+  std::getline(in, first);
+  in.clear();
+  in.seekg(mark);
+  if (first.rfind("version", 0) == 0) return load_dbg(in, error);
+  if (first.rfind("al ", 0) == 0) return load_vice(in, error);
+  error = "unrecognized symbol file format";
+  return false;
+}
+
+bool SymbolTable::load_dbg(std::istream& in, std::string& error) {
+  std::vector<DbgScope> scopes;
+  std::vector<DbgSym> syms;
+  std::string line;
+  size_t line_number = 0;
+  while (std::getline(in, line)) {
+    ++line_number;
+    const std::string_view text = line;
+    const size_t tab = text.find_first_of("\t ");
+    if (tab == std::string_view::npos) continue;
+    const std::string_view kind = text.substr(0, tab);
+    const std::string_view rest = text.substr(tab + 1);
+
+    if (kind == "version") {
+      bool supported = false;
+      fields(rest, [&](std::string_view key, std::string_view value) {
+        if (key == "major") supported = number(value) == 2;
+      });
+      if (!supported) {
+        error = "unsupported debug info version";
+        return false;
+      }
+    } else if (kind == "scope") {
+      DbgScope scope;
+      std::uint32_t id = None;
+      fields(rest, [&](std::string_view key, std::string_view value) {
+        if (key == "id") id = number(value);
+        else if (key == "name") scope.name = value;
+        else if (key == "type") scope.type = value;
+        else if (key == "parent") scope.parent = number(value);
+        else if (key == "sym") scope.sym = number(value);
+        else if (key == "size") scope.size = number(value);
+      });
+      if (id == None) {
+        error = "scope without id on line " + std::to_string(line_number);
+        return false;
+      }
+      slot(scopes, id) = std::move(scope);
+    } else if (kind == "sym") {
+      DbgSym sym;
+      std::uint32_t id = None;
+      fields(rest, [&](std::string_view key, std::string_view value) {
+        if (key == "id") id = number(value);
+        else if (key == "name") sym.name = value;
+        else if (key == "type") sym.type = value;
+        else if (key == "scope") sym.scope = number(value);
+        else if (key == "parent") sym.parent = number(value);
+        else if (key == "val") sym.val = number(value);
+        else if (key == "size") sym.size = number(value);
+      });
+      if (id == None) {
+        error = "symbol without id on line " + std::to_string(line_number);
+        return false;
+      }
+      slot(syms, id) = std::move(sym);
+    }
+  }
+
+  // A .proc's size is recorded on the scope it opens.
+  for (const DbgScope& scope : scopes) {
+    if (scope.sym < syms.size() && scope.size) syms[scope.sym].size = scope.size;
+  }
+
+  // Names are qualified with their enclosing named scopes (`proc::label`);
+  // cheap locals with the label they belong to (`label@loop`).
+  const auto scope_prefix = [&](std::uint32_t id) {
+    std::string prefix;
+    for (size_t depth = 0; id < scopes.size() && scopes[id].parent != None &&
+                           depth < scopes.size();
+         id = scopes[id].parent, ++depth) {
+      if (!scopes[id].name.empty()) prefix = scopes[id].name + "::" + prefix;
+    }
+    return prefix;
+  };
+  const auto in_type = [&](std::uint32_t id) {
+    if (id >= scopes.size()) return false;
+    return scopes[id].type == "struct" || scopes[id].type == "enum";
+  };
+
+  for (const DbgSym& sym : syms) {
+    if (sym.val == None || sym.val > 0xFFFF || sym.name.empty()) continue;
+    const bool equate = sym.type == "equ";
+    if (!equate && sym.type != "lab") continue; // imports repeat an export
+    if (in_type(sym.scope)) continue;
+
+    std::string name;
+    if (sym.parent < syms.size()) {
+      const DbgSym& parent = syms[sym.parent];
+      name = scope_prefix(parent.scope) + parent.name + sym.name;
+    } else {
+      name = scope_prefix(sym.scope) + sym.name;
+    }
+    add(static_cast<std::uint16_t>(sym.val), name, sym.size, equate);
+  }
+  index();
+  return true;
+}
+
+bool SymbolTable::load_vice(std::istream& in, std::string& error) {
+  std::string line;
+  size_t line_number = 0;
+  while (std::getline(in, line)) {
+    ++line_number;
+    std::string_view text = line;
+    if (text.rfind("al ", 0) != 0) continue;
+    text.remove_prefix(3);
+    // An optional memory space: `C:` is the computer, other spaces (drive
+    // CPUs) are not part of this address space.
+    if (text.size() > 2 && text[1] == ':') {
+      if (text[0] != 'C' && text[0] != 'c') continue;
+      text.remove_prefix(2);
+    }
+    const size_t space = text.find(' ');
+    char* end = nullptr;
+    const std::string addr_text(text.substr(0, space));
+    const unsigned long addr = std::strtoul(addr_text.c_str(), &end, 16);
+    if (space == std::string_view::npos || addr_text.empty() || *end || addr > 0xFFFF) {
+      error = "bad label on line " + std::to_string(line_number);
+      return false;
+    }
+    std::string_view name = text.substr(space + 1);
+    while (!name.empty() && (name.back() == '\r' || name.back() == ' ')) name.remove_suffix(1);
+    if (!name.empty() && name[0] == '.') name.remove_prefix(1);
+    if (name.empty()) continue;
+    add(static_cast<std::uint16_t>(addr), name);
+  }
+  index();
+  return true;
+}
+
+}; // namespace emu
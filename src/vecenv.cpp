@@ -0,0 +1,177 @@
+#include <vecenv.hpp>
+
+#include <array>
+#include <utility>
+
+namespace emu {
+
+namespace {
+
+/// Luminance of each NES colour, Rec. 601 weights.
+std::array<std::uint8_t, 64> luma_table() {
+  std::array<std::uint8_t, 64> luma{};
+  for (size_t i = 0; i < luma.size(); ++i) {
+    const std::uint32_t rgb = Ppu::Palette[i];
+    const std::uint32_t r = rgb >> 16, g = (rgb >> 8) & 0xFF, b = rgb & 0xFF;
+    luma[i] = static_cast<std::uint8_t>((r * 299 + g * 587 + b * 114) / 1000);
+  }
+  return luma;
+}
+
+const std::array<std::uint8_t, 64> Luma = luma_table();
+
+} // namespace
+
+bool VectorEnv::load(std::vector<std::uint8_t> ines, Config config, std::string& error) {
+  if (config.count == 0) {
+    error = "no instances";
+    return false;
+  }
+  if (config.frameskip == 0) {
+    error = "frameskip must be at least 1";
+    return false;
+  }
+  if (config.downscale &&
+      (Ppu::Width % config.downscale != 0 || Ppu::Height % config.downscale != 0)) {
+    error = "downscale must divide 256 and 240";
+    return false;
+  }
+  for (const RewardTerm& term : config.rewards) {
+    if (term.size < 1 || term.size > 4) {
+      error = "reward values are 1 to 4 bytes";
+      return false;
+    }
+  }
+  ram_bytes_ = 0;
+  for (const RamSlice& slice : config.slices) ram_bytes_ += slice.size;
+
+  config_ = std::move(config);
+  instances_.clear();
+  instances_.resize(config_.count);
+  values_.assign(config_.count * config_.rewards.size(), 0.0);
+  for (auto& instance : instances_) {
+    instance = std::make_unique<Nes>();
+    if (!instance->load(ines, error)) return false;
+    instance->ppu().set_headless(true);
+    instance->apu().set_audio(false);
+  }
+
+  // Episodes start one frame after power-on, so the first observation
+  // holds a drawn frame (the PPU draws its first frame even when headless;
+  // games often leave it blank while the PPU warms up). The machine is
+  // deterministic, so every episode starts from the same state, and a
+  // snapshot of it restarts an instance in place.
+  Nes& first = *instances_.front();
+  first.run_frame();
+  start_cpu_ = first.cpu();
+  SnapshotWriter measure(nullptr);
+  first.save(measure);
+  start_.resize(measure.size());
+  SnapshotWriter out(start_.data());
+  first.save(out);
+  for (size_t i = 0; i < instances_.size(); ++i) restart(i);
+  return true;
+}
+
+void VectorEnv::restart(size_t index) {
+  Nes& nes = *instances_[index];
+  SnapshotReader in(start_.data(), start_.size());
+  nes.restore(in);
+  // Only the architectural state: the instance keeps its own idioms,
+  // coverage and trap handler.
+  CPU& cpu = nes.cpu();
+  cpu.PC = start_cpu_.PC;
+  cpu.A = start_cpu_.A;
+  cpu.X = start_cpu_.X;
+  cpu.Y = start_cpu_.Y;
+  cpu.SP = start_cpu_.SP;
+  cpu.Status = start_cpu_.Status;
+  cpu.cycles = start_cpu_.cycles;
+  cpu.irq_lines = start_cpu_.irq_lines;
+  cpu.nmi_pending = start_cpu_.nmi_pending;
+  cpu.jammed = start_cpu_.jammed;
+  for (size_t t = 0; t < config_.rewards.size(); ++t) {
+    values_[index * config_.rewards.size() + t] = value(nes, config_.rewards[t]);
+  }
+}
+
+void VectorEnv::reset(std::uint8_t* observations) {
+  for (size_t i = 0; i < instances_.size(); ++i) {
+    restart(i);
+    observe(i, observations + i * observation_size());
+  }
+}
+
+void VectorEnv::step(const std::uint8_t* buttons, std::uint8_t* observations, float* rewards,
+                     std::uint8_t* dones) {
+  const size_t stride = observation_size();
+  for (size_t i = 0; i < instances_.size(); ++i) {
+    Nes& nes = *instances_[i];
+    nes.set_buttons(0, buttons[i]);
+    for (unsigned frame = 0; frame < config_.frameskip; ++frame) {
+      if (config_.downscale && frame + 1 == config_.frameskip) nes.ppu().request_frame();
+      nes.run_frame();
+    }
+    rewards[i] = static_cast<float>(score(i));
+    const bool done =
+        (config_.done_test &&
+         (nes.bus().peek(config_.done_address) & config_.done_mask) == config_.done_value) ||
+        nes.cpu().jammed;
+    dones[i] = done;
+    if (done) restart(i);
+    observe(i, observations + i * stride);
+  }
+}
+
+double VectorEnv::value(Nes& nes, const RewardTerm& term) const {
+  double result = 0;
+  double scale = 1;
+  for (std::uint8_t i = 0; i < term.size; ++i) {
+    const std::uint8_t byte = nes.bus().peek(static_cast<std::uint16_t>(term.address + i));
+    if (term.bcd) {
+      result += ((byte >> 4) * 10 + (byte & 0x0F)) * scale;
+      scale *= 100;
+    } else {
+      result += byte * scale;
+      scale *= 256;
+    }
+  }
+  return result;
+}
+
+double VectorEnv::score(size_t index) {
+  double reward = 0;
+  double* values = values_.data() + index * config_.rewards.size();
+  for (size_t t = 0; t < config_.rewards.size(); ++t) {
+    const double now = value(*instances_[index], config_.rewards[t]);
+    reward += config_.rewards[t].weight * (now - values[t]);
+    values[t] = now;
+  }
+  return reward;
+}
+
+void VectorEnv::observe(size_t index, std::uint8_t* out) {
+  Nes& nes = *instances_[index];
+  for (const RamSlice& slice : config_.slices) {
+    for (std::uint16_t i = 0; i < slice.size; ++i) {
+      *out++ = nes.bus().peek(static_cast<std::uint16_t>(slice.address + i));
+    }
+  }
+  if (!config_.downscale) return;
+
+  const unsigned block = config_.downscale;
+  const unsigned area = block * block;
+  const std::uint8_t* frame = nes.ppu().frame();
+  for (size_t y = 0; y < frame_height(); ++y) {
+    for (size_t x = 0; x < frame_width(); ++x) {
+      unsigned sum = 0;
+      for (unsigned dy = 0; dy < block; ++dy) {
+        const std::uint8_t* row = frame + (y * block + dy) * Ppu::Width + x * block;
+        for (unsigned dx = 0; dx < block; ++dx) sum += Luma[row[dx] & 0x3F];
+      }
+      *out++ = static_cast<std::uint8_t>(sum / area);
+    }
+  }
+}
+
+}; // namespace emu
@@ -0,0 +1,232 @@
+#include <via.hpp>
+#include <cpu.hpp>
+
+#include <algorithm>
+#include <limits>
+
+namespace emu {
+
+namespace {
+
+constexpr std::uint8_t IfrCa2 = 0x01;
+constexpr std::uint8_t IfrCa1 = 0x02;
+constexpr std::uint8_t IfrCb2 = 0x08;
+constexpr std::uint8_t IfrCb1 = 0x10;
+constexpr std::uint8_t IfrTimer2 = 0x20;
+constexpr std::uint8_t IfrTimer1 = 0x40;
+constexpr std::uint8_t AcrFreeRun = 0x40;
+
+} // namespace
+
+Via::Via(CPU& cpu, ViaPorts& ports, std::uint8_t irq_source)
+    : cpu_(cpu), ports_(ports), irq_source_(irq_source) {
+  reset();
+}
+
+void Via::reset() {
+  std::fill(std::begin(output_), std::end(output_), 0);
+  std::fill(std::begin(ddr_), std::end(ddr_), 0);
+  acr_ = 0;
+  pcr_ = 0;
+  sr_ = 0;
+  ier_ = 0;
+  ifr_ = 0;
+  clear(0);
+  t1_armed_ = false;
+  t1_reload_ = false;
+  t2_armed_ = false;
+}
+
+void Via::catch_up(std::uint64_t cycle) {
+  if (cycle <= clock_) return;
+  const std::uint64_t ticks = cycle - clock_;
+  clock_ = cycle;
+
+  std::uint64_t left = ticks;
+  if (t1_reload_) {
+    t1_reload_ = false;
+    t1_ = t1_latch_;
+    --left;
+  }
+  if (left <= t1_) {
+    t1_ = static_cast<std::uint16_t>(t1_ - left);
+  } else {
+    // The counter shows $FFFF for a cycle after reaching 0 and only then
+    // reloads, so a free-running period is the latch plus 2.
+    const std::uint64_t period = t1_latch_ + std::uint64_t{2};
+    const std::uint64_t phase = (left - t1_ - 1) % period;
+    t1_reload_ = phase == 0;
+    t1_ = static_cast<std::uint16_t>(phase == 0 ? 0xFFFF : t1_latch_ + 1 - phase);
+    if (t1_armed_) {
+      t1_armed_ = (acr_ & AcrFreeRun) != 0;
+      raise(IfrTimer1);
+    }
+  }
+
+  if (ticks > t2_ && t2_armed_) {
+    t2_armed_ = false;
+    raise(IfrTimer2);
+  }
+  t2_ = static_cast<std::uint16_t>(t2_ - ticks);
+}
+
+void Via::sync() { catch_up(cpu_.cycles); }
+
+std::uint64_t Via::next_event() const {
+  std::uint64_t next = std::numeric_limits<std::uint64_t>::max();
+  const std::uint8_t pending = ier_ & ~ifr_;
+  if (t1_armed_ && (pending & IfrTimer1)) {
+    next = clock_ + (t1_reload_ ? t1_latch_ + std::uint64_t{2} : t1_ + std::uint64_t{1});
+  }
+  if (t2_armed_ && (pending & IfrTimer2)) next = std::min(next, clock_ + t2_ + 1);
+  return next;
+}
+
+void Via::set_ca1(bool level) {
+  if (level == ca1_) return;
+  ca1_ = level;
+  // PCR bit 0 selects the rising edge.
+  if (level == ((pcr_ & 0x01) != 0)) raise(IfrCa1);
+}
+
+void Via::raise(std::uint8_t flags) {
+  ifr_ |= flags;
+  cpu_.set_irq(irq_source_, (ifr_ & ier_ & 0x7F) != 0);
+}
+
+void Via::clear(std::uint8_t flags) {
+  ifr_ &= ~flags;
+  cpu_.set_irq(irq_source_, (ifr_ & ier_ & 0x7F) != 0);
+}
+
+std::uint8_t Via::read(std::uint16_t addr) {
+  sync();
+  switch (addr & 0x0F) {
+  case 0x0:
+    clear(IfrCb1 | IfrCb2);
+    return ports_.read_port(*this, 1, port_output(1));
+  case 0x1:
+    clear(IfrCa1 | IfrCa2);
+    return ports_.read_port(*this, 0, port_output(0));
+  case 0x4:
+    clear(IfrTimer1);
+    cpu_.end_run_by(next_event());
+    return static_cast<std::uint8_t>(t1_);
+  case 0x8:
+    clear(IfrTimer2);
+    cpu_.end_run_by(next_event());
+    return static_cast<std::uint8_t>(t2_);
+  case 0xF:
+    return ports_.read_port(*this, 0, port_output(0));
+  default:
+    return peek(addr);
+  }
+}
+
+std::uint8_t Via::peek(std::uint16_t addr) {
+  switch (addr & 0x0F) {
+  case 0x0:
+    return port_output(1);
+  case 0x1:
+  case 0xF:
+    return port_output(0);
+  case 0x2:
+    return ddr_[1];
+  case 0x3:
+    return ddr_[0];
+  case 0x4:
+    return static_cast<std::uint8_t>(t1_);
+  case 0x5:
+    return static_cast<std::uint8_t>(t1_ >> 8);
+  case 0x6:
+    return static_cast<std::uint8_t>(t1_latch_);
+  case 0x7:
+    return static_cast<std::uint8_t>(t1_latch_ >> 8);
+  case 0x8:
+    return static_cast<std::uint8_t>(t2_);
+  case 0x9:
+    return static_cast<std::uint8_t>(t2_ >> 8);
+  case 0xA:
+    return sr_;
+  case 0xB:
+    return acr_;
+  case 0xC:
+    return pcr_;
+  case 0xD:
+    return static_cast<std::uint8_t>(ifr_ | ((ifr_ & ier_ & 0x7F) ? 0x80 : 0));
+  default:
+    return ier_ | 0x80;
+  }
+}
+
+void Via::write(std::uint16_t addr, std::uint8_t value) {
+  sync();
+  switch (addr & 0x0F) {
+  case 0x0:
+    output_[1] = value;
+    clear(IfrCb1 | IfrCb2);
+    ports_.write_port(*this, 1, port_output(1));
+    break;
+  case 0x1:
+  case 0xF:
+    output_[0] = value;
+    if ((addr & 0x0F) == 0x1) clear(IfrCa1 | IfrCa2);
+    ports_.write_port(*this, 0, port_output(0));
+    break;
+  case 0x2:
+    ddr_[1] = value;
+    ports_.write_port(*this, 1, port_output(1));
+    break;
+  case 0x3:
+    ddr_[0] = value;
+    ports_.write_port(*this, 0, port_output(0));
+    break;
+  case 0x4:
+  case 0x6:
+    t1_latch_ = static_cast<std::uint16_t>((t1_latch_ & 0xFF00) | value);
+    break;
+  case 0x5:
+    // Loads and starts timer 1.
+    t1_latch_ = static_cast<std::uint16_t>((t1_latch_ & 0x00FF) | value << 8);
+    t1_ = t1_latch_;
+    t1_reload_ = false;
+    t1_armed_ = true;
+    clear(IfrTimer1);
+    break;
+  case 0x7:
+    t1_latch_ = static_cast<std::uint16_t>((t1_latch_ & 0x00FF) | value << 8);
+    clear(IfrTimer1);
+    break;
+  case 0x8:
+    t2_latch_low_ = value;
+    break;
+  case 0x9:
+    t2_ = static_cast<std::uint16_t>(t2_latch_low_ | value << 8);
+    t2_armed_ = true;
+    clear(IfrTimer2);
+    break;
+  case 0xA:
+    sr_ = value;
+    break;
+  case 0xB:
+    acr_ = value;
+    break;
+  case 0xC:
+    pcr_ = value;
+    break;
+  case 0xD:
+    clear(value & 0x7F);
+    break;
+  default:
+    if (value & 0x80) {
+      ier_ |= value & 0x7F;
+    } else {
+      ier_ &= ~value;
+    }
+    clear(0);
+    break;
+  }
+  cpu_.end_run_by(next_event());
+}
+
+}; // namespace emu
@@ -0,0 +1,481 @@
+#include <vic.hpp>
+#include <cpu.hpp>
+#include <snapshot.hpp>
+
+#include <algorithm>
+#include <limits>
+
+namespace emu {
+
+namespace {
+
+constexpr int Control1 = 0x11;
+constexpr int Raster = 0x12;
+constexpr int SpriteEnable = 0x15;
+constexpr int Control2 = 0x16;
+constexpr int SpriteYExpand = 0x17;
+constexpr int Memory = 0x18;
+constexpr int IrqFlags = 0x19;
+constexpr int IrqEnable = 0x1A;
+constexpr int SpritePriority = 0x1B;
+constexpr int SpriteMulticolor = 0x1C;
+constexpr int SpriteXExpand = 0x1D;
+constexpr int SpriteSprite = 0x1E;
+constexpr int SpriteBackground = 0x1F;
+constexpr int BorderColor = 0x20;
+constexpr int Background0 = 0x21;
+constexpr int SpriteMulticolor0 = 0x25;
+constexpr int SpriteMulticolor1 = 0x26;
+constexpr int SpriteColor0 = 0x27;
+constexpr int FirstUnused = 0x2F;
+
+constexpr std::uint8_t IrqRaster = 0x01;
+constexpr std::uint8_t IrqSpriteBackground = 0x02;
+constexpr std::uint8_t IrqSpriteSprite = 0x04;
+
+constexpr int FirstBadline = 0x30;
+constexpr int LastBadline = 0xF7;
+/// Cycles of a line at which the display logic acts.
+constexpr int BadlineCycle = 12;
+constexpr int RowFetchCycle = 14;
+constexpr int SpriteCycle = 55;
+constexpr int RowCounterCycle = 58;
+/// The first and last cycles that produce pixels; x is (cycle - 12) * 8.
+constexpr int FirstPixelCycle = 12;
+constexpr int LastPixelCycle = 60;
+/// Cycles taken from the CPU: 40 matrix fetches and 3 while BA settles.
+constexpr std::uint64_t BadlineStall = 43;
+/// Screen x of sprite x 0 and of the display window's first column.
+constexpr int SpriteOrigin = 8;
+constexpr int DisplayLeft = 32;
+
+} // namespace
+
+const std::array<std::uint32_t, 16> Vic::Palette = {
+    0x000000, 0xFFFFFF, 0x813338, 0x75CEC8, 0x8E3C97, 0x56AC4D, 0x2E2C9B, 0xEDF171,
+    0x8E5029, 0x553800, 0xC46C71, 0x4A4A4A, 0x7B7B7B, 0xA9FF9F, 0x706DEB, 0xB2B2B2,
+};
+
+Vic::Vic(CPU& cpu) : cpu_(cpu) {}
+
+void Vic::set_memory(const std::uint8_t* ram, const std::uint8_t* chargen,
+                     const std::uint8_t* color_ram) {
+  ram_ = ram;
+  chargen_ = chargen;
+  color_ram_ = color_ram;
+}
+
+std::uint8_t Vic::vic_read(std::uint16_t addr) const {
+  addr &= 0x3FFF;
+  if (chargen_ && (bank_ & 1) == 0 && (addr & 0x3000) == 0x1000) return chargen_[addr & 0x0FFF];
+  return ram_[bank_ << 14 | addr];
+}
+
+bool Vic::badline(int line) const {
+  return den_latched_ && line >= FirstBadline && line <= LastBadline &&
+         (line & 7) == (regs_[Control1] & 7);
+}
+
+void Vic::catch_up(std::uint64_t cycle) {
+  while (clock_ < cycle) {
+    const int to = static_cast<int>(
+        std::min<std::uint64_t>(CyclesPerLine, cycle_ + (cycle - clock_)));
+    run_line(cycle_, to);
+    clock_ += static_cast<std::uint64_t>(to - cycle_);
+    cycle_ = to;
+    if (cycle_ == CyclesPerLine) {
+      cycle_ = 0;
+      line_ = (line_ + 1) % LinesPerFrame;
+      start_line();
+    }
+  }
+}
+
+void Vic::sync() { catch_up(cpu_.cycles); }
+
+void Vic::run_line(int from, int to) {
+  // The state at a cycle is the state after its events, so an event at
+  // `from` has already happened.
+  int at = from;
+  for (const int event : {BadlineCycle, RowFetchCycle, SpriteCycle, RowCounterCycle}) {
+    if (event <= from || event > to) continue;
+    render(at, event);
+    at = event;
+    switch (event) {
+    case BadlineCycle:
+      if (badline(line_)) cpu_.cycles += BadlineStall;
+      break;
+    case RowFetchCycle:
+      fetch_row();
+      break;
+    case SpriteCycle:
+      update_sprites();
+      break;
+    default:
+      update_row_counter();
+      break;
+    }
+  }
+  render(at, to);
+}
+
+void Vic::start_line() {
+  if (line_ == 0) {
+    ++frames_;
+    vc_base_ = 0;
+    den_latched_ = false;
+  }
+  // Decided at the first visible line, so that a frame requested when
+  // `run_frame` returns, at line 0, is the next one.
+  if (line_ == FirstLine) {
+    drawing_ = !headless_ || frame_requested_;
+    frame_requested_ = false;
+  }
+  const std::uint8_t control = regs_[Control1];
+  if (line_ == FirstBadline && (control & 0x10)) den_latched_ = true;
+  const bool rows25 = control & 0x08;
+  if (line_ == (rows25 ? 251 : 247)) vertical_border_ = true;
+  if (line_ == (rows25 ? 51 : 55) && (control & 0x10)) vertical_border_ = false;
+  if (line_ == compare_) raise(IrqRaster);
+
+  bool any_shown = false;
+  const std::uint16_t pointers = static_cast<std::uint16_t>((regs_[Memory] & 0xF0) << 6 | 0x3F8);
+  for (int i = 0; i < 8; ++i) {
+    Sprite& sprite = sprites_[i];
+    sprite.shown = sprite.dma;
+    if (!sprite.shown) continue;
+    any_shown = true;
+    const std::uint16_t addr = static_cast<std::uint16_t>(vic_read(pointers + i) << 6 | sprite.base);
+    sprite.data = static_cast<std::uint32_t>(vic_read(addr) << 16 | vic_read(addr + 1) << 8 |
+                                             vic_read(addr + 2));
+  }
+  const bool visible = line_ >= FirstLine && line_ < FirstLine + Height;
+  rendering_ = visible && (drawing_ || any_shown);
+}
+
+void Vic::fetch_row() {
+  if (!badline(line_)) return;
+  display_ = true;
+  rc_ = 0;
+  const std::uint16_t matrix = static_cast<std::uint16_t>((regs_[Memory] & 0xF0) << 6);
+  for (int i = 0; i < 40; ++i) {
+    const int vc = (vc_base_ + i) & 0x3FF;
+    matrix_[i] = vic_read(static_cast<std::uint16_t>(matrix | vc));
+    colors_[i] = color_ram_[vc] & 0x0F;
+  }
+}
+
+void Vic::update_row_counter() {
+  // VC counted the 40 columns if the line was displayed.
+  if (rc_ == 7) {
+    if (display_) vc_base_ = (vc_base_ + 40) & 0x3FF;
+    display_ = badline(line_);
+  }
+  if (display_) rc_ = (rc_ + 1) & 7;
+}
+
+void Vic::update_sprites() {
+  int fetched = 0;
+  for (int i = 0; i < 8; ++i) {
+    Sprite& sprite = sprites_[i];
+    if (sprite.shown) {
+      if (((regs_[SpriteYExpand] >> i) & 1) && !sprite.repeat) {
+        sprite.repeat = true;
+      } else {
+        sprite.repeat = false;
+        sprite.base = static_cast<std::uint8_t>(sprite.base + 3);
+        if (sprite.base >= 63) sprite.dma = false;
+      }
+    }
+    if (!sprite.dma && ((regs_[SpriteEnable] >> i) & 1) && regs_[1 + 2 * i] == (line_ & 0xFF)) {
+      sprite.dma = true;
+      sprite.base = 0;
+      sprite.repeat = false;
+    }
+    if (sprite.dma) ++fetched;
+  }
+  if (fetched) cpu_.cycles += 3 + 2 * static_cast<std::uint64_t>(fetched);
+}
+
+void Vic::decode_column(int column, int x) {
+  const std::uint8_t control1 = regs_[Control1];
+  const bool ecm = control1 & 0x40;
+  const bool bmm = control1 & 0x20;
+  const bool mcm = regs_[Control2] & 0x10;
+  std::uint8_t c = 0, color = 0, g;
+  if (display_) {
+    c = matrix_[column];
+    color = colors_[column];
+    const int vc = (vc_base_ + column) & 0x3FF;
+    int addr = bmm ? (regs_[Memory] & 0x08) << 10 | vc << 3 | rc_
+                   : (regs_[Memory] & 0x0E) << 10 | c << 3 | rc_;
+    if (ecm) addr &= 0x39FF;
+    g = vic_read(static_cast<std::uint16_t>(addr));
+  } else {
+    g = vic_read(ecm ? 0x39FF : 0x3FFF);
+  }
+
+  std::uint8_t* out = graphics_.data() + x;
+  std::uint8_t* fg = foreground_.data() + x;
+  const bool multicolor = mcm && (bmm || (color & 0x08));
+  if (multicolor) {
+    std::uint8_t colors[4];
+    if (bmm) {
+      colors[0] = regs_[Background0] & 0x0F;
+      colors[1] = c >> 4;
+      colors[2] = c & 0x0F;
+      colors[3] = color;
+    } else {
+      colors[0] = regs_[Background0] & 0x0F;
+      colors[1] = regs_[Background0 + 1] & 0x0F;
+      colors[2] = regs_[Background0 + 2] & 0x0F;
+      colors[3] = color & 0x07;
+    }
+    for (int i = 0; i < 8; i += 2) {
+      const int pair = (g >> (6 - i)) & 3;
+      out[i] = out[i + 1] = colors[pair];
+      fg[i] = fg[i + 1] = pair >= 2;
+    }
+  } else {
+    std::uint8_t set, clear;
+    if (bmm) {
+      set = c >> 4;
+      clear = c & 0x0F;
+    } else {
+      set = mcm ? color & 0x07 : color;
+      clear = regs_[Background0 + (ecm ? c >> 6 : 0)] & 0x0F;
+    }
+    for (int i = 0; i < 8; ++i) {
+      const bool bit = (g >> (7 - i)) & 1;
+      out[i] = bit ? set : clear;
+      fg[i] = bit;
+    }
+  }
+  // ECM with either of the other mode bits is invalid and shows black,
+  // but still has foreground for the collisions.
+  if (ecm && (bmm || mcm)) std::fill(out, out + 8, 0);
+}
+
+void Vic::render(int from, int to) {
+  if (!rendering_) return;
+  const int c0 = std::max(from, FirstPixelCycle);
+  const int c1 = std::min(to, LastPixelCycle);
+  if (c0 >= c1) return;
+  const int x0 = (c0 - FirstPixelCycle) * 8;
+  const int x1 = (c1 - FirstPixelCycle) * 8;
+  std::uint8_t* out = drawing_ ? frame_.data() + (line_ - FirstLine) * Width : scratch_.data();
+
+  // Graphics, shifted right by XSCROLL; background before the first column.
+  const int origin = DisplayLeft + (regs_[Control2] & 7);
+  std::fill(graphics_.begin() + x0, graphics_.begin() + x1, regs_[Background0] & 0x0F);
+  std::fill(foreground_.begin() + x0, foreground_.begin() + x1, 0);
+  const int first = std::max(0, (x0 - origin + 8) / 8 - 1);
+  const int last = std::min(39, (x1 - 1 - origin) >> 3);
+  if (x1 > origin) {
+    for (int column = first; column <= last; ++column) decode_column(column, origin + column * 8);
+  }
+  std::copy(graphics_.begin() + x0, graphics_.begin() + x1, out + x0);
+
+  draw_sprites(x0, x1, out);
+
+  const bool columns40 = regs_[Control2] & 0x08;
+  const int left = columns40 ? 32 : 39;
+  const int right = columns40 ? 352 : 343;
+  const std::uint8_t border = regs_[BorderColor] & 0x0F;
+  if (vertical_border_) {
+    std::fill(out + x0, out + x1, border);
+    return;
+  }
+  if (x0 < left) std::fill(out + x0, out + std::min(x1, left), border);
+  if (x1 > right) std::fill(out + std::max(x0, right), out + x1, border);
+}
+
+void Vic::draw_sprites(int x0, int x1, std::uint8_t* out) {
+  std::uint8_t hits[Width];
+  std::uint8_t colors[Width];
+  bool drawn = false;
+  // Lower numbered sprites are in front, so they are drawn last.
+  for (int i = 7; i >= 0; --i) {
+    const Sprite& sprite = sprites_[i];
+    if (!sprite.shown || sprite.data == 0) continue;
+    const int x = regs_[2 * i] | ((regs_[0x10] >> i) & 1) << 8;
+    const int sx = x + SpriteOrigin;
+    const int shift = (regs_[SpriteXExpand] >> i) & 1;
+    const int px0 = std::max(x0, sx);
+    const int px1 = std::min(x1, sx + (24 << shift));
+    if (px0 >= px1) continue;
+    if (!drawn) {
+      std::fill(hits + x0, hits + x1, 0);
+      drawn = true;
+    }
+    const bool multicolor = (regs_[SpriteMulticolor] >> i) & 1;
+    const std::uint8_t bit = static_cast<std::uint8_t>(1 << i);
+    const std::uint8_t own = regs_[SpriteColor0 + i] & 0x0F;
+    const std::uint8_t behind = ((regs_[SpritePriority] >> i) & 1) ? 0x80 : 0;
+    for (int px = px0; px < px1; ++px) {
+      const int p = (px - sx) >> shift;
+      std::uint8_t color;
+      if (multicolor) {
+        const int pair = (sprite.data >> (22 - (p & ~1))) & 3;
+        if (pair == 0) continue;
+        color = pair == 1 ? regs_[SpriteMulticolor0] & 0x0F
+                          : pair == 2 ? own : regs_[SpriteMulticolor1] & 0x0F;
+      } else {
+        if (!((sprite.data >> (23 - p)) & 1)) continue;
+        color = own;
+      }
+      hits[px] |= bit;
+      colors[px] = color | behind;
+    }
+  }
+  if (!drawn) return;
+
+  std::uint8_t sprite_sprite = 0, sprite_background = 0;
+  for (int x = x0; x < x1; ++x) {
+    const std::uint8_t hit = hits[x];
+    if (!hit) continue;
+    if (hit & (hit - 1)) sprite_sprite |= hit;
+    if (foreground_[x]) sprite_background |= hit;
+    if (!((colors[x] & 0x80) && foreground_[x])) out[x] = colors[x] & 0x0F;
+  }
+  if (sprite_sprite) {
+    if (!sprite_sprite_) raise(IrqSpriteSprite);
+    sprite_sprite_ |= sprite_sprite;
+  }
+  if (sprite_background) {
+    if (!sprite_background_) raise(IrqSpriteBackground);
+    sprite_background_ |= sprite_background;
+  }
+}
+
+void Vic::raise(std::uint8_t flags) {
+  irq_flags_ |= flags;
+  cpu_.set_irq(Irq, (irq_flags_ & regs_[IrqEnable] & 0x0F) != 0);
+}
+
+std::uint64_t Vic::next_event() const {
+  std::uint64_t next = std::numeric_limits<std::uint64_t>::max();
+  const std::uint8_t enabled = regs_[IrqEnable];
+  if ((enabled & IrqRaster) && !(irq_flags_ & IrqRaster) && compare_ < LinesPerFrame) {
+    const int lines = (compare_ - line_ + LinesPerFrame - 1) % LinesPerFrame + 1;
+    next = line_cycle(lines, 0);
+  }
+
+  bool sprites_on = false;
+  for (const Sprite& sprite : sprites_) sprites_on = sprites_on || sprite.dma;
+  // Collisions are noticed at the latest at the end of the line.
+  if ((enabled & (IrqSpriteSprite | IrqSpriteBackground)) && sprites_on) {
+    next = std::min(next, line_cycle(1, 0));
+  }
+
+  // The next cycle stealing: a badline or a line with sprite fetches. DEN
+  // is latched anew at line $30 of every frame.
+  const bool den = regs_[Control1] & 0x10;
+  const std::uint8_t sprites = regs_[SpriteEnable];
+  for (int i = 0; i <= LinesPerFrame; ++i) {
+    const std::uint64_t at = line_cycle(i, 0);
+    if (at >= next) break;
+    const int ahead = line_ + i;
+    const int line = ahead % LinesPerFrame;
+    const bool relatched = ahead >= LinesPerFrame || (line_ < FirstBadline && ahead >= FirstBadline);
+    const bool bad = (relatched ? den : den_latched_) && line >= FirstBadline &&
+                     line <= LastBadline && (line & 7) == (regs_[Control1] & 7);
+    if (bad && (i > 0 || cycle_ < BadlineCycle)) return std::min(next, at + BadlineCycle);
+    if (i > 0 || cycle_ < SpriteCycle) {
+      bool fetch = sprites_on;
+      for (int s = 0; s < 8 && !fetch; ++s) {
+        fetch = ((sprites >> s) & 1) && regs_[1 + 2 * s] == (line & 0xFF);
+      }
+      if (fetch) return std::min(next, at + SpriteCycle);
+    }
+  }
+  return next;
+}
+
+std::uint64_t Vic::next_frame() const { return line_cycle(LinesPerFrame - line_, 0); }
+
+std::uint8_t Vic::read(std::uint16_t addr) {
+  sync();
+  const int reg = addr & 0x3F;
+  if (reg != SpriteSprite && reg != SpriteBackground) return peek(addr);
+  std::uint8_t& collisions = reg == SpriteSprite ? sprite_sprite_ : sprite_background_;
+  const std::uint8_t value = collisions;
+  collisions = 0;
+  return value;
+}
+
+std::uint8_t Vic::peek(std::uint16_t addr) {
+  const int reg = addr & 0x3F;
+  switch (reg) {
+  case Control1:
+    return static_cast<std::uint8_t>((regs_[Control1] & 0x7F) | (line_ & 0x100) >> 1);
+  case Raster:
+    return static_cast<std::uint8_t>(line_);
+  case 0x13:
+  case 0x14:
+    return 0;
+  case Control2:
+    return regs_[reg] | 0xC0;
+  case Memory:
+    return regs_[reg] | 0x01;
+  case IrqFlags:
+    return static_cast<std::uint8_t>(irq_flags_ | 0x70 |
+                                     ((irq_flags_ & regs_[IrqEnable] & 0x0F) ? 0x80 : 0));
+  case IrqEnable:
+    return regs_[reg] | 0xF0;
+  case SpriteSprite:
+    return sprite_sprite_;
+  case SpriteBackground:
+    return sprite_background_;
+  default:
+    if (reg >= FirstUnused) return 0xFF;
+    return reg >= BorderColor ? regs_[reg] | 0xF0 : regs_[reg];
+  }
+}
+
+void Vic::write(std::uint16_t addr, std::uint8_t value) {
+  sync();
+  const int reg = addr & 0x3F;
+  if (reg >= FirstUnused || reg == SpriteSprite || reg == SpriteBackground) return;
+  const std::uint16_t compare = compare_;
+  switch (reg) {
+  case Control1:
+    regs_[reg] = value;
+    compare_ = static_cast<std::uint16_t>((compare_ & 0xFF) | (value & 0x80) << 1);
+    if (line_ == FirstBadline && (value & 0x10)) den_latched_ = true;
+    break;
+  case Raster:
+    compare_ = static_cast<std::uint16_t>((compare_ & 0x100) | value);
+    break;
+  case IrqFlags:
+    irq_flags_ &= ~value;
+    raise(0);
+    break;
+  case IrqEnable:
+    regs_[reg] = value & 0x0F;
+    raise(0);
+    break;
+  default:
+    regs_[reg] = value;
+    break;
+  }
+  // Moving the compare line onto the current line matches at once.
+  if (compare_ != compare && compare_ == line_) raise(IrqRaster);
+  cpu_.end_run_by(next_event());
+}
+
+template <typename Archive, typename Self> void Vic::fields(Archive& archive, Self& self) {
+  archive(self.bank_, self.regs_, self.compare_, self.irq_flags_, self.sprite_sprite_,
+          self.sprite_background_);
+  archive(self.clock_, self.line_, self.cycle_, self.frames_);
+  archive(self.vc_base_, self.rc_, self.display_, self.den_latched_, self.vertical_border_,
+          self.matrix_, self.colors_, self.sprites_);
+  archive(self.frame_requested_, self.drawing_, self.rendering_, self.graphics_,
+          self.foreground_, self.frame_);
+}
+
+void Vic::save(SnapshotWriter& out) const { fields(out, *this); }
+
+void Vic::restore(SnapshotReader& in) { fields(in, *this); }
+
+}; // namespace emu